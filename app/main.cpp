@@ -3,33 +3,55 @@
 #include "polaris/polaris.hpp"
 #include "polaris/version.hpp"
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <sstream>
 #include <vector>
 
+#include <csignal>
 #include <cstdlib>
+#include <thread>
 
 namespace {
 
 void error_callback(polaris::error_level_e level, const char *message) {
 
+   // Errors raised while running a file point at the statement they came
+   // from
+   //
+   std::string where =
+       polaris::describe_source_location(polaris::current_source_location());
+   if (!where.empty()) {
+      where = " (at " + where + ")";
+   }
+
    switch (level) {
    case polaris::error_level_e::FAILURE:
-      std::cout << "[failure]: " << message << std::endl;
+      std::cout << "[failure]: " << message << where << std::endl;
       break;
 
    case polaris::error_level_e::FATAL:
-      std::cout << "[fatal]: " << message << std::endl;
+      std::cout << "[fatal]: " << message << where << std::endl;
       std::exit(1);
       break;
    }
 }
 
 polaris::evaluator_c evaluator;
+polaris::compiler_c compiler;
+polaris::engine_c *engine = &evaluator;
 auto environment = std::make_shared<polaris::environment_c>(error_callback);
-polaris::feeder_c feeder(evaluator, environment);
+polaris::loop_c loop;
+std::unique_ptr<polaris::actors_c> actors;
+std::unique_ptr<polaris::feeder_c> feeder;
+std::unique_ptr<polaris::server_c> server;
+polaris::line_profile_c line_profile;
+
+void stop_server(int) { server->stop(); }
 
 } // namespace
 
@@ -37,6 +59,32 @@ void help() {
    std::cout
        << "\nHelp : " << std::endl
        << "-i | --include  < ':' delim list >    Add include directories\n"
+       << "-c | --compile                        Compile statements before "
+          "executing them\n"
+       << "--max-steps < n >                     Limit cells evaluated per "
+          "statement\n"
+       << "--max-depth < n >                     Limit nested calls per "
+          "statement\n"
+       << "--max-bytes < n >                     Limit bytes allocated per "
+          "statement\n"
+       << "--image < file >                      Boot from an image instead "
+          "of an empty environment\n"
+       << "--dump-image < file >                 Execute the file (if any) "
+          "then write the environment to an image\n"
+       << "--emit-cpp < out.cpp >                Translate the file to a C++ "
+          "program instead of executing it\n"
+       << "--stats                               Print runtime statistics "
+          "at exit\n"
+       << "--line-profile                        Print the hits and time of "
+          "every source line at exit\n"
+       << "--serve < socket >                    Serve requests on a unix "
+          "socket, the file (if any) is run by every worker first\n"
+       << "--workers < n >                       Number of interpreters "
+          "serving requests\n"
+       << "--connect < socket >                  Send the file, or each line "
+          "of input, to a server\n"
+       << "--metrics                             With --connect, show the "
+          "latency metrics of the server\n"
        << "-h | --help                           Show help\n"
        << "-v | --version                        Show version\n"
        << "\nTo enter REPL do not include a file\n"
@@ -44,11 +92,44 @@ void help() {
    std::exit(EXIT_SUCCESS);
 }
 
+std::string option_value(const std::vector<std::string> &arguments,
+                         size_t i) {
+   if (i + 1 >= arguments.size()) {
+      std::cerr << "Expected value to be passed in with " << arguments[i]
+                << std::endl;
+      std::exit(EXIT_FAILURE);
+   }
+   return arguments[i + 1];
+}
+
+uint64_t limit_value(const std::vector<std::string> &arguments, size_t i) {
+   std::string value = option_value(arguments, i);
+   try {
+      return std::stoull(value);
+   } catch (...) {
+      std::cerr << "Invalid value for " << arguments[i] << " : "
+                << value << std::endl;
+      std::exit(EXIT_FAILURE);
+   }
+}
+
 void version() {
    std::cout << "polaris version " LIBPOLARIS_VERSION << std::endl;
    std::exit(EXIT_SUCCESS);
 }
 
+void dump_stats() {
+   std::cerr << "\nRuntime statistics :\n";
+   for (auto &stat : polaris::stats_to_cell().list) {
+      std::cerr << "   " << stat.list[0].val << " : "
+                << polaris::to_string(stat.list[1]) << "\n";
+   }
+}
+
+void dump_line_profile() { line_profile.report(std::cerr); }
+
+void stop_actors() { actors.reset(); }
+
 void repl(const std::string &prompt) {
 
    bool show_prompt{true};
@@ -58,11 +139,11 @@ void repl(const std::string &prompt) {
       }
       std::string line;
       std::getline(std::cin, line);
-      show_prompt = feeder.feed(line, true);
+      show_prompt = feeder->feed(line, true);
    }
 }
 
-void execute(const std::string &file) {
+std::string read_source(const std::string &file) {
 
    std::filesystem::path p(file);
    if (!std::filesystem::is_regular_file(p)) {
@@ -70,24 +151,92 @@ void execute(const std::string &file) {
       std::exit(EXIT_FAILURE);
    }
 
-   std::fstream fs;
-   fs.open(file, std::fstream::in);
-
+   std::ifstream fs(file, std::ios::in | std::ios::binary);
    if (!fs.is_open()) {
       std::cerr << "Unable to open file: " << file << std::endl;
       std::exit(EXIT_FAILURE);
    }
 
+   return std::string((std::istreambuf_iterator<char>(fs)),
+                      std::istreambuf_iterator<char>());
+}
+
+void execute(const std::string &file) {
+   polaris::evaluate_all(*engine, read_source(file), environment, nullptr,
+                         file);
+}
+
+int serve(polaris::server_config_t config, const std::string &file) {
+
+   if (!file.empty()) {
+      config.prelude = read_source(file);
+   }
+   server = std::make_unique<polaris::server_c>(config, error_callback);
+   if (!server->start()) {
+      return EXIT_FAILURE;
+   }
+
+   // The socket is removed on the way out
+   //
+   std::signal(SIGINT, stop_server);
+   std::signal(SIGTERM, stop_server);
+
+   std::cerr << "Serving on " << config.socket_path << " with "
+             << config.workers << " workers" << std::endl;
+   server->run();
+   std::cerr << polaris::to_string(server->metrics()) << std::endl;
+   return EXIT_SUCCESS;
+}
+
+int connect_client(const std::string &socket_path, const std::string &file,
+                   bool metrics) {
+
+   polaris::client_c client;
+   if (!client.connect(socket_path)) {
+      std::cerr << "Unable to connect to " << socket_path << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   auto show = [](const polaris::reply_t &reply) {
+      if (reply.ok) {
+         std::cout << reply.text << std::endl;
+      } else {
+         std::cout << "[failure]: " << reply.text << std::endl;
+      }
+      return reply.ok;
+   };
+
+   if (metrics) {
+      return show(client.metrics()) ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+   if (!file.empty()) {
+      return show(client.evaluate(read_source(file))) ? EXIT_SUCCESS
+                                                       : EXIT_FAILURE;
+   }
+
    std::string line;
-   while (std::getline(fs, line)) {
-      feeder.feed(line);
+   while (std::getline(std::cin, line)) {
+      if (!line.empty()) {
+         show(client.evaluate(line));
+      }
    }
+   return EXIT_SUCCESS;
 }
 
 int main(int argc, char **argv) {
 
    std::string file;
+   std::string image;
+   std::string dump_image;
+   std::string emit_cpp;
    std::vector<std::string> include_dirs;
+   polaris::limits_t limits;
+   bool show_stats{false};
+   bool show_line_profile{false};
+   std::string serve_socket;
+   std::string connect_socket;
+   bool show_metrics{false};
+   std::size_t workers = std::max(1u, std::thread::hardware_concurrency());
 
    // Check if we can find the stdlib
    //
@@ -120,6 +269,71 @@ int main(int argc, char **argv) {
          continue;
       }
 
+      if (arguments[i] == "-c" || arguments[i] == "--compile") {
+         engine = &compiler;
+         continue;
+      }
+
+      if (arguments[i] == "--max-steps") {
+         limits.steps = limit_value(arguments, i++);
+         continue;
+      }
+
+      if (arguments[i] == "--max-depth") {
+         limits.depth = limit_value(arguments, i++);
+         continue;
+      }
+
+      if (arguments[i] == "--max-bytes") {
+         limits.bytes = limit_value(arguments, i++);
+         continue;
+      }
+
+      if (arguments[i] == "--image") {
+         image = option_value(arguments, i++);
+         continue;
+      }
+
+      if (arguments[i] == "--dump-image") {
+         dump_image = option_value(arguments, i++);
+         continue;
+      }
+
+      if (arguments[i] == "--emit-cpp") {
+         emit_cpp = option_value(arguments, i++);
+         continue;
+      }
+
+      if (arguments[i] == "--stats") {
+         show_stats = true;
+         continue;
+      }
+
+      if (arguments[i] == "--line-profile") {
+         show_line_profile = true;
+         continue;
+      }
+
+      if (arguments[i] == "--serve") {
+         serve_socket = option_value(arguments, i++);
+         continue;
+      }
+
+      if (arguments[i] == "--workers") {
+         workers = std::max<uint64_t>(1, limit_value(arguments, i++));
+         continue;
+      }
+
+      if (arguments[i] == "--connect") {
+         connect_socket = option_value(arguments, i++);
+         continue;
+      }
+
+      if (arguments[i] == "--metrics") {
+         show_metrics = true;
+         continue;
+      }
+
       if (arguments[i] == "-h" || arguments[i] == "--help") {
          help();
       }
@@ -134,13 +348,105 @@ int main(int argc, char **argv) {
       }
    }
 
-   polaris::imports_c imports(evaluator, environment, include_dirs);
+   if (!connect_socket.empty()) {
+      return connect_client(connect_socket, file, show_metrics);
+   }
+
+   if (!serve_socket.empty()) {
+      polaris::server_config_t config;
+      config.socket_path = serve_socket;
+      config.workers = workers;
+      config.compile = (engine == &compiler);
+      config.limits = limits;
+      config.include_dirs = include_dirs;
+      config.image = image;
+      return serve(config, file);
+   }
+
+   evaluator.set_limits(limits);
+
+   // Builtins are wrapped to count their calls as they are named, which
+   // add_globals does
+   //
+   polaris::count_builtin_calls(show_stats);
+
+   polaris::imports_c imports(*engine, environment, include_dirs);
    polaris::add_globals(environment, imports);
+   polaris::add_async_globals(environment, *engine, loop);
+   actors = std::make_unique<polaris::actors_c>(include_dirs);
+   polaris::add_actor_globals(environment, *engine, *actors);
+   feeder = std::make_unique<polaris::feeder_c>(*engine, environment);
+
+   // Actors are waited for however the program leaves, before anything
+   // made since they started (the statistics among it) is destroyed
+   //
+   std::atexit(stop_actors);
+
+   // Scripts can leave through (exit) so the statistics are printed by an
+   // exit handler
+   //
+   if (show_stats) {
+      std::atexit(dump_stats);
+   }
+
+   // Lines are counted by the evaluator, compiled code has no lines left
+   // to count
+   //
+   if (show_line_profile) {
+      if (engine == &compiler) {
+         std::cerr << "--line-profile can not be used with --compile"
+                   << std::endl;
+         return EXIT_FAILURE;
+      }
+      evaluator.set_line_profile(&line_profile);
+      std::atexit(dump_line_profile);
+   }
+
+   if (!image.empty() &&
+       !polaris::load_image(image, *engine, environment, imports)) {
+      std::exit(EXIT_FAILURE);
+   }
+
+   // Macros are expanded while translating, so the environment is set up
+   // as it would be for running the file
+   //
+   if (!emit_cpp.empty()) {
+      if (file.empty()) {
+         std::cerr << "Expected a file to translate with --emit-cpp"
+                   << std::endl;
+         return EXIT_FAILURE;
+      }
+      std::ofstream out(emit_cpp, std::ios::out | std::ios::trunc);
+      if (!out.is_open() ||
+          !polaris::emit_cpp(read_source(file), file, out, environment,
+                             *engine)) {
+         std::cerr << "Unable to translate " << file << " to " << emit_cpp
+                   << std::endl;
+         return EXIT_FAILURE;
+      }
+      return EXIT_SUCCESS;
+   }
+
+   if (!dump_image.empty()) {
+      if (!file.empty()) {
+         execute(file);
+         loop.run();
+      }
+      return polaris::save_image(dump_image, environment, imports)
+                 ? EXIT_SUCCESS
+                 : EXIT_FAILURE;
+   }
 
    if (file.empty()) {
       repl("polaris> ");
    } else {
       execute(file);
+
+      // Let anything that was spawned and never awaited finish, actors
+      // included
+      //
+      loop.run();
+      actors->join();
    }
    return 0;
 }
\ No newline at end of file
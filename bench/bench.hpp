@@ -0,0 +1,34 @@
+#ifndef POLARIS_BENCH_HPP
+#define POLARIS_BENCH_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace bench {
+
+//! \brief Run a function a number of times and report the time per run
+//! \param name The name to report the measurement under
+//! \param runs The number of times to call the function
+//! \param fn The function to measure
+//! \returns nanoseconds per run
+template <typename Fn>
+double measure(const std::string &name, uint64_t runs, Fn &&fn) {
+   auto start = std::chrono::steady_clock::now();
+   for (uint64_t i = 0; i < runs; i++) {
+      fn();
+   }
+   auto end = std::chrono::steady_clock::now();
+   double ns =
+       std::chrono::duration<double, std::nano>(end - start).count() / runs;
+   std::cout << std::left << std::setw(40) << name << std::right
+             << std::setw(14) << std::fixed << std::setprecision(1) << ns
+             << " ns/run" << std::endl;
+   return ns;
+}
+
+} // namespace bench
+
+#endif
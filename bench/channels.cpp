@@ -0,0 +1,162 @@
+#include "bench.hpp"
+
+#include "polaris/polaris.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+void error_callback(polaris::error_level_e, const char *message) {
+   std::cerr << message << std::endl;
+   std::exit(1);
+}
+
+using clock = std::chrono::steady_clock;
+
+polaris::message_t number(std::size_t n) {
+   return polaris::message_t{
+       polaris::cell_t(polaris::cell_type_e::NUMBER, std::to_string(n)),
+       nullptr};
+}
+
+//  Keeps the two ends of a measurement on different cores when there are
+//  more than one, otherwise every hand over is a context switch
+//
+void pin(std::thread &t, unsigned core) {
+#if defined(__linux__)
+   unsigned cores = std::thread::hardware_concurrency();
+   if (cores < 2) {
+      return;
+   }
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   CPU_SET(core % cores, &set);
+   pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+#else
+   (void)t;
+   (void)core;
+#endif
+}
+
+void throughput(std::size_t producers, std::size_t consumers,
+                std::size_t capacity, std::size_t messages) {
+   polaris::channel_c channel(capacity);
+   std::vector<std::thread> threads;
+   auto start = clock::now();
+   for (std::size_t p = 0; p < producers; p++) {
+      threads.emplace_back([&channel, messages, producers]() {
+         for (std::size_t i = 0; i < messages / producers; i++) {
+            channel.send(number(i));
+         }
+      });
+      pin(threads.back(), static_cast<unsigned>(threads.size() - 1));
+   }
+   std::vector<std::thread> receivers;
+   for (std::size_t c = 0; c < consumers; c++) {
+      receivers.emplace_back([&channel]() {
+         polaris::message_t m;
+         while (channel.receive(m)) {
+         }
+      });
+      pin(receivers.back(),
+          static_cast<unsigned>(producers + receivers.size() - 1));
+   }
+   for (auto &t : threads) {
+      t.join();
+   }
+   channel.close();
+   for (auto &t : receivers) {
+      t.join();
+   }
+   double seconds =
+       std::chrono::duration<double>(clock::now() - start).count();
+   std::cout << "   " << producers << " -> " << consumers << ", capacity "
+             << capacity << " : "
+             << static_cast<uint64_t>(messages / seconds) << " messages/s"
+             << std::endl;
+}
+
+//  A message goes over and straight back, half of the round trip is the
+//  time for one to cross between threads
+//
+void ping_pong(std::size_t round_trips) {
+   polaris::channel_c ping(1);
+   polaris::channel_c pong(1);
+   std::thread echo([&]() {
+      polaris::message_t m;
+      while (ping.receive(m)) {
+         pong.send(std::move(m));
+      }
+   });
+   pin(echo, 1);
+
+   polaris::message_t m;
+   double ns = bench::measure("   round trip", round_trips, [&]() {
+      ping.send(number(1));
+      pong.receive(m);
+   });
+   std::cout << "   one way " << ns / 2 << " ns" << std::endl;
+   ping.close();
+   echo.join();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+   constexpr std::size_t messages = 1000000;
+   std::size_t pairs = std::thread::hardware_concurrency() / 2;
+
+   polaris::channel_c channel(1024);
+   polaris::message_t m;
+   bench::measure("send and receive on one thread", messages, [&]() {
+      channel.send(number(7));
+      channel.receive(m);
+   });
+
+   std::cout << "\nthroughput" << std::endl;
+   for (std::size_t capacity : {16UL, 1024UL}) {
+      throughput(1, 1, capacity, messages);
+      if (pairs > 1) {
+         throughput(pairs, pairs, capacity, messages);
+      }
+   }
+
+   std::cout << "\ncross thread" << std::endl;
+   ping_pong(100000);
+
+   //  The same round trip between two interpreters, which copies the
+   //  message out of one and into the other
+   //
+   polaris::evaluator_c evaluator;
+   auto env = std::make_shared<polaris::environment_c>(error_callback);
+   polaris::actors_c actors;
+   polaris::imports_c imports(evaluator, env, {});
+   polaris::add_globals(env, imports);
+   polaris::add_actor_globals(env, evaluator, actors);
+   polaris::evaluate_all(
+       evaluator,
+       "(define ping (make-channel 1)) (define pong (make-channel 1))"
+       "(define echo (lambda () (do ((v (receive ping) (receive ping))) "
+       "((eq v nil) nil) (send pong v))))"
+       "(spawn-actor echo)",
+       env);
+   auto round_trip = polaris::read("(begin (send ping (list 1 \"two\" 3.0)) "
+                                   "(receive pong))");
+   bench::measure("   actor round trip of a list", 20000,
+                  [&]() { evaluator.evaluate(round_trip, env); });
+   polaris::evaluate_all(evaluator, "(close ping)", env);
+   actors.join();
+   return 0;
+}
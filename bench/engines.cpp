@@ -0,0 +1,85 @@
+#include "bench.hpp"
+
+#include "polaris/polaris.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct workload_t {
+   std::string name;
+   std::string setup;
+   std::string run;
+   uint64_t runs;
+};
+
+std::vector<workload_t> workloads = {
+    {"fib", "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) "
+            "(fib (- n 2))))))",
+     "(fib 15)", 20},
+    {"fact", "(define fact (lambda (n) (if (<= n 1) 1 (* n (fact (- n 1))))))",
+     "(fact 12)", 5000},
+    {"compose",
+     "(begin (define twice (lambda (x) (* 2 x)))"
+     "(define compose (lambda (f g) (lambda (x) (f (g x)))))"
+     "(define repeat (lambda (f) (compose f f))))",
+     "((repeat (repeat twice)) 5)", 20000},
+    {"zip",
+     "(define zip (lambda (x y) (if (null? x) (quote ())"
+     "(cons (list (car x) (car y)) (zip (cdr x) (cdr y))))))",
+     "(zip (list 1 2 3 4 5 6 7 8) (list 8 7 6 5 4 3 2 1))", 5000},
+    {"sum (recursion)",
+     "(define sum (lambda (i acc) (if (> i 1000) acc (sum (+ i 1) (+ acc "
+     "i)))))",
+     "(sum 0 0)", 500},
+    {"sum (named let)", "(quote ())",
+     "(let loop ((i 0) (acc 0)) (if (> i 1000) acc (loop (+ i 1) (+ acc "
+     "i))))",
+     500},
+    {"sum (do)", "(quote ())",
+     "(do ((i 0 (+ i 1)) (acc 0 (+ acc i))) ((> i 1000) acc))", 500},
+};
+
+void error_callback(polaris::error_level_e, const char *message) {
+   std::cerr << message << std::endl;
+   std::exit(1);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+   polaris::evaluator_c evaluator;
+   polaris::compiler_c compiler;
+   auto evaluator_env =
+       std::make_shared<polaris::environment_c>(error_callback);
+   auto compiler_env =
+       std::make_shared<polaris::environment_c>(error_callback);
+   polaris::imports_c evaluator_imports(evaluator, evaluator_env, {});
+   polaris::imports_c compiler_imports(compiler, compiler_env, {});
+   polaris::add_globals(evaluator_env, evaluator_imports);
+   polaris::add_globals(compiler_env, compiler_imports);
+
+   for (auto &w : workloads) {
+      evaluator.evaluate(polaris::read(w.setup), evaluator_env);
+      compiler.evaluate(polaris::read(w.setup), compiler_env);
+
+      //  The tree walker sees the parsed cell each run, the compiler
+      //  translates it once and then only executes the result
+      //
+      auto cell = polaris::read(w.run);
+      auto code = compiler.compile(cell);
+
+      double walked = bench::measure(w.name + " (evaluator)", w.runs, [&]() {
+         evaluator.evaluate(cell, evaluator_env);
+      });
+      double compiled = bench::measure(w.name + " (compiler)", w.runs,
+                                       [&]() { code(compiler_env); });
+      std::cout << "   speedup " << walked / compiled << "x\n" << std::endl;
+   }
+
+   return 0;
+}
@@ -0,0 +1,71 @@
+#include "bench.hpp"
+
+#include "polaris/feeder.hpp"
+#include "polaris/polaris.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+
+void error_callback(polaris::error_level_e, const char *message) {
+   std::cerr << message << std::endl;
+   std::exit(1);
+}
+
+const std::string setup =
+    "(define score (lambda (a b) (if (> a b) (- a b) (+ (* a 10) b))))";
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+   polaris::evaluator_c evaluator;
+   polaris::compiler_c compiler;
+   constexpr uint64_t runs = 100000;
+
+   for (polaris::engine_c *engine :
+        {static_cast<polaris::engine_c *>(&evaluator),
+         static_cast<polaris::engine_c *>(&compiler)}) {
+
+      std::string engine_name =
+          (engine == &evaluator) ? "evaluator" : "compiler";
+      auto env = std::make_shared<polaris::environment_c>(error_callback);
+      polaris::imports_c imports(*engine, env, {});
+      polaris::add_globals(env, imports);
+      polaris::program_c(*engine, env, setup).run();
+
+      //  A request handler built on the feeder has to write the request
+      //  out as source, have it parsed, and then fish the result out of
+      //  the environment
+      //
+      polaris::feeder_c feeder(*engine, env);
+      long total{0};
+      double fed = bench::measure("feed (" + engine_name + ")", runs, [&]() {
+         std::string line = "(define result (score 3 " +
+                            std::to_string(total % 7) + "))";
+         feeder.feed(line);
+         total += std::stol(env->find("result")["result"].val);
+      });
+
+      //  With handles the lambda is found once and called directly
+      //
+      polaris::function_c score(*engine, env, "score");
+      double handled =
+          bench::measure("handle (" + engine_name + ")", runs, [&]() {
+             total += score.call<long>(3, total % 7);
+          });
+
+      //  A prepared program skips the parse but still goes through source
+      //  level evaluation
+      //
+      polaris::program_c program(*engine, env, "(score 3 4)");
+      bench::measure("program (" + engine_name + ")", runs,
+                     [&]() { total += std::stol(program.run().val); });
+
+      std::cout << "   handle speedup over feed " << fed / handled << "x\n"
+                << std::endl;
+   }
+   return 0;
+}
@@ -0,0 +1,110 @@
+#include "bench.hpp"
+
+#include "polaris/polaris.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+void error_callback(polaris::error_level_e, const char *message) {
+   std::cerr << message << std::endl;
+   std::exit(1);
+}
+
+//  The same operation written in polaris on top of car, cdr and cons, the
+//  way it had to be before the builtins existed
+//
+struct workload_t {
+   std::string name;
+   std::string script;
+   std::string native;
+};
+
+const std::string setup =
+    "(begin "
+    "(define s-map (lambda (f l) (if (null? l) (quote ()) "
+    "(cons (f (car l)) (s-map f (cdr l))))))"
+    "(define s-filter (lambda (f l) (if (null? l) (quote ()) "
+    "(if (f (car l)) (cons (car l) (s-filter f (cdr l))) "
+    "(s-filter f (cdr l))))))"
+    "(define s-fold-left (lambda (f acc l) (if (null? l) acc "
+    "(s-fold-left f (f acc (car l)) (cdr l)))))"
+    "(define s-fold-right (lambda (f acc l) (if (null? l) acc "
+    "(f (car l) (s-fold-right f acc (cdr l))))))"
+    "(define s-reverse (lambda (l) (s-fold-left (lambda (acc x) "
+    "(cons x acc)) (quote ()) l)))"
+    "(define s-nth (lambda (n l) (if (<= n 0) (car l) (s-nth (- n 1) "
+    "(cdr l)))))"
+    "(define s-range (lambda (n acc) (if (<= n 0) acc "
+    "(s-range (- n 1) (cons (- n 1) acc)))))"
+    "(define s-merge (lambda (a b) (if (null? a) b (if (null? b) a "
+    "(if (< (car b) (car a)) (cons (car b) (s-merge a (cdr b))) "
+    "(cons (car a) (s-merge (cdr a) b)))))))"
+    "(define s-take (lambda (l n) (if (<= n 0) (quote ()) "
+    "(cons (car l) (s-take (cdr l) (- n 1))))))"
+    "(define s-drop (lambda (l n) (if (<= n 0) l (s-drop (cdr l) (- n 1)))))"
+    "(define s-sort (lambda (l) (if (< (length l) 2) l "
+    "(s-merge (s-sort (s-take l (/ (length l) 2))) "
+    "(s-sort (s-drop l (/ (length l) 2)))))))"
+    "(define items (s-range 200 (quote ())))"
+    "(define shuffled (map (lambda (x) (- (* x 7919) (* 200 (/ (* x 7919) "
+    "200)))) items)))";
+
+std::vector<workload_t> workloads = {
+    {"map", "(s-map (lambda (x) (* x 2)) items)",
+     "(map (lambda (x) (* x 2)) items)"},
+    {"filter", "(s-filter (lambda (x) (< x 100)) items)",
+     "(filter (lambda (x) (< x 100)) items)"},
+    {"fold-left", "(s-fold-left + 0 items)", "(fold-left + 0 items)"},
+    {"fold-right", "(s-fold-right (lambda (x acc) (+ x acc)) 0 items)",
+     "(fold-right (lambda (x acc) (+ x acc)) 0 items)"},
+    {"reverse", "(s-reverse items)", "(reverse items)"},
+    {"nth", "(s-nth 150 items)", "(nth 150 items)"},
+    {"range", "(s-range 200 (quote ()))", "(collect (range 200))"},
+    {"sort", "(s-sort shuffled)", "(sort shuffled)"},
+    {"sort with a lambda", "(s-sort shuffled)",
+     "(sort shuffled (lambda (a b) (< a b)))"},
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+   polaris::evaluator_c evaluator;
+   polaris::compiler_c compiler;
+   constexpr uint64_t runs = 2000;
+
+   for (polaris::engine_c *engine :
+        {static_cast<polaris::engine_c *>(&evaluator),
+         static_cast<polaris::engine_c *>(&compiler)}) {
+
+      std::string engine_name =
+          (engine == &evaluator) ? "evaluator" : "compiler";
+      auto env = std::make_shared<polaris::environment_c>(error_callback);
+      polaris::imports_c imports(*engine, env, {});
+      polaris::add_globals(env, imports);
+      polaris::program_c(*engine, env, setup).run();
+
+      for (auto &w : workloads) {
+         polaris::program_c script(*engine, env, w.script);
+         polaris::program_c native(*engine, env, w.native);
+         if (!polaris::cell_equal(script.run(), native.run())) {
+            std::cerr << w.name << " results differ" << std::endl;
+            return 1;
+         }
+
+         double scripted = bench::measure(
+             w.name + " script (" + engine_name + ")", runs,
+             [&]() { script.run(); });
+         double builtin = bench::measure(
+             w.name + " native (" + engine_name + ")", runs,
+             [&]() { native.run(); });
+         std::cout << "   speedup " << scripted / builtin << "x\n"
+                   << std::endl;
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,67 @@
+#include "bench.hpp"
+
+#include "polaris/polaris.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+
+void error_callback(polaris::error_level_e, const char *message) {
+   std::cerr << message << std::endl;
+   std::exit(1);
+}
+
+//  The same loop written three ways : with a macro, by hand, and with a
+//  procedure taking the body as a lambda, the usual way to get the
+//  abstraction without macros
+//
+const char *definitions =
+    "(define-syntax repeat (syntax-rules () ((_ n body ...) "
+    "(do ((i 0 (+ i 1))) ((eq i n) nil) body ...))))"
+    "(define repeat-fn (lambda (n f) "
+    "(do ((i 0 (+ i 1))) ((eq i n) nil) (f))))"
+    "(define total 0)"
+    "(define with-macro (lambda () (repeat 1000 (set! total (+ total 1)))))"
+    "(define by-hand (lambda () "
+    "(do ((i 0 (+ i 1))) ((eq i 1000) nil) (set! total (+ total 1)))))"
+    "(define with-lambda (lambda () "
+    "(repeat-fn 1000 (lambda () (set! total (+ total 1))))))";
+
+void run(const std::string &name, polaris::engine_c &engine) {
+   auto env = std::make_shared<polaris::environment_c>(error_callback);
+   polaris::imports_c imports(engine, env, {});
+   polaris::add_globals(env, imports);
+   polaris::evaluate_all(engine, definitions, env);
+
+   std::cout << name << std::endl;
+   for (const char *fn : {"by-hand", "with-macro", "with-lambda"}) {
+      auto call = polaris::read(std::string("(") + fn + ")");
+      bench::measure(std::string("   ") + fn + " 1000 iterations", 2000,
+                     [&]() { engine.evaluate(call, env); });
+   }
+
+   //  Expanding a use for the first time against finding it in the cache
+   //
+   auto use = polaris::read("(repeat 10 (set! total 0))");
+   std::size_t fresh = 0;
+   bench::measure("   expand a new use", 20000, [&]() {
+      auto form = polaris::read("(repeat " + std::to_string(fresh++) +
+                                " (set! total 0))");
+      polaris::expand_macros(std::move(form), env, engine);
+   });
+   bench::measure("   expand a cached use", 20000, [&]() {
+      polaris::expand_macros(use, env, engine);
+   });
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+   polaris::evaluator_c evaluator;
+   run("evaluator", evaluator);
+   polaris::compiler_c compiler;
+   run("compiler", compiler);
+   return 0;
+}
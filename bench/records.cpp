@@ -0,0 +1,55 @@
+#include "bench.hpp"
+
+#include "polaris/polaris.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+
+void error_callback(polaris::error_level_e, const char *message) {
+   std::cerr << message << std::endl;
+   std::exit(1);
+}
+
+//  The same eight field value as a record and as a positional list, the
+//  last field is where the list is slowest
+//
+const char *definitions =
+    "(define-record row a b c d e f g h)"
+    "(define as-record (make-row 1 2 3 4 5 6 7 8))"
+    "(define as-list (list 1 2 3 4 5 6 7 8))"
+    "(define list-h (lambda (r) "
+    "(car (cdr (cdr (cdr (cdr (cdr (cdr (cdr r))))))))))";
+
+void run(const std::string &name, polaris::engine_c &engine) {
+   auto env = std::make_shared<polaris::environment_c>(error_callback);
+   polaris::imports_c imports(engine, env, {});
+   polaris::add_globals(env, imports);
+   polaris::evaluate_all(engine, definitions, env);
+
+   std::cout << name << std::endl;
+   auto measure = [&](const std::string &what, const std::string &source) {
+      auto form = polaris::read(source);
+      bench::measure("   " + what, 200000,
+                     [&]() { engine.evaluate(form, env); });
+   };
+   measure("first field of a record", "(row-a as-record)");
+   measure("last field of a record", "(row-h as-record)");
+   measure("first field of a list", "(car as-list)");
+   measure("last field of a list by cdr", "(list-h as-list)");
+   measure("last field of a list by nth", "(nth 7 as-list)");
+   measure("make a record", "(make-row 1 2 3 4 5 6 7 8)");
+   measure("make a list", "(list 1 2 3 4 5 6 7 8)");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+   polaris::evaluator_c evaluator;
+   run("evaluator", evaluator);
+   polaris::compiler_c compiler;
+   run("compiler", compiler);
+   return 0;
+}
@@ -0,0 +1,106 @@
+#include "bench.hpp"
+
+#include "polaris/polaris.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+
+void error_callback(polaris::error_level_e, const char *message) {
+   std::cerr << message << std::endl;
+   std::exit(1);
+}
+
+//  Rows of a table, the kind of data that gets persisted or handed between
+//  processes : repeated field names, integers, doubles and short strings
+//
+polaris::cell_t make_rows(std::size_t count) {
+   polaris::cell_t rows(polaris::cell_type_e::LIST);
+   for (std::size_t i = 0; i < count; i++) {
+      polaris::cell_t row(polaris::cell_type_e::LIST);
+      auto field = [&row](const std::string &name, polaris::cell_t value) {
+         polaris::cell_t pair(polaris::cell_type_e::LIST);
+         pair.list.emplace_back(polaris::cell_type_e::SYMBOL, name);
+         pair.list.push_back(std::move(value));
+         row.list.push_back(std::move(pair));
+      };
+      field("id", polaris::cell_t(polaris::cell_type_e::NUMBER,
+                                  std::to_string(i)));
+      field("price", polaris::cell_t(polaris::cell_type_e::DOUBLE,
+                                     std::to_string(i * 0.25)));
+      field("name", polaris::cell_t(polaris::cell_type_e::STRING,
+                                    "item-" + std::to_string(i)));
+      field("stock", polaris::cell_t(polaris::cell_type_e::NUMBER,
+                                     std::to_string(i * 37 % 1000)));
+      rows.list.push_back(std::move(row));
+   }
+   return rows;
+}
+
+void report(const std::string &what, double ns, std::size_t bytes) {
+   std::cout << "   " << what << " : " << bytes << " bytes, "
+             << static_cast<uint64_t>(bytes / ns * 1e3) << " MB/s"
+             << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+   polaris::evaluator_c evaluator;
+   auto env = std::make_shared<polaris::environment_c>(error_callback);
+   polaris::imports_c imports(evaluator, env, {});
+   polaris::add_globals(env, imports);
+
+   constexpr std::size_t runs = 20;
+   polaris::cell_t rows = make_rows(10000);
+
+   //  The text path prints with to_string and parses with read, which
+   //  also turns the string fields back into symbols
+   //
+   std::string text;
+   double text_write =
+       bench::measure("to_string 10000 rows", runs,
+                      [&]() { text = polaris::to_string(rows); });
+   double text_read = bench::measure("read 10000 rows", runs,
+                                     [&]() { polaris::read(text); });
+
+   std::string binary;
+   double binary_write =
+       bench::measure("serialize 10000 rows", runs,
+                      [&]() { binary = polaris::serialize(rows, env); });
+   double binary_read = bench::measure("deserialize 10000 rows", runs, [&]() {
+      polaris::deserialize(binary, evaluator, env);
+   });
+
+   std::cout << "   write speedup " << text_write / binary_write
+             << "x, read speedup " << text_read / binary_read << "x"
+             << std::endl;
+   report("text", text_write + text_read, text.size());
+   report("binary", binary_write + binary_read, binary.size());
+
+   //  Streaming one record per row through a file
+   //
+   std::string path = "polaris_bench_serialize.bin";
+   std::cout << std::endl;
+   bench::measure("write 10000 records to a file", runs, [&]() {
+      std::ofstream out(path, std::ios::binary | std::ios::trunc);
+      polaris::serial_writer_c writer(out, env);
+      for (auto &row : rows.list) {
+         writer.write(row);
+      }
+   });
+   bench::measure("read 10000 records from a file", runs, [&]() {
+      std::ifstream in(path, std::ios::binary);
+      polaris::serial_reader_c reader(in, evaluator, env);
+      polaris::cell_t row;
+      while (reader.read(row)) {
+      }
+   });
+   std::remove(path.c_str());
+   return 0;
+}
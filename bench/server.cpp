@@ -0,0 +1,138 @@
+#include "bench.hpp"
+
+#include "polaris/polaris.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+void error_callback(polaris::error_level_e, const char *message) {
+   std::cerr << message << std::endl;
+   std::exit(1);
+}
+
+//  What every job needs before it can do any work, standing in for the
+//  stdlib and application code a job would import
+//
+const std::string prelude =
+    "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+    "(define square (lambda (x) (* x x)))"
+    "(define sum-squares (lambda (l) (fold-left + 0 (map square l))))"
+    "(define table (collect (range 500)))";
+
+const std::string job = "(sum-squares (list 1 2 3 4 5 6 7 8))";
+
+using clock = std::chrono::steady_clock;
+
+uint64_t elapsed_us(clock::time_point start) {
+   return static_cast<uint64_t>(
+       std::chrono::duration_cast<std::chrono::microseconds>(clock::now() -
+                                                             start)
+           .count());
+}
+
+//  Each client keeps up to window requests in flight, a window of 1 waits
+//  for every reply before sending the next request
+//
+void load(const std::string &socket_path, std::size_t clients,
+          std::size_t requests, std::size_t window) {
+
+   polaris::latency_c latency;
+   std::vector<std::thread> threads;
+   auto start = clock::now();
+   for (std::size_t c = 0; c < clients; c++) {
+      threads.emplace_back([&]() {
+         polaris::client_c client;
+         if (!client.connect(socket_path)) {
+            error_callback(polaris::error_level_e::FATAL,
+                           "Unable to connect to the server");
+         }
+         std::vector<clock::time_point> sent;
+         std::size_t received = 0;
+         while (received < requests) {
+            while (sent.size() < requests &&
+                   sent.size() - received < window) {
+               sent.push_back(clock::now());
+               client.send(polaris::request_kind_e::EVALUATE, job);
+            }
+            if (!client.receive().ok) {
+               error_callback(polaris::error_level_e::FATAL,
+                              "Request failed");
+            }
+            latency.record(elapsed_us(sent[received++]));
+         }
+      });
+   }
+   for (auto &t : threads) {
+      t.join();
+   }
+   double seconds =
+       std::chrono::duration<double>(clock::now() - start).count();
+
+   std::cout << "   " << clients << " clients, window " << window << " : "
+             << static_cast<uint64_t>(clients * requests / seconds)
+             << " requests/s, p50 " << latency.percentile(0.5) << "us, p99 "
+             << latency.percentile(0.99) << "us, max " << latency.max()
+             << "us" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+   std::size_t workers = std::max(1u, std::thread::hardware_concurrency());
+   constexpr std::size_t requests = 5000;
+
+   //  Without a server every job builds an interpreter and runs the prelude
+   //  before doing its work. This is the floor of forking a process per
+   //  job, which also pays for the process and reading the stdlib
+   //
+   polaris::evaluator_c evaluator;
+   double fresh = bench::measure("fresh interpreter per job", 200, [&]() {
+      auto env = std::make_shared<polaris::environment_c>(error_callback);
+      polaris::imports_c imports(evaluator, env, {});
+      polaris::add_globals(env, imports);
+      polaris::evaluate_all(evaluator, prelude, env);
+      polaris::evaluate_all(evaluator, job, env);
+   });
+
+   polaris::server_config_t config;
+   config.socket_path =
+       "/tmp/polaris_bench_" + std::to_string(::getpid()) + ".sock";
+   config.workers = workers;
+   config.prelude = prelude;
+   polaris::server_c server(config, error_callback);
+   if (!server.start()) {
+      return 1;
+   }
+   std::thread serving([&server]() { server.run(); });
+
+   polaris::client_c client;
+   client.connect(config.socket_path);
+   double served = bench::measure("request to a warm server", requests,
+                                  [&]() { client.evaluate(job); });
+   std::cout << "   speedup " << fresh / served << "x\n" << std::endl;
+
+   std::cout << "load with " << workers << " workers" << std::endl;
+   std::vector<std::size_t> loads = {1, workers, workers * 4};
+   loads.erase(std::unique(loads.begin(), loads.end()), loads.end());
+   for (std::size_t clients : loads) {
+      for (std::size_t window : {1UL, 16UL}) {
+         load(config.socket_path, clients, requests, window);
+      }
+   }
+
+   std::cout << "\nserver metrics " << client.metrics().text << std::endl;
+
+   server.stop();
+   serving.join();
+   return 0;
+}
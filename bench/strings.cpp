@@ -0,0 +1,55 @@
+#include "bench.hpp"
+
+#include "polaris/polaris.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+
+void error_callback(polaris::error_level_e, const char *message) {
+   std::cerr << message << std::endl;
+   std::exit(1);
+}
+
+//  A thousand numbers made into one line, by appending to a builder and by
+//  appending to a string that is copied on every step
+//
+const char *definitions =
+    "(define by-builder (lambda (n) "
+    "(let ((b (string-builder))) "
+    "(do ((i 0 (+ i 1))) ((eq i n) (builder->string b)) "
+    "(builder-append! b i \",\")))))"
+    "(define by-append (lambda (n) "
+    "(let ((s \"\")) "
+    "(do ((i 0 (+ i 1))) ((eq i n) s) "
+    "(set! s (string-append s i \",\"))))))"
+    "(define line (by-builder 1000))";
+
+void run(const std::string &name, polaris::engine_c &engine) {
+   auto env = std::make_shared<polaris::environment_c>(error_callback);
+   polaris::imports_c imports(engine, env, {});
+   polaris::add_globals(env, imports);
+   polaris::evaluate_all(engine, definitions, env);
+
+   std::cout << name << std::endl;
+   auto measure = [&](const std::string &what, const std::string &source) {
+      auto form = polaris::read(source);
+      bench::measure("   " + what, 200, [&]() { engine.evaluate(form, env); });
+   };
+   measure("build 1000 items with a builder", "(by-builder 1000)");
+   measure("build 1000 items with string-append", "(by-append 1000)");
+   measure("split 1000 items", "(string-split line \",\")");
+   measure("join 1000 items", "(string-join (string-split line \",\") \",\")");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+   polaris::evaluator_c evaluator;
+   run("evaluator", evaluator);
+   polaris::compiler_c compiler;
+   run("compiler", compiler);
+   return 0;
+}
@@ -0,0 +1,17 @@
+# polaris_add_program(<name> <source.pol>)
+#
+# Translate a polaris program to C++ with `polaris --emit-cpp` and build it
+# as an executable. The program is translated again when the source or the
+# translator changes
+function(polaris_add_program name source)
+  get_filename_component(_source ${source} ABSOLUTE)
+  set(_generated ${CMAKE_CURRENT_BINARY_DIR}/${name}.cpp)
+  add_custom_command(
+    OUTPUT ${_generated}
+    COMMAND polaris --emit-cpp ${_generated} ${_source}
+    DEPENDS polaris ${_source}
+    COMMENT "Translating ${source} to C++")
+  add_executable(${name} ${_generated})
+  target_include_directories(${name} PUBLIC ${PROJECT_SOURCE_DIR})
+  target_link_libraries(${name} ${LIBRARY_NAME} Threads::Threads)
+endfunction()
@@ -1,9 +1,13 @@
+#include <cmath>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <polaris/feeder.hpp>
+#include <polaris/handle.hpp>
+#include <polaris/native.hpp>
 #include <polaris/polaris.hpp>
 
 namespace {
@@ -22,7 +26,10 @@ int main(int argc, char **argv) {
 
    //  Create the environment that will store data
    //
-   auto environment = std::make_shared<polaris::environment_c>();
+   auto environment = std::make_shared<polaris::environment_c>(
+       [](polaris::error_level_e level, const char *message) {
+          std::cerr << message << std::endl;
+       });
 
    //  Create the importer that will search disk for imported files
    //
@@ -56,7 +63,7 @@ int main(int argc, char **argv) {
    //
    std::string call_to_new_func = "(new_func 1 2 3)";
    environment->get("new_func") =
-       polaris::cell_t([](const polaris::cells &c) -> polaris::cell_t {
+       polaris::cell_t([](polaris::cell_span c) -> polaris::cell_t {
           std::cout << "My func was called with : " << c.size() << " params"
                     << std::endl;
           return polaris::true_sym;
@@ -66,5 +73,57 @@ int main(int argc, char **argv) {
    //
    feeder.feed(call_to_new_func);
 
+   //  Ordinary C++ functions can be bound directly, their arguments and
+   //  results are converted to and from cells automatically
+   //
+   polaris::register_native(environment, "hypot", [](double a, double b) {
+      return std::sqrt(a * a + b * b);
+   });
+   polaris::register_native(environment, "greet", [](std::string_view who) {
+      return "Hello, " + std::string(who);
+   });
+
+   std::string call_natives = "(print (greet name) \" \" (hypot 3 4))";
+   feeder.feed(call_natives);
+
+   //  Source that runs repeatedly can be prepared once, and lambdas can be
+   //  looked up once and then called with native arguments and results
+   //
+   polaris::program_c promote(evaluator, environment,
+                              "(set! rank (+ rank 1))");
+   polaris::function_c add(evaluator, environment, "+");
+   for (int i = 0; i < 3; i++) {
+      promote.run();
+   }
+   std::cout << "Rank : " << environment->lookup("rank").val
+             << ", 2 + 3 = " << add.call<long>(2, 3) << std::endl;
+
+   //  Other threads must not use find or lookup while statements run, the
+   //  variables they watch are published to a snapshot after each
+   //  statement instead
+   //
+   auto snapshot = std::make_shared<polaris::snapshot_c>(
+       std::vector<std::string>{"name", "rank"});
+   environment->set_snapshot(snapshot);
+
+   std::thread monitor([snapshot]() {
+      uint64_t seen = 0;
+      while (seen < 3) {
+         auto view = snapshot->read();
+         if (view->version != seen) {
+            seen = view->version;
+            std::cout << "Monitor : " << view->values.at("name").val
+                      << " is rank " << view->values.at("rank").val
+                      << std::endl;
+         }
+         std::this_thread::yield();
+      }
+   });
+   std::string demote = "(set! rank (- rank 1))";
+   for (int i = 0; i < 3; i++) {
+      feeder.feed(demote);
+   }
+   monitor.join();
+
    return 0;
 }
\ No newline at end of file
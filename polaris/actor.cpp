@@ -0,0 +1,542 @@
+#include "actor.hpp"
+#include "compiler.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+#include "evaluator.hpp"
+#include "imports.hpp"
+#include "polaris.hpp"
+#include "serialize.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <sstream>
+#include <utility>
+
+namespace polaris {
+
+//  Anything that is not a single value is sent as serialized data, the
+//  channels in it are shared rather than written
+//
+struct packed_graph_t {
+   std::string data;
+   serial_carry_t carry;
+};
+
+namespace {
+
+//  A blocked call spins this many times before it sleeps, a message that
+//  arrives in that window costs no system call on either side
+//
+constexpr int spin_limit = 128;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_ia32_pause();
+#elif defined(__aarch64__)
+   asm volatile("yield");
+#endif
+}
+
+//  Selects wait on one epoch shared by every channel, a select could be
+//  woken by any of them
+//
+std::atomic<uint32_t> select_epoch{0};
+std::atomic<uint32_t> select_waiting{0};
+
+// The fence pairs with the one in block_until, either the waiter sees the
+// change or this sees the waiter
+void wake(std::atomic<uint32_t> &epoch, const std::atomic<uint32_t> &waiting) {
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if (waiting.load(std::memory_order_relaxed)) {
+      epoch.fetch_add(1, std::memory_order_release);
+      epoch.notify_all();
+   }
+}
+
+void wake_all(std::atomic<uint32_t> &epoch) {
+   epoch.fetch_add(1, std::memory_order_release);
+   epoch.notify_all();
+}
+
+template <typename Ready>
+void block_until(std::atomic<uint32_t> &epoch,
+                 std::atomic<uint32_t> &waiting, Ready ready) {
+   for (int i = 0; i < spin_limit; i++) {
+      if (ready()) {
+         return;
+      }
+      cpu_relax();
+   }
+   waiting.fetch_add(1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   while (true) {
+      uint32_t seen = epoch.load(std::memory_order_acquire);
+      if (ready()) {
+         break;
+      }
+      epoch.wait(seen, std::memory_order_acquire);
+   }
+   waiting.fetch_sub(1, std::memory_order_relaxed);
+}
+
+//  Thrown by the error callback of an actor to end it, the error has
+//  already been reported
+//
+class actor_failed_c {};
+
+std::shared_ptr<channel_c> channel_of(std::shared_ptr<environment_c> env,
+                                      const cell_t &c,
+                                      const std::string &name) {
+   if (c.type != cell_type_e::CHANNEL) {
+      std::string err = "Expected a channel for [" + name + "]";
+      env->get_error_cb()(error_level_e::FATAL, err.c_str());
+      std::exit(1);
+   }
+   return std::static_pointer_cast<channel_c>(c.obj);
+}
+
+cell_t channel_cell(std::shared_ptr<channel_c> channel) {
+   cell_t c(cell_type_e::CHANNEL);
+   c.obj = std::move(channel);
+   return c;
+}
+
+} // namespace
+
+message_t pack_message(const cell_t &value,
+                       std::shared_ptr<environment_c> env) {
+   message_t message;
+   switch (value.type) {
+   case cell_type_e::SYMBOL:
+      [[fallthrough]];
+   case cell_type_e::NUMBER:
+      [[fallthrough]];
+   case cell_type_e::DOUBLE:
+      [[fallthrough]];
+   case cell_type_e::STRING:
+      [[fallthrough]];
+   case cell_type_e::CHANNEL:
+      message.value = value;
+      return message;
+   default:
+      break;
+   }
+
+   message.graph = std::make_shared<packed_graph_t>();
+   std::ostringstream out(std::ios::out | std::ios::binary);
+   serial_writer_c writer(out, env, "a message to another actor",
+                          &message.graph->carry);
+   writer.write(value);
+   message.graph->data = std::move(out).str();
+   return message;
+}
+
+cell_t unpack_message(message_t message, std::shared_ptr<environment_c> env,
+                      engine_c &engine) {
+   if (!message.graph) {
+      return std::move(message.value);
+   }
+   try {
+      return deserialize(message.graph->data, engine, env,
+                         &message.graph->carry);
+   } catch (const std::exception &e) {
+      std::string err = std::string("Unable to receive a message : ") +
+                        e.what();
+      env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+      return nil;
+   }
+}
+
+channel_c::channel_c(std::size_t capacity)
+    : _mask(std::bit_ceil(std::clamp<std::size_t>(capacity, 2,
+                                                    max_channel_capacity)) -
+            1) {
+   _slots = std::make_unique<slot_t[]>(_mask + 1);
+   for (std::size_t i = 0; i <= _mask; i++) {
+      _slots[i].sequence.store(i, std::memory_order_relaxed);
+   }
+}
+
+// A slot is free for the sender at position n when its sequence is n, and
+// holds a message for the receiver at position n when it is n + 1. Once the
+// closed bit is in the send position no slot can be claimed
+bool channel_c::try_send(message_t &message) {
+   std::size_t pos = _enqueue.load(std::memory_order_acquire);
+   slot_t *slot;
+   while (true) {
+      if (pos & closed_bit) {
+         return false;
+      }
+      slot = &_slots[pos & _mask];
+      std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence - pos);
+      if (diff == 0) {
+         if (_enqueue.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_acq_rel)) {
+            break;
+         }
+      } else if (diff < 0) {
+         return false;
+      } else {
+         pos = _enqueue.load(std::memory_order_acquire);
+      }
+   }
+   slot->message = std::move(message);
+   slot->sequence.store(pos + 1, std::memory_order_release);
+   wake(_sent, _receivers_waiting);
+   wake(select_epoch, select_waiting);
+   return true;
+}
+
+bool channel_c::try_receive(message_t &message) {
+   std::size_t pos = _dequeue.load(std::memory_order_relaxed);
+   slot_t *slot;
+   while (true) {
+      slot = &_slots[pos & _mask];
+      std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence - (pos + 1));
+      if (diff == 0) {
+         if (_dequeue.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) {
+            break;
+         }
+      } else if (diff < 0) {
+         return false;
+      } else {
+         pos = _dequeue.load(std::memory_order_relaxed);
+      }
+   }
+   message = std::move(slot->message);
+   slot->message = message_t();
+   slot->sequence.store(pos + _mask + 1, std::memory_order_release);
+   wake(_received, _senders_waiting);
+   return true;
+}
+
+bool channel_c::send(message_t message) {
+   while (!try_send(message)) {
+      if (closed()) {
+         return false;
+      }
+      block_until(_received, _senders_waiting,
+                  [this]() { return writable() || closed(); });
+   }
+   return true;
+}
+
+// A sender that claimed a slot before the channel closed may not have put
+// its message there yet, the channel is only done once it has been taken
+bool channel_c::receive(message_t &message) {
+   while (!try_receive(message)) {
+      if (drained()) {
+         return false;
+      }
+      block_until(_sent, _receivers_waiting,
+                  [this]() { return ready(); });
+   }
+   return true;
+}
+
+void channel_c::close() {
+   _enqueue.fetch_or(closed_bit, std::memory_order_seq_cst);
+   wake_all(_sent);
+   wake_all(_received);
+   wake_all(select_epoch);
+}
+
+bool channel_c::drained() const {
+   std::size_t end = _enqueue.load(std::memory_order_acquire);
+   return (end & closed_bit) &&
+          _dequeue.load(std::memory_order_acquire) == (end & ~closed_bit);
+}
+
+bool channel_c::ready() const {
+   std::size_t pos = _dequeue.load(std::memory_order_relaxed);
+   return _slots[pos & _mask].sequence.load(std::memory_order_acquire) ==
+              pos + 1 ||
+          drained();
+}
+
+bool channel_c::writable() const {
+   std::size_t pos = _enqueue.load(std::memory_order_relaxed) & ~closed_bit;
+   return _slots[pos & _mask].sequence.load(std::memory_order_acquire) == pos;
+}
+
+std::size_t select(const std::vector<channel_c *> &channels,
+                   message_t &message) {
+   if (channels.empty()) {
+      return 0;
+   }
+
+   // Each select starts at the next channel so that a busy channel does not
+   // starve the others
+   //
+   thread_local std::size_t turn = 0;
+   std::size_t start = turn++ % channels.size();
+   while (true) {
+      bool open = false;
+      for (std::size_t n = 0; n < channels.size(); n++) {
+         std::size_t i = (start + n) % channels.size();
+         if (channels[i]->try_receive(message)) {
+            return i;
+         }
+         open = open || !channels[i]->drained();
+      }
+      if (!open) {
+         return channels.size();
+      }
+      block_until(select_epoch, select_waiting, [&channels]() {
+         return std::any_of(channels.begin(), channels.end(),
+                            [](channel_c *c) { return c->ready(); });
+      });
+   }
+}
+
+actors_c::actors_c(std::vector<std::string> include_dirs)
+    : _shared(std::make_shared<shared_t>()) {
+   _shared->include_dirs = std::move(include_dirs);
+}
+
+actors_c::actors_c(std::shared_ptr<shared_t> shared)
+    : _shared(std::move(shared)), _owner(false) {}
+
+actors_c::~actors_c() {
+   if (!_owner) {
+      return;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(_shared->mutex);
+      _shared->stopped = true;
+      for (auto &weak : _shared->channels) {
+         if (auto channel = weak.lock()) {
+            channel->close();
+         }
+      }
+   }
+
+   //  An actor left running would still be using its interpreter, and the
+   //  statistics of its thread, while the program exits
+   //
+   join();
+}
+
+std::shared_ptr<channel_c> actors_c::make_channel(std::size_t capacity) {
+   auto channel = std::make_shared<channel_c>(capacity);
+   std::lock_guard<std::mutex> lock(_shared->mutex);
+   if (_shared->stopped) {
+      channel->close();
+      return channel;
+   }
+
+   // Channels that are gone are dropped whenever the list has doubled
+   //
+   auto &channels = _shared->channels;
+   if (channels.size() >= 64 && std::has_single_bit(channels.size())) {
+      std::erase_if(channels, [](auto &weak) { return weak.expired(); });
+   }
+   channels.push_back(channel);
+   return channel;
+}
+
+std::shared_ptr<channel_c> actors_c::spawn(engine_c &engine,
+                                           std::shared_ptr<environment_c> env,
+                                           const cell_t &fn, cell_span args) {
+   auto evaluator = dynamic_cast<evaluator_c *>(&engine);
+   bool compile = evaluator == nullptr;
+   limits_t limits = evaluator ? evaluator->get_limits() : limits_t{};
+
+   message_t packed_fn = pack_message(fn, env);
+   std::vector<message_t> packed_args;
+   for (auto &arg : args) {
+      packed_args.push_back(pack_message(arg, env));
+   }
+   auto result = make_channel(1);
+
+   auto run = [shared = _shared, compile, limits, result,
+               error_cb = env->get_error_cb(),
+               packed_fn = std::move(packed_fn),
+               packed_args = std::move(packed_args)]() mutable {
+      //  Errors are passed on to the spawner one at a time, those that
+      //  would end the program end only the actor
+      //
+      auto report = [shared, error_cb](error_level_e level,
+                                       const char *message) {
+         {
+            std::lock_guard<std::mutex> lock(shared->error_mutex);
+            error_cb(error_level_e::FAILURE, message);
+         }
+         if (level == error_level_e::FATAL) {
+            throw actor_failed_c();
+         }
+      };
+
+      evaluator_c evaluator;
+      compiler_c compiler;
+      evaluator.set_limits(limits);
+      engine_c &engine = compile ? static_cast<engine_c &>(compiler)
+                                 : static_cast<engine_c &>(evaluator);
+      auto env = std::make_shared<environment_c>(report);
+      imports_c imports(engine, env, shared->include_dirs);
+      actors_c actors(shared);
+
+      //  Nothing that happens in an actor leaves its thread
+      //
+      try {
+         add_globals(env, imports);
+         add_actor_globals(env, engine, actors);
+         env->get("exit") = cell_t([env](cell_span) -> cell_t {
+            env->get_error_cb()(error_level_e::FATAL,
+                                "[exit] is not available to actors");
+            return nil;
+         });
+
+         cell_t fn = unpack_message(std::move(packed_fn), env, engine);
+         cells args;
+         for (auto &arg : packed_args) {
+            args.push_back(unpack_message(std::move(arg), env, engine));
+         }
+         result->send(pack_message(engine.apply(fn, args), env));
+      } catch (const actor_failed_c &) {
+      } catch (const std::exception &e) {
+         std::string err = std::string("Actor failed : ") + e.what();
+         std::lock_guard<std::mutex> lock(shared->error_mutex);
+         error_cb(error_level_e::FAILURE, err.c_str());
+      }
+      result->close();
+
+      // Builtins hold on to the environment they were added to
+      //
+      env->get_bindings().clear();
+   };
+
+   {
+      std::lock_guard<std::mutex> lock(_shared->mutex);
+      if (!_shared->stopped) {
+         _shared->actors.emplace_back(std::move(run));
+         return result;
+      }
+   }
+   env->get_error_cb()(error_level_e::FAILURE,
+                       "Actors have been stopped, nothing was spawned");
+   return result;
+}
+
+void actors_c::join() {
+   while (true) {
+      std::vector<std::thread> actors;
+      {
+         std::lock_guard<std::mutex> lock(_shared->mutex);
+         actors.swap(_shared->actors);
+      }
+      if (actors.empty()) {
+         return;
+      }
+      for (auto &actor : actors) {
+         actor.join();
+      }
+   }
+}
+
+void add_actor_globals(std::shared_ptr<environment_c> env, engine_c &engine,
+                       actors_c &actors) {
+
+   // (make-channel) (make-channel capacity)
+   env->get("make-channel") = cell_t([=, &actors](cell_span c) -> cell_t {
+      std::size_t capacity = default_channel_capacity;
+      if (c.size() > 1 ||
+          (c.size() == 1 && c[0].type != cell_type_e::NUMBER)) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected an optional capacity for "
+                             "[make-channel]");
+         std::exit(1);
+      }
+      if (c.size() == 1) {
+         long long n = 0;
+         try {
+            n = std::stoll(c[0].val);
+         } catch (const std::exception &) {
+         }
+         if (n < 1 || static_cast<std::size_t>(n) > max_channel_capacity) {
+            std::string err = "Expected a capacity from 1 to " +
+                              std::to_string(max_channel_capacity) +
+                              " for [make-channel]";
+            env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+            return nil;
+         }
+         capacity = static_cast<std::size_t>(n);
+      }
+      return channel_cell(actors.make_channel(capacity));
+   });
+
+   // (send channel value), #f if the channel is closed
+   env->get("send") = cell_t([=](cell_span c) -> cell_t {
+      if (c.size() != 2) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected a channel and a value for [send]");
+         std::exit(1);
+      }
+      auto channel = channel_of(env, c[0], "send");
+      return channel->send(pack_message(c[1], env)) ? true_sym : false_sym;
+   });
+
+   // (receive channel), nil once the channel is closed and drained
+   env->get("receive") = cell_t([=, &engine](cell_span c) -> cell_t {
+      if (c.size() != 1) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected 1 argument for [receive]");
+         std::exit(1);
+      }
+      auto channel = channel_of(env, c[0], "receive");
+      message_t message;
+      if (!channel->receive(message)) {
+         return nil;
+      }
+      return unpack_message(std::move(message), env, engine);
+   });
+
+   // (select channel...), the channel received from and the value as a
+   // list, nil once every channel is closed and drained
+   env->get("select") = cell_t([=, &engine](cell_span c) -> cell_t {
+      std::vector<channel_c *> channels;
+      for (auto &arg : c) {
+         channels.push_back(channel_of(env, arg, "select").get());
+      }
+      message_t message;
+      std::size_t i = select(channels, message);
+      if (i == channels.size()) {
+         return nil;
+      }
+      cell_t result(cell_type_e::LIST);
+      result.list.push_back(c[i]);
+      result.list.push_back(unpack_message(std::move(message), env, engine));
+      return result;
+   });
+
+   env->get("close") = cell_t([=](cell_span c) -> cell_t {
+      if (c.size() != 1) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected 1 argument for [close]");
+         std::exit(1);
+      }
+      channel_of(env, c[0], "close")->close();
+      return true_sym;
+   });
+
+   // (spawn-actor fn arg...), a channel that receives the result
+   env->get("spawn-actor") =
+       cell_t([=, &engine, &actors](cell_span c) -> cell_t {
+          if (c.empty()) {
+             env->get_error_cb()(error_level_e::FATAL,
+                                 "Expected a function for [spawn-actor]");
+             std::exit(1);
+          }
+          return channel_cell(
+              actors.spawn(engine, env, c[0], c.subspan(1)));
+       });
+
+   env->name_procs();
+}
+
+} // namespace polaris
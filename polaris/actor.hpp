@@ -0,0 +1,213 @@
+#ifndef POLARIS_ACTOR_HPP
+#define POLARIS_ACTOR_HPP
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace polaris {
+
+//! \brief Capacity of a channel made without one
+constexpr std::size_t default_channel_capacity = 64;
+
+//! \brief Most messages a channel can hold at once
+constexpr std::size_t max_channel_capacity = std::size_t(1) << 24;
+
+struct packed_graph_t;
+
+//! \brief A value copied out of the interpreter that sent it. Single
+//!        values are copied as they are, anything else is serialized with
+//!        the lambdas in it carrying what they captured and the globals
+//!        they refer to, builtins by their name and channels shared
+struct message_t {
+   //! The value when it is a single value
+   cell_t value;
+
+   //! The serialized value and the channels it shares, null when the
+   //! value is a single value
+   std::shared_ptr<packed_graph_t> graph;
+};
+
+//! \brief Copy a value so that it can be given to another interpreter.
+//!        Anything that can not be serialized is reported as a failure and
+//!        sent as nil
+//! \param value The value to copy
+//! \param env The environment the value was made in
+extern message_t pack_message(const cell_t &value,
+                              std::shared_ptr<environment_c> env);
+
+//! \brief Rebuild a copied value in the interpreter receiving it. Globals
+//!        the lambdas refer to are only defined if the receiver does not
+//!        already have them. A message that can not be rebuilt is reported
+//!        as a failure and received as nil
+//! \param message The message to take the value from
+//! \param env The global environment of the receiver
+//! \param engine The engine of the receiver, it adopts the lambdas
+extern cell_t unpack_message(message_t message,
+                             std::shared_ptr<environment_c> env,
+                             engine_c &engine);
+
+//! \brief Bounded multi producer, multi consumer queue of messages. Sends
+//!        and receives claim a slot with a single compare and swap, the
+//!        blocking calls spin briefly before sleeping on an atomic wait.
+//!        Closing marks the send position itself, so a send either claims
+//!        its slot before the close and is received, or fails
+class channel_c : public object_c {
+ public:
+   //! \brief Create the channel
+   //! \param capacity The most messages held at once, rounded up to a
+   //!        power of two and kept to max_channel_capacity
+   explicit channel_c(std::size_t capacity = default_channel_capacity);
+
+   channel_c(const channel_c &) = delete;
+   channel_c &operator=(const channel_c &) = delete;
+
+   //! \brief Send without blocking, the message is only moved from if it
+   //!        was sent
+   //! \returns false if the channel is full or closed
+   bool try_send(message_t &message);
+
+   //! \brief Receive without blocking
+   //! \returns false if the channel is empty
+   bool try_receive(message_t &message);
+
+   //! \brief Send, waiting while the channel is full
+   //! \returns false if the channel is closed
+   bool send(message_t message);
+
+   //! \brief Receive, waiting while the channel is empty
+   //! \returns false once the channel is closed and every message sent
+   //!          before it was closed has been received
+   bool receive(message_t &message);
+
+   //! \brief Close the channel, waking everything waiting on it. Messages
+   //!        already sent can still be received
+   void close();
+
+   //! \brief Check if the channel has been closed
+   bool closed() const {
+      return _enqueue.load(std::memory_order_acquire) & closed_bit;
+   }
+
+   //! \brief Check if the channel has been closed and every message sent
+   //!        before it was closed has been received
+   bool drained() const;
+
+   //! \brief Check if a receive would not have to wait
+   bool ready() const;
+
+   //! \brief Retrieve the most messages held at once
+   std::size_t capacity() const { return _mask + 1; }
+
+ private:
+   struct slot_t {
+      std::atomic<std::size_t> sequence;
+      message_t message;
+   };
+
+   static constexpr std::size_t closed_bit =
+       std::size_t(1) << (sizeof(std::size_t) * 8 - 1);
+
+   bool writable() const;
+
+   std::unique_ptr<slot_t[]> _slots;
+   std::size_t _mask;
+   alignas(64) std::atomic<std::size_t> _enqueue{0};
+   alignas(64) std::atomic<std::size_t> _dequeue{0};
+   alignas(64) std::atomic<uint32_t> _sent{0};
+   std::atomic<uint32_t> _receivers_waiting{0};
+   alignas(64) std::atomic<uint32_t> _received{0};
+   std::atomic<uint32_t> _senders_waiting{0};
+};
+
+//! \brief Receive from whichever of the channels has a message first,
+//!        waiting until one does
+//! \param channels The channels to receive from
+//! \param message Set to the message received
+//! \returns The index of the channel received from, or the number of
+//!          channels if they are all closed and drained
+extern std::size_t select(const std::vector<channel_c *> &channels,
+                          message_t &message);
+
+//! \brief Runs actors, each is a lambda called on a thread of its own by an
+//!        interpreter of its own. Actors share nothing but channels, they
+//!        start with the builtins and the globals their lambda refers to.
+//!        Errors in an actor are passed to the error callback of its
+//!        spawner as failures, one actor at a time. An error that would be
+//!        fatal ends the actor, its channel is closed without a result
+class actors_c {
+ public:
+   //! \brief Create the actors
+   //! \param include_dirs Directories the actors import files from
+   explicit actors_c(std::vector<std::string> include_dirs = {});
+
+   //! \brief Close every channel made through this, stop spawning and wait
+   //!        for every actor. Actors waiting on a channel are woken by the
+   //!        close, those still computing are waited for, none outlives
+   //!        this
+   ~actors_c();
+
+   actors_c(const actors_c &) = delete;
+   actors_c &operator=(const actors_c &) = delete;
+
+   //! \brief Make a channel that is closed when the actors are destroyed
+   //! \param capacity The most messages held at once
+   std::shared_ptr<channel_c> make_channel(std::size_t capacity);
+
+   //! \brief Start an actor calling fn with the arguments given. The actor
+   //!        uses the same kind of engine as the caller
+   //! \param engine The engine of the caller
+   //! \param env The global environment of the caller
+   //! \param fn The lambda or builtin the actor calls
+   //! \param args The arguments to call it with
+   //! \returns A channel that receives the result of the call and is
+   //!          then closed
+   std::shared_ptr<channel_c> spawn(engine_c &engine,
+                                    std::shared_ptr<environment_c> env,
+                                    const cell_t &fn, cell_span args);
+
+   //! \brief Wait for every actor to finish, including any they spawn
+   void join();
+
+ private:
+   //  Shared with the actors, which spawn through it too
+   //
+   struct shared_t {
+      std::vector<std::string> include_dirs;
+      std::mutex mutex;
+      std::vector<std::thread> actors;
+      std::vector<std::weak_ptr<channel_c>> channels;
+      bool stopped{false};
+      std::mutex error_mutex;
+   };
+
+   //  The actors as seen from within an actor, destroying it leaves them
+   //  running
+   //
+   explicit actors_c(std::shared_ptr<shared_t> shared);
+
+   std::shared_ptr<shared_t> _shared;
+   bool _owner{true};
+};
+
+//! \brief Add the actor builtins to an environment. These are
+//!        `(make-channel [capacity])`, `(send channel value)`,
+//!        `(receive channel)`, `(select channel...)`, `(close channel)`
+//!        and `(spawn-actor fn arg...)`
+//! \param env The environment to load the symbols into
+//! \param engine The engine of the environment
+//! \param actors The actors that spawned actors are run by
+extern void add_actor_globals(std::shared_ptr<environment_c> env,
+                              engine_c &engine, actors_c &actors);
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,280 @@
+#include "async.hpp"
+#include "engine.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+#include "native.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+namespace polaris {
+
+namespace {
+
+cell_t future_cell(std::shared_ptr<future_c> future) {
+   cell_t c(cell_type_e::FUTURE);
+   c.obj = std::move(future);
+   return c;
+}
+
+task_t sleep_task(loop_c &loop, uint64_t ms) {
+   co_await loop.sleep(ms);
+   co_return true_sym;
+}
+
+task_t read_task(loop_c &loop, std::shared_ptr<environment_c> env, int fd) {
+   if (int error = co_await loop.readable(fd)) {
+      std::string err = "Unable to wait on file descriptor " +
+                        std::to_string(fd) + " : " + std::strerror(error);
+      env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+      co_return false_sym;
+   }
+   char buffer[4096];
+   ssize_t n = ::read(fd, buffer, sizeof(buffer));
+   if (n < 0) {
+      co_return false_sym;
+   }
+   co_return cell_t(cell_type_e::STRING,
+                    std::string(buffer, static_cast<size_t>(n)));
+}
+
+} // namespace
+
+void future_c::resolve(cell_t value) {
+   _value = std::move(value);
+   settle();
+}
+
+void future_c::fail(std::exception_ptr error) {
+   _error = error;
+   settle();
+}
+
+const cell_t &future_c::value() const {
+   if (_error) {
+      std::rethrow_exception(_error);
+   }
+   return _value;
+}
+
+void future_c::then(std::coroutine_handle<> waiter) {
+   if (_done) {
+      _loop.post(waiter);
+      return;
+   }
+   _waiters.push_back(waiter);
+}
+
+void future_c::settle() {
+   _done = true;
+   for (auto &waiter : _waiters) {
+      _loop.post(waiter);
+   }
+   _waiters.clear();
+}
+
+cell_t task_t::to_cell() const { return future_cell(_future); }
+
+loop_c::loop_c() {
+#if defined(__linux__)
+   _poll_fd = epoll_create1(EPOLL_CLOEXEC);
+#endif
+}
+
+loop_c::~loop_c() {
+   if (_poll_fd >= 0) {
+      ::close(_poll_fd);
+   }
+}
+
+void loop_c::post(std::function<void()> fn) { _ready.push_back(std::move(fn)); }
+
+void loop_c::post(std::coroutine_handle<> h) {
+   _ready.push_back([h]() { h.resume(); });
+}
+
+std::shared_ptr<future_c> loop_c::make_future() {
+   return std::make_shared<future_c>(*this);
+}
+
+void loop_c::add_timer(clock::time_point when, std::coroutine_handle<> h) {
+   _timers.emplace(when, h);
+}
+
+int loop_c::watch(int fd, std::coroutine_handle<> h) {
+   if (_readers.contains(fd)) {
+      return EBUSY;
+   }
+
+   //  epoll refuses descriptors it can not wait on, such as regular files
+   //
+#if defined(__linux__)
+   epoll_event ev{};
+   ev.events = EPOLLIN;
+   ev.data.fd = fd;
+   if (epoll_ctl(_poll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      return errno;
+   }
+#endif
+   _readers[fd] = h;
+   return 0;
+}
+
+bool loop_c::idle() const {
+   return _ready.empty() && _timers.empty() && _readers.empty();
+}
+
+void loop_c::wait(int timeout_ms) {
+   std::vector<int> ready_fds;
+
+#if defined(__linux__)
+   epoll_event events[16];
+   int n = epoll_wait(_poll_fd, events, 16, timeout_ms);
+   for (int i = 0; i < n; i++) {
+      ready_fds.push_back(events[i].data.fd);
+   }
+#else
+   std::vector<pollfd> fds;
+   for (auto &[fd, h] : _readers) {
+      fds.push_back(pollfd{fd, POLLIN, 0});
+   }
+   if (::poll(fds.data(), fds.size(), timeout_ms) > 0) {
+      for (auto &p : fds) {
+         if (p.revents) {
+            ready_fds.push_back(p.fd);
+         }
+      }
+   }
+#endif
+
+   // Readiness is one shot, whoever waited has to ask again
+   //
+   for (auto fd : ready_fds) {
+      auto it = _readers.find(fd);
+      if (it == _readers.end()) {
+         continue;
+      }
+#if defined(__linux__)
+      epoll_ctl(_poll_fd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+      post(it->second);
+      _readers.erase(it);
+   }
+}
+
+bool loop_c::run_once() {
+   if (idle()) {
+      return false;
+   }
+
+   // Only what was queued before this turn is run so that work which keeps
+   // queueing more work can not starve the timers and descriptors
+   //
+   if (!_ready.empty()) {
+      for (auto count = _ready.size(); count && !_ready.empty(); --count) {
+         auto fn = std::move(_ready.front());
+         _ready.pop_front();
+         fn();
+      }
+      if (!_readers.empty()) {
+         wait(0);
+      }
+   } else {
+      int timeout = -1;
+      if (!_timers.empty()) {
+         auto delay = std::chrono::ceil<std::chrono::milliseconds>(
+             _timers.begin()->first - clock::now());
+         timeout = static_cast<int>(std::max<int64_t>(0, delay.count()));
+      }
+      if (_readers.empty()) {
+         if (timeout > 0) {
+            ::usleep(static_cast<useconds_t>(timeout) * 1000);
+         }
+      } else {
+         wait(timeout);
+      }
+   }
+
+   auto now = clock::now();
+   while (!_timers.empty() && _timers.begin()->first <= now) {
+      post(_timers.begin()->second);
+      _timers.erase(_timers.begin());
+   }
+   return true;
+}
+
+void loop_c::run() {
+   while (run_once()) {
+   }
+}
+
+bool loop_c::run_until(const future_c &future) {
+   while (!future.done()) {
+      if (!run_once()) {
+         return false;
+      }
+   }
+   return true;
+}
+
+void add_async_globals(std::shared_ptr<environment_c> env, engine_c &engine,
+                       loop_c &loop) {
+
+   env->get("spawn") = cell_t([=, &engine, &loop](cell_span c) -> cell_t {
+      if (c.size() != 1) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected 1 argument for [spawn]");
+         std::exit(1);
+      }
+      auto future = loop.make_future();
+      loop.post([&engine, future, thunk = c[0]]() {
+         try {
+            future->resolve(engine.apply(thunk, {}));
+         } catch (...) {
+            future->fail(std::current_exception());
+         }
+      });
+      return future_cell(future);
+   });
+
+   env->get("await") = cell_t([=, &loop](cell_span c) -> cell_t {
+      if (c.size() != 1) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected 1 argument for [await]");
+         std::exit(1);
+      }
+      if (c[0].type != cell_type_e::FUTURE) {
+         return c[0];
+      }
+      auto future = std::static_pointer_cast<future_c>(c[0].obj);
+      if (!loop.run_until(*future)) {
+         env->get_error_cb()(error_level_e::FAILURE,
+                             "awaited future can never complete");
+         return nil;
+      }
+      return future->value();
+   });
+
+   register_native(env, "sleep", [&loop](uint64_t ms) -> cell_t {
+      return sleep_task(loop, ms).to_cell();
+   });
+
+   register_native(env, "fd-read", [env, &loop](int fd) -> cell_t {
+      return read_task(loop, env, fd).to_cell();
+   });
+
+   env->name_procs();
+}
+
+} // namespace polaris
@@ -0,0 +1,197 @@
+#ifndef POLARIS_ASYNC_HPP
+#define POLARIS_ASYNC_HPP
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace polaris {
+
+class loop_c;
+
+//! \brief The eventual result of an asynchronous operation. Held by a cell
+//!        of type FUTURE so scripts can pass it around and await it
+class future_c : public object_c {
+ public:
+   //! \brief Create a future that schedules its waiters on the given loop
+   explicit future_c(loop_c &loop) : _loop(loop) {}
+
+   //! \brief Check if the future has a value (or an error)
+   bool done() const { return _done; }
+
+   //! \brief Set the value and schedule everything waiting on it
+   void resolve(cell_t value);
+
+   //! \brief Set an error that is rethrown to whoever retrieves the value
+   void fail(std::exception_ptr error);
+
+   //! \brief Retrieve the value, rethrowing the error if there is one
+   const cell_t &value() const;
+
+   //! \brief Have a suspended coroutine resumed once the future is done
+   void then(std::coroutine_handle<> waiter);
+
+   //! \brief Make the future awaitable from a coroutine
+   auto operator co_await() {
+      struct awaiter_t {
+         future_c &future;
+         bool await_ready() const noexcept { return future.done(); }
+         void await_suspend(std::coroutine_handle<> h) { future.then(h); }
+         const cell_t &await_resume() const { return future.value(); }
+      };
+      return awaiter_t{*this};
+   }
+
+ private:
+   void settle();
+
+   loop_c &_loop;
+   bool _done{false};
+   cell_t _value;
+   std::exception_ptr _error;
+   std::vector<std::coroutine_handle<>> _waiters;
+};
+
+//! \brief Coroutine type for natives that suspend. The coroutine starts
+//!        running immediately, when it suspends the caller gets the future
+//!        that will hold whatever it `co_return`s. The first parameter of
+//!        the coroutine must be the loop it runs on
+class task_t {
+ public:
+   struct promise_type {
+      std::shared_ptr<future_c> future;
+
+      template <typename... Args>
+      promise_type(loop_c &loop, Args &&...)
+          : future(std::make_shared<future_c>(loop)) {}
+
+      task_t get_return_object() { return task_t(future); }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_value(cell_t value) { future->resolve(std::move(value)); }
+      void unhandled_exception() { future->fail(std::current_exception()); }
+   };
+
+   //! \brief Retrieve the future of the coroutine
+   const std::shared_ptr<future_c> &future() const { return _future; }
+
+   //! \brief Wrap the future of the coroutine into a cell
+   cell_t to_cell() const;
+
+ private:
+   explicit task_t(std::shared_ptr<future_c> future)
+       : _future(std::move(future)) {}
+
+   std::shared_ptr<future_c> _future;
+};
+
+//! \brief Single threaded event loop with timers and file descriptor
+//!        readiness. Uses epoll on Linux and poll everywhere else
+class loop_c {
+ public:
+   using clock = std::chrono::steady_clock;
+
+   loop_c();
+   ~loop_c();
+
+   loop_c(const loop_c &) = delete;
+   loop_c &operator=(const loop_c &) = delete;
+
+   //! \brief Queue a function to be run on the next turn of the loop
+   void post(std::function<void()> fn);
+
+   //! \brief Queue a suspended coroutine to be resumed on the next turn
+   void post(std::coroutine_handle<> h);
+
+   //! \brief Create a future that is resolved through this loop
+   std::shared_ptr<future_c> make_future();
+
+   //! \brief Awaitable that resumes the coroutine after a delay
+   //! \param ms Milliseconds to wait for
+   auto sleep(uint64_t ms) {
+      struct awaiter_t {
+         loop_c &loop;
+         clock::time_point when;
+         bool await_ready() const noexcept { return when <= clock::now(); }
+         void await_suspend(std::coroutine_handle<> h) {
+            loop.add_timer(when, h);
+         }
+         void await_resume() const noexcept {}
+      };
+      return awaiter_t{*this, clock::now() + std::chrono::milliseconds(ms)};
+   }
+
+   //! \brief Awaitable that resumes the coroutine once a file descriptor
+   //!        has data to read (or has been closed). The result is 0, or an
+   //!        errno value if the descriptor could not be watched, in which
+   //!        case the coroutine carries on straight away
+   //! \param fd The file descriptor to watch, only one coroutine can
+   //!           wait on a file descriptor at a time, a second is given
+   //!           EBUSY
+   auto readable(int fd) {
+      struct awaiter_t {
+         loop_c &loop;
+         int fd;
+         int error{0};
+         bool await_ready() const noexcept { return false; }
+         bool await_suspend(std::coroutine_handle<> h) {
+            error = loop.watch(fd, h);
+            return error == 0;
+         }
+         int await_resume() const noexcept { return error; }
+      };
+      return awaiter_t{*this, fd};
+   }
+
+   //! \brief Run a single turn of the loop, blocking only if nothing is
+   //!        ready to run
+   //! \returns false if there was nothing left to do
+   bool run_once();
+
+   //! \brief Run until there is nothing left to do
+   void run();
+
+   //! \brief Run until the future is done
+   //! \returns false if the loop ran out of work before the future was done
+   bool run_until(const future_c &future);
+
+   //! \brief Check if there is no queued, timed or watched work
+   bool idle() const;
+
+ private:
+   void add_timer(clock::time_point when, std::coroutine_handle<> h);
+   int watch(int fd, std::coroutine_handle<> h);
+   void wait(int timeout_ms);
+
+   std::deque<std::function<void()>> _ready;
+   std::multimap<clock::time_point, std::coroutine_handle<>> _timers;
+   std::unordered_map<int, std::coroutine_handle<>> _readers;
+   int _poll_fd{-1};
+};
+
+//! \brief Add the asynchronous primitives to an environment. These are
+//!        `(spawn thunk)`, `(await future)`, `(sleep ms)` and
+//!        `(fd-read fd)`. Awaiting from a script runs the loop on the
+//!        stack of the caller until the future is done, so a spawned
+//!        task that awaits finishes before the task that it interrupted
+//!        can continue
+//! \param env The environment to load the symbols into
+//! \param engine The engine used to run spawned lambdas
+//! \param loop The loop that runs the asynchronous work
+extern void add_async_globals(std::shared_ptr<environment_c> env,
+                              engine_c &engine, loop_c &loop);
+
+} // namespace polaris
+
+#endif
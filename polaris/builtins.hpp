@@ -0,0 +1,62 @@
+#ifndef POLARIS_BUILTINS_HPP
+#define POLARIS_BUILTINS_HPP
+
+#include "cell.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+
+//  Helpers shared by the files that add builtins, not part of the installed
+//  headers
+//
+namespace polaris {
+
+//! \brief Report a fatal error through the error callback of an
+//!        environment, exiting if the callback returns
+//! \param env The environment whose callback is told
+//! \param err The message
+[[noreturn]] inline void fail(const std::shared_ptr<environment_c> &env,
+                              const std::string &err) {
+   env->get_error_cb()(error_level_e::FATAL, err.c_str());
+   std::exit(1);
+}
+
+//! \brief Fail unless a builtin was given from least to most arguments
+//! \param env The environment whose callback is told
+//! \param c The arguments given
+//! \param least The fewest arguments the builtin takes
+//! \param most The most arguments the builtin takes
+//! \param name The name of the builtin, for the message
+inline void expect_arguments(const std::shared_ptr<environment_c> &env,
+                             cell_span c, std::size_t least, std::size_t most,
+                             std::string_view name) {
+   if (c.size() < least || c.size() > most) {
+      fail(env, "Unexpected number of arguments for [" + std::string(name) +
+                    "]");
+   }
+}
+
+//! \brief Check a value the way if does, anything but #f is true
+inline bool truthy(const cell_t &c) { return c.val != false_sym.val; }
+
+//! \brief Make a (name value) list, as statistics are reported
+inline cell_t pair(const std::string &name, cell_t value) {
+   cell_t c(cell_type_e::LIST);
+   c.list.push_back(cell_t(cell_type_e::SYMBOL, name));
+   c.list.push_back(std::move(value));
+   return c;
+}
+
+//! \brief Make a (name n) list for a count
+inline cell_t pair(const std::string &name, uint64_t n) {
+   return pair(name, cell_t(cell_type_e::NUMBER, std::to_string(n)));
+}
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,85 @@
+#include "cell.hpp"
+
+namespace polaris {
+
+namespace {
+
+std::size_t combine(std::size_t seed, std::size_t value) {
+   return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+bool lists_equal(const cells &lhs, const cells &rhs) {
+   if (lhs.size() != rhs.size()) {
+      return false;
+   }
+   for (std::size_t i = 0; i < lhs.size(); i++) {
+      if (!cell_equal(lhs[i], rhs[i])) {
+         return false;
+      }
+   }
+   return true;
+}
+
+} // namespace
+
+std::size_t cell_hash(const cell_t &c) {
+   std::size_t seed = static_cast<std::size_t>(c.type);
+   switch (c.type) {
+   case cell_type_e::LIST:
+      seed = combine(seed, c.list.size());
+      for (auto &item : c.list) {
+         seed = combine(seed, cell_hash(item));
+      }
+      return seed;
+   case cell_type_e::LAMBDA:
+      return combine(seed, std::hash<environment_c *>{}(c.env.get()));
+   case cell_type_e::FUTURE:
+      [[fallthrough]];
+   case cell_type_e::SEQUENCE:
+      [[fallthrough]];
+   case cell_type_e::PROMISE:
+      [[fallthrough]];
+   case cell_type_e::CHANNEL:
+      [[fallthrough]];
+   case cell_type_e::MACRO:
+      [[fallthrough]];
+   case cell_type_e::RECORD:
+      [[fallthrough]];
+   case cell_type_e::BUILDER:
+      return combine(seed, std::hash<object_c *>{}(c.obj.get()));
+   default:
+      return combine(seed, std::hash<std::string>{}(c.val));
+   }
+}
+
+bool cell_equal(const cell_t &lhs, const cell_t &rhs) {
+   if (lhs.type != rhs.type) {
+      return false;
+   }
+   switch (lhs.type) {
+   case cell_type_e::LIST:
+      return lists_equal(lhs.list, rhs.list);
+   case cell_type_e::LAMBDA:
+      return lhs.env == rhs.env && lists_equal(lhs.list, rhs.list);
+   case cell_type_e::PROC:
+      return !lhs.val.empty() && lhs.val == rhs.val && lhs.obj == rhs.obj;
+   case cell_type_e::FUTURE:
+      [[fallthrough]];
+   case cell_type_e::SEQUENCE:
+      [[fallthrough]];
+   case cell_type_e::PROMISE:
+      [[fallthrough]];
+   case cell_type_e::CHANNEL:
+      [[fallthrough]];
+   case cell_type_e::MACRO:
+      [[fallthrough]];
+   case cell_type_e::RECORD:
+      [[fallthrough]];
+   case cell_type_e::BUILDER:
+      return lhs.obj == rhs.obj;
+   default:
+      return lhs.val == rhs.val;
+   }
+}
+
+} // namespace polaris
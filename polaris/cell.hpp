@@ -2,16 +2,41 @@
 #define POLARIS_CELL_HPP
 
 #include "fwd.hpp"
+#include "stats.hpp"
 #include <functional>
+#include <concepts>
+#include <cstdint>
 #include <memory>
+#include <span>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace polaris {
 
 //! \brief General cell types
-enum class cell_type_e { SYMBOL, LIST, PROC, LAMBDA, STRING, NUMBER, DOUBLE };
+enum class cell_type_e {
+   SYMBOL,
+   LIST,
+   PROC,
+   LAMBDA,
+   STRING,
+   NUMBER,
+   DOUBLE,
+   FUTURE,
+   SEQUENCE,
+   PROMISE,
+   CHANNEL,
+   MACRO,
+   RECORD,
+   BUILDER
+};
+
+//! \brief Number of cell types
+constexpr std::size_t cell_type_count =
+    static_cast<std::size_t>(cell_type_e::BUILDER) + 1;
+static_assert(cell_type_count <= stats_cell_types);
 
 constexpr const char *cell_type_to_string(cell_type_e type) {
    switch(type) {
@@ -22,14 +47,34 @@ constexpr const char *cell_type_to_string(cell_type_e type) {
    case cell_type_e::STRING: return "string";
    case cell_type_e::NUMBER: return "number";
    case cell_type_e::DOUBLE: return "double";
+   case cell_type_e::FUTURE: return "future";
+   case cell_type_e::SEQUENCE: return "sequence";
+   case cell_type_e::PROMISE: return "promise";
+   case cell_type_e::CHANNEL: return "channel";
+   case cell_type_e::MACRO: return "macro";
+   case cell_type_e::RECORD: return "record";
+   case cell_type_e::BUILDER: return "builder";
    };
    return "unknown";
 };
 
+struct cell_t;
+
+//! \brief Base for runtime objects that a cell can hold (futures,
+//!        sequences, channels, ...)
+class object_c {
+ public:
+   virtual ~object_c() = default;
+};
+
+//! \brief View over the arguments of a call. The cells are owned by the
+//!        caller (usually a buffer on its stack) and only live for the call
+using cell_span = std::span<const cell_t>;
+
 //! \brief A given cell
 struct cell_t {
    //! Shorthand for function calls
-   using proc_fn = std::function<cell_t(const std::vector<cell_t> &)>;
+   using proc_fn = std::function<cell_t(cell_span)>;
 
    //! Shorthand for an unordered map of cells
    using map = std::unordered_map<std::string, cell_t>;
@@ -37,6 +82,10 @@ struct cell_t {
    //! The cells type
    cell_type_e type{cell_type_e::SYMBOL};
 
+   //! Where a list was read from, 0 if it was not read from a file. See
+   //! source.hpp, the index fits beside the type without growing the cell
+   uint32_t loc{0};
+
    //! Cell value
    std::string val;
 
@@ -49,18 +98,79 @@ struct cell_t {
    //! Cell operating environment
    std::shared_ptr<environment_c> env;
 
+   //! Runtime object held by the cell
+   std::shared_ptr<object_c> obj;
+
    //! \brief Construct a cell with only a given type
    //! \param type The type to give the cell
-   cell_t(cell_type_e type = cell_type_e::SYMBOL) : type(type) {}
+   cell_t(cell_type_e type = cell_type_e::SYMBOL) : type(type) { created(); }
 
    //! \brief Construct the cell with a type and value
    //! \param type The type to give the cell
    //! \param val The value to give the cell
-   cell_t(cell_type_e type, const std::string &val) : type(type), val(val) {}
+   cell_t(cell_type_e type, const std::string &val) : type(type), val(val) {
+      created();
+   }
 
    //! \brief Construct a cell that executes a function
    //! \param proc The function to process
-   cell_t(proc_fn proc) : type(cell_type_e::PROC), proc(proc) {}
+   cell_t(proc_fn proc) : type(cell_type_e::PROC), proc(std::move(proc)) {
+      created();
+   }
+
+   //! \brief Copy a cell, counted in the runtime statistics
+   cell_t(const cell_t &other)
+       : type(other.type), loc(other.loc), val(other.val), list(other.list),
+         proc(other.proc), env(other.env), obj(other.obj) {
+      copied();
+   }
+
+   //! \brief Copy a cell over this one, counted in the runtime statistics
+   cell_t &operator=(const cell_t &other) {
+      type = other.type;
+      loc = other.loc;
+      val = other.val;
+      list = other.list;
+      proc = other.proc;
+      env = other.env;
+      obj = other.obj;
+      copied();
+      return *this;
+   }
+
+   cell_t(cell_t &&) noexcept = default;
+   cell_t &operator=(cell_t &&) noexcept = default;
+
+   //! \brief Construct a cell that executes a function taking its arguments
+   //!        as a vector. The arguments are copied into a vector for every
+   //!        call, prefer taking a cell_span
+   //! \param fn The function to process
+   template <typename Fn>
+      requires(std::invocable<Fn, const std::vector<cell_t> &> &&
+               !std::invocable<Fn, cell_span>)
+   cell_t(Fn fn)
+       : type(cell_type_e::PROC), proc([fn](cell_span args) -> cell_t {
+            return fn(std::vector<cell_t>(args.begin(), args.end()));
+         }) {
+      created();
+   }
+
+ private:
+   void created() const {
+      ++stats().cells_created[static_cast<std::size_t>(type)];
+   }
+
+   //  The copied list and a value too long to be stored inline are the
+   //  allocations a copy makes
+   //
+   void copied() const {
+      stats_t &s = stats();
+      ++s.cells_copied[static_cast<std::size_t>(type)];
+      s.bytes_allocated += list.size() * sizeof(cell_t);
+      if (val.size() >= sizeof(std::string)) {
+         s.bytes_allocated += val.size();
+      }
+   }
 };
 
 using cells = std::vector<cell_t>; //! Shorthand for vector of cells
@@ -68,6 +178,30 @@ const cell_t false_sym(cell_type_e::SYMBOL, "#f"); //! Cell for "FALSE"
 const cell_t true_sym(cell_type_e::SYMBOL, "#t");  //! Cell for "TRUE"
 const cell_t nil(cell_type_e::SYMBOL, "nil");      //! Cell for "NIL"
 
+//! \brief Structural hash of a cell. Lists are hashed by their contents,
+//!        lambdas and runtime objects by identity. Records are runtime
+//!        objects, their fields can change after they are hashed
+//! \param c The cell to hash
+extern std::size_t cell_hash(const cell_t &c);
+
+//! \brief Structural equality of two cells, consistent with cell_hash.
+//!        Procs are only equal if they are the same named builtin
+//! \param lhs The first cell
+//! \param rhs The second cell
+extern bool cell_equal(const cell_t &lhs, const cell_t &rhs);
+
+//! \brief Hash for containers keyed by cells
+struct cell_hash_t {
+   std::size_t operator()(const cell_t &c) const { return cell_hash(c); }
+};
+
+//! \brief Equality for containers keyed by cells
+struct cell_equal_t {
+   bool operator()(const cell_t &lhs, const cell_t &rhs) const {
+      return cell_equal(lhs, rhs);
+   }
+};
+
 } // namespace polaris
 
 #endif
\ No newline at end of file
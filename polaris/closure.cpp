@@ -0,0 +1,363 @@
+#include "closure.hpp"
+#include "engine.hpp"
+
+namespace polaris {
+
+namespace {
+
+using name_set = std::unordered_set<std::string>;
+
+// What a walk over a lambda body found
+struct scan_t {
+   name_set refs;     // variables referenced, including by nested lambdas
+   name_set defined;  // names introduced with define at this level
+   name_set assigned; // set! targets, including those in nested lambdas
+   name_set captured; // variables referenced from nested lambdas
+};
+
+// Special form heads that are not variable references
+bool is_keyword(const std::string &name) {
+   return name == "quote" || name == "if" || name == "set!" ||
+          name == "define" || name == "lambda" || name == "begin" ||
+          name == "delay" || name == "let" || name == "let*" ||
+          name == "do" || name == "while";
+}
+
+std::shared_ptr<lambda_info_t> analyze(const std::vector<std::string> &names,
+                                       cell_span body, name_set &assigned);
+void scan(const cell_t &x, scan_t &s);
+
+// Analyze the scope of a nested lambda or binding form. Whatever it needs
+// from outside of itself has to be reachable from here when it is created
+void scan_scope(const std::vector<std::string> &names, cell_span body,
+                scan_t &s) {
+   auto nested = analyze(names, body, s.assigned);
+   for (auto &var : nested->free) {
+      s.refs.insert(var);
+      s.captured.insert(var);
+   }
+}
+
+// The names a binding form (let, let*, named let, do) introduces and the
+// expressions evaluated within its scope. Expressions evaluated before
+// the scope exists go to outside
+void binding_scope(const cell_t &x, std::vector<std::string> &names,
+                   cells &inside, cells &outside) {
+   const std::string &form = x.list[0].val;
+   bool named = form == "let" && x.list[1].type == cell_type_e::SYMBOL;
+   bool sequential = form == "let*";
+   const cell_t &specs = x.list[named ? 2 : 1];
+
+   for (auto &spec : specs.list) {
+      if (spec.type != cell_type_e::LIST || spec.list.empty()) {
+         continue;
+      }
+      names.push_back(spec.list[0].val);
+      if (spec.list.size() > 1) {
+         (sequential ? inside : outside).push_back(spec.list[1]);
+      }
+      if (form == "do" && spec.list.size() > 2) {
+         inside.push_back(spec.list[2]);
+      }
+   }
+   if (named) {
+      names.push_back(x.list[1].val);
+   }
+   inside.insert(inside.end(), x.list.begin() + (named ? 3 : 2),
+                 x.list.end());
+}
+
+void scan(const cell_t &x, scan_t &s) {
+   if (x.type == cell_type_e::SYMBOL) {
+      s.refs.insert(x.val);
+      return;
+   }
+   if (x.type != cell_type_e::LIST || x.list.empty()) {
+      return;
+   }
+
+   auto begin = x.list.begin();
+   const cell_t &head = x.list[0];
+   if (head.type == cell_type_e::SYMBOL && is_keyword(head.val)) {
+      if (head.val == "quote") {
+         return;
+      }
+      if (head.val == "lambda" && x.list.size() > 2) {
+         std::vector<std::string> params;
+         for (auto &p : x.list[1].list) {
+            params.push_back(p.val);
+         }
+         scan_scope(params, cell_span(x.list).subspan(2), s);
+         return;
+      }
+      if ((head.val == "let" || head.val == "let*" || head.val == "do") &&
+          x.list.size() > 2) {
+         std::vector<std::string> names;
+         cells inside;
+         cells outside;
+         binding_scope(x, names, inside, outside);
+         for (auto &init : outside) {
+            scan(init, s);
+         }
+         scan_scope(names, inside, s);
+         return;
+      }
+      if (head.val == "define" && x.list.size() > 2) {
+         s.defined.insert(x.list[1].val);
+         begin += 2;
+      } else if (head.val == "set!" && x.list.size() > 2) {
+         s.assigned.insert(x.list[1].val);
+         s.refs.insert(x.list[1].val);
+         begin += 2;
+      } else {
+         ++begin;
+      }
+   }
+
+   for (auto i = begin; i != x.list.end(); ++i) {
+      scan(*i, s);
+   }
+}
+
+std::shared_ptr<lambda_info_t> analyze(const std::vector<std::string> &names,
+                                       cell_span body, name_set &assigned) {
+   auto info = std::make_shared<lambda_info_t>();
+   info->params = names;
+   name_set params(names.begin(), names.end());
+
+   scan_t s;
+   for (auto &x : body) {
+      scan(x, s);
+   }
+
+   for (auto &var : s.refs) {
+      if (!params.contains(var) && !s.defined.contains(var)) {
+         info->free.push_back(var);
+      }
+   }
+
+   // A captured name only needs a box if its value can change after the
+   // capture happens. Defined names are boxed because the closure may be
+   // created before the define runs (recursive local functions)
+   for (auto &var : s.captured) {
+      if (s.defined.contains(var) ||
+          (params.contains(var) && s.assigned.contains(var))) {
+         info->boxed.insert(var);
+      }
+   }
+
+   assigned.insert(s.assigned.begin(), s.assigned.end());
+   return info;
+}
+
+std::shared_ptr<environment_c> global_of(std::shared_ptr<environment_c> env) {
+   while (env->get_outer()) {
+      env = env->get_outer();
+   }
+   return env;
+}
+
+// Run an analysis once per form. Two threads evaluating copies of the same
+// form at once may both run it, either result is the same
+template <typename Fn>
+std::shared_ptr<const lambda_info_t> kept(const cell_t &form, Fn fn) {
+   auto *slot = dynamic_cast<form_analysis_c *>(form.obj.get());
+   if (slot) {
+      if (auto info = slot->info.load(std::memory_order_acquire)) {
+         return info;
+      }
+   }
+   std::shared_ptr<const lambda_info_t> info = fn();
+   if (slot) {
+      slot->info.store(info, std::memory_order_release);
+   }
+   return info;
+}
+
+} // namespace
+
+const cell_t &lambda_source(const cell_t &lambda) {
+   if (auto *source = dynamic_cast<const lambda_source_c *>(lambda.obj.get())) {
+      return source->form;
+   }
+   return lambda;
+}
+
+void keep_analysis(cell_t &form) {
+   if (!form.obj) {
+      form.obj = std::make_shared<form_analysis_c>();
+   }
+}
+
+std::shared_ptr<const lambda_info_t> analyze_lambda(const cell_t &lambda) {
+   return kept(lambda, [&]() {
+      std::vector<std::string> params;
+      for (auto &p : lambda.list[1].list) {
+         params.push_back(p.val);
+      }
+      name_set assigned;
+      return analyze(params, cell_span(lambda.list).subspan(2, 1), assigned);
+   });
+}
+
+std::shared_ptr<const lambda_info_t>
+analyze_binding_form(const cell_t &form) {
+   return kept(form, [&]() {
+      std::vector<std::string> names;
+      cells inside;
+      cells outside;
+      binding_scope(form, names, inside, outside);
+      name_set assigned;
+      return analyze(names, inside, assigned);
+   });
+}
+
+std::shared_ptr<const named_let_t> analyze_named_let(const cell_t &form) {
+   auto *slot = dynamic_cast<form_analysis_c *>(form.obj.get());
+   if (slot) {
+      if (auto shape = slot->named_let.load(std::memory_order_acquire)) {
+         return shape;
+      }
+   }
+
+   auto shape = std::make_shared<named_let_t>();
+   shape->body = cell_t(cell_type_e::LIST);
+   shape->body.list.push_back(cell_t(cell_type_e::SYMBOL, "begin"));
+   shape->body.list.insert(shape->body.list.end(), form.list.begin() + 3,
+                           form.list.end());
+   shape->loop = only_tail_calls(shape->body, form.list[1].val);
+   if (!shape->loop) {
+      shape->lambda = cell_t(cell_type_e::LIST);
+      shape->lambda.list.push_back(cell_t(cell_type_e::SYMBOL, "lambda"));
+      shape->lambda.list.push_back(cell_t(cell_type_e::LIST));
+      for (auto &spec : form.list[2].list) {
+         shape->lambda.list[1].list.push_back(spec.list[0]);
+      }
+      shape->lambda.list.push_back(shape->body);
+      shape->lambda.loc = form.loc;
+      keep_analysis(shape->lambda);
+   }
+
+   if (slot) {
+      slot->named_let.store(shape, std::memory_order_release);
+   }
+   return shape;
+}
+
+std::shared_ptr<environment_c> make_scope(const lambda_info_t &info,
+                                          std::shared_ptr<environment_c> env) {
+   auto scope = std::make_shared<environment_c>(env);
+   for (auto &var : info.boxed) {
+      scope->bind_box(var, std::make_shared<cell_t>(nil));
+   }
+   return scope;
+}
+
+bool only_tail_calls(const cell_t &x, const std::string &name, bool tail) {
+   if (x.type == cell_type_e::SYMBOL) {
+      return x.val != name;
+   }
+   if (x.type != cell_type_e::LIST || x.list.empty()) {
+      return true;
+   }
+
+   const cell_t &head = x.list[0];
+   std::size_t tail_from = x.list.size();
+   if (head.type == cell_type_e::SYMBOL) {
+      if (head.val == "quote") {
+         return true;
+      }
+      if (head.val == name) {
+         if (!tail) {
+            return false;
+         }
+         for (auto i = x.list.begin() + 1; i != x.list.end(); ++i) {
+            if (!only_tail_calls(*i, name, false)) {
+               return false;
+            }
+         }
+         return true;
+      }
+      // The branches of an if and the last expression of a begin are in
+      // the same position as the form itself
+      if (head.val == "if") {
+         tail_from = 2;
+      } else if (head.val == "begin") {
+         tail_from = x.list.size() - 1;
+      }
+   }
+
+   for (std::size_t i = 0; i < x.list.size(); i++) {
+      if (!only_tail_calls(x.list[i], name, tail && i >= tail_from)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+closure_c::closure_c(std::shared_ptr<const lambda_info_t> info,
+                     std::shared_ptr<environment_c> env)
+    : environment_c(global_of(env)), _info(info) {
+   for (auto &var : _info->free) {
+      env->capture(var, *this);
+   }
+}
+
+std::shared_ptr<environment_c>
+make_frame(const std::shared_ptr<closure_c> &closure, cell_span args) {
+   auto frame = std::make_shared<environment_c>(closure);
+   const lambda_info_t &info = closure->info();
+
+   auto arg = args.begin();
+   for (auto &param : info.params) {
+      cell_t value = (arg != args.end()) ? *arg++ : nil;
+      if (info.boxed.contains(param)) {
+         frame->bind_box(param, std::make_shared<cell_t>(std::move(value)));
+      } else {
+         frame->get(param) = std::move(value);
+      }
+   }
+
+   // Boxed locals that are not parameters come from define, give them their
+   // box now so closures created before the define can share it
+   for (auto &var : info.boxed) {
+      if (!frame->contains(var)) {
+         frame->bind_box(var, std::make_shared<cell_t>(nil));
+      }
+   }
+   return frame;
+}
+
+call_frame_c::call_frame_c(engine_c &engine, cell_t fn)
+    : _engine(engine), _fn(std::move(fn)) {
+   if (_fn.type == cell_type_e::LAMBDA) {
+      auto closure = std::static_pointer_cast<closure_c>(_fn.env);
+      if (closure->info().boxed.empty()) {
+         _closure = std::move(closure);
+      }
+   }
+}
+
+cell_t call_frame_c::call(cell_span args) {
+   if (!_closure) {
+      return _engine.apply(_fn, args);
+   }
+
+   //  Only this object refers to the frame and the body did not define
+   //  anything in it, so it is indistinguishable from a new one once the
+   //  parameters are rebound
+   //
+   const lambda_info_t &info = _closure->info();
+   if (_frame && _frame.use_count() == 1 &&
+       _frame->get_bindings().size() == info.params.size()) {
+      auto arg = args.begin();
+      for (auto &param : info.params) {
+         _frame->get(param) = (arg != args.end()) ? *arg++ : nil;
+      }
+   } else {
+      _frame = make_frame(_closure, args);
+   }
+   return _engine.apply_in(_fn, _frame);
+}
+
+} // namespace polaris
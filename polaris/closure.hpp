@@ -0,0 +1,164 @@
+#ifndef POLARIS_CLOSURE_HPP
+#define POLARIS_CLOSURE_HPP
+
+#include "cell.hpp"
+#include "environment.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace polaris {
+
+//! \brief Static facts about a lambda, computed once from its source
+struct lambda_info_t {
+   //! Parameter names in call order
+   std::vector<std::string> params;
+
+   //! Variables referenced by the body that are bound outside of it
+   std::vector<std::string> free;
+
+   //! Names bound by a call frame that inner closures capture and that
+   //! are assigned after binding. These live in shared boxes so that
+   //! every closure sees the same value
+   std::unordered_set<std::string> boxed;
+};
+
+//! \brief How a named let is evaluated, worked out once from its source
+struct named_let_t {
+   //! The body as a single `(begin exp*)` form
+   cell_t body;
+
+   //! Whether the name is only called in tail position, the let is then a
+   //! loop that updates its variables in place
+   bool loop{false};
+
+   //! When it is not a loop, the `(lambda (var*) body)` the name is bound to
+   cell_t lambda;
+};
+
+//! \brief Where a lambda or binding form keeps its analysis. The macro
+//!        expander gives one to each such form before it is evaluated and
+//!        copies of the form share it, so a lambda created in a loop is
+//!        analyzed once rather than on every iteration
+class form_analysis_c : public object_c {
+ public:
+   //! The analysis, set by the first analyze_lambda or
+   //! analyze_binding_form of the form
+   std::atomic<std::shared_ptr<const lambda_info_t>> info;
+
+   //! The shape of a named let, set by the first analyze_named_let
+   std::atomic<std::shared_ptr<const named_let_t>> named_let;
+};
+
+//! \brief The form a lambda was made from, for lambdas that share it rather
+//!        than holding a copy in their list. Held as the object of the
+//!        lambda, every lambda made from the same form refers to one
+class lambda_source_c : public object_c {
+ public:
+   //! \brief Keep the form
+   //! \param form The `(lambda (var*) exp)` form
+   explicit lambda_source_c(cell_t form) : form(std::move(form)) {}
+
+   //! The form, never changed once kept
+   const cell_t form;
+};
+
+//! \brief Retrieve the `(lambda (var*) exp)` form a lambda was made from,
+//!        whether it holds the form itself or shares it
+//! \param lambda The lambda
+extern const cell_t &lambda_source(const cell_t &lambda);
+
+//! \brief Give a lambda or binding form somewhere to keep its analysis
+//! \param form The form, left alone if it already has somewhere
+extern void keep_analysis(cell_t &form);
+
+//! \brief Run free variable analysis over a lambda form, or retrieve the
+//!        analysis the form kept from an earlier run
+//! \param lambda The `(lambda (var*) exp)` form to analyze
+extern std::shared_ptr<const lambda_info_t>
+analyze_lambda(const cell_t &lambda);
+
+//! \brief Run free variable analysis over the scope a binding form (let,
+//!        let*, named let, do) introduces. The params of the result are
+//!        the variables of the form in order, followed by the name of a
+//!        named let. The analysis is kept as it is for lambdas
+//! \param form The binding form to analyze
+extern std::shared_ptr<const lambda_info_t>
+analyze_binding_form(const cell_t &form);
+
+//! \brief Work out whether a named let is a loop and build the body (and
+//!        lambda) it is evaluated with, or retrieve what the form kept
+//! \param form The `(let name ((var init)*) exp*)` form
+extern std::shared_ptr<const named_let_t>
+analyze_named_let(const cell_t &form);
+
+//! \brief Create the environment of a binding form. Variables that need a
+//!        box are given one holding nil, the rest are bound by the caller
+//! \param info The analysis of the scope
+//! \param env The environment the form is evaluated in
+extern std::shared_ptr<environment_c>
+make_scope(const lambda_info_t &info, std::shared_ptr<environment_c> env);
+
+//! \brief Check that a name is only ever used as the head of a call in tail
+//!        position, such calls can be turned into a jump
+//! \param x The expression to check
+//! \param name The name to look for
+//! \param tail Whether the expression itself is in tail position
+extern bool only_tail_calls(const cell_t &x, const std::string &name,
+                            bool tail = true);
+
+//! \brief Flat closure environment. Holds only the variables a lambda
+//!        captured when it was created, its outer environment is always
+//!        the global environment so no intermediate frames are retained.
+//!        The captures are bindings of the environment rather than a
+//!        vector of their own, call frames chain to the closure and every
+//!        engine finds captured variables with the same lookup as locals
+class closure_c : public environment_c {
+ public:
+   //! \brief Create the closure, capturing the free variables of the
+   //!        lambda from the given environment
+   //! \param info The analysis of the lambda being closed over
+   //! \param env The environment the lambda is being created in
+   closure_c(std::shared_ptr<const lambda_info_t> info,
+             std::shared_ptr<environment_c> env);
+
+   //! \brief Retrieve the analysis of the lambda
+   const lambda_info_t &info() const { return *_info; }
+
+ private:
+   std::shared_ptr<const lambda_info_t> _info;
+};
+
+//! \brief Create the environment for a single call of a closure
+//! \param closure The closure being called
+//! \param args The evaluated arguments of the call
+extern std::shared_ptr<environment_c>
+make_frame(const std::shared_ptr<closure_c> &closure, cell_span args);
+
+//! \brief Calls one function many times over, as map and fold do. A lambda
+//!        is given one frame that is reused for each call, provided that
+//!        nothing kept hold of it and none of its variables are boxed
+class call_frame_c {
+ public:
+   //! \brief Create the call frame
+   //! \param engine The engine to call the function with
+   //! \param fn The lambda or proc to call
+   call_frame_c(engine_c &engine, cell_t fn);
+
+   //! \brief Call the function
+   //! \param args The arguments to call it with
+   cell_t call(cell_span args);
+
+ private:
+   engine_c &_engine;
+   cell_t _fn;
+   std::shared_ptr<closure_c> _closure;
+   std::shared_ptr<environment_c> _frame;
+};
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,460 @@
+#include "compiler.hpp"
+#include "closure.hpp"
+#include "environment.hpp"
+#include "native.hpp"
+#include "polaris.hpp"
+#include "sequence.hpp"
+
+#include "cell.hpp"
+#include <iostream>
+#include <vector>
+
+namespace polaris {
+
+namespace {
+
+//  The compiled body of a lambda, shared by every closure made from the
+//  same source along with the source itself. Lambdas hold it as their
+//  object so that it can be run in a frame made elsewhere, their own list
+//  is left empty
+//
+class body_c : public lambda_source_c {
+ public:
+   body_c(cell_t form, code_f code)
+       : lambda_source_c(std::move(form)), code(std::move(code)) {}
+   const code_f code;
+};
+
+//  Binds a compiled body to the closure of a lambda
+//
+void bind_body(cell_t &lambda, std::shared_ptr<body_c> body) {
+   auto closure = std::static_pointer_cast<closure_c>(lambda.env);
+   lambda.proc = [body, closure](cell_span args) -> cell_t {
+      call_depth_t counted;
+      return body->code(make_frame(closure, args));
+   };
+   lambda.obj = std::move(body);
+}
+
+//  Calls of things that are not functions fail the evaluation, the same as
+//  they do in the evaluator
+//
+cell_t reporting(const code_f &code,
+                 const std::shared_ptr<environment_c> &env) {
+   try {
+      return code(env);
+   } catch (const not_callable_c &e) {
+      env->get_error_cb()(error_level_e::FAILURE, e.what());
+   }
+   return nil;
+}
+
+} // namespace
+
+code_f compiler_c::compile(const cell_t &x) {
+   switch (x.type) {
+   case cell_type_e::SYMBOL:
+      return [name = x.val](const std::shared_ptr<environment_c> &env) {
+         return env->lookup(name);
+      };
+   case cell_type_e::LIST:
+      return compile_list(x);
+   default:
+      return [x](const std::shared_ptr<environment_c> &) { return x; };
+   }
+}
+
+cell_t compiler_c::evaluate(cell_t x, std::shared_ptr<environment_c> env) {
+   return reporting(compile(x), env);
+}
+
+code_f compiler_c::prepare(const cell_t &x) {
+   return [code = compile(x)](const std::shared_ptr<environment_c> &env) {
+      return reporting(code, env);
+   };
+}
+
+cell_t compiler_c::apply(const cell_t &fn, cell_span args) {
+
+   if (fn.type == cell_type_e::LAMBDA) {
+
+      // Lambdas made by the compiler carry their compiled body, anything else
+      // (a lambda handed over from the evaluator) gets compiled on the spot
+      //
+      if (fn.proc) {
+         return fn.proc(args);
+      }
+      call_depth_t counted;
+      return compile(lambda_source(fn).list[2])(
+          make_frame(std::static_pointer_cast<closure_c>(fn.env), args));
+
+   } else if (fn.type == cell_type_e::PROC) {
+      return fn.proc(args);
+   }
+
+   throw not_callable_c(to_string(fn));
+}
+
+cell_t compiler_c::apply_in(const cell_t &fn,
+                            const std::shared_ptr<environment_c> &frame) {
+   call_depth_t counted;
+   if (fn.proc) {
+      return std::static_pointer_cast<body_c>(fn.obj)->code(frame);
+   }
+   return compile(lambda_source(fn).list[2])(frame);
+}
+
+void compiler_c::adopt(cell_t &lambda) {
+   if (lambda.type == cell_type_e::LAMBDA && !lambda.proc) {
+      cell_t form(cell_type_e::LIST);
+      form.list = std::move(lambda.list);
+      lambda.list.clear();
+      code_f code = compile(form.list[2]);
+      bind_body(lambda, std::make_shared<body_c>(std::move(form), code));
+   }
+}
+
+code_f compiler_c::compile_list(const cell_t &x) {
+   if (x.list.empty()) {
+      return [](const std::shared_ptr<environment_c> &) { return nil; };
+   }
+
+   //  Special forms are decided here, once, rather than on every execution
+   //
+   if (x.list[0].type == cell_type_e::SYMBOL) {
+      const std::string &head = x.list[0].val;
+      if (head == "quote") {
+         return compile_quote(x);
+      } else if (head == "if") {
+         return compile_if(x);
+      } else if (head == "set!") {
+         return compile_set(x);
+      } else if (head == "define") {
+         return compile_define(x);
+      } else if (head == "lambda") {
+         return compile_lambda(x);
+      } else if (head == "begin") {
+         return compile_begin(x);
+      } else if (head == "delay") {
+         return compile_delay(x);
+      } else if (head == "let" || head == "let*") {
+         return compile_let(x);
+      } else if (head == "while") {
+         return compile_while(x);
+      } else if (head == "do") {
+         return compile_do(x);
+      }
+   }
+   return compile_call(x);
+}
+
+code_f compiler_c::compile_quote(const cell_t &x) {
+   return [value = x.list[1]](const std::shared_ptr<environment_c> &) {
+      return value;
+   };
+}
+
+code_f compiler_c::compile_if(const cell_t &x) {
+   code_f test = compile(x.list[1]);
+   code_f consequent = compile(x.list[2]);
+   if (x.list.size() < 4) {
+      return [test, consequent](const std::shared_ptr<environment_c> &env) {
+         return test(env).val == "#f" ? nil : consequent(env);
+      };
+   }
+   code_f alternative = compile(x.list[3]);
+   return [test, consequent,
+           alternative](const std::shared_ptr<environment_c> &env) {
+      return test(env).val == "#f" ? alternative(env) : consequent(env);
+   };
+}
+
+code_f compiler_c::compile_set(const cell_t &x) {
+   code_f value = compile(x.list[2]);
+   return [name = x.list[1].val,
+           value](const std::shared_ptr<environment_c> &env) {
+      return env->lookup(name) = value(env);
+   };
+}
+
+code_f compiler_c::compile_define(const cell_t &x) {
+   code_f value = compile(x.list[2]);
+   return [name = x.list[1].val,
+           value](const std::shared_ptr<environment_c> &env) {
+      return (*env)[name] = value(env);
+   };
+}
+
+code_f compiler_c::compile_lambda(const cell_t &x) {
+   // (lambda (var*) exp)
+   // The analysis, the body and the source are kept once, creating the
+   // lambda only captures its free variables and binds the compiled body
+   // to them. The source is not copied into the lambda
+   auto info = analyze_lambda(x);
+   auto body = std::make_shared<body_c>(x, compile(x.list[2]));
+
+   return [info, body, loc = x.loc](const std::shared_ptr<environment_c> &env) {
+      cell_t lambda(cell_type_e::LAMBDA);
+      lambda.loc = loc;
+      lambda.env = std::make_shared<closure_c>(info, env);
+      bind_body(lambda, body);
+      return lambda;
+   };
+}
+
+code_f compiler_c::compile_begin(const cell_t &x) {
+   // (begin exp*)
+   return compile_body(x, 1);
+}
+
+code_f compiler_c::compile_body(const cell_t &x, std::size_t first) {
+   std::vector<code_f> body;
+   for (auto i = x.list.begin() + first; i < x.list.end(); ++i) {
+      body.push_back(compile(*i));
+   }
+   return [body](const std::shared_ptr<environment_c> &env) -> cell_t {
+      if (body.empty()) {
+         return nil;
+      }
+      for (size_t i = 0; i < body.size() - 1; ++i) {
+         body[i](env);
+      }
+      return body.back()(env);
+   };
+}
+
+code_f compiler_c::compile_delay(const cell_t &x) {
+   // (delay exp)
+   code_f value = compile(x.list[1]);
+   return [value](const std::shared_ptr<environment_c> &env) {
+      return make_promise([value, env]() { return value(env); });
+   };
+}
+
+code_f compiler_c::compile_let(const cell_t &x) {
+   // (let ((var exp)*) exp*) (let* ((var exp)*) exp*)
+   if (x.list.size() > 2 && x.list[1].type == cell_type_e::SYMBOL) {
+      return compile_named_let(x);
+   }
+
+   auto info = analyze_binding_form(x);
+   bool sequential = x.list[0].val == "let*";
+   std::vector<std::string> names;
+   std::vector<code_f> inits;
+   for (auto &spec : x.list[1].list) {
+      names.push_back(spec.list[0].val);
+      inits.push_back(compile(spec.list.size() > 1 ? spec.list[1] : nil));
+   }
+   code_f body = compile_body(x, 2);
+
+   return [info, sequential, names, inits,
+           body](const std::shared_ptr<environment_c> &env) {
+      auto scope = make_scope(*info, env);
+      if (sequential) {
+         for (std::size_t i = 0; i < names.size(); ++i) {
+            scope->get(names[i]) = inits[i](scope);
+         }
+      } else {
+         arguments_c<stack_arguments> values(inits.size());
+         for (auto &init : inits) {
+            values.push_back(init(env));
+         }
+         for (std::size_t i = 0; i < names.size(); ++i) {
+            scope->get(names[i]) = values.span()[i];
+         }
+      }
+      return body(scope);
+   };
+}
+
+code_f compiler_c::compile_named_let(const cell_t &x) {
+   // (let name ((var exp)*) exp*)
+   const std::string &name = x.list[1].val;
+   std::vector<std::string> names;
+   std::vector<code_f> inits;
+   for (auto &spec : x.list[2].list) {
+      names.push_back(spec.list[0].val);
+      inits.push_back(compile(spec.list.size() > 1 ? spec.list[1] : nil));
+   }
+
+   auto shape = analyze_named_let(x);
+
+   //  A name that is only called in tail position is a loop, the variables
+   //  are updated in place and the body is run again
+   //
+   if (shape->loop) {
+      auto info = analyze_binding_form(x);
+      tail_f loop = compile_tail(shape->body, name);
+      return [info, names, inits,
+              loop](const std::shared_ptr<environment_c> &env) -> cell_t {
+         auto scope = make_scope(*info, env);
+         std::vector<cell_t *> vars;
+         for (std::size_t i = 0; i < names.size(); ++i) {
+            cell_t value = inits[i](env);
+            vars.push_back(&scope->get(names[i]));
+            *vars.back() = std::move(value);
+         }
+
+         std::vector<cell_t> next;
+         while (true) {
+            bool again = false;
+            cell_t result = loop(scope, next, again);
+            if (!again) {
+               return result;
+            }
+            for (std::size_t i = 0; i < vars.size() && i < next.size(); ++i) {
+               *vars[i] = std::move(next[i]);
+            }
+         }
+      };
+   }
+
+   //  Otherwise the name is bound to a lambda over the variables that can
+   //  be called (and captured) like any other
+   //
+   code_f make = compile_lambda(shape->lambda);
+
+   return [this, name, inits,
+           make](const std::shared_ptr<environment_c> &env) -> cell_t {
+      arguments_c<stack_arguments> args(inits.size());
+      for (auto &init : inits) {
+         args.push_back(init(env));
+      }
+      auto scope = std::make_shared<environment_c>(env);
+      auto box = std::make_shared<cell_t>(nil);
+      scope->bind_box(name, box);
+      *box = make(scope);
+      return apply(*box, args.span());
+   };
+}
+
+compiler_c::tail_f compiler_c::compile_tail(const cell_t &x,
+                                            const std::string &name) {
+   if (x.type == cell_type_e::LIST && !x.list.empty() &&
+       x.list[0].type == cell_type_e::SYMBOL) {
+      const std::string &head = x.list[0].val;
+
+      if (head == name) {
+         std::vector<code_f> args;
+         for (auto i = x.list.begin() + 1; i != x.list.end(); ++i) {
+            args.push_back(compile(*i));
+         }
+         return [args](const std::shared_ptr<environment_c> &env,
+                       std::vector<cell_t> &next, bool &again) -> cell_t {
+            next.clear();
+            for (auto &arg : args) {
+               next.push_back(arg(env));
+            }
+            again = true;
+            return nil;
+         };
+      }
+
+      if (head == "if") {
+         code_f test = compile(x.list[1]);
+         tail_f consequent = compile_tail(x.list[2], name);
+         tail_f alternative =
+             compile_tail(x.list.size() < 4 ? nil : x.list[3], name);
+         return [test, consequent,
+                 alternative](const std::shared_ptr<environment_c> &env,
+                              std::vector<cell_t> &next, bool &again) {
+            return test(env).val == "#f" ? alternative(env, next, again)
+                                         : consequent(env, next, again);
+         };
+      }
+
+      if (head == "begin" && x.list.size() > 1) {
+         std::vector<code_f> body;
+         for (std::size_t i = 1; i < x.list.size() - 1; ++i) {
+            body.push_back(compile(x.list[i]));
+         }
+         tail_f last = compile_tail(x.list.back(), name);
+         return [body, last](const std::shared_ptr<environment_c> &env,
+                             std::vector<cell_t> &next, bool &again) {
+            for (auto &exp : body) {
+               exp(env);
+            }
+            return last(env, next, again);
+         };
+      }
+   }
+
+   code_f code = compile(x);
+   return [code](const std::shared_ptr<environment_c> &env,
+                 std::vector<cell_t> &, bool &) { return code(env); };
+}
+
+code_f compiler_c::compile_while(const cell_t &x) {
+   // (while test exp*)
+   code_f test = compile(x.list[1]);
+   code_f body = compile_body(x, 2);
+   return [test, body](const std::shared_ptr<environment_c> &env) {
+      while (test(env).val != "#f") {
+         body(env);
+      }
+      return nil;
+   };
+}
+
+code_f compiler_c::compile_do(const cell_t &x) {
+   // (do ((var init step)*) (test result*) exp*)
+   auto info = analyze_binding_form(x);
+   std::vector<std::string> names;
+   std::vector<code_f> inits;
+   std::vector<code_f> steps;
+   for (auto &spec : x.list[1].list) {
+      names.push_back(spec.list[0].val);
+      inits.push_back(compile(spec.list.size() > 1 ? spec.list[1] : nil));
+      steps.push_back(spec.list.size() > 2 ? compile(spec.list[2]) : nullptr);
+   }
+   code_f test = compile(x.list[2].list[0]);
+   code_f result = compile_body(x.list[2], 1);
+   code_f body = compile_body(x, 3);
+
+   return [info, names, inits, steps, test, result,
+           body](const std::shared_ptr<environment_c> &env) {
+      auto scope = make_scope(*info, env);
+      std::vector<cell_t *> vars;
+      for (std::size_t i = 0; i < names.size(); ++i) {
+         cell_t value = inits[i](env);
+         vars.push_back(&scope->get(names[i]));
+         *vars.back() = std::move(value);
+      }
+
+      //  Every step is evaluated before any variable is updated
+      //
+      std::vector<cell_t> next(steps.size());
+      while (test(scope).val == "#f") {
+         body(scope);
+         for (std::size_t i = 0; i < steps.size(); ++i) {
+            if (steps[i]) {
+               next[i] = steps[i](scope);
+            }
+         }
+         for (std::size_t i = 0; i < steps.size(); ++i) {
+            if (steps[i]) {
+               *vars[i] = std::move(next[i]);
+            }
+         }
+      }
+      return result(scope);
+   };
+}
+
+code_f compiler_c::compile_call(const cell_t &x) {
+   code_f head = compile(x.list[0]);
+   std::vector<code_f> args;
+   for (auto i = x.list.begin() + 1; i != x.list.end(); ++i) {
+      args.push_back(compile(*i));
+   }
+   return [this, head, args](const std::shared_ptr<environment_c> &env) {
+      cell_t proc(head(env));
+      arguments_c<stack_arguments> exps(args.size());
+      for (auto &arg : args) {
+         exps.push_back(arg(env));
+      }
+      return apply(proc, exps.span());
+   };
+}
+
+} // namespace polaris
@@ -0,0 +1,73 @@
+#ifndef POLARIS_COMPILER_HPP
+#define POLARIS_COMPILER_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "engine.hpp"
+#include "fwd.hpp"
+
+namespace polaris {
+
+//! \brief Compiler - translates a cell once into a tree of pre-bound
+//!        callables that invoke their children directly. Special forms
+//!        are resolved at compile time so executing the result never
+//!        inspects cell types or copies the source tree
+class compiler_c final : public engine_c {
+ public:
+   //! \brief Compile a cell
+   //! \param x The cell to compile
+   code_f compile(const cell_t &x);
+
+   //! \brief Compile and then execute a cell given an environment
+   //! \param x The cell to evaluate
+   //! \param env The environment to use in the evaluation
+   cell_t evaluate(cell_t x, std::shared_ptr<environment_c> env) override;
+
+   //! \brief Compile a cell so it can be executed any number of times
+   //! \param x The cell to prepare
+   code_f prepare(const cell_t &x) override;
+
+   //! \brief Call a lambda or proc with already evaluated arguments
+   //! \param fn The lambda or proc to call
+   //! \param args The arguments to call it with
+   cell_t apply(const cell_t &fn, cell_span args) override;
+
+   //! \brief Call a lambda in a frame already made for it
+   //! \param lambda The lambda to call
+   //! \param frame The frame holding its arguments
+   cell_t apply_in(const cell_t &lambda,
+                   const std::shared_ptr<environment_c> &frame) override;
+
+   //! \brief Compile the body of a lambda that has none
+   //! \param lambda The lambda to compile
+   void adopt(cell_t &lambda) override;
+
+ private:
+   //  Code in tail position of a loop, a call to the loop stores the new
+   //  values of the variables and sets again instead of calling anything
+   using tail_f = std::function<cell_t(const std::shared_ptr<environment_c> &,
+                                       std::vector<cell_t> &, bool &)>;
+
+   code_f compile_list(const cell_t &x);
+   code_f compile_quote(const cell_t &x);
+   code_f compile_if(const cell_t &x);
+   code_f compile_set(const cell_t &x);
+   code_f compile_define(const cell_t &x);
+   code_f compile_lambda(const cell_t &x);
+   code_f compile_begin(const cell_t &x);
+   code_f compile_delay(const cell_t &x);
+   code_f compile_body(const cell_t &x, std::size_t first);
+   code_f compile_let(const cell_t &x);
+   code_f compile_named_let(const cell_t &x);
+   tail_f compile_tail(const cell_t &x, const std::string &name);
+   code_f compile_while(const cell_t &x);
+   code_f compile_do(const cell_t &x);
+   code_f compile_call(const cell_t &x);
+};
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,1076 @@
+#include "emit.hpp"
+#include "closure.hpp"
+#include "macro.hpp"
+#include "polaris.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace polaris {
+
+namespace {
+
+//  Thrown when a top level form uses something the translator does not
+//  handle, the form is then kept as source for the interpreter
+//
+struct untranslatable_t {};
+
+//  Loop variables are only kept as integers while they start, and are
+//  stepped, far from the limits of 64 bits. Leaving them is still checked
+//
+constexpr int64_t max_counter_init = int64_t{1} << 53;
+constexpr int64_t max_counter_step = int64_t{1} << 20;
+
+const std::unordered_map<std::string, const char *> arithmetic_ops = {
+    {"+", "polaris::arithmetic_e::ADD"},
+    {"-", "polaris::arithmetic_e::SUBTRACT"},
+    {"*", "polaris::arithmetic_e::MULTIPLY"}};
+
+const std::unordered_map<std::string, const char *> comparison_ops = {
+    {"<", "polaris::comparison_e::LESS"},
+    {"<=", "polaris::comparison_e::LESS_EQUAL"},
+    {">", "polaris::comparison_e::GREATER"},
+    {">=", "polaris::comparison_e::GREATER_EQUAL"}};
+
+//  The special forms of the evaluator, these are recognised by name before
+//  any variable is looked at
+//
+const std::unordered_set<std::string> keywords = {
+    "quote", "if",    "set!",  "define", "lambda", "delay",
+    "let",   "let*",  "while", "do",     "begin"};
+
+bool is_symbol(const cell_t &c, std::string_view name) {
+   return c.type == cell_type_e::SYMBOL && c.val == name;
+}
+
+bool is_form(const cell_t &c, std::string_view head) {
+   return c.type == cell_type_e::LIST && !c.list.empty() &&
+          is_symbol(c.list[0], head);
+}
+
+//  An integer literal that prints the same once it has been computed with,
+//  "+5" or "007" are left as cells
+//
+std::optional<int64_t> small_integer(const cell_t &c, int64_t limit) {
+   if (c.type != cell_type_e::NUMBER) {
+      return std::nullopt;
+   }
+   int64_t value = 0;
+   const char *end = c.val.data() + c.val.size();
+   auto [ptr, ec] = std::from_chars(c.val.data(), end, value);
+   if (ec != std::errc() || ptr != end || value <= -limit || value >= limit ||
+       std::to_string(value) != c.val) {
+      return std::nullopt;
+   }
+   return value;
+}
+
+std::string cpp_string(std::string_view s) {
+   static const char digits[] = "01234567";
+   std::string out = "\"";
+   for (unsigned char c : s) {
+      if (c == '"' || c == '\\') {
+         out += '\\';
+         out += static_cast<char>(c);
+      } else if (c == '\n') {
+         out += "\\n";
+      } else if (c < 0x20 || c >= 0x7f) {
+         out += '\\';
+         out += digits[c >> 6];
+         out += digits[(c >> 3) & 7];
+         out += digits[c & 7];
+      } else {
+         out += static_cast<char>(c);
+      }
+   }
+   return out + '"';
+}
+
+std::string identifier(std::string_view name) {
+   std::string out;
+   for (char c : name) {
+      out += std::isalnum(static_cast<unsigned char>(c)) != 0 ? c : '_';
+   }
+   return out;
+}
+
+//  Write a form back out as the reader would read it, strings were kept as
+//  written so they go back between quotes unchanged
+//
+std::string write(const cell_t &c) {
+   switch (c.type) {
+   case cell_type_e::LIST: {
+      std::string s = "(";
+      for (auto &item : c.list) {
+         s += (s.size() > 1 ? " " : "") + write(item);
+      }
+      return s + ')';
+   }
+   case cell_type_e::STRING:
+      return '"' + c.val + '"';
+   case cell_type_e::SYMBOL:
+      [[fallthrough]];
+   case cell_type_e::NUMBER:
+      [[fallthrough]];
+   case cell_type_e::DOUBLE:
+      return c.val;
+   default:
+      throw untranslatable_t{};
+   }
+}
+
+bool defines_macro(const cell_t &x) {
+   if (x.type != cell_type_e::LIST || is_form(x, "quote")) {
+      return false;
+   }
+   if (is_form(x, "define-syntax") || is_form(x, "define-macro")) {
+      return true;
+   }
+   return std::any_of(x.list.begin(), x.list.end(), defines_macro);
+}
+
+//  Names given a value by define or set! anywhere in an expression
+//
+void assigned_in(const cell_t &x, std::unordered_set<std::string> &names) {
+   if (x.type != cell_type_e::LIST || x.list.empty() || is_form(x, "quote")) {
+      return;
+   }
+   if ((is_form(x, "define") || is_form(x, "set!")) && x.list.size() > 1 &&
+       x.list[1].type == cell_type_e::SYMBOL) {
+      names.insert(x.list[1].val);
+   }
+   for (auto &item : x.list) {
+      assigned_in(item, names);
+   }
+}
+
+//  Names used inside a delay or, with lambdas set, inside a lambda. These
+//  are the variables that can be seen after the scope of the form moved on
+//
+void used_within(const cell_t &x, bool lambdas, bool nested,
+                 std::unordered_set<std::string> &names) {
+   if (x.type == cell_type_e::SYMBOL) {
+      if (nested) {
+         names.insert(x.val);
+      }
+      return;
+   }
+   if (x.type != cell_type_e::LIST || x.list.empty() || is_form(x, "quote")) {
+      return;
+   }
+   nested = nested || is_form(x, "delay") || (lambdas && is_form(x, "lambda"));
+   for (auto &item : x.list) {
+      used_within(item, lambdas, nested, names);
+   }
+}
+
+//  Names a define binds in the scope an expression is evaluated in, the
+//  forms that make a scope of their own keep theirs
+//
+void defines_in(const cell_t &x, std::vector<std::string> &names) {
+   if (x.type != cell_type_e::LIST || x.list.empty()) {
+      return;
+   }
+   for (const char *scope : {"quote", "lambda", "let", "let*", "do"}) {
+      if (is_form(x, scope)) {
+         return;
+      }
+   }
+   if (is_form(x, "define") && x.list.size() > 2 &&
+       x.list[1].type == cell_type_e::SYMBOL &&
+       std::find(names.begin(), names.end(), x.list[1].val) == names.end()) {
+      names.push_back(x.list[1].val);
+   }
+   for (auto &item : x.list) {
+      defines_in(item, names);
+   }
+}
+
+//  Every call of a named let that only calls itself in tail position
+//
+void calls_of(const cell_t &x, const std::string &name,
+              std::vector<const cell_t *> &calls) {
+   if (x.type != cell_type_e::LIST || x.list.empty() || is_form(x, "quote")) {
+      return;
+   }
+   if (is_symbol(x.list[0], name)) {
+      calls.push_back(&x);
+   }
+   for (auto &item : x.list) {
+      calls_of(item, name, calls);
+   }
+}
+
+//  Indent by braces, the generated code has no braces inside strings other
+//  than escaped ones on a single line
+//
+std::string indent(const std::string &code) {
+   std::string out;
+   int depth = 0;
+   std::size_t at = 0;
+   while (at < code.size()) {
+      std::size_t end = code.find('\n', at);
+      std::string_view line(code.data() + at, end - at);
+      at = end + 1;
+
+      int opens = 0;
+      int closes = 0;
+      int leading = 0;
+      bool in_str = false;
+      for (std::size_t i = 0; i < line.size(); i++) {
+         char c = line[i];
+         if (in_str) {
+            if (c == '\\') {
+               i++;
+            } else if (c == '"') {
+               in_str = false;
+            }
+         } else if (c == '"') {
+            in_str = true;
+         } else if (c == '{') {
+            opens++;
+         } else if (c == '}') {
+            leading += opens == 0 && closes == leading ? 1 : 0;
+            closes++;
+         }
+      }
+      if (!line.empty()) {
+         out.append(3 * std::max(depth - leading, 0), ' ');
+      }
+      out += line;
+      out += '\n';
+      depth += opens - closes;
+   }
+   return out;
+}
+
+class emitter_c {
+ public:
+   emitter_c(std::shared_ptr<environment_c> env, engine_c &engine,
+             const cells &forms)
+       : _env(std::move(env)), _engine(engine) {
+      for (auto &form : forms) {
+         assigned_in(form, _redefined);
+      }
+   }
+
+   //  Translate a top level form to a function of its own
+   //
+   void form(const cell_t &x) {
+      std::string body;
+      cell_t expanded = expand_macros(x, _env, _engine);
+
+      //  Macros are defined again when the program runs, forms that follow
+      //  and are not translated need them
+      //
+      if (!defines_macro(x)) {
+         _scopes.clear();
+         _delayed.clear();
+         used_within(expanded, false, false, _delayed);
+         try {
+            body = "return " + expr(expanded) + ";\n";
+         } catch (const untranslatable_t &) {
+            body.clear();
+         }
+      }
+      if (body.empty()) {
+         body = "return program->evaluate(" + cpp_string(write(x)) + ");\n";
+      }
+      _functions += "polaris::cell_t form_" + std::to_string(_forms++) +
+                    "() {\n" + body + "}\n\n";
+   }
+
+   void output(std::ostream &out, const std::string &name) const {
+      std::string main = "int main(int argc, char **argv) {\n"
+                         "polaris::emitted::program_c running(argc, argv);\n"
+                         "program = &running;\n"
+                         "env = running.env();\n";
+      for (std::size_t i = 0; i < _forms; i++) {
+         main += "form_" + std::to_string(i) + "();\n";
+      }
+      main += "return running.finish();\n}\n";
+
+      out << "//  Translated from " << name << " by polaris --emit-cpp\n//\n"
+          << "#include \"polaris/emitted.hpp\"\n"
+          << "#include \"polaris/polaris.hpp\"\n\n"
+          << "#include <array>\n#include <cstdint>\n#include <memory>\n\n"
+          << "namespace {\n\n"
+          << "std::shared_ptr<polaris::environment_c> env;\n"
+          << "polaris::emitted::program_c *program = nullptr;\n\n"
+          << _declarations << "\n"
+          << indent(_functions) << "} // namespace\n\n"
+          << indent(main);
+   }
+
+ private:
+   enum class kind_e { CELL, BOX, INT };
+
+   struct var_t {
+      std::string cpp;
+      kind_e kind;
+   };
+
+   using scope_t = std::unordered_map<std::string, var_t>;
+
+   //  A named let translated to a loop, calls of the name assign the
+   //  variables and go around again
+   //
+   struct loop_t {
+      std::string name;
+      std::vector<std::string> vars;
+   };
+
+   std::shared_ptr<environment_c> _env;
+   engine_c &_engine;
+
+   //  Globals the program defines or assigns, the builtins among them are
+   //  always called
+   //
+   std::unordered_set<std::string> _redefined;
+
+   //  Names used inside a delay in the current form, a promise sees the
+   //  variables as they are when it is forced so these are boxed
+   //
+   std::unordered_set<std::string> _delayed;
+
+   std::vector<scope_t> _scopes;
+   std::unordered_map<std::string, std::string> _constants;
+   std::unordered_map<std::string, std::string> _globals;
+   std::string _declarations;
+   std::string _functions;
+   std::size_t _forms{0};
+   std::size_t _names{0};
+
+   std::string fresh(const char *prefix, std::string_view name = {}) {
+      std::string s = prefix + std::to_string(_names++);
+      return name.empty() ? s : s + '_' + identifier(name);
+   }
+
+   const var_t *local(const std::string &name) const {
+      for (auto scope = _scopes.rbegin(); scope != _scopes.rend(); ++scope) {
+         auto it = scope->find(name);
+         if (it != scope->end()) {
+            return &it->second;
+         }
+      }
+      return nullptr;
+   }
+
+   //  A builtin the program never redefines, calls of it with two arguments
+   //  are computed in place while it still holds the builtin
+   //
+   bool inlinable(const cell_t &head) const {
+      return head.type == cell_type_e::SYMBOL && !keywords.contains(head.val) &&
+             !local(head.val) && !_redefined.contains(head.val);
+   }
+
+   std::string global(const std::string &name) {
+      auto [it, inserted] = _globals.try_emplace(name);
+      if (inserted) {
+         it->second = fresh("g", name);
+         _declarations += "polaris::emitted::global_c " + it->second +
+                          "(env, " + cpp_string(name) + ");\n";
+      }
+      return it->second;
+   }
+
+   std::string ref(const std::string &name) {
+      const var_t *var = local(name);
+      if (!var) {
+         return global(name) + ".get()";
+      }
+      switch (var->kind) {
+      case kind_e::BOX:
+         return "(*" + var->cpp + ")";
+      case kind_e::INT:
+         return "polaris::emitted::integer(" + var->cpp + ")";
+      default:
+         return var->cpp;
+      }
+   }
+
+   std::string assign(const var_t &var, const std::string &value) {
+      switch (var.kind) {
+      case kind_e::BOX:
+         return "(*" + var.cpp + " = " + value + ")";
+      case kind_e::CELL:
+         return "(" + var.cpp + " = " + value + ")";
+      default:
+         throw untranslatable_t{};
+      }
+   }
+
+   //  Declare a variable in the innermost scope
+   //
+   std::string declare(const std::string &name, const lambda_info_t &info,
+                       const std::string &value) {
+      if (_scopes.back().contains(name)) {
+         throw untranslatable_t{};
+      }
+      std::string cpp = fresh("v", name);
+      if (info.boxed.contains(name) || _delayed.contains(name)) {
+         _scopes.back()[name] = {cpp, kind_e::BOX};
+         return "auto " + cpp + " = std::make_shared<polaris::cell_t>(" +
+                value + ");\n";
+      }
+      _scopes.back()[name] = {cpp, kind_e::CELL};
+      return "polaris::cell_t " + cpp + " = " + value + ";\n";
+   }
+
+   std::string declare_int(const std::string &name, int64_t value) {
+      if (_scopes.back().contains(name)) {
+         throw untranslatable_t{};
+      }
+      std::string cpp = fresh("v", name);
+      _scopes.back()[name] = {cpp, kind_e::INT};
+      return "int64_t " + cpp + " = " + std::to_string(value) + ";\n";
+   }
+
+   std::string declare_defines(const std::vector<std::string> &names,
+                               const lambda_info_t &info) {
+      std::string code;
+      for (auto &name : names) {
+         if (!_scopes.back().contains(name)) {
+            code += declare(name, info, "polaris::nil");
+         }
+      }
+      return code;
+   }
+
+   std::string constant(const cell_t &c) {
+      const char *type = nullptr;
+      switch (c.type) {
+      case cell_type_e::SYMBOL:
+         type = "SYMBOL";
+         break;
+      case cell_type_e::NUMBER:
+         type = "NUMBER";
+         break;
+      case cell_type_e::DOUBLE:
+         type = "DOUBLE";
+         break;
+      case cell_type_e::STRING:
+         type = "STRING";
+         break;
+      default:
+         throw untranslatable_t{};
+      }
+      auto [it, inserted] =
+          _constants.try_emplace(std::string(type) + ':' + c.val);
+      if (inserted) {
+         it->second = fresh("k");
+         _declarations += "const polaris::cell_t " + it->second +
+                          "(polaris::cell_type_e::" + type + ", " +
+                          cpp_string(c.val) + ");\n";
+      }
+      return it->second;
+   }
+
+   std::string datum(const cell_t &c) {
+      if (c.type != cell_type_e::LIST) {
+         return constant(c);
+      }
+      std::string items;
+      for (auto &item : c.list) {
+         items += (items.empty() ? "" : ", ") + datum(item);
+      }
+      auto [it, inserted] = _constants.try_emplace("(" + items + ")");
+      if (inserted) {
+         it->second = fresh("k");
+         _declarations += "const polaris::cell_t " + it->second +
+                          " = polaris::emitted::list({" + items + "});\n";
+      }
+      return it->second;
+   }
+
+   //  Operands of the inlined arithmetic, integers stay integers
+   //
+   std::string operand(const cell_t &x) {
+      if (x.type == cell_type_e::SYMBOL) {
+         const var_t *var = local(x.val);
+         if (var && var->kind == kind_e::INT) {
+            return var->cpp;
+         }
+      }
+      if (auto value = small_integer(x, max_counter_init)) {
+         return "int64_t{" + x.val + "}";
+      }
+      return expr(x);
+   }
+
+   //  A step of a loop variable, (+ var k), (+ k var) or (- var k)
+   //
+   std::optional<std::pair<const char *, int64_t>>
+   step_of(const cell_t &x, const std::string &var) const {
+      if (x.type != cell_type_e::LIST || x.list.size() != 3 ||
+          !inlinable(x.list[0])) {
+         return std::nullopt;
+      }
+      const std::string &op = x.list[0].val;
+      std::optional<int64_t> by;
+      if (op == "+" && is_symbol(x.list[1], var)) {
+         by = small_integer(x.list[2], max_counter_step);
+      } else if (op == "+" && is_symbol(x.list[2], var)) {
+         by = small_integer(x.list[1], max_counter_step);
+      } else if (op == "-" && is_symbol(x.list[1], var)) {
+         by = small_integer(x.list[2], max_counter_step);
+      }
+      if (!by) {
+         return std::nullopt;
+      }
+      return std::make_pair(arithmetic_ops.at(op), *by);
+   }
+
+   //  Whether a binding form keeps a variable as an integer. It has to
+   //  start at an integer, only be stepped by a small integer and not be
+   //  seen by a lambda or a delay, or changed by anything but its steps
+   //
+   bool counter(const cell_t &form, const std::string &var,
+                const cell_t *init, const std::vector<const cell_t *> &steps) {
+      std::unordered_set<std::string> captured;
+      std::unordered_set<std::string> assigned;
+      used_within(form, true, false, captured);
+      assigned_in(form, assigned);
+      if (!init || !small_integer(*init, max_counter_init) ||
+          captured.contains(var) || assigned.contains(var)) {
+         return false;
+      }
+      return std::all_of(steps.begin(), steps.end(), [&](const cell_t *s) {
+         return is_symbol(*s, var) || step_of(*s, var).has_value();
+      });
+   }
+
+   //  The value of a stepped integer variable, as a C++ expression
+   //
+   std::string stepped(const cell_t &x, const std::string &name,
+                       const var_t &var) {
+      if (is_symbol(x, name)) {
+         return var.cpp;
+      }
+      auto [op, by] = *step_of(x, name);
+      return "polaris::emitted::step(" + global(x.list[0].val) + ", " + op +
+             ", " + var.cpp + ", " + std::to_string(by) + ")";
+   }
+
+   //  Whether an expression is not false, comparisons are computed in
+   //  place without making #t or #f
+   //
+   std::string test(const cell_t &x) {
+      if (x.type == cell_type_e::LIST && x.list.size() == 3 &&
+          inlinable(x.list[0])) {
+         const std::string &head = x.list[0].val;
+         auto op = comparison_ops.find(head);
+         if (op != comparison_ops.end()) {
+            return "polaris::emitted::test(" + global(head) + ", " +
+                   op->second + ", " + operand(x.list[1]) + ", " +
+                   operand(x.list[2]) + ")";
+         }
+         if (head == "eq") {
+            return "polaris::emitted::test_eq(" + global(head) + ", " +
+                   operand(x.list[1]) + ", " + operand(x.list[2]) + ")";
+         }
+      }
+      return "!polaris::emitted::is_false(" + expr(x) + ")";
+   }
+
+   std::string statements(const cell_t &x, std::size_t first,
+                          std::size_t last) {
+      std::string code;
+      for (std::size_t i = first; i < last; i++) {
+         code += "(void)" + expr(x.list[i]) + ";\n";
+      }
+      return code;
+   }
+
+   //  The statements of a body, returning the value of the last
+   //
+   std::string body(const cell_t &x, std::size_t first) {
+      if (first >= x.list.size()) {
+         return "return polaris::nil;\n";
+      }
+      return statements(x, first, x.list.size() - 1) + "return " +
+             expr(x.list.back()) + ";\n";
+   }
+
+   std::string expr(const cell_t &x) {
+      switch (x.type) {
+      case cell_type_e::SYMBOL:
+         return ref(x.val);
+      case cell_type_e::NUMBER:
+         [[fallthrough]];
+      case cell_type_e::DOUBLE:
+         [[fallthrough]];
+      case cell_type_e::STRING:
+         return constant(x);
+      case cell_type_e::LIST:
+         break;
+      default:
+         throw untranslatable_t{};
+      }
+      if (x.list.empty()) {
+         return "polaris::nil";
+      }
+      const cell_t &head = x.list[0];
+      if (head.type == cell_type_e::SYMBOL && keywords.contains(head.val)) {
+         return special(x);
+      }
+      return call(x);
+   }
+
+   std::string special(const cell_t &x) {
+      const std::string &head = x.list[0].val;
+      std::size_t size = x.list.size();
+      if (head == "quote" && size > 1) {
+         return datum(x.list[1]);
+      }
+      if (head == "if" && size > 2) {
+         return "(" + test(x.list[1]) + " ? polaris::cell_t(" +
+                expr(x.list[2]) + ") : polaris::cell_t(" +
+                (size > 3 ? expr(x.list[3]) : "polaris::nil") + "))";
+      }
+      if ((head == "set!" || head == "define") && size > 2 &&
+          x.list[1].type == cell_type_e::SYMBOL) {
+         return assignment(x);
+      }
+      if (head == "lambda") {
+         return lambda(x);
+      }
+      if (head == "delay" && size > 1) {
+         return "polaris::make_promise([=]() mutable -> polaris::cell_t {\n"
+                "return " +
+                expr(x.list[1]) + ";\n})";
+      }
+      if (head == "let" && size > 2 &&
+          x.list[1].type == cell_type_e::SYMBOL) {
+         return named_let(x);
+      }
+      if (head == "let" || head == "let*") {
+         return let(x);
+      }
+      if (head == "while" && size > 1) {
+         return "[&]() -> polaris::cell_t {\nwhile (" + test(x.list[1]) +
+                ") {\n" + statements(x, 2, size) +
+                "}\nreturn polaris::nil;\n}()";
+      }
+      if (head == "do") {
+         return loop(x);
+      }
+      if (head == "begin" && size > 1) {
+         return "[&]() -> polaris::cell_t {\n" + body(x, 1) + "}()";
+      }
+      throw untranslatable_t{};
+   }
+
+   //  set! assigns the nearest binding, define binds in the current scope
+   //  which for translated code was declared when the scope was entered
+   //
+   std::string assignment(const cell_t &x) {
+      const std::string &name = x.list[1].val;
+      std::string value = expr(x.list[2]);
+      if (x.list[0].val == "define") {
+         if (_scopes.empty()) {
+            return global(name) + ".define(" + value + ")";
+         }
+         auto it = _scopes.back().find(name);
+         if (it == _scopes.back().end()) {
+            throw untranslatable_t{};
+         }
+         return assign(it->second, value);
+      }
+      if (const var_t *var = local(name)) {
+         return assign(*var, value);
+      }
+      return global(name) + ".set(" + value + ")";
+   }
+
+   std::string call(const cell_t &x) {
+      const cell_t &head = x.list[0];
+      if (x.list.size() == 3 && inlinable(head)) {
+         if (auto op = arithmetic_ops.find(head.val);
+             op != arithmetic_ops.end()) {
+            return "polaris::emitted::arithmetic(" + global(head.val) + ", " +
+                   op->second + ", " + operand(x.list[1]) + ", " +
+                   operand(x.list[2]) + ")";
+         }
+         if (auto op = comparison_ops.find(head.val);
+             op != comparison_ops.end()) {
+            return "polaris::emitted::compare(" + global(head.val) + ", " +
+                   op->second + ", " + operand(x.list[1]) + ", " +
+                   operand(x.list[2]) + ")";
+         }
+         if (head.val == "eq") {
+            return "polaris::emitted::equal(" + global(head.val) + ", " +
+                   operand(x.list[1]) + ", " + operand(x.list[2]) + ")";
+         }
+      }
+
+      //  The function is evaluated before its arguments, and the braces
+      //  evaluate the arguments left to right
+      //
+      std::string fn = expr(head);
+      std::string args = "polaris::cell_span()";
+      if (x.list.size() > 1) {
+         args = "std::array<polaris::cell_t, " +
+                std::to_string(x.list.size() - 1) + ">{";
+         for (std::size_t i = 1; i < x.list.size(); i++) {
+            args += (i > 1 ? ", " : "") + expr(x.list[i]);
+         }
+         args += "}";
+      }
+      if (head.type == cell_type_e::SYMBOL) {
+         return "polaris::emitted::call(" + fn + ", " + args + ")";
+      }
+      return "[&]() -> polaris::cell_t {\npolaris::cell_t fn = " + fn +
+             ";\nreturn polaris::emitted::call(fn, " + args + ");\n}()";
+   }
+
+   std::string lambda(const cell_t &x) {
+      if (x.list.size() < 3 || x.list[1].type != cell_type_e::LIST) {
+         throw untranslatable_t{};
+      }
+      auto info = analyze_lambda(x);
+      std::vector<std::string> defined;
+      defines_in(x.list[2], defined);
+
+      std::string code = "polaris::emitted::lambda([=](polaris::cell_span "
+                         "args) mutable -> polaris::cell_t {\n";
+      _scopes.emplace_back();
+      const cells &params = x.list[1].list;
+      for (std::size_t i = 0; i < params.size(); i++) {
+         if (params[i].type != cell_type_e::SYMBOL) {
+            throw untranslatable_t{};
+         }
+         code += declare(params[i].val, *info,
+                         "polaris::emitted::arg(args, " + std::to_string(i) +
+                             ")");
+      }
+      code += declare_defines(defined, *info);
+      code += "return " + expr(x.list[2]) + ";\n})";
+      _scopes.pop_back();
+      return code;
+   }
+
+   static void check_specs(const cell_t &specs) {
+      if (specs.type != cell_type_e::LIST) {
+         throw untranslatable_t{};
+      }
+      for (auto &spec : specs.list) {
+         if (spec.type != cell_type_e::LIST || spec.list.empty() ||
+             spec.list[0].type != cell_type_e::SYMBOL) {
+            throw untranslatable_t{};
+         }
+      }
+   }
+
+   //  The values of the variables of let, do and named let, evaluated
+   //  before the scope is entered
+   //
+   std::string inits(const cells &specs, std::vector<std::string> &values,
+                     const std::vector<bool> &ints = {}) {
+      std::string code;
+      for (std::size_t i = 0; i < specs.size(); i++) {
+         const cell_t &spec = specs[i];
+         if (i < ints.size() && ints[i]) {
+            values.emplace_back();
+            continue;
+         }
+         std::string t = fresh("t");
+         code += "polaris::cell_t " + t + " = " +
+                 (spec.list.size() > 1 ? expr(spec.list[1]) : "polaris::nil") +
+                 ";\n";
+         values.push_back("std::move(" + t + ")");
+      }
+      return code;
+   }
+
+   std::string let(const cell_t &x) {
+      if (x.list.size() < 2) {
+         throw untranslatable_t{};
+      }
+      check_specs(x.list[1]);
+      const cells &specs = x.list[1].list;
+      bool sequential = x.list[0].val == "let*";
+      auto info = analyze_binding_form(x);
+
+      std::vector<std::string> defined;
+      if (sequential) {
+         for (auto &spec : specs) {
+            if (spec.list.size() > 1) {
+               defines_in(spec.list[1], defined);
+            }
+         }
+      }
+      for (std::size_t i = 2; i < x.list.size(); i++) {
+         defines_in(x.list[i], defined);
+      }
+
+      std::string code = "[&]() -> polaris::cell_t {\n";
+      std::vector<std::string> values;
+      if (!sequential) {
+         code += inits(specs, values);
+      }
+
+      //  Boxes exist before any value is bound, as they do for the
+      //  interpreter
+      //
+      _scopes.emplace_back();
+      for (auto &spec : specs) {
+         const std::string &name = spec.list[0].val;
+         if (info->boxed.contains(name) || _delayed.contains(name)) {
+            code += declare(name, *info, "polaris::nil");
+         }
+      }
+      code += declare_defines(defined, *info);
+      for (std::size_t i = 0; i < specs.size(); i++) {
+         const std::string &name = specs[i].list[0].val;
+         std::string value =
+             !sequential ? values[i]
+             : specs[i].list.size() > 1 ? expr(specs[i].list[1])
+                                        : "polaris::nil";
+         auto it = _scopes.back().find(name);
+         if (it != _scopes.back().end()) {
+            code += "(void)" + assign(it->second, value) + ";\n";
+         } else {
+            code += declare(name, *info, value);
+         }
+      }
+      code += body(x, 2) + "}()";
+      _scopes.pop_back();
+      return code;
+   }
+
+   //  (do ((var init step)*) (test result*) exp*)
+   //
+   std::string loop(const cell_t &x) {
+      if (x.list.size() < 3 || x.list[2].type != cell_type_e::LIST ||
+          x.list[2].list.empty()) {
+         throw untranslatable_t{};
+      }
+      check_specs(x.list[1]);
+      const cells &specs = x.list[1].list;
+      const cell_t &exit = x.list[2];
+      auto info = analyze_binding_form(x);
+
+      std::vector<std::string> defined;
+      for (auto &spec : specs) {
+         if (spec.list.size() > 2) {
+            defines_in(spec.list[2], defined);
+         }
+      }
+      defines_in(exit, defined);
+      for (std::size_t i = 3; i < x.list.size(); i++) {
+         defines_in(x.list[i], defined);
+      }
+
+      std::vector<bool> ints;
+      for (auto &spec : specs) {
+         std::vector<const cell_t *> steps;
+         if (spec.list.size() > 2) {
+            steps.push_back(&spec.list[2]);
+         }
+         ints.push_back(counter(x, spec.list[0].val,
+                                spec.list.size() > 1 ? &spec.list[1] : nullptr,
+                                steps));
+      }
+
+      std::string code = "[&]() -> polaris::cell_t {\n";
+      std::vector<std::string> values;
+      code += inits(specs, values, ints);
+      _scopes.emplace_back();
+      for (std::size_t i = 0; i < specs.size(); i++) {
+         code += ints[i] ? declare_int(specs[i].list[0].val,
+                                       *small_integer(specs[i].list[1],
+                                                      max_counter_init))
+                         : declare(specs[i].list[0].val, *info, values[i]);
+      }
+      code += declare_defines(defined, *info);
+
+      //  Every step is evaluated before any variable is updated
+      //
+      code += "while (!(" + test(exit.list[0]) + ")) {\n" +
+              statements(x, 3, x.list.size());
+      std::string update;
+      for (std::size_t i = 0; i < specs.size(); i++) {
+         if (specs[i].list.size() < 3) {
+            continue;
+         }
+         const std::string &name = specs[i].list[0].val;
+         const var_t &var = _scopes.back().at(name);
+         std::string s = fresh("s");
+         if (ints[i]) {
+            code += "int64_t " + s + " = " +
+                    stepped(specs[i].list[2], name, var) + ";\n";
+            update += var.cpp + " = " + s + ";\n";
+         } else {
+            code += "polaris::cell_t " + s + " = " +
+                    expr(specs[i].list[2]) + ";\n";
+            update += "(void)" + assign(var, "std::move(" + s + ")") + ";\n";
+         }
+      }
+      code += update + "}\n" + body(exit, 1) + "}()";
+      _scopes.pop_back();
+      return code;
+   }
+
+   //  (let name ((var exp)*) exp*)
+   //
+   std::string named_let(const cell_t &x) {
+      if (x.list.size() < 4) {
+         throw untranslatable_t{};
+      }
+      check_specs(x.list[2]);
+      const std::string &name = x.list[1].val;
+      const cells &specs = x.list[2].list;
+
+      cell_t body(cell_type_e::LIST);
+      body.list.push_back(cell_t(cell_type_e::SYMBOL, "begin"));
+      body.list.insert(body.list.end(), x.list.begin() + 3, x.list.end());
+
+      std::string code = "[&]() -> polaris::cell_t {\n";
+      std::vector<std::string> values;
+
+      //  A name that is only called in tail position is a loop, as it is
+      //  for the interpreter
+      //
+      if (only_tail_calls(body, name)) {
+         auto info = analyze_binding_form(x);
+         std::vector<const cell_t *> calls;
+         calls_of(body, name, calls);
+         std::vector<std::string> defined;
+         defines_in(body, defined);
+
+         loop_t loop{name, {}};
+         std::vector<bool> ints;
+         for (std::size_t i = 0; i < specs.size(); i++) {
+            std::vector<const cell_t *> steps;
+            for (auto c : calls) {
+               if (i + 1 < c->list.size()) {
+                  steps.push_back(&c->list[i + 1]);
+               }
+            }
+            ints.push_back(counter(x, specs[i].list[0].val,
+                                   specs[i].list.size() > 1 ? &specs[i].list[1]
+                                                            : nullptr,
+                                   steps));
+         }
+
+         code += inits(specs, values, ints);
+         _scopes.emplace_back();
+         for (std::size_t i = 0; i < specs.size(); i++) {
+            const std::string &var = specs[i].list[0].val;
+            code += ints[i] ? declare_int(var, *small_integer(
+                                                   specs[i].list[1],
+                                                   max_counter_init))
+                            : declare(var, *info, values[i]);
+            loop.vars.push_back(var);
+         }
+         code += declare_defines(defined, *info);
+         code += "while (true) {\n" + tail(body, loop) + "}\n}()";
+         _scopes.pop_back();
+         return code;
+      }
+
+      //  Otherwise the name is bound to a lambda over the variables
+      //
+      cell_t fn(cell_type_e::LIST);
+      fn.list.push_back(cell_t(cell_type_e::SYMBOL, "lambda"));
+      fn.list.push_back(cell_t(cell_type_e::LIST));
+      for (auto &spec : specs) {
+         fn.list[1].list.push_back(spec.list[0]);
+      }
+      fn.list.push_back(body);
+
+      code += inits(specs, values);
+      _scopes.emplace_back();
+      std::string box = fresh("v", name);
+      _scopes.back()[name] = {box, kind_e::BOX};
+      code += "auto " + box + " = polaris::emitted::box();\n*" + box + " = " +
+              lambda(fn) + ";\n";
+      std::string args = "polaris::cell_span()";
+      if (!values.empty()) {
+         args = "std::array<polaris::cell_t, " + std::to_string(values.size()) +
+                ">{";
+         for (std::size_t i = 0; i < values.size(); i++) {
+            args += (i ? ", " : "") + values[i];
+         }
+         args += "}";
+      }
+      code += "return polaris::emitted::call(*" + box + ", " + args +
+              ");\n}()";
+      _scopes.pop_back();
+      return code;
+   }
+
+   //  The body of a named let loop, a call of the name evaluates every
+   //  argument then assigns the variables and goes around again
+   //
+   std::string tail(const cell_t &x, const loop_t &loop) {
+      if (x.type != cell_type_e::LIST || x.list.empty() ||
+          x.list[0].type != cell_type_e::SYMBOL) {
+         return "return " + expr(x) + ";\n";
+      }
+      const std::string &head = x.list[0].val;
+      if (head == loop.name) {
+         std::string code = "{\n";
+         std::string update;
+         for (std::size_t i = 1; i < x.list.size(); i++) {
+            if (i > loop.vars.size()) {
+               code += "(void)" + expr(x.list[i]) + ";\n";
+               continue;
+            }
+            const std::string &name = loop.vars[i - 1];
+            const var_t &var = _scopes.back().at(name);
+            std::string s = fresh("s");
+            if (var.kind == kind_e::INT) {
+               code += "int64_t " + s + " = " + stepped(x.list[i], name, var) +
+                       ";\n";
+               update += var.cpp + " = " + s + ";\n";
+            } else {
+               code += "polaris::cell_t " + s + " = " + expr(x.list[i]) +
+                       ";\n";
+               update +=
+                   "(void)" + assign(var, "std::move(" + s + ")") + ";\n";
+            }
+         }
+         return code + update + "continue;\n}\n";
+      }
+      if (head == "if" && x.list.size() > 2) {
+         return "if (" + test(x.list[1]) + ") {\n" + tail(x.list[2], loop) +
+                "} else {\n" +
+                (x.list.size() > 3 ? tail(x.list[3], loop)
+                                   : "return polaris::nil;\n") +
+                "}\n";
+      }
+      if (head == "begin" && x.list.size() > 1) {
+         return statements(x, 1, x.list.size() - 1) +
+                tail(x.list.back(), loop);
+      }
+      return "return " + expr(x) + ";\n";
+   }
+};
+
+} // namespace
+
+bool emit_cpp(std::string_view source, const std::string &name,
+              std::ostream &out, std::shared_ptr<environment_c> env,
+              engine_c &engine) {
+   cells forms;
+   if (!read_all(source, forms)) {
+      return false;
+   }
+   emitter_c emitter(env, engine, forms);
+   for (auto &form : forms) {
+      emitter.form(form);
+   }
+   emitter.output(out, name);
+   return true;
+}
+
+} // namespace polaris
@@ -0,0 +1,35 @@
+#ifndef POLARIS_EMIT_HPP
+#define POLARIS_EMIT_HPP
+
+#include "fwd.hpp"
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace polaris {
+
+//! \brief Translate a program to a C++ source file with a main that runs
+//!        it, see emitted.hpp for the runtime it is written against. Each
+//!        top level form becomes a function. Lambdas become C++ lambdas,
+//!        variables become C++ variables and globals are found once rather
+//!        than on every use. Loop variables that start at an integer and
+//!        are only stepped by one are kept as 64 bit integers, and two
+//!        argument arithmetic and comparisons are computed in place while
+//!        the builtins have not been redefined. Macros are expanded first.
+//!        A form that can not be translated is kept as source and
+//!        evaluated by the interpreter when the program reaches it
+//! \param source The program
+//! \param name The name of the program, for the comment at the top
+//! \param out The stream to write the C++ source to
+//! \param env The global environment macros are expanded in
+//! \param engine The engine procedural macros are called with
+//! \returns false if the program could not be read
+extern bool emit_cpp(std::string_view source, const std::string &name,
+                     std::ostream &out, std::shared_ptr<environment_c> env,
+                     engine_c &engine);
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,113 @@
+#include "emitted.hpp"
+#include "error.hpp"
+#include "polaris.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+
+namespace polaris::emitted {
+
+namespace {
+
+void error_callback(error_level_e level, const char *message) {
+   switch (level) {
+   case error_level_e::FAILURE:
+      std::cout << "[failure]: " << message << std::endl;
+      break;
+   case error_level_e::FATAL:
+      std::cout << "[fatal]: " << message << std::endl;
+      std::exit(1);
+      break;
+   }
+}
+
+//  The program being run, translated code has no other way to reach it
+//
+program_c *running = nullptr;
+
+} // namespace
+
+program_c::program_c(int argc, char **argv)
+    : _env(std::make_shared<environment_c>(error_callback)) {
+
+   std::vector<std::string> include_dirs;
+   if (const char *home = std::getenv("HOME")) {
+      std::filesystem::path dir(home);
+      dir /= ".polaris";
+      dir /= "stdlib";
+      if (std::filesystem::is_directory(dir)) {
+         include_dirs.push_back(dir);
+      }
+   }
+   for (int i = 1; i + 1 < argc; i++) {
+      std::string option = argv[i];
+      if (option == "-i" || option == "--include") {
+         std::string item;
+         std::istringstream ss(argv[++i]);
+         while (std::getline(ss, item, ':')) {
+            include_dirs.emplace_back(item);
+         }
+      }
+   }
+
+   _imports = std::make_unique<imports_c>(_engine, _env, include_dirs);
+   add_globals(_env, *_imports);
+   add_async_globals(_env, _engine, _loop);
+   _actors = std::make_unique<actors_c>(include_dirs);
+   add_actor_globals(_env, _engine, *_actors);
+   running = this;
+}
+
+cell_t program_c::evaluate(std::string_view source) {
+   return evaluate_all(_engine, source, _env);
+}
+
+int program_c::finish() {
+   _loop.run();
+   _actors->join();
+   return 0;
+}
+
+cell_t call(const cell_t &fn, cell_span args) {
+   if (fn.type == cell_type_e::PROC) {
+      return fn.proc(args);
+   }
+
+   //  Lambdas made by the interpreter, from an import or an untranslated
+   //  form, are called through it
+   //
+   if (fn.type == cell_type_e::LAMBDA) {
+      return running->_engine.apply(fn, args);
+   }
+   running->env()->get_error_cb()(error_level_e::FAILURE,
+                                  not_callable_c(to_string(fn)).what());
+   return nil;
+}
+
+int64_t step(global_c &g, arithmetic_e op, int64_t value, int64_t by) {
+   int64_t result = 0;
+   if (g.builtin()) {
+      bool overflow = op == arithmetic_e::ADD
+                          ? __builtin_add_overflow(value, by, &result)
+                          : __builtin_sub_overflow(value, by, &result);
+      if (!overflow) {
+         return result;
+      }
+   } else if (auto stepped = as_int(call(
+                  g.get(), std::array<cell_t, 2>{integer(value),
+                                                 integer(by)}))) {
+      return *stepped;
+   }
+
+   //  Only reachable by stepping a counter out of 64 bits or by redefining
+   //  the arithmetic to return something else
+   //
+   running->env()->get_error_cb()(
+       error_level_e::FATAL,
+       "A loop variable of translated code is no longer a 64 bit integer");
+   std::exit(1);
+}
+
+} // namespace polaris::emitted
@@ -0,0 +1,262 @@
+#ifndef POLARIS_EMITTED_HPP
+#define POLARIS_EMITTED_HPP
+
+#include "actor.hpp"
+#include "async.hpp"
+#include "cell.hpp"
+#include "compiler.hpp"
+#include "environment.hpp"
+#include "imports.hpp"
+#include "number.hpp"
+
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+//! \brief Runtime for programs translated to C++ by `polaris --emit-cpp`.
+//!        Generated code is written against this and nothing else
+namespace polaris::emitted {
+
+//! \brief The interpreter a translated program runs in. Builtins, imports
+//!        and any form that could not be translated use it, set up the same
+//!        way the polaris executable sets up for running a file
+class program_c {
+ public:
+   //! \brief Set up the interpreter
+   //! \param argc Arguments of the program, `-i dir:dir` adds include
+   //!        directories as it does for polaris
+   //! \param argv Arguments of the program
+   program_c(int argc, char **argv);
+
+   //! \brief Retrieve the global environment
+   std::shared_ptr<environment_c> env() const { return _env; }
+
+   //! \brief Evaluate source that was left untranslated
+   cell_t evaluate(std::string_view source);
+
+   //! \brief Run what was spawned and never awaited and wait for the actors
+   //! \returns The exit code of the program
+   int finish();
+
+ private:
+   friend cell_t call(const cell_t &fn, cell_span args);
+
+   compiler_c _engine;
+   std::shared_ptr<environment_c> _env;
+   loop_c _loop;
+   std::unique_ptr<imports_c> _imports;
+   std::unique_ptr<actors_c> _actors;
+};
+
+//! \brief A global variable. The binding is found on first use and kept,
+//!        bindings of the global environment never move
+class global_c {
+ public:
+   //! \brief Create the global
+   //! \param env The variable holding the global environment
+   //! \param name The name of the variable
+   global_c(const std::shared_ptr<environment_c> &env, std::string name)
+       : _env(env), _name(std::move(name)) {}
+
+   global_c(const global_c &) = delete;
+   global_c &operator=(const global_c &) = delete;
+
+   //! \brief Retrieve the value, fatal if it is unbound
+   const cell_t &get() {
+      if (!_cell) {
+         _cell = &_env->lookup(_name);
+      }
+      return *_cell;
+   }
+
+   //! \brief Bind the variable, as define does
+   const cell_t &define(cell_t value) {
+      _cell = &_env->get(_name);
+      *_cell = std::move(value);
+      return *_cell;
+   }
+
+   //! \brief Assign the variable, as set! does
+   const cell_t &set(cell_t value) {
+      _cell = &_env->lookup(_name);
+      *_cell = std::move(value);
+      return *_cell;
+   }
+
+   //! \brief Check that the variable still holds the builtin of its name,
+   //!        the inlined arithmetic is only used while it does
+   bool builtin() {
+      const cell_t &c = get();
+      return c.type == cell_type_e::PROC && c.val == _name;
+   }
+
+ private:
+   const std::shared_ptr<environment_c> &_env;
+   std::string _name;
+   cell_t *_cell{nullptr};
+};
+
+//! \brief Retrieve an argument, missing arguments are nil
+inline const cell_t &arg(cell_span args, std::size_t i) {
+   return i < args.size() ? args[i] : nil;
+}
+
+//! \brief Check a value the way if and while do
+inline bool is_false(const cell_t &c) { return c.val == "#f"; }
+
+//! \brief Make #t or #f
+inline cell_t boolean(bool value) { return value ? true_sym : false_sym; }
+
+//! \brief Make a box for a variable shared with closures
+inline std::shared_ptr<cell_t> box() { return std::make_shared<cell_t>(nil); }
+
+//! \brief Make a lambda from translated code
+inline cell_t lambda(cell_t::proc_fn fn) { return cell_t(std::move(fn)); }
+
+//! \brief Make a list from quoted data
+inline cell_t list(std::initializer_list<cell_t> items) {
+   cell_t c(cell_type_e::LIST);
+   c.list.assign(items.begin(), items.end());
+   return c;
+}
+
+//! \brief Make a NUMBER cell from an integer
+inline cell_t integer(int64_t value) {
+   char buf[24];
+   auto end = std::to_chars(buf, buf + sizeof(buf), value).ptr;
+   return cell_t(cell_type_e::NUMBER, std::string(buf, end));
+}
+
+//! \brief Call a lambda or builtin
+//! \param fn The function to call
+//! \param args The evaluated arguments
+extern cell_t call(const cell_t &fn, cell_span args);
+
+//! \brief Step a loop variable that was translated to an integer
+//! \param g The global, + or -, used to step it
+//! \param op ADD or SUBTRACT
+//! \param value The current value
+//! \param by The literal it is stepped by
+extern int64_t step(global_c &g, arithmetic_e op, int64_t value, int64_t by);
+
+//  Operands of the inlined arithmetic are cells, or integers when the
+//  translator knew them to be
+//
+inline std::optional<int64_t> as_int(int64_t value) { return value; }
+
+inline std::optional<int64_t> as_int(const cell_t &c) {
+   if (c.type != cell_type_e::NUMBER) {
+      return std::nullopt;
+   }
+   int64_t value = 0;
+   const char *begin = c.val.data() + (c.val.starts_with('+') ? 1 : 0);
+   const char *end = c.val.data() + c.val.size();
+   auto [ptr, ec] = std::from_chars(begin, end, value);
+   if (ec != std::errc() || ptr != end) {
+      return std::nullopt;
+   }
+   return value;
+}
+
+inline cell_t as_cell(int64_t value) { return integer(value); }
+inline const cell_t &as_cell(const cell_t &c) { return c; }
+
+//! \brief Apply + - or * to two operands, computed in place while the
+//!        global holds the builtin and both fit in 64 bits
+template <typename A, typename B>
+cell_t arithmetic(global_c &g, arithmetic_e op, const A &a, const B &b) {
+   if (g.builtin()) {
+      auto x = as_int(a);
+      auto y = as_int(b);
+      int64_t result = 0;
+      bool overflow = true;
+      if (x && y) {
+         switch (op) {
+         case arithmetic_e::ADD:
+            overflow = __builtin_add_overflow(*x, *y, &result);
+            break;
+         case arithmetic_e::SUBTRACT:
+            overflow = __builtin_sub_overflow(*x, *y, &result);
+            break;
+         case arithmetic_e::MULTIPLY:
+            overflow = __builtin_mul_overflow(*x, *y, &result);
+            break;
+         case arithmetic_e::DIVIDE:
+            break;
+         }
+      }
+      if (!overflow) {
+         return integer(result);
+      }
+   }
+   return call(g.get(), std::array<cell_t, 2>{as_cell(a), as_cell(b)});
+}
+
+//! \brief Apply a comparison to two operands for if, while and do, which
+//!        only need to know if the result is false
+template <typename A, typename B>
+bool test(global_c &g, comparison_e op, const A &a, const B &b) {
+   if (g.builtin()) {
+      auto x = as_int(a);
+      auto y = as_int(b);
+      if (x && y) {
+         switch (op) {
+         case comparison_e::LESS:
+            return *x < *y;
+         case comparison_e::LESS_EQUAL:
+            return *x <= *y;
+         case comparison_e::GREATER:
+            return *x > *y;
+         case comparison_e::GREATER_EQUAL:
+            return *x >= *y;
+         }
+      }
+   }
+   return !is_false(
+       call(g.get(), std::array<cell_t, 2>{as_cell(a), as_cell(b)}));
+}
+
+//! \brief Apply a comparison to two operands
+template <typename A, typename B>
+cell_t compare(global_c &g, comparison_e op, const A &a, const B &b) {
+   if (g.builtin() && as_int(a) && as_int(b)) {
+      return boolean(test(g, op, a, b));
+   }
+   return call(g.get(), std::array<cell_t, 2>{as_cell(a), as_cell(b)});
+}
+
+//! \brief Apply eq to two operands for if, while and do. Integers are
+//!        compared as integers, anything else as eq compares cells
+template <typename A, typename B>
+bool test_eq(global_c &g, const A &a, const B &b) {
+   if (g.builtin()) {
+      if constexpr (std::is_same_v<A, int64_t> && std::is_same_v<B, int64_t>) {
+         return a == b;
+      } else {
+         const cell_t &x = as_cell(a);
+         const cell_t &y = as_cell(b);
+         return x.type == y.type && x.val == y.val;
+      }
+   }
+   return !is_false(
+       call(g.get(), std::array<cell_t, 2>{as_cell(a), as_cell(b)}));
+}
+
+//! \brief Apply eq to two operands
+template <typename A, typename B>
+cell_t equal(global_c &g, const A &a, const B &b) {
+   if (g.builtin()) {
+      return boolean(test_eq(g, a, b));
+   }
+   return call(g.get(), std::array<cell_t, 2>{as_cell(a), as_cell(b)});
+}
+
+} // namespace polaris::emitted
+
+#endif
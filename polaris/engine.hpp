@@ -0,0 +1,66 @@
+#ifndef POLARIS_ENGINE_HPP
+#define POLARIS_ENGINE_HPP
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+namespace polaris {
+
+//! \brief A cell prepared for execution, invoked with the environment to
+//!        execute in
+using code_f = std::function<cell_t(const std::shared_ptr<environment_c> &)>;
+
+//! \brief Raised when something that is not a lambda or proc is called.
+//!        The engines report it as a FAILURE through the error callback of
+//!        the environment the evaluation started in, a host that calls
+//!        apply with something it can not call sees it
+class not_callable_c : public std::runtime_error {
+ public:
+   //! \brief Construct the error
+   //! \param what The printed form of what was called
+   explicit not_callable_c(const std::string &what)
+       : std::runtime_error("Not a function : [" + what + "]") {}
+};
+
+//! \brief Interface shared by everything that can execute cells
+class engine_c {
+ public:
+   virtual ~engine_c() = default;
+
+   //! \brief Evaluate a cell given and environment
+   //! \param x The cell to evaluate
+   //! \param env The environment to use in the evaluation
+   virtual cell_t evaluate(cell_t x, std::shared_ptr<environment_c> env) = 0;
+
+   //! \brief Prepare a cell so it can be executed any number of times
+   //!        without being processed again
+   //! \param x The cell to prepare
+   virtual code_f prepare(const cell_t &x) = 0;
+
+   //! \brief Call a lambda or proc with already evaluated arguments
+   //! \param fn The lambda or proc to call, anything else raises
+   //!           not_callable_c
+   //! \param args The arguments to call it with
+   virtual cell_t apply(const cell_t &fn, cell_span args) = 0;
+
+   //! \brief Call a lambda in a frame that has already been made for it by
+   //!        make_frame, so that callers can reuse one frame for many calls
+   //! \param lambda The lambda to call
+   //! \param frame The frame holding its arguments
+   virtual cell_t apply_in(const cell_t &lambda,
+                           const std::shared_ptr<environment_c> &frame) = 0;
+
+   //! \brief Prepare a lambda that was not created by this engine (for
+   //!        instance one restored from an image) to be called efficiently
+   //! \param lambda The lambda to prepare
+   virtual void adopt([[maybe_unused]] cell_t &lambda) {}
+};
+
+} // namespace polaris
+
+#endif
@@ -4,20 +4,40 @@
 
 namespace polaris {
 
-environment_c::environment_c(error_cb_f cb) : _outer(nullptr), _error_cb(cb) {}
+namespace {
+
+//  Every environment is counted in the runtime statistics, along with the
+//  bytes of the environment itself
+//
+void count_environment() {
+   stats_t &s = stats();
+   ++s.environments_created;
+   s.bytes_allocated += sizeof(environment_c);
+}
+
+} // namespace
+
+environment_c::environment_c(error_cb_f cb) : _outer(nullptr), _error_cb(cb) {
+   count_environment();
+}
 
 environment_c::environment_c(std::shared_ptr<environment_c> outer)
-    : _outer(outer) {}
+    : _outer(outer) {
+   count_environment();
+}
 
-environment_c::environment_c(const cells &params, const cells &args,
+environment_c::environment_c(const cells &params, cell_span args,
                              std::shared_ptr<environment_c> outer)
     : _outer(outer) {
+   count_environment();
    auto arg = args.begin();
    for (auto param = params.begin(); param != params.end(); ++param) {
       _env[param->val] = *arg++;
    }
 }
 
+environment_c::~environment_c() { ++stats().environments_destroyed; }
+
 cell_t::map &environment_c::find(const std::string &var) {
    if (_env.find(var) != _env.end()) {
       return _env;
@@ -31,8 +51,72 @@ cell_t::map &environment_c::find(const std::string &var) {
    std::exit(1);
 }
 
-cell_t &environment_c::operator[](const std::string &var) { return _env[var]; }
+cell_t &environment_c::lookup(const std::string &var) {
+   auto it = _env.find(var);
+   if (it != _env.end()) {
+      return it->second;
+   }
+   if (!_boxes.empty()) {
+      auto box = _boxes.find(var);
+      if (box != _boxes.end()) {
+         return *box->second;
+      }
+   }
+   if (_outer) {
+      return _outer->lookup(var);
+   }
+
+   std::string err = "Unbound symbol : [" + var + "]";
+   _error_cb(error_level_e::FATAL, err.c_str());
+   std::exit(1);
+}
+
+cell_t &environment_c::operator[](const std::string &var) { return get(var); }
+
+cell_t &environment_c::get(const std::string &value) {
+   if (!_boxes.empty()) {
+      auto box = _boxes.find(value);
+      if (box != _boxes.end()) {
+         return *box->second;
+      }
+   }
+   return _env[value];
+}
+
+bool environment_c::contains(const std::string &var) const {
+   return _env.contains(var) || _boxes.contains(var);
+}
 
-cell_t &environment_c::get(const std::string &value) { return _env[value]; }
+void environment_c::bind_box(const std::string &var,
+                             std::shared_ptr<cell_t> box) {
+   _env.erase(var);
+   _boxes[var] = box;
+}
+
+void environment_c::name_procs() {
+   for (auto &[name, c] : _env) {
+      if (c.type == cell_type_e::PROC && c.val.empty()) {
+         c.val = name;
+         if (counting_builtin_calls()) {
+            count_calls(c, name);
+         }
+      }
+   }
+}
+
+void environment_c::capture(const std::string &var, environment_c &into) {
+   for (environment_c *e = this; e->_outer; e = e->_outer.get()) {
+      auto it = e->_env.find(var);
+      if (it != e->_env.end()) {
+         into._env[var] = it->second;
+         return;
+      }
+      auto box = e->_boxes.find(var);
+      if (box != e->_boxes.end()) {
+         into._boxes[var] = box->second;
+         return;
+      }
+   }
+}
 
 } // namespace polaris
\ No newline at end of file
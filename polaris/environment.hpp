@@ -3,7 +3,9 @@
 
 #include "cell.hpp"
 #include "error.hpp"
+#include "fwd.hpp"
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 namespace polaris {
@@ -22,15 +24,27 @@ class environment_c {
    //!        from the getgo
    //! \param params Names of incoming data
    //! \param args Value of incoming datas
-   environment_c(const cells &params, const cells &args,
+   environment_c(const cells &params, cell_span args,
                  std::shared_ptr<environment_c> outer);
 
+   environment_c(const environment_c &) = delete;
+   environment_c &operator=(const environment_c &) = delete;
+
+   ~environment_c();
+
    //! \brief Find an environment variable given the name
    //!        If the item can not be found in the current environment
    //!        Then the outer environments will be checked - If the item
-   //!        does not exist std::exit will be called
+   //!        does not exist std::exit will be called. Only the thread
+   //!        evaluating in the environment may use it, other threads read
+   //!        variables through a snapshot_c
    cell_t::map &find(const std::string &var);
 
+   //! \brief Find an environment variable given the name and retrieve its
+   //!        cell. Unlike find this also sees variables that have been
+   //!        boxed for sharing with closures
+   cell_t &lookup(const std::string &var);
+
    //! \brief Operator [] overload for accessing environment variables
    //! \param var The variable to retrieve
    cell_t &operator[](const std::string &var);
@@ -39,13 +53,62 @@ class environment_c {
    //! \param var The variable to retrieve
    cell_t &get(const std::string &value);
 
+   //! \brief Check if a variable is bound directly in this environment
+   //! \param var The variable to check
+   bool contains(const std::string &var) const;
+
+   //! \brief Bind a variable to a shared box so that closures capturing it
+   //!        observe assignments made through this environment
+   //! \param var The variable to bind
+   //! \param box The box holding the value
+   void bind_box(const std::string &var, std::shared_ptr<cell_t> box);
+
+   //! \brief Copy (or share, if boxed) the binding of a variable into a
+   //!        closure environment. Only non-global environments are searched,
+   //!        globals are always resolved when they are used
+   //! \param var The variable to capture
+   //! \param into The environment receiving the capture
+   void capture(const std::string &var, environment_c &into);
+
+   //! \brief Name every proc bound in this environment that does not have a
+   //!        name yet after the variable it is bound to. Images refer to
+   //!        builtins by these names
+   void name_procs();
+
+   //! \brief Retrieve the variables bound directly in this environment
+   cell_t::map &get_bindings() { return _env; }
+
+   //! \brief Retrieve the boxed variables bound in this environment
+   const std::unordered_map<std::string, std::shared_ptr<cell_t>> &
+   get_boxes() const {
+      return _boxes;
+   }
+
+   //! \brief Retrieve the outer environment
+   std::shared_ptr<environment_c> get_outer() { return _outer; }
+
    //! \brief Retrieve the error callback
    error_cb_f get_error_cb() { return _error_cb; }
 
+   //! \brief Publish variables of this environment after every statement
+   //!        evaluate_all runs in it, and whenever the script calls
+   //!        (publish)
+   //! \param snapshot The snapshot to publish to, nullptr to stop
+   void set_snapshot(std::shared_ptr<snapshot_c> snapshot) {
+      _snapshot = std::move(snapshot);
+   }
+
+   //! \brief Retrieve the snapshot variables are published to, if any
+   const std::shared_ptr<snapshot_c> &get_snapshot() const {
+      return _snapshot;
+   }
+
  private:
    cell_t::map _env;
+   std::unordered_map<std::string, std::shared_ptr<cell_t>> _boxes;
    std::shared_ptr<environment_c> _outer;
    error_cb_f _error_cb;
+   std::shared_ptr<snapshot_c> _snapshot;
 };
 
 } // namespace polaris
@@ -1,10 +1,41 @@
 #include "evaluator.hpp"
+#include "closure.hpp"
 #include "environment.hpp"
+#include "native.hpp"
+#include "polaris.hpp"
+#include "sequence.hpp"
 
 #include "cell.hpp"
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 namespace polaris {
+
+namespace {
+
+//  Thrown to unwind an evaluation that went over one of its limits
+//
+class limit_exceeded_c : public std::runtime_error {
+ public:
+   limit_exceeded_c(const std::string &limit, uint64_t value)
+       : std::runtime_error(limit + " limit exceeded (" +
+                            std::to_string(value) + ")") {}
+};
+
+//  Decrements the call depth however the call is left
+//
+struct depth_guard_t {
+   uint64_t &depth;
+   ~depth_guard_t() { --depth; }
+};
+
+uint64_t or_unlimited(uint64_t limit) {
+   return limit ? limit : std::numeric_limits<uint64_t>::max();
+}
+
+} // namespace
+
 evaluator_c::evaluator_c() {
    _callable_symbol_table["quote"] =
        [](cell_t x, std::shared_ptr<environment_c> env) -> cell_t {
@@ -21,7 +52,7 @@ evaluator_c::evaluator_c() {
 
    _callable_symbol_table["set!"] =
        [this](cell_t x, std::shared_ptr<environment_c> env) -> cell_t {
-      return env->find(x.list[1].val)[x.list[1].val] = evaluate(x.list[2], env);
+      return env->lookup(x.list[1].val) = evaluate(x.list[2], env);
    };
 
    _callable_symbol_table["define"] =
@@ -33,13 +64,51 @@ evaluator_c::evaluator_c() {
        [this](cell_t x, std::shared_ptr<environment_c> env) -> cell_t {
       // (lambda (var*) exp)
       x.type = cell_type_e::LAMBDA;
-      // keep a reference to the environment that exists now (when the
-      // lambda is being defined) because that's the outer environment
-      // we'll need to use when the lambda is executed
-      x.env = std::make_shared<environment_c>(env);
+      // capture only the variables the body refers to from the environment
+      // that exists now (when the lambda is being defined), everything else
+      // is resolved in the global environment when the lambda is executed
+      x.env = std::make_shared<closure_c>(analyze_lambda(x), env);
+      charge(sizeof(closure_c));
       return x;
    };
 
+   _callable_symbol_table["delay"] =
+       [this](cell_t x, std::shared_ptr<environment_c> env) -> cell_t {
+      // (delay exp)
+      return make_promise(
+          [this, exp = x.list[1], env]() { return evaluate(exp, env); });
+   };
+
+   _callable_symbol_table["let"] =
+       [this](cell_t x, std::shared_ptr<environment_c> env) -> cell_t {
+      // (let ((var exp)*) exp*) or (let name ((var exp)*) exp*)
+      if (x.list.size() > 2 && x.list[1].type == cell_type_e::SYMBOL) {
+         return evaluate_named_let(x, env);
+      }
+      return evaluate_let(x, env);
+   };
+
+   _callable_symbol_table["let*"] =
+       [this](cell_t x, std::shared_ptr<environment_c> env) -> cell_t {
+      // (let* ((var exp)*) exp*)
+      return evaluate_let(x, env);
+   };
+
+   _callable_symbol_table["while"] =
+       [this](cell_t x, std::shared_ptr<environment_c> env) -> cell_t {
+      // (while test exp*)
+      while (evaluate(x.list[1], env).val != "#f") {
+         evaluate_body(x, 2, env);
+      }
+      return nil;
+   };
+
+   _callable_symbol_table["do"] =
+       [this](cell_t x, std::shared_ptr<environment_c> env) -> cell_t {
+      // (do ((var init step)*) (test result*) exp*)
+      return evaluate_do(x, env);
+   };
+
    _callable_symbol_table["begin"] =
        [this](cell_t x, std::shared_ptr<environment_c> env) -> cell_t {
       // (begin exp*)
@@ -50,18 +119,97 @@ evaluator_c::evaluator_c() {
    };
 }
 
+void evaluator_c::set_limits(const limits_t &limits) {
+   _limits = limits;
+   _step_limit = or_unlimited(limits.steps);
+   _depth_limit = or_unlimited(limits.depth);
+   _byte_limit = or_unlimited(limits.bytes);
+}
+
+void evaluator_c::charge(uint64_t bytes) {
+   _usage.bytes += bytes;
+   if (_usage.bytes > _byte_limit) {
+      throw limit_exceeded_c("memory", _limits.bytes);
+   }
+}
+
+cell_t evaluator_c::run(const std::function<cell_t()> &fn,
+                        std::shared_ptr<environment_c> env) {
+   _usage = usage_t{};
+   _running = true;
+   try {
+      cell_t result = fn();
+      _running = false;
+      return result;
+   } catch (const limit_exceeded_c &e) {
+      _running = false;
+      _usage.aborted = true;
+
+      while (env && env->get_outer()) {
+         env = env->get_outer();
+      }
+      if (env) {
+         env->get_error_cb()(error_level_e::FAILURE, e.what());
+      }
+   } catch (const not_callable_c &e) {
+      _running = false;
+
+      // Without an environment (a host applying something that is not a
+      // lambda) there is no one to report to but the host
+      //
+      while (env && env->get_outer()) {
+         env = env->get_outer();
+      }
+      if (!env) {
+         throw;
+      }
+      env->get_error_cb()(error_level_e::FAILURE, e.what());
+   } catch (...) {
+      // An error callback that throws rather than exiting leaves the
+      // evaluator ready for the next top level evaluation
+      //
+      _running = false;
+      throw;
+   }
+   return nil;
+}
+
 cell_t evaluator_c::evaluate(cell_t x, std::shared_ptr<environment_c> env) {
 
+   // The first call is the top level of an evaluation, it sets up the
+   // accounting that every nested call contributes to
+   //
+   if (!_running) {
+      return run([&]() { return evaluate(std::move(x), env); }, env);
+   }
+   if (++_usage.steps > _step_limit) {
+      throw limit_exceeded_c("step", _limits.steps);
+   }
+
    // Check for symbol number and string types
    //
    switch (x.type) {
    case cell_type_e::SYMBOL:
-      return env->find(x.val)[x.val];
+      return env->lookup(x.val);
    case cell_type_e::NUMBER:
       [[fallthrough]];
    case cell_type_e::DOUBLE:
       [[fallthrough]];
    case cell_type_e::STRING:
+      [[fallthrough]];
+   case cell_type_e::FUTURE:
+      [[fallthrough]];
+   case cell_type_e::SEQUENCE:
+      [[fallthrough]];
+   case cell_type_e::PROMISE:
+      [[fallthrough]];
+   case cell_type_e::CHANNEL:
+      [[fallthrough]];
+   case cell_type_e::MACRO:
+      [[fallthrough]];
+   case cell_type_e::RECORD:
+      [[fallthrough]];
+   case cell_type_e::BUILDER:
       return x;
    default:
       break;
@@ -73,6 +221,19 @@ cell_t evaluator_c::evaluate(cell_t x, std::shared_ptr<environment_c> env) {
       return nil;
    }
 
+   //  Forms read from a file are counted against their line while a line
+   //  profile is attached
+   //
+   if (_profile && x.loc) {
+      line_profile_c::scope_t counted(*_profile, x.loc);
+      return evaluate_list(x, env);
+   }
+   return evaluate_list(x, env);
+}
+
+cell_t evaluator_c::evaluate_list(const cell_t &x,
+                                  std::shared_ptr<environment_c> env) {
+
    //  If the item is a symbol and its in the symbol table that means
    //  its a callable symbol table that means we need to call it
    //
@@ -82,37 +243,260 @@ cell_t evaluator_c::evaluate(cell_t x, std::shared_ptr<environment_c> env) {
       return _callable_symbol_table[x.list[0].val](x, env);
    }
 
-   //  Create a processing cell with evaluated parameters
+   //  Create a processing cell with evaluated parameters, the parameters
+   //  are built in a buffer on the stack rather than in a new vector
    //
-   cells exps;
    cell_t proc(evaluate(x.list[0], env));
+   arguments_c<stack_arguments> exps(x.list.size() - 1);
    for (auto exp = x.list.begin() + 1; exp != x.list.end(); ++exp) {
       exps.push_back(evaluate(*exp, env));
    }
 
+   return apply(proc, exps.span());
+}
+
+cell_t evaluator_c::evaluate_body(const cell_t &x, std::size_t first,
+                                  std::shared_ptr<environment_c> env) {
+   cell_t result = nil;
+   for (std::size_t i = first; i < x.list.size(); ++i) {
+      result = evaluate(x.list[i], env);
+   }
+   return result;
+}
+
+std::shared_ptr<environment_c>
+evaluator_c::make_binding_scope(const cell_t &x,
+                                std::shared_ptr<environment_c> env) {
+   auto info = analyze_binding_form(x);
+   charge(sizeof(environment_c) +
+          info->params.size() * sizeof(cell_t::map::value_type));
+   return make_scope(*info, env);
+}
+
+cell_t evaluator_c::evaluate_let(const cell_t &x,
+                                 std::shared_ptr<environment_c> env) {
+   const cells &specs = x.list[1].list;
+   auto scope = make_binding_scope(x, env);
+
+   //  let* sees each variable as soon as it is bound, let evaluates every
+   //  value before binding any of them
+   //
+   if (x.list[0].val == "let*") {
+      for (auto &spec : specs) {
+         scope->get(spec.list[0].val) =
+             spec.list.size() > 1 ? evaluate(spec.list[1], scope) : nil;
+      }
+   } else {
+      arguments_c<stack_arguments> values(specs.size());
+      for (auto &spec : specs) {
+         values.push_back(spec.list.size() > 1 ? evaluate(spec.list[1], env)
+                                               : cell_t(nil));
+      }
+      for (std::size_t i = 0; i < specs.size(); ++i) {
+         scope->get(specs[i].list[0].val) = values.span()[i];
+      }
+   }
+   return evaluate_body(x, 2, scope);
+}
+
+cell_t evaluator_c::evaluate_named_let(const cell_t &x,
+                                       std::shared_ptr<environment_c> env) {
+   const std::string &name = x.list[1].val;
+   const cells &specs = x.list[2].list;
+
+   arguments_c<stack_arguments> inits(specs.size());
+   for (auto &spec : specs) {
+      inits.push_back(spec.list.size() > 1 ? evaluate(spec.list[1], env)
+                                           : cell_t(nil));
+   }
+
+   auto shape = analyze_named_let(x);
+
+   //  A name that is only called in tail position is a loop, the variables
+   //  are updated in place and the body is evaluated again
+   //
+   if (shape->loop) {
+      auto scope = make_binding_scope(x, env);
+      std::vector<cell_t *> vars;
+      for (std::size_t i = 0; i < specs.size(); ++i) {
+         vars.push_back(&scope->get(specs[i].list[0].val));
+         *vars.back() = inits.span()[i];
+      }
+
+      std::vector<cell_t> next;
+      while (true) {
+         bool again = false;
+         cell_t result = evaluate_tail(shape->body, scope, name, next, again);
+         if (!again) {
+            return result;
+         }
+         for (std::size_t i = 0; i < vars.size() && i < next.size(); ++i) {
+            *vars[i] = std::move(next[i]);
+         }
+      }
+   }
+
+   //  Otherwise the name is bound to a lambda over the variables that can
+   //  be called (and captured) like any other
+   //
+   auto scope = std::make_shared<environment_c>(env);
+   auto box = std::make_shared<cell_t>(nil);
+   scope->bind_box(name, box);
+   *box = evaluate(shape->lambda, scope);
+   return apply(*box, inits.span());
+}
+
+cell_t evaluator_c::evaluate_tail(const cell_t &x,
+                                  std::shared_ptr<environment_c> env,
+                                  const std::string &name,
+                                  std::vector<cell_t> &next, bool &again) {
+   if (x.type != cell_type_e::LIST || x.list.empty() ||
+       x.list[0].type != cell_type_e::SYMBOL) {
+      return evaluate(x, env);
+   }
+
+   const std::string &head = x.list[0].val;
+   if (head == name) {
+      if (++_usage.steps > _step_limit) {
+         throw limit_exceeded_c("step", _limits.steps);
+      }
+      next.clear();
+      for (auto i = x.list.begin() + 1; i != x.list.end(); ++i) {
+         next.push_back(evaluate(*i, env));
+      }
+      again = true;
+      return nil;
+   }
+   if (head == "if") {
+      if (evaluate(x.list[1], env).val != "#f") {
+         return evaluate_tail(x.list[2], env, name, next, again);
+      }
+      return x.list.size() < 4
+                 ? nil
+                 : evaluate_tail(x.list[3], env, name, next, again);
+   }
+   if (head == "begin" && x.list.size() > 1) {
+      for (std::size_t i = 1; i < x.list.size() - 1; ++i) {
+         evaluate(x.list[i], env);
+      }
+      return evaluate_tail(x.list.back(), env, name, next, again);
+   }
+   return evaluate(x, env);
+}
+
+cell_t evaluator_c::evaluate_do(const cell_t &x,
+                                std::shared_ptr<environment_c> env) {
+   const cells &specs = x.list[1].list;
+   const cell_t &exit = x.list[2];
+   auto scope = make_binding_scope(x, env);
+
+   arguments_c<stack_arguments> inits(specs.size());
+   for (auto &spec : specs) {
+      inits.push_back(spec.list.size() > 1 ? evaluate(spec.list[1], env)
+                                           : cell_t(nil));
+   }
+   std::vector<cell_t *> vars;
+   for (std::size_t i = 0; i < specs.size(); ++i) {
+      vars.push_back(&scope->get(specs[i].list[0].val));
+      *vars.back() = inits.span()[i];
+   }
+
+   std::vector<cell_t> steps(specs.size());
+   while (evaluate(exit.list[0], scope).val == "#f") {
+      evaluate_body(x, 3, scope);
+
+      //  Every step is evaluated before any variable is updated
+      //
+      for (std::size_t i = 0; i < specs.size(); ++i) {
+         if (specs[i].list.size() > 2) {
+            steps[i] = evaluate(specs[i].list[2], scope);
+         }
+      }
+      for (std::size_t i = 0; i < specs.size(); ++i) {
+         if (specs[i].list.size() > 2) {
+            *vars[i] = std::move(steps[i]);
+         }
+      }
+   }
+   return evaluate_body(exit, 1, scope);
+}
+
+code_f evaluator_c::prepare(const cell_t &x) {
+   return [this, x](const std::shared_ptr<environment_c> &env) {
+      return evaluate(x, env);
+   };
+}
+
+cell_t evaluator_c::apply(const cell_t &fn, cell_span args) {
+
+   // Called directly by a host rather than from within an evaluation
+   //
+   if (!_running) {
+      return run([&]() { return apply(fn, args); }, fn.env);
+   }
+
    //  Proc type is a lambda, so it needs to be executed.
    //  Upon creation we give it a new environment to thrive in and operate on
    //  with the current environment stated as its outer
    //
-   if (proc.type == cell_type_e::LAMBDA) {
+   if (fn.type == cell_type_e::LAMBDA) {
+
+      // Lambdas created by the compiler carry their compiled body
+      //
+      if (fn.proc) {
+         return fn.proc(args);
+      }
+
+      if (++_depth > _depth_limit) {
+         --_depth;
+         throw limit_exceeded_c("depth", _limits.depth);
+      }
+      depth_guard_t guard{_depth};
+      call_depth_t counted;
+      if (_depth > _usage.peak_depth) {
+         _usage.peak_depth = _depth;
+      }
+
+      auto closure = std::static_pointer_cast<closure_c>(fn.env);
+      charge(sizeof(environment_c) +
+             closure->info().params.size() * sizeof(cell_t::map::value_type));
 
-      // Evaluate the body (proc.list[2]) of the lambda with the new environemnt
+      // Evaluate the body (fn.list[2]) of the lambda with the new environemnt
       //
-      return evaluate(proc.list[2], std::make_shared<environment_c>(
-                                        proc.list[1].list, exps, proc.env));
+      return evaluate(fn.list[2], make_frame(closure, args));
 
-   } else if (proc.type == cell_type_e::PROC) {
+   } else if (fn.type == cell_type_e::PROC) {
 
       //  If the item isn't a lambda perhaps its a processing cell so we need to
-      //  call it
+      //  call it. Only the top level of what it built is accounted for, that
+      //  is enough to catch things like a runaway append
       //
-      return proc.proc(exps);
+      cell_t result = fn.proc(args);
+      charge(result.val.size() + result.list.size() * sizeof(cell_t));
+      return result;
    }
 
-   //  Sadly, if we get here it is time to kill.. something wild came in and
-   //  the user most likely did something silly.
+   //  Something wild came in and the user most likely did something silly,
+   //  the evaluation is abandoned and reported by run
    //
-   std::cerr << "Not a function\n";
-   std::exit(EXIT_FAILURE);
+   throw not_callable_c(to_string(fn));
+}
+
+cell_t evaluator_c::apply_in(const cell_t &fn,
+                             const std::shared_ptr<environment_c> &frame) {
+   if (!_running) {
+      return run([&]() { return apply_in(fn, frame); }, fn.env);
+   }
+
+   if (++_depth > _depth_limit) {
+      --_depth;
+      throw limit_exceeded_c("depth", _limits.depth);
+   }
+   depth_guard_t guard{_depth};
+   call_depth_t counted;
+   if (_depth > _usage.peak_depth) {
+      _usage.peak_depth = _depth;
+   }
+   return evaluate(lambda_source(fn).list[2], frame);
 }
 } // namespace polaris
\ No newline at end of file
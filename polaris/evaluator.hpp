@@ -1,17 +1,51 @@
 #ifndef POLARIS_EVALUATOR_HPP
 #define POLARIS_EVALUATOR_HPP
 
+#include <cstdint>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "engine.hpp"
 #include "fwd.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
 
 namespace polaris {
 
-//! \brief Evaluator
-class evaluator_c {
+//! \brief Limits on a single top level evaluation, 0 means unlimited
+struct limits_t {
+   //! Number of cells evaluated
+   uint64_t steps{0};
+
+   //! Depth of nested lambda calls
+   uint64_t depth{0};
+
+   //! Bytes allocated for call frames, closures and builtin results
+   uint64_t bytes{0};
+};
+
+//! \brief What a top level evaluation used
+struct usage_t {
+   //! Number of cells evaluated
+   uint64_t steps{0};
+
+   //! Deepest nesting of lambda calls reached
+   uint64_t peak_depth{0};
+
+   //! Approximate bytes allocated for call frames, closures and the
+   //! top level of builtin results
+   uint64_t bytes{0};
+
+   //! Set if the evaluation was stopped by a limit
+   bool aborted{false};
+};
+
+//! \brief Evaluator - walks the cell tree directly
+class evaluator_c final : public engine_c {
  public:
    //! \brief Construct the base evaluator with the standard
    //!         callable symbols baked into it
@@ -20,9 +54,74 @@ class evaluator_c {
    //! \brief Evaluate a cell given and environment
    //! \param x The cell to evaluate
    //! \param env The environment to use in the evaluation
-   cell_t evaluate(cell_t x, std::shared_ptr<environment_c> env);
+   cell_t evaluate(cell_t x, std::shared_ptr<environment_c> env) override;
+
+   //! \brief Prepare a cell for repeated evaluation
+   //! \param x The cell to prepare
+   code_f prepare(const cell_t &x) override;
+
+   //! \brief Call a lambda or proc with already evaluated arguments
+   //! \param fn The lambda or proc to call
+   //! \param args The arguments to call it with
+   cell_t apply(const cell_t &fn, cell_span args) override;
+
+   //! \brief Call a lambda in a frame already made for it
+   //! \param lambda The lambda to call
+   //! \param frame The frame holding its arguments
+   cell_t apply_in(const cell_t &lambda,
+                   const std::shared_ptr<environment_c> &frame) override;
+
+   //! \brief Set the limits applied to each top level evaluation. When a
+   //!        limit is hit the evaluation is abandoned, the error callback of
+   //!        the environment is called with a failure and nil is returned
+   //! \param limits The limits to apply
+   void set_limits(const limits_t &limits);
+
+   //! \brief Retrieve the limits applied to each top level evaluation
+   const limits_t &get_limits() const { return _limits; }
+
+   //! \brief Retrieve what the current (or last) top level evaluation used
+   const usage_t &get_usage() const { return _usage; }
+
+   //! \brief Count the forms read from a file that are evaluated, and the
+   //!        time spent in them, against their source lines
+   //! \param profile The profile to count into, it must outlive its use.
+   //!        nullptr stops counting
+   void set_line_profile(line_profile_c *profile) { _profile = profile; }
+
+   //! \brief Retrieve the runtime statistics of the calling thread. These
+   //!        are kept across every evaluation and engine, builtin call
+   //!        counts are available from builtin_calls()
+   const stats_t &get_stats() const { return stats(); }
 
  private:
+   cell_t run(const std::function<cell_t()> &fn,
+              std::shared_ptr<environment_c> env);
+   void charge(uint64_t bytes);
+
+   cell_t evaluate_list(const cell_t &x, std::shared_ptr<environment_c> env);
+
+   cell_t evaluate_body(const cell_t &x, std::size_t first,
+                        std::shared_ptr<environment_c> env);
+   std::shared_ptr<environment_c>
+   make_binding_scope(const cell_t &x, std::shared_ptr<environment_c> env);
+   cell_t evaluate_let(const cell_t &x, std::shared_ptr<environment_c> env);
+   cell_t evaluate_named_let(const cell_t &x,
+                             std::shared_ptr<environment_c> env);
+   cell_t evaluate_tail(const cell_t &x, std::shared_ptr<environment_c> env,
+                        const std::string &name, std::vector<cell_t> &next,
+                        bool &again);
+   cell_t evaluate_do(const cell_t &x, std::shared_ptr<environment_c> env);
+
+   limits_t _limits;
+   usage_t _usage;
+   uint64_t _step_limit{std::numeric_limits<uint64_t>::max()};
+   uint64_t _depth_limit{std::numeric_limits<uint64_t>::max()};
+   uint64_t _byte_limit{std::numeric_limits<uint64_t>::max()};
+   uint64_t _depth{0};
+   bool _running{false};
+   line_profile_c *_profile{nullptr};
+
    std::unordered_map<std::string, std::function<cell_t(
                                        cell_t, std::shared_ptr<environment_c>)>>
        _callable_symbol_table;
@@ -5,9 +5,9 @@
 
 namespace polaris {
 
-feeder_c::feeder_c(polaris::evaluator_c &evaluator,
+feeder_c::feeder_c(polaris::engine_c &engine,
                    std::shared_ptr<polaris::environment_c> env)
-    : _eval(evaluator), _env(env) {}
+    : _eval(engine), _env(env) {}
 
 bool feeder_c::feed(std::string &line, bool print_result) {
 
@@ -38,12 +38,15 @@ bool feeder_c::feed(std::string &line, bool print_result) {
    // we can submit the statement
    if (_tracker == 0 && !_statement.empty()) {
 
-      auto result = _eval.evaluate(polaris::read(_statement), _env);
+      cells results;
+      polaris::evaluate_all(_eval, _statement, _env, &results);
 
       // If they requested that we print the result,
       // then print the result
       if (print_result) {
-         std::cout << polaris::to_string(result) << std::endl;
+         for (auto &result : results) {
+            std::cout << polaris::to_string(result) << std::endl;
+         }
       }
       _statement.clear();
       return true;
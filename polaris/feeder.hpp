@@ -1,8 +1,8 @@
 #ifndef POLARIS_FEEDER_HPP
 #define POLARIS_FEEDER_HPP
 
+#include "engine.hpp"
 #include "environment.hpp"
-#include "evaluator.hpp"
 #include <memory>
 #include <string>
 
@@ -15,9 +15,9 @@ namespace polaris {
 class feeder_c {
  public:
    //! \brief Create the feeder
-   //! \param evaluator The evaluator to use
+   //! \param engine The engine to use (evaluator or compiler)
    //! \param env The environment to use in execution
-   feeder_c(polaris::evaluator_c &evaluator,
+   feeder_c(polaris::engine_c &engine,
             std::shared_ptr<polaris::environment_c> env);
 
    //! \brief Feed the line into the system.
@@ -25,7 +25,7 @@ class feeder_c {
    bool feed(std::string &line, bool print_result = false);
 
  private:
-   polaris::evaluator_c &_eval;
+   polaris::engine_c &_eval;
    std::shared_ptr<polaris::environment_c> _env;
    uint64_t _tracker{0};
    std::string _statement;
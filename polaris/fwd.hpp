@@ -5,9 +5,14 @@ namespace polaris {
 
 struct cell_t;
 class environment_c;
+class closure_c;
+class engine_c;
 class evaluator_c;
+class compiler_c;
 class imports_c;
 class feeder_c;
+class loop_c;
+class snapshot_c;
 
 } // namespace polaris
 
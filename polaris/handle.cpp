@@ -0,0 +1,42 @@
+#include "handle.hpp"
+#include "macro.hpp"
+#include "polaris.hpp"
+
+namespace polaris {
+
+namespace {
+
+// Wrap the top level forms in a single begin so they are prepared in one go,
+// each is expanded in turn so a macro can be used by the forms after it
+cell_t as_single_form(engine_c &engine, std::shared_ptr<environment_c> env,
+                      const std::string &source) {
+   cells forms;
+   cell_t form(cell_type_e::LIST);
+   form.list.push_back(cell_t(cell_type_e::SYMBOL, "begin"));
+   if (!read_all(source, forms)) {
+      env->get_error_cb()(error_level_e::FAILURE,
+                          "Unbalanced parentheses in program");
+      return form;
+   }
+   for (auto &f : forms) {
+      form.list.push_back(expand_macros(std::move(f), env, engine));
+   }
+   return form;
+}
+
+} // namespace
+
+program_c::program_c(engine_c &engine, std::shared_ptr<environment_c> env,
+                     const std::string &source)
+    : _env(env), _code(engine.prepare(as_single_form(engine, env, source))) {}
+
+cell_t program_c::run() { return _code(_env); }
+
+function_c::function_c(engine_c &engine, cell_t fn)
+    : _engine(engine), _fn(std::move(fn)) {}
+
+function_c::function_c(engine_c &engine, std::shared_ptr<environment_c> env,
+                       const std::string &name)
+    : _engine(engine), _fn(env->lookup(name)) {}
+
+} // namespace polaris
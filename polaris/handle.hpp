@@ -0,0 +1,88 @@
+#ifndef POLARIS_HANDLE_HPP
+#define POLARIS_HANDLE_HPP
+
+#include "cell.hpp"
+#include "engine.hpp"
+#include "environment.hpp"
+#include "native.hpp"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace polaris {
+
+//! \brief A snippet of source that is read and prepared by an engine once
+//!        and can then be executed any number of times
+class program_c {
+ public:
+   //! \brief Read and prepare the source. Macros are expanded here, those
+   //!        the source defines are defined once, when it is prepared
+   //! \param engine The engine that will execute the program
+   //! \param env The environment the program executes in
+   //! \param source One or more top level forms
+   program_c(engine_c &engine, std::shared_ptr<environment_c> env,
+             const std::string &source);
+
+   //! \brief Execute the program
+   //! \returns The result of the last form
+   cell_t run();
+
+ private:
+   std::shared_ptr<environment_c> _env;
+   code_f _code;
+};
+
+//! \brief A lambda (or proc) that can be called from C++ with native
+//!        arguments and results, without going through source text
+class function_c {
+ public:
+   //! \brief Wrap a callable cell
+   //! \param engine The engine to call the function with
+   //! \param fn The lambda or proc to call
+   function_c(engine_c &engine, cell_t fn);
+
+   //! \brief Look a function up by name once
+   //! \param engine The engine to call the function with
+   //! \param env The environment to find the function in
+   //! \param name The name the function is bound to
+   function_c(engine_c &engine, std::shared_ptr<environment_c> env,
+              const std::string &name);
+
+   //! \brief Call the function, converting the arguments into cells and the
+   //!        result into R. Supports the same types as register_native,
+   //!        except std::string_view and const char * which would point
+   //!        into a result that is gone once the call returns
+   //! \param args The arguments to call the function with
+   template <typename R = cell_t, typename... Args> R call(Args &&...args) {
+      static_assert(!std::is_same_v<R, std::string_view> &&
+                        !std::is_same_v<std::decay_t<R>, const char *> &&
+                        !std::is_same_v<std::decay_t<R>, char *>,
+                    "the result would not outlive the call, use std::string");
+
+      arguments_c<stack_arguments> c(sizeof...(Args));
+      (c.push_back(native_type_t<std::decay_t<Args>>::to(
+           std::forward<Args>(args))),
+       ...);
+      cell_t result = _engine.apply(_fn, c.span());
+      if constexpr (std::is_same_v<R, cell_t>) {
+         return result;
+      } else {
+         return R(native_type_t<R>::from(result));
+      }
+   }
+
+   //! \brief Retrieve the wrapped cell
+   const cell_t &get() const { return _fn; }
+
+ private:
+   engine_c &_engine;
+   cell_t _fn;
+};
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,124 @@
+#include "image.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+#include "imports.hpp"
+#include "serialize.hpp"
+#include "version.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace polaris {
+
+namespace {
+
+//  Images start with this line, an image is only loaded by the same
+//  version of polaris that wrote it. The rest is a serialized stream
+//  holding the closures, the imported files and then the globals
+//
+const std::string image_header = "polaris-image " LIBPOLARIS_VERSION "\n";
+
+} // namespace
+
+bool save_image(const std::string &path, std::shared_ptr<environment_c> env,
+                const imports_c &imports) {
+
+   // Builtins bound to their own name are already there when the image
+   // is loaded. Macros are left out, code that used them was expanded
+   // when it was defined
+   //
+   std::vector<std::pair<std::string, const cell_t *>> globals;
+   for (auto &[name, c] : env->get_bindings()) {
+      if ((c.type == cell_type_e::PROC && c.val == name) ||
+          c.type == cell_type_e::MACRO) {
+         continue;
+      }
+      globals.emplace_back(name, &c);
+   }
+
+   std::ofstream fs(path, std::ios::out | std::ios::binary | std::ios::trunc);
+   if (!fs.is_open()) {
+      std::string err = "Unable to write image : " + path;
+      env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+      return false;
+   }
+   fs << image_header;
+
+   serial_writer_c writer(fs, env, "image");
+   for (auto &[name, c] : globals) {
+      writer.collect(*c);
+   }
+   writer.write_closures();
+   writer.write_count(imports.get_imported().size());
+   for (auto &file : imports.get_imported()) {
+      writer.write_string(file);
+   }
+   writer.write_count(globals.size());
+   for (auto &[name, c] : globals) {
+      writer.write_string(name);
+      writer.write_cell(*c);
+   }
+   if (!writer.good()) {
+
+      //  An image missing some of the globals would load without complaint
+      //  and fail later, it is not kept
+      //
+      fs.close();
+      std::filesystem::remove(path);
+      std::string err = "Unable to save image : " + path;
+      env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+      return false;
+   }
+   return true;
+}
+
+bool load_image(const std::string &path, engine_c &engine,
+                std::shared_ptr<environment_c> env, imports_c &imports) {
+
+   std::ifstream fs(path, std::ios::in | std::ios::binary);
+   if (!fs.is_open()) {
+      std::string err = "Unable to open image : " + path;
+      env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+      return false;
+   }
+
+   // Nothing is bound until the whole image has been read
+   //
+   try {
+      std::string header(image_header.size(), '\0');
+      fs.read(header.data(), static_cast<std::streamsize>(header.size()));
+      if (!fs || header != image_header) {
+         throw std::runtime_error("not an image for this version of polaris");
+      }
+      serial_reader_c reader(fs, engine, env);
+      reader.read_closures();
+
+      std::vector<std::string> files;
+      for (uint64_t i = reader.read_count(); i > 0; i--) {
+         files.push_back(reader.read_string());
+      }
+
+      std::vector<std::pair<std::string, cell_t>> globals;
+      for (uint64_t i = reader.read_count(); i > 0; i--) {
+         std::string name = reader.read_string();
+         globals.emplace_back(std::move(name), reader.read_cell());
+      }
+
+      for (auto &file : files) {
+         imports.mark_imported(file);
+      }
+      for (auto &[name, c] : globals) {
+         env->get(name) = std::move(c);
+      }
+   } catch (const std::exception &e) {
+      std::string err = "Unable to load image " + path + " : " + e.what();
+      env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+      return false;
+   }
+   return true;
+}
+
+} // namespace polaris
@@ -0,0 +1,42 @@
+#ifndef POLARIS_IMAGE_HPP
+#define POLARIS_IMAGE_HPP
+
+#include "fwd.hpp"
+
+#include <memory>
+#include <string>
+
+namespace polaris {
+
+//! \brief Write the global environment to an image file. Values, lambdas
+//!        along with everything their closures captured, and the set of
+//!        imported files are written. Builtins are written by name, so
+//!        an image can only be loaded into an environment with the same
+//!        builtins. Futures, sequences, promises and builtins without a
+//!        name (such as memoized functions) can not be written, they are
+//!        reported as failures and no image is left behind
+//! \param path The file to write
+//! \param env The global environment to write
+//! \param imports The importer whose imported files should be recorded
+//! \returns false if the file could not be written or a global could not
+//!          be saved
+extern bool save_image(const std::string &path,
+                       std::shared_ptr<environment_c> env,
+                       const imports_c &imports);
+
+//! \brief Restore an image written by save_image into a global environment
+//!        that has already had its builtins added. Nothing is evaluated,
+//!        the bindings are set directly
+//! \param path The file to read
+//! \param engine The engine that will call the restored lambdas
+//! \param env The global environment to restore into
+//! \param imports The importer to mark the recorded files as imported in
+//! \returns false if the image could not be read, the error callback of
+//!          the environment is given the reason
+extern bool load_image(const std::string &path, engine_c &engine,
+                       std::shared_ptr<environment_c> env,
+                       imports_c &imports);
+
+} // namespace polaris
+
+#endif
@@ -1,16 +1,16 @@
 #include "imports.hpp"
 
-#include "evaluator.hpp"
-#include "feeder.hpp"
+#include "engine.hpp"
 #include "polaris.hpp"
 
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 
 namespace polaris {
 
-imports_c::imports_c(evaluator_c &eval,
+imports_c::imports_c(engine_c &eval,
                      std::shared_ptr<environment_c> environment,
                      const std::vector<std::string> &include_directories)
     : _evaluator(eval), _environment(environment),
@@ -23,7 +23,8 @@ void imports_c::import(const std::string &file) {
    while (!std::filesystem::is_regular_file(file_path)) {
 
       if (idx >= _include_directories.size()) {
-         std::cerr << "File not found : " << file << std::endl;
+         std::string err = "File not found : " + file;
+         _environment->get_error_cb()(error_level_e::FATAL, err.c_str());
          std::exit(EXIT_FAILURE);
       }
 
@@ -42,18 +43,16 @@ void imports_c::import(const std::string &file) {
 
 void imports_c::read_file(const std::string &path) {
 
-   std::fstream fs;
-   fs.open(path, std::fstream::in);
+   std::ifstream fs(path, std::ios::in | std::ios::binary);
    if (!fs.is_open()) {
-      std::cerr << "Unable to open file : " << path << std::endl;
+      std::string err = "Unable to open file : " + path;
+      _environment->get_error_cb()(error_level_e::FATAL, err.c_str());
       std::exit(EXIT_FAILURE);
    }
 
-   std::string line;
-   feeder_c feeder(_evaluator, _environment);
-   while (std::getline(fs, line)) {
-      feeder.feed(line);
-   }
+   std::string source((std::istreambuf_iterator<char>(fs)),
+                      std::istreambuf_iterator<char>());
+   evaluate_all(_evaluator, source, _environment, nullptr, path);
 }
 
 } // namespace polaris
\ No newline at end of file
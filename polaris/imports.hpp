@@ -13,9 +13,9 @@ namespace polaris {
 //! \brief Import helper
 class imports_c {
  public:
-   //! \brief Construct the importer with the evaluator that
+   //! \brief Construct the importer with the engine that
    // will be used to
-   imports_c(evaluator_c &eval, std::shared_ptr<environment_c> environment,
+   imports_c(engine_c &eval, std::shared_ptr<environment_c> environment,
              const std::vector<std::string> &include_directories);
 
    //! \brief Attempt to import a file - If its already imported nothing will
@@ -26,8 +26,18 @@ class imports_c {
    //! \param file The file to import
    void import(const std::string &file);
 
+   //! \brief Retrieve the full paths of every file imported so far
+   const std::set<std::string> &get_imported() const { return _imported; }
+
+   //! \brief Record a file as imported without reading it
+   //! \param path The full path of the file
+   void mark_imported(const std::string &path) { _imported.insert(path); }
+
+   //! \brief Retrieve the engine that imported files are run with
+   engine_c &get_engine() { return _evaluator; }
+
  private:
-   evaluator_c &_evaluator;
+   engine_c &_evaluator;
    std::shared_ptr<environment_c> _environment;
    std::set<std::string> _imported;
    std::vector<std::string> _include_directories;
@@ -0,0 +1,556 @@
+#include "macro.hpp"
+#include "builtins.hpp"
+#include "closure.hpp"
+#include "engine.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+#include "polaris.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <unordered_set>
+#include <vector>
+
+namespace polaris {
+
+namespace {
+
+//  A macro whose expansion keeps producing uses of macros is assumed to
+//  never finish
+//
+constexpr std::size_t max_expansions = 1000;
+
+std::atomic<uint64_t> fresh_names{0};
+
+bool is_symbol(const cell_t &c, const char *name) {
+   return c.type == cell_type_e::SYMBOL && c.val == name;
+}
+
+//  What a pattern variable matched. Variables under an ellipsis hold one
+//  binding per repetition instead of a form
+//
+struct binding_t {
+   cell_t form;
+   bool repeated{false};
+   std::vector<binding_t> items;
+};
+
+using bindings_t = std::unordered_map<std::string, binding_t>;
+using view_t = std::unordered_map<std::string, const binding_t *>;
+
+class rules_macro_c : public macro_c {
+ public:
+   rules_macro_c(std::string name, const cell_t &spec,
+                 std::shared_ptr<environment_c> env)
+       : macro_c(std::move(name)) {
+      if (spec.type != cell_type_e::LIST || spec.list.size() < 2 ||
+          !is_symbol(spec.list[0], "syntax-rules") ||
+          spec.list[1].type != cell_type_e::LIST) {
+         fail(env, "Expected (syntax-rules (literal*) (pattern template)*) "
+                   "for macro [" +
+                       this->name() + "]");
+      }
+      for (auto &literal : spec.list[1].list) {
+         _literals.insert(literal.val);
+      }
+      for (std::size_t i = 2; i < spec.list.size(); i++) {
+         const cell_t &rule = spec.list[i];
+         if (rule.type != cell_type_e::LIST || rule.list.size() != 2 ||
+             rule.list[0].type != cell_type_e::LIST ||
+             rule.list[0].list.empty()) {
+            fail(env, "Expected (pattern template) in macro [" +
+                          this->name() + "]");
+         }
+         rule_t r{rule.list[0], rule.list[1], {}};
+         std::unordered_set<std::string> vars;
+         for (std::size_t j = 1; j < r.pattern.list.size(); j++) {
+            pattern_vars(r.pattern.list[j], vars);
+         }
+         find_binders(r.tmpl, vars, r.binders);
+         _rules.push_back(std::move(r));
+      }
+   }
+
+ protected:
+   cell_t transform(const cell_t &form, engine_c &,
+                    std::shared_ptr<environment_c> env) override {
+      for (auto &rule : _rules) {
+         bindings_t bindings;
+         if (!match_items(rule.pattern, 1, form, 1, bindings)) {
+            continue;
+         }
+         view_t view;
+         for (auto &[name, binding] : bindings) {
+            view[name] = &binding;
+         }
+         std::unordered_map<std::string, std::string> renames;
+         return instantiate(rule.tmpl, view, rule, renames, env);
+      }
+      fail(env, "No rule of macro [" + name() + "] matches " +
+                    to_string(form));
+   }
+
+ private:
+   struct rule_t {
+      cell_t pattern;
+      cell_t tmpl;
+      std::unordered_set<std::string> binders;
+   };
+
+   void pattern_vars(const cell_t &p,
+                     std::unordered_set<std::string> &vars) const {
+      if (p.type == cell_type_e::SYMBOL) {
+         if (p.val != "_" && p.val != "..." && p.val != "." &&
+             !_literals.contains(p.val)) {
+            vars.insert(p.val);
+         }
+      } else if (p.type == cell_type_e::LIST) {
+         for (auto &item : p.list) {
+            pattern_vars(item, vars);
+         }
+      }
+   }
+
+   //  Names the template binds with lambda, let, let* or do that do not
+   //  come from the use, these are renamed on every expansion
+   //
+   static void find_binders(const cell_t &t,
+                            const std::unordered_set<std::string> &vars,
+                            std::unordered_set<std::string> &binders) {
+      if (t.type != cell_type_e::LIST || t.list.empty()) {
+         return;
+      }
+      auto add = [&](const cell_t &c) {
+         if (c.type == cell_type_e::SYMBOL && c.val != "..." &&
+             c.val != "." && !vars.contains(c.val)) {
+            binders.insert(c.val);
+         }
+      };
+      auto add_specs = [&](const cell_t &specs) {
+         for (auto &spec : specs.list) {
+            if (spec.type == cell_type_e::LIST && !spec.list.empty()) {
+               add(spec.list[0]);
+            }
+         }
+      };
+      const cell_t &head = t.list[0];
+      if (t.list.size() > 2) {
+         if (is_symbol(head, "lambda")) {
+            for (auto &param : t.list[1].list) {
+               add(param);
+            }
+         } else if (is_symbol(head, "let") &&
+                    t.list[1].type == cell_type_e::SYMBOL) {
+            add(t.list[1]);
+            add_specs(t.list[2]);
+         } else if (is_symbol(head, "let") || is_symbol(head, "let*") ||
+                    is_symbol(head, "do")) {
+            add_specs(t.list[1]);
+         }
+      }
+      for (auto &item : t.list) {
+         find_binders(item, vars, binders);
+      }
+   }
+
+   bool match(const cell_t &p, const cell_t &f, bindings_t &bindings) const {
+      if (p.type == cell_type_e::SYMBOL) {
+         if (p.val == "_") {
+            return true;
+         }
+         if (_literals.contains(p.val)) {
+            return f.type == cell_type_e::SYMBOL && f.val == p.val;
+         }
+         bindings[p.val].form = f;
+         return true;
+      }
+      if (p.type == cell_type_e::LIST) {
+         return f.type == cell_type_e::LIST &&
+                match_items(p, 0, f, 0, bindings);
+      }
+      return f.type == p.type && f.val == p.val;
+   }
+
+   bool match_items(const cell_t &p, std::size_t pi, const cell_t &f,
+                    std::size_t fi, bindings_t &bindings) const {
+      const cells &ps = p.list;
+      const cells &fs = f.list;
+      while (pi < ps.size()) {
+
+         //  (a . rest) matches rest against whatever is left
+         //
+         if (is_symbol(ps[pi], ".") && pi + 2 == ps.size()) {
+            cell_t rest(cell_type_e::LIST);
+            rest.list.assign(fs.begin() + static_cast<long>(fi), fs.end());
+            return match(ps[pi + 1], rest, bindings);
+         }
+
+         //  (a ... b c) gives the repetition everything that the patterns
+         //  after it do not need
+         //
+         if (pi + 1 < ps.size() && is_symbol(ps[pi + 1], "...")) {
+            std::size_t after = ps.size() - pi - 2;
+            if (fs.size() < fi + after) {
+               return false;
+            }
+            std::unordered_set<std::string> vars;
+            pattern_vars(ps[pi], vars);
+            for (auto &var : vars) {
+               bindings[var].repeated = true;
+            }
+            for (std::size_t end = fs.size() - after; fi < end; fi++) {
+               bindings_t item;
+               if (!match(ps[pi], fs[fi], item)) {
+                  return false;
+               }
+               for (auto &var : vars) {
+                  bindings[var].items.push_back(std::move(item[var]));
+               }
+            }
+            pi += 2;
+            continue;
+         }
+
+         if (fi >= fs.size() || !match(ps[pi], fs[fi], bindings)) {
+            return false;
+         }
+         ++pi;
+         ++fi;
+      }
+      return fi == fs.size();
+   }
+
+   static void repeated_vars(const cell_t &t, const view_t &view,
+                             std::vector<const std::string *> &vars) {
+      if (t.type == cell_type_e::SYMBOL) {
+         auto it = view.find(t.val);
+         if (it != view.end() && it->second->repeated &&
+             std::none_of(vars.begin(), vars.end(),
+                          [&](auto *v) { return *v == t.val; })) {
+            vars.push_back(&it->first);
+         }
+      } else if (t.type == cell_type_e::LIST) {
+         for (auto &item : t.list) {
+            repeated_vars(item, view, vars);
+         }
+      }
+   }
+
+   cell_t instantiate(const cell_t &t, const view_t &view, const rule_t &rule,
+                      std::unordered_map<std::string, std::string> &renames,
+                      std::shared_ptr<environment_c> env) const {
+      if (t.type == cell_type_e::SYMBOL) {
+         auto it = view.find(t.val);
+         if (it != view.end()) {
+            if (it->second->repeated) {
+               fail(env, "Pattern variable [" + t.val +
+                             "] needs ... in macro [" + name() + "]");
+            }
+            return it->second->form;
+         }
+         if (rule.binders.contains(t.val)) {
+            auto [rename, added] = renames.try_emplace(t.val);
+            if (added) {
+               rename->second = t.val + "%" + std::to_string(++fresh_names);
+            }
+            return cell_t(cell_type_e::SYMBOL, rename->second);
+         }
+         return t;
+      }
+      if (t.type != cell_type_e::LIST) {
+         return t;
+      }
+
+      cell_t out(cell_type_e::LIST);
+      out.list.reserve(t.list.size());
+      for (std::size_t i = 0; i < t.list.size(); i++) {
+         const cell_t &item = t.list[i];
+         if (i + 1 < t.list.size() && is_symbol(t.list[i + 1], "...")) {
+            std::vector<const std::string *> vars;
+            repeated_vars(item, view, vars);
+            if (vars.empty()) {
+               fail(env, "... follows a template without pattern "
+                         "variables in macro [" +
+                             name() + "]");
+            }
+            std::size_t count = view.at(*vars[0])->items.size();
+            for (auto *var : vars) {
+               if (view.at(*var)->items.size() != count) {
+                  fail(env, "Pattern variables repeat a different number "
+                            "of times in macro [" +
+                                name() + "]");
+               }
+            }
+            view_t inner = view;
+            for (std::size_t k = 0; k < count; k++) {
+               for (auto *var : vars) {
+                  inner[*var] = &view.at(*var)->items[k];
+               }
+               out.list.push_back(instantiate(item, inner, rule, renames, env));
+            }
+            ++i;
+            continue;
+         }
+
+         //  (f a . rest) splices the list rest was bound to
+         //
+         if (is_symbol(item, ".") && i + 2 == t.list.size()) {
+            cell_t rest = instantiate(t.list[i + 1], view, rule, renames, env);
+            if (rest.type == cell_type_e::LIST) {
+               out.list.insert(out.list.end(), rest.list.begin(),
+                               rest.list.end());
+            } else {
+               out.list.push_back(item);
+               out.list.push_back(std::move(rest));
+            }
+            break;
+         }
+         out.list.push_back(instantiate(item, view, rule, renames, env));
+      }
+      return out;
+   }
+
+   std::unordered_set<std::string> _literals;
+   std::vector<rule_t> _rules;
+};
+
+//  (define-macro (name param* [. rest]) body*), the body is an ordinary
+//  procedure that is given the forms of the use and returns the expansion
+//
+class procedure_macro_c : public macro_c {
+ public:
+   procedure_macro_c(std::string name, cell_t fn, std::size_t fixed,
+                     bool rest)
+       : macro_c(std::move(name)), _fn(std::move(fn)), _fixed(fixed),
+         _rest(rest) {}
+
+ protected:
+   cell_t transform(const cell_t &form, engine_c &engine,
+                    std::shared_ptr<environment_c> env) override {
+      std::size_t given = form.list.size() - 1;
+      if (given < _fixed || (!_rest && given != _fixed)) {
+         fail(env, "Expected " + std::to_string(_fixed) +
+                       (_rest ? " or more" : "") + " forms for macro [" +
+                       name() + "]");
+      }
+      cells args(form.list.begin() + 1,
+                 form.list.begin() + 1 + static_cast<long>(_fixed));
+      if (_rest) {
+         cell_t rest(cell_type_e::LIST);
+         rest.list.assign(form.list.begin() + 1 + static_cast<long>(_fixed),
+                          form.list.end());
+         args.push_back(std::move(rest));
+      }
+      return engine.apply(_fn, cell_span(args));
+   }
+
+ private:
+   cell_t _fn;
+   std::size_t _fixed;
+   bool _rest;
+};
+
+class expander_c {
+ public:
+   expander_c(std::shared_ptr<environment_c> env, engine_c &engine)
+       : _env(std::move(env)), _engine(engine) {}
+
+   cell_t expand(cell_t x) {
+      for (std::size_t rounds = 0;; rounds++) {
+         if (x.type != cell_type_e::LIST || x.list.empty()) {
+            return x;
+         }
+         const cell_t &head = x.list[0];
+         if (head.type == cell_type_e::SYMBOL) {
+            if (head.val == "quote") {
+               return x;
+            }
+            if (head.val == "define-syntax" || head.val == "define-macro") {
+               return define(x);
+            }
+            if (auto macro = find(head.val)) {
+               if (rounds == max_expansions) {
+                  fail(_env, "Expansion of macro [" + head.val +
+                                 "] did not terminate");
+               }
+               x = macro->expand(x, _engine, _env);
+               continue;
+            }
+            if (x.list.size() > 2) {
+               if (head.val == "lambda" || head.val == "let" ||
+                   head.val == "let*" || head.val == "do") {
+                  keep_analysis(x);
+               }
+               if (head.val == "lambda") {
+                  return expand_scope(std::move(x), 1, false);
+               }
+               if (head.val == "let" &&
+                   x.list[1].type == cell_type_e::SYMBOL) {
+                  _scope.push_back(x.list[1].val);
+                  x = expand_scope(std::move(x), 2, true);
+                  _scope.pop_back();
+                  return x;
+               }
+               if (head.val == "let" || head.val == "let*" ||
+                   head.val == "do") {
+                  return expand_scope(std::move(x), 1, true);
+               }
+            }
+         }
+         for (auto &item : x.list) {
+            item = expand(std::move(item));
+         }
+         return x;
+      }
+   }
+
+ private:
+   std::shared_ptr<macro_c> find(const std::string &name) const {
+      if (std::find(_scope.begin(), _scope.end(), name) != _scope.end()) {
+         return nullptr;
+      }
+      auto &bindings = _env->get_bindings();
+      auto it = bindings.find(name);
+      if (it == bindings.end() || it->second.type != cell_type_e::MACRO) {
+         return nullptr;
+      }
+      return std::static_pointer_cast<macro_c>(it->second.obj);
+   }
+
+   //  Expands a binding form with the names it binds hidden from the
+   //  macros of the same name. The values of let and do specs are
+   //  expanded too, let* and do can see the names so they are all hidden
+   //  while anything in the form is expanded
+   //
+   cell_t expand_scope(cell_t x, std::size_t names, bool specs) {
+      std::size_t depth = _scope.size();
+      for (auto &name : x.list[names].list) {
+         if (specs && name.type == cell_type_e::LIST && !name.list.empty()) {
+            _scope.push_back(name.list[0].val);
+         } else if (name.type == cell_type_e::SYMBOL) {
+            _scope.push_back(name.val);
+         }
+      }
+      for (std::size_t i = 1; i < x.list.size(); i++) {
+         x.list[i] = expand(std::move(x.list[i]));
+      }
+      _scope.resize(depth);
+      return x;
+   }
+
+   cell_t define(const cell_t &x) {
+      if (x.list.size() < 3) {
+         fail(_env, "Malformed macro definition " + to_string(x));
+      }
+      const cell_t &target = x.list[1];
+      std::string name;
+      std::shared_ptr<macro_c> macro;
+      if (target.type == cell_type_e::SYMBOL && x.list.size() == 3) {
+         name = target.val;
+         macro = std::make_shared<rules_macro_c>(name, x.list[2], _env);
+      } else if (x.list[0].val == "define-macro" &&
+                 target.type == cell_type_e::LIST && !target.list.empty() &&
+                 target.list[0].type == cell_type_e::SYMBOL) {
+         name = target.list[0].val;
+         macro = define_procedure(name, x);
+      } else {
+         fail(_env, "Malformed macro definition " + to_string(x));
+      }
+
+      cell_t c(cell_type_e::MACRO);
+      c.obj = macro;
+      _env->get(name) = c;
+
+      cell_t quoted(cell_type_e::LIST);
+      quoted.list.emplace_back(cell_type_e::SYMBOL, "quote");
+      quoted.list.emplace_back(cell_type_e::SYMBOL, name);
+      return quoted;
+   }
+
+   std::shared_ptr<macro_c> define_procedure(const std::string &name,
+                                             const cell_t &x) {
+      const cells &target = x.list[1].list;
+      cell_t params(cell_type_e::LIST);
+      bool rest = false;
+      for (std::size_t i = 1; i < target.size(); i++) {
+         if (is_symbol(target[i], ".")) {
+            if (i + 2 != target.size()) {
+               fail(_env, "Expected one name after . in macro [" + name +
+                              "]");
+            }
+            rest = true;
+            continue;
+         }
+         params.list.push_back(target[i]);
+      }
+
+      cell_t lambda(cell_type_e::LIST);
+      lambda.list.emplace_back(cell_type_e::SYMBOL, "lambda");
+      lambda.list.push_back(std::move(params));
+      if (x.list.size() == 3) {
+         lambda.list.push_back(x.list[2]);
+      } else {
+         cell_t body(cell_type_e::LIST);
+         body.list.emplace_back(cell_type_e::SYMBOL, "begin");
+         body.list.insert(body.list.end(), x.list.begin() + 2, x.list.end());
+         lambda.list.push_back(std::move(body));
+      }
+
+      std::size_t fixed = lambda.list[1].list.size() - (rest ? 1 : 0);
+      cell_t fn = _engine.evaluate(expand(std::move(lambda)), _env);
+      return std::make_shared<procedure_macro_c>(name, std::move(fn), fixed,
+                                                 rest);
+   }
+
+   std::shared_ptr<environment_c> _env;
+   engine_c &_engine;
+   std::vector<std::string> _scope;
+};
+
+} // namespace
+
+cell_t macro_c::expand(const cell_t &form, engine_c &engine,
+                       std::shared_ptr<environment_c> env) {
+
+   //  Uses are equal whatever line they are on, the expansion is placed
+   //  where this one is
+   //
+   auto it = _cache.find(form);
+   if (it != _cache.end()) {
+      cell_t result = it->second;
+      result.loc = form.loc;
+      return result;
+   }
+   cell_t result = transform(form, engine, env);
+   result.loc = form.loc;
+   if (_cache.size() < macro_cache_size) {
+      _cache.emplace(form, result);
+   }
+   return result;
+}
+
+cell_t expand_macros(cell_t form, std::shared_ptr<environment_c> env,
+                     engine_c &engine) {
+
+   //  Nothing to do for atoms, the common case for a repl
+   //
+   if (form.type != cell_type_e::LIST) {
+      return form;
+   }
+   return expander_c(std::move(env), engine).expand(std::move(form));
+}
+
+void add_macro_globals(std::shared_ptr<environment_c> env, engine_c &engine) {
+
+   env->get("macroexpand") = cell_t([=, &engine](cell_span c) -> cell_t {
+      if (c.size() != 1) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected 1 argument for [macroexpand]");
+         std::exit(1);
+      }
+      return expand_macros(c[0], env, engine);
+   });
+}
+
+} // namespace polaris
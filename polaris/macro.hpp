@@ -0,0 +1,69 @@
+#ifndef POLARIS_MACRO_HPP
+#define POLARIS_MACRO_HPP
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace polaris {
+
+//! \brief Uses of one macro are cached up to this many distinct forms
+constexpr std::size_t macro_cache_size = 4096;
+
+//! \brief A macro bound in the global environment. Each use is rewritten
+//!        once, before anything is evaluated, and the rewrite of a form is
+//!        remembered so the same use is never rewritten twice
+class macro_c : public object_c {
+ public:
+   //! \brief Create the macro
+   //! \param name The name the macro is bound to
+   explicit macro_c(std::string name) : _name(std::move(name)) {}
+
+   //! \brief Rewrite one use of the macro, the result may hold other uses
+   //!        that still need expanding
+   //! \param form The use, headed by the name of the macro
+   //! \param engine The engine that procedural macros are called with
+   //! \param env The global environment
+   cell_t expand(const cell_t &form, engine_c &engine,
+                 std::shared_ptr<environment_c> env);
+
+   //! \brief Retrieve the name the macro is bound to
+   const std::string &name() const { return _name; }
+
+ protected:
+   //! \brief Rewrite a use that is not in the cache
+   virtual cell_t transform(const cell_t &form, engine_c &engine,
+                            std::shared_ptr<environment_c> env) = 0;
+
+ private:
+   std::string _name;
+   std::unordered_map<cell_t, cell_t, cell_hash_t, cell_equal_t> _cache;
+};
+
+//! \brief Expand every macro used in a form. `(define-syntax name
+//!        (syntax-rules (literal*) (pattern template)*))` and
+//!        `(define-macro (name param*) body*)` define macros in the global
+//!        environment as they are met and are replaced by the quoted name.
+//!        Names bound by an enclosing lambda, let, let* or do are not
+//!        treated as macros. Binders that a template introduces are given
+//!        fresh names so they can not capture the variables of the use
+//! \param form The form to expand
+//! \param env The global environment macros are found in and defined in
+//! \param engine The engine procedural macros are defined and called with
+extern cell_t expand_macros(cell_t form, std::shared_ptr<environment_c> env,
+                            engine_c &engine);
+
+//! \brief Add the macro builtins to an environment. This is `(macroexpand
+//!        form)`, which returns the form with its macros expanded
+//! \param env The environment to load the symbols into
+//! \param engine The engine procedural macros are called with
+extern void add_macro_globals(std::shared_ptr<environment_c> env,
+                              engine_c &engine);
+
+} // namespace polaris
+
+#endif
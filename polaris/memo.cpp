@@ -0,0 +1,108 @@
+#include "memo.hpp"
+#include "engine.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+namespace polaris {
+
+const cell_t *memo_c::find(const cell_t &key) {
+   auto it = _index.find(key);
+   if (it == _index.end()) {
+      return nullptr;
+   }
+   _entries.splice(_entries.begin(), _entries, it->second);
+   return &it->second->second;
+}
+
+void memo_c::insert(cell_t key, cell_t value) {
+   if (_capacity == 0) {
+      return;
+   }
+
+   // The call that produced the value may have cached the same key already
+   // (recursion), the newest result wins
+   //
+   auto it = _index.find(key);
+   if (it != _index.end()) {
+      it->second->second = std::move(value);
+      _entries.splice(_entries.begin(), _entries, it->second);
+      return;
+   }
+
+   if (_entries.size() >= _capacity) {
+      _index.erase(_entries.back().first);
+      _entries.pop_back();
+   }
+   _entries.emplace_front(key, std::move(value));
+   _index.emplace(std::move(key), _entries.begin());
+}
+
+void memo_c::clear() {
+   _index.clear();
+   _entries.clear();
+}
+
+void add_memo_globals(std::shared_ptr<environment_c> env, engine_c &engine) {
+
+   env->get("memoize") = cell_t([=, &engine](cell_span c) -> cell_t {
+      if (c.empty() || c.size() > 2 ||
+          (c[0].type != cell_type_e::LAMBDA &&
+           c[0].type != cell_type_e::PROC)) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected a function and optional capacity "
+                             "for [memoize]");
+         std::exit(1);
+      }
+
+      std::size_t capacity = default_memo_capacity;
+      if (c.size() == 2) {
+         try {
+            capacity = std::stoull(c[1].val);
+         } catch (const std::exception &) {
+            env->get_error_cb()(error_level_e::FATAL,
+                                "invalid capacity for [memoize]");
+            std::exit(1);
+         }
+      }
+
+      auto memo = std::make_shared<memo_c>(capacity);
+      cell_t result([&engine, memo, fn = c[0]](cell_span args) -> cell_t {
+         cell_t key(cell_type_e::LIST);
+         key.list.assign(args.begin(), args.end());
+         if (auto cached = memo->find(key)) {
+            return *cached;
+         }
+         cell_t value = engine.apply(fn, args);
+         memo->insert(std::move(key), value);
+         return value;
+      });
+      result.obj = memo;
+      return result;
+   });
+
+   env->get("clear-memo") = cell_t([=](cell_span c) -> cell_t {
+      if (c.size() != 1 || c[0].type != cell_type_e::PROC ||
+          !std::dynamic_pointer_cast<memo_c>(c[0].obj)) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected a memoized function for [clear-memo]");
+         std::exit(1);
+      }
+      std::static_pointer_cast<memo_c>(c[0].obj)->clear();
+      return true_sym;
+   });
+
+   env->get("equal?") = cell_t([=](cell_span c) -> cell_t {
+      if (c.size() != 2) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected 2 arguments for [equal?]");
+         std::exit(1);
+      }
+      return cell_equal(c[0], c[1]) ? true_sym : false_sym;
+   });
+}
+
+} // namespace polaris
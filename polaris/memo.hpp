@@ -0,0 +1,65 @@
+#ifndef POLARIS_MEMO_HPP
+#define POLARIS_MEMO_HPP
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+namespace polaris {
+
+//! \brief Cache of call results keyed by the structure of the arguments.
+//!        Holds a bounded number of results, the least recently used
+//!        result is evicted first
+class memo_c : public object_c {
+ public:
+   //! \brief Create the cache
+   //! \param capacity The most results to hold
+   explicit memo_c(std::size_t capacity) : _capacity(capacity) {}
+
+   //! \brief Find the result for a set of arguments, marking it as the most
+   //!        recently used
+   //! \param key The arguments of the call as a list
+   //! \returns The result, or nullptr if it is not cached
+   const cell_t *find(const cell_t &key);
+
+   //! \brief Cache the result for a set of arguments
+   //! \param key The arguments of the call as a list
+   //! \param value The result of the call
+   void insert(cell_t key, cell_t value);
+
+   //! \brief Drop every cached result
+   void clear();
+
+   //! \brief Retrieve the number of cached results
+   std::size_t size() const { return _entries.size(); }
+
+ private:
+   using entry_t = std::pair<cell_t, cell_t>;
+
+   std::size_t _capacity;
+   std::list<entry_t> _entries;
+   std::unordered_map<cell_t, std::list<entry_t>::iterator, cell_hash_t,
+                      cell_equal_t>
+       _index;
+};
+
+//! \brief Number of results memoize keeps when no capacity is given
+constexpr std::size_t default_memo_capacity = 4096;
+
+//! \brief Add the memoization builtins to an environment. These are
+//!        `(memoize fn [capacity])` that returns a caching version of fn,
+//!        `(clear-memo fn)` that empties the cache of a memoized function
+//!        and `(equal? a b)` for structural equality
+//! \param env The environment to load the symbols into
+//! \param engine The engine used to call memoized lambdas
+extern void add_memo_globals(std::shared_ptr<environment_c> env,
+                             engine_c &engine);
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef POLARIS_NATIVE_HPP
+#define POLARIS_NATIVE_HPP
+
+#include "cell.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace polaris {
+
+//! \brief Argument buffer for a call. Up to N arguments are built in place
+//!        on the callers stack, longer argument lists spill over to the heap
+template <std::size_t N> class arguments_c {
+ public:
+   //! \brief Prepare the buffer for a given number of arguments
+   //! \param count The number of arguments that will be pushed
+   explicit arguments_c(std::size_t count) {
+      if (count > N) {
+         _spill.reserve(count);
+      }
+   }
+
+   arguments_c(const arguments_c &) = delete;
+   arguments_c &operator=(const arguments_c &) = delete;
+
+   ~arguments_c() {
+      for (std::size_t i = 0; i < _size; i++) {
+         std::destroy_at(slot(i));
+      }
+   }
+
+   //! \brief Add the next argument
+   //! \param c The evaluated argument
+   void push_back(cell_t &&c) {
+      if (_size < N && _spill.empty()) {
+         std::construct_at(slot(_size++), std::move(c));
+         return;
+      }
+      if (_spill.empty()) {
+         for (std::size_t i = 0; i < _size; i++) {
+            _spill.push_back(std::move(*slot(i)));
+         }
+      }
+      _spill.push_back(std::move(c));
+   }
+
+   //! \brief Retrieve the arguments to hand to a call
+   cell_span span() const {
+      if (!_spill.empty()) {
+         return cell_span(_spill);
+      }
+      return cell_span(reinterpret_cast<const cell_t *>(_storage), _size);
+   }
+
+ private:
+   cell_t *slot(std::size_t i) {
+      return std::launder(reinterpret_cast<cell_t *>(_storage) + i);
+   }
+
+   alignas(cell_t) std::byte _storage[N * sizeof(cell_t)];
+   std::size_t _size{0};
+   std::vector<cell_t> _spill;
+};
+
+//! \brief Number of arguments the engines keep on the stack for a call
+constexpr std::size_t stack_arguments = 4;
+
+//! \brief Conversion between a C++ type and a cell. Specialized for the
+//!        types that can appear in the signature of a native function
+template <typename T> struct native_type_t;
+
+template <> struct native_type_t<cell_t> {
+   static const cell_t &from(const cell_t &c) { return c; }
+   static cell_t to(cell_t v) { return v; }
+};
+
+template <> struct native_type_t<bool> {
+   static bool from(const cell_t &c) { return c.val != false_sym.val; }
+   static cell_t to(bool v) { return v ? true_sym : false_sym; }
+};
+
+template <std::integral T> struct native_type_t<T> {
+   static T from(const cell_t &c) {
+      if (c.type == cell_type_e::DOUBLE) {
+         return static_cast<T>(std::stod(c.val));
+      }
+      T value{};
+      auto [end, ec] =
+          std::from_chars(c.val.data(), c.val.data() + c.val.size(), value);
+      if (ec == std::errc::result_out_of_range) {
+         throw std::out_of_range(c.val);
+      }
+      if (ec != std::errc() || end != c.val.data() + c.val.size()) {
+         throw std::invalid_argument(c.val);
+      }
+      return value;
+   }
+   static cell_t to(T v) {
+      return cell_t(cell_type_e::NUMBER, std::to_string(v));
+   }
+};
+
+template <std::floating_point T> struct native_type_t<T> {
+   static T from(const cell_t &c) { return static_cast<T>(std::stod(c.val)); }
+   static cell_t to(T v) {
+      return cell_t(cell_type_e::DOUBLE, std::to_string(v));
+   }
+};
+
+template <> struct native_type_t<std::string> {
+   static const std::string &from(const cell_t &c) { return c.val; }
+   static cell_t to(std::string v) {
+      return cell_t(cell_type_e::STRING, std::move(v));
+   }
+};
+
+template <> struct native_type_t<std::string_view> {
+   static std::string_view from(const cell_t &c) { return c.val; }
+   static cell_t to(std::string_view v) {
+      return cell_t(cell_type_e::STRING, std::string(v));
+   }
+};
+
+template <> struct native_type_t<const char *> {
+   static const char *from(const cell_t &c) { return c.val.c_str(); }
+   static cell_t to(const char *v) { return cell_t(cell_type_e::STRING, v); }
+};
+
+namespace detail {
+
+template <typename T> using native_t = native_type_t<std::remove_cvref_t<T>>;
+
+template <typename Fn> struct signature_t;
+
+template <typename R, typename... Args> struct signature_t<R (*)(Args...)> {
+   using result = R;
+   using args = std::tuple<Args...>;
+};
+
+template <typename C, typename R, typename... Args>
+struct signature_t<R (C::*)(Args...) const> {
+   using result = R;
+   using args = std::tuple<Args...>;
+};
+
+template <typename C, typename R, typename... Args>
+struct signature_t<R (C::*)(Args...)> {
+   using result = R;
+   using args = std::tuple<Args...>;
+};
+
+template <typename Fn>
+   requires requires { &Fn::operator(); }
+struct signature_t<Fn> : signature_t<decltype(&Fn::operator())> {};
+
+template <typename R, typename Fn, typename... Args, std::size_t... I>
+cell_t invoke(Fn &fn, cell_span c, std::tuple<Args...> *,
+              std::index_sequence<I...>) {
+   if constexpr (std::is_void_v<R>) {
+      fn(native_t<Args>::from(c[I])...);
+      return nil;
+   } else {
+      return native_t<R>::to(fn(native_t<Args>::from(c[I])...));
+   }
+}
+
+} // namespace detail
+
+//! \brief Bind an ordinary C++ function (or lambda) into the environment.
+//!        Arguments are unpacked from the call and converted to the
+//!        parameter types at compile time, the result is converted back
+//!        into a cell. Supported types are cell_t, bool, integers, floating
+//!        point numbers, std::string, std::string_view and const char *
+//! \param env The environment to register the function in
+//! \param name The name of the function within polaris
+//! \param fn The function to bind
+template <typename Fn>
+void register_native(std::shared_ptr<environment_c> env,
+                     const std::string &name, Fn fn) {
+   using signature = detail::signature_t<std::decay_t<Fn>>;
+   using result = typename signature::result;
+   using args = typename signature::args;
+   constexpr std::size_t arity = std::tuple_size_v<args>;
+
+   env->get(name) = cell_t([=](cell_span c) mutable -> cell_t {
+      if (c.size() != arity) {
+         std::string err = "Expected " + std::to_string(arity) +
+                           " arguments for [" + name + "]";
+         env->get_error_cb()(error_level_e::FATAL, err.c_str());
+         std::exit(1);
+      }
+      try {
+         return detail::invoke<result>(fn, c, static_cast<args *>(nullptr),
+                                       std::make_index_sequence<arity>{});
+      } catch (const std::invalid_argument &) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "invalid argument for native conversion");
+      } catch (const std::out_of_range &) {
+         env->get_error_cb()(error_level_e::FATAL, "out of range");
+      }
+      std::exit(1);
+   });
+   env->get(name).val = name;
+   count_calls(env->get(name), name);
+}
+
+} // namespace polaris
+
+#endif
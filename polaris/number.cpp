@@ -0,0 +1,526 @@
+#include "number.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+
+namespace polaris {
+
+namespace {
+
+using limbs_t = std::vector<uint32_t>;
+
+constexpr uint32_t base = 1000000000;
+constexpr std::size_t base_digits = 9;
+
+//  Below this many limbs in the smaller operand schoolbook multiplication
+//  beats splitting the operands
+//
+constexpr std::size_t karatsuba_threshold = 32;
+
+void trim(limbs_t &l) {
+   while (!l.empty() && l.back() == 0) {
+      l.pop_back();
+   }
+}
+
+int compare_magnitude(const limbs_t &a, const limbs_t &b) {
+   if (a.size() != b.size()) {
+      return a.size() < b.size() ? -1 : 1;
+   }
+   for (std::size_t i = a.size(); i-- > 0;) {
+      if (a[i] != b[i]) {
+         return a[i] < b[i] ? -1 : 1;
+      }
+   }
+   return 0;
+}
+
+limbs_t add_magnitude(const limbs_t &a, const limbs_t &b) {
+   limbs_t r(std::max(a.size(), b.size()) + 1, 0);
+   uint32_t carry = 0;
+   for (std::size_t i = 0; i < r.size(); i++) {
+      uint32_t sum = carry;
+      if (i < a.size()) {
+         sum += a[i];
+      }
+      if (i < b.size()) {
+         sum += b[i];
+      }
+      carry = sum >= base;
+      r[i] = carry ? sum - base : sum;
+   }
+   trim(r);
+   return r;
+}
+
+// a - b, where a is at least b
+limbs_t subtract_magnitude(const limbs_t &a, const limbs_t &b) {
+   limbs_t r(a);
+   int64_t borrow = 0;
+   for (std::size_t i = 0; i < r.size(); i++) {
+      int64_t diff = static_cast<int64_t>(r[i]) - borrow -
+                     (i < b.size() ? static_cast<int64_t>(b[i]) : 0);
+      borrow = diff < 0;
+      r[i] = static_cast<uint32_t>(borrow ? diff + base : diff);
+   }
+   trim(r);
+   return r;
+}
+
+// r += x * base^shift, r is large enough to hold the result
+void add_shifted(limbs_t &r, const limbs_t &x, std::size_t shift) {
+   uint32_t carry = 0;
+   std::size_t i = 0;
+   for (; i < x.size() || carry; i++) {
+      uint32_t sum = r[i + shift] + carry + (i < x.size() ? x[i] : 0);
+      carry = sum >= base;
+      r[i + shift] = carry ? sum - base : sum;
+   }
+}
+
+limbs_t multiply_schoolbook(const limbs_t &a, const limbs_t &b) {
+   limbs_t r(a.size() + b.size(), 0);
+   for (std::size_t i = 0; i < a.size(); i++) {
+      uint64_t carry = 0;
+      for (std::size_t j = 0; j < b.size(); j++) {
+         uint64_t cur = r[i + j] + static_cast<uint64_t>(a[i]) * b[j] + carry;
+         r[i + j] = static_cast<uint32_t>(cur % base);
+         carry = cur / base;
+      }
+      r[i + b.size()] = static_cast<uint32_t>(carry);
+   }
+   trim(r);
+   return r;
+}
+
+limbs_t multiply_magnitude(const limbs_t &a, const limbs_t &b) {
+   if (a.empty() || b.empty()) {
+      return {};
+   }
+   if (std::min(a.size(), b.size()) < karatsuba_threshold) {
+      return multiply_schoolbook(a, b);
+   }
+
+   // a = a1 * base^m + a0, b = b1 * base^m + b0
+   //
+   std::size_t m = std::max(a.size(), b.size()) / 2;
+   auto low = [m](const limbs_t &x) {
+      limbs_t l(x.begin(), x.begin() + std::min(m, x.size()));
+      trim(l);
+      return l;
+   };
+   auto high = [m](const limbs_t &x) {
+      return x.size() > m ? limbs_t(x.begin() + m, x.end()) : limbs_t{};
+   };
+   limbs_t a0 = low(a), a1 = high(a), b0 = low(b), b1 = high(b);
+
+   limbs_t z0 = multiply_magnitude(a0, b0);
+   limbs_t z2 = multiply_magnitude(a1, b1);
+   limbs_t z1 =
+       multiply_magnitude(add_magnitude(a0, a1), add_magnitude(b0, b1));
+   z1 = subtract_magnitude(subtract_magnitude(z1, z0), z2);
+
+   limbs_t r(a.size() + b.size() + 1, 0);
+   add_shifted(r, z0, 0);
+   add_shifted(r, z1, m);
+   add_shifted(r, z2, 2 * m);
+   trim(r);
+   return r;
+}
+
+limbs_t multiply_small(const limbs_t &a, uint32_t m) {
+   limbs_t r(a.size() + 1, 0);
+   uint64_t carry = 0;
+   for (std::size_t i = 0; i < a.size(); i++) {
+      uint64_t cur = static_cast<uint64_t>(a[i]) * m + carry;
+      r[i] = static_cast<uint32_t>(cur % base);
+      carry = cur / base;
+   }
+   r[a.size()] = static_cast<uint32_t>(carry);
+   trim(r);
+   return r;
+}
+
+// Long division, one limb of the quotient at a time. Each limb is found by
+// a binary search, division is rare enough that this is not worth more
+limbs_t divide_magnitude(const limbs_t &a, const limbs_t &b) {
+   if (compare_magnitude(a, b) < 0) {
+      return {};
+   }
+
+   limbs_t q(a.size(), 0);
+   if (b.size() == 1) {
+      uint64_t rem = 0;
+      for (std::size_t i = a.size(); i-- > 0;) {
+         uint64_t cur = rem * base + a[i];
+         q[i] = static_cast<uint32_t>(cur / b[0]);
+         rem = cur % b[0];
+      }
+      trim(q);
+      return q;
+   }
+
+   limbs_t rem;
+   for (std::size_t i = a.size(); i-- > 0;) {
+      rem.insert(rem.begin(), a[i]);
+      trim(rem);
+      uint32_t lo = 0;
+      uint32_t hi = base - 1;
+      while (lo < hi) {
+         uint32_t mid = lo + (hi - lo + 1) / 2;
+         if (compare_magnitude(multiply_small(b, mid), rem) <= 0) {
+            lo = mid;
+         } else {
+            hi = mid - 1;
+         }
+      }
+      q[i] = lo;
+      if (lo) {
+         rem = subtract_magnitude(rem, multiply_small(b, lo));
+      }
+   }
+   trim(q);
+   return q;
+}
+
+enum class parsed_e { INT64, BIG, OTHER };
+
+// Parse an integer, BIG if it is one but does not fit in 64 bits
+parsed_e parse_integer(const std::string &s, int64_t &value) {
+   const char *begin = s.data();
+   const char *end = s.data() + s.size();
+   if (begin != end && *begin == '+') {
+      ++begin;
+   }
+   auto [ptr, ec] = std::from_chars(begin, end, value);
+   if (ptr != end || begin == end) {
+      return parsed_e::OTHER;
+   }
+   if (ec == std::errc()) {
+      return parsed_e::INT64;
+   }
+   return ec == std::errc::result_out_of_range ? parsed_e::BIG
+                                               : parsed_e::OTHER;
+}
+
+cell_t integer_cell(int64_t value) {
+   char buffer[24];
+   auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+   return cell_t(cell_type_e::NUMBER, std::string(buffer, ptr));
+}
+
+bigint_c apply(arithmetic_e op, const bigint_c &lhs, const bigint_c &rhs) {
+   switch (op) {
+   case arithmetic_e::ADD:
+      return lhs + rhs;
+   case arithmetic_e::SUBTRACT:
+      return lhs - rhs;
+   case arithmetic_e::MULTIPLY:
+      return lhs * rhs;
+   case arithmetic_e::DIVIDE:
+      return lhs / rhs;
+   }
+   return lhs;
+}
+
+// False if the result does not fit
+bool apply(arithmetic_e op, int64_t lhs, int64_t rhs, int64_t &result) {
+   switch (op) {
+   case arithmetic_e::ADD:
+      return !__builtin_add_overflow(lhs, rhs, &result);
+   case arithmetic_e::SUBTRACT:
+      return !__builtin_sub_overflow(lhs, rhs, &result);
+   case arithmetic_e::MULTIPLY:
+      return !__builtin_mul_overflow(lhs, rhs, &result);
+   case arithmetic_e::DIVIDE:
+      if (rhs == 0) {
+         throw std::domain_error("division by zero");
+      }
+      if (lhs == std::numeric_limits<int64_t>::min() && rhs == -1) {
+         return false;
+      }
+      result = lhs / rhs;
+      return true;
+   }
+   return false;
+}
+
+// Nothing if an argument is not an integer
+std::optional<cell_t> integer_arithmetic(arithmetic_e op, cell_span args) {
+   int64_t acc = op == arithmetic_e::MULTIPLY ? 1 : 0;
+   std::optional<bigint_c> big;
+   auto arg = args.begin();
+   if (op == arithmetic_e::SUBTRACT || op == arithmetic_e::DIVIDE) {
+      switch (parse_integer(arg->val, acc)) {
+      case parsed_e::INT64:
+         break;
+      case parsed_e::BIG:
+         big = bigint_c(arg->val);
+         break;
+      case parsed_e::OTHER:
+         return std::nullopt;
+      }
+      ++arg;
+   }
+
+   for (; arg != args.end(); ++arg) {
+      int64_t value;
+      parsed_e parsed = parse_integer(arg->val, value);
+      if (parsed == parsed_e::OTHER) {
+         return std::nullopt;
+      }
+      int64_t result;
+      if (!big && parsed == parsed_e::INT64 &&
+          apply(op, acc, value, result)) {
+         acc = result;
+         continue;
+      }
+      if (!big) {
+         big = bigint_c(acc);
+      }
+      big = apply(op, *big,
+                  parsed == parsed_e::INT64 ? bigint_c(value)
+                                            : bigint_c(arg->val));
+      if (big->fits_int64()) {
+         acc = big->to_int64();
+         big.reset();
+      }
+   }
+
+   if (big) {
+      return cell_t(cell_type_e::NUMBER, big->to_string());
+   }
+   return integer_cell(acc);
+}
+
+cell_t double_arithmetic(arithmetic_e op, cell_span args) {
+   double n = op == arithmetic_e::MULTIPLY ? 1 : 0;
+   bool store_as_double = false;
+   auto arg = args.begin();
+   if (op == arithmetic_e::SUBTRACT || op == arithmetic_e::DIVIDE) {
+      n = std::stod(arg->val);
+      store_as_double = arg->type == cell_type_e::DOUBLE;
+      ++arg;
+   }
+   for (; arg != args.end(); ++arg) {
+      double value = std::stod(arg->val);
+      switch (op) {
+      case arithmetic_e::ADD:
+         n += value;
+         break;
+      case arithmetic_e::SUBTRACT:
+         n -= value;
+         break;
+      case arithmetic_e::MULTIPLY:
+         n *= value;
+         break;
+      case arithmetic_e::DIVIDE:
+         n /= value;
+         break;
+      }
+      if (arg->type == cell_type_e::DOUBLE) {
+         store_as_double = true;
+      }
+   }
+   if (store_as_double) {
+      return cell_t(cell_type_e::DOUBLE, std::to_string(n));
+   }
+   return cell_t(cell_type_e::NUMBER, std::to_string(static_cast<long>(n)));
+}
+
+// Less than, equal to or greater than zero, as for strcmp
+int compare_numbers(const cell_t &lhs, const cell_t &rhs) {
+   if (lhs.type != cell_type_e::DOUBLE && rhs.type != cell_type_e::DOUBLE) {
+      int64_t l, r;
+      parsed_e pl = parse_integer(lhs.val, l);
+      parsed_e pr = parse_integer(rhs.val, r);
+      if (pl == parsed_e::INT64 && pr == parsed_e::INT64) {
+         return (l > r) - (l < r);
+      }
+      if (pl != parsed_e::OTHER && pr != parsed_e::OTHER) {
+         return bigint_c(lhs.val).compare(bigint_c(rhs.val));
+      }
+   }
+   double l = std::stod(lhs.val);
+   double r = std::stod(rhs.val);
+   return (l > r) - (l < r);
+}
+
+} // namespace
+
+bigint_c::bigint_c(int64_t value) {
+   _negative = value < 0;
+   uint64_t magnitude = _negative ? 0 - static_cast<uint64_t>(value)
+                                  : static_cast<uint64_t>(value);
+   while (magnitude) {
+      _limbs.push_back(static_cast<uint32_t>(magnitude % base));
+      magnitude /= base;
+   }
+}
+
+bigint_c::bigint_c(std::string_view decimal) {
+   bool negative = false;
+   if (!decimal.empty() && (decimal[0] == '+' || decimal[0] == '-')) {
+      negative = decimal[0] == '-';
+      decimal.remove_prefix(1);
+   }
+   if (decimal.empty()) {
+      throw std::invalid_argument("not an integer");
+   }
+   for (char c : decimal) {
+      if (c < '0' || c > '9') {
+         throw std::invalid_argument("not an integer");
+      }
+   }
+
+   for (std::size_t end = decimal.size(); end > 0;) {
+      std::size_t start = end > base_digits ? end - base_digits : 0;
+      uint32_t limb = 0;
+      for (std::size_t i = start; i < end; i++) {
+         limb = limb * 10 + static_cast<uint32_t>(decimal[i] - '0');
+      }
+      _limbs.push_back(limb);
+      end = start;
+   }
+   trim(_limbs);
+   _negative = negative && !_limbs.empty();
+}
+
+std::string bigint_c::to_string() const {
+   if (_limbs.empty()) {
+      return "0";
+   }
+   std::string s = _negative ? "-" : "";
+   s += std::to_string(_limbs.back());
+   for (std::size_t i = _limbs.size() - 1; i-- > 0;) {
+      std::string limb = std::to_string(_limbs[i]);
+      s.append(base_digits - limb.size(), '0');
+      s += limb;
+   }
+   return s;
+}
+
+bool bigint_c::fits_int64() const {
+   if (_limbs.size() > 3) {
+      return false;
+   }
+   unsigned __int128 magnitude = 0;
+   for (std::size_t i = _limbs.size(); i-- > 0;) {
+      magnitude = magnitude * base + _limbs[i];
+   }
+   unsigned __int128 max = std::numeric_limits<int64_t>::max();
+   return magnitude <= (_negative ? max + 1 : max);
+}
+
+int64_t bigint_c::to_int64() const {
+   uint64_t magnitude = 0;
+   for (std::size_t i = _limbs.size(); i-- > 0;) {
+      magnitude = magnitude * base + _limbs[i];
+   }
+   return _negative ? static_cast<int64_t>(0 - magnitude)
+                    : static_cast<int64_t>(magnitude);
+}
+
+int bigint_c::compare(const bigint_c &other) const {
+   if (_negative != other._negative) {
+      return _negative ? -1 : 1;
+   }
+   int magnitude = compare_magnitude(_limbs, other._limbs);
+   return _negative ? -magnitude : magnitude;
+}
+
+bigint_c bigint_c::make(bool negative, limbs_t limbs) {
+   bigint_c r;
+   trim(limbs);
+   r._negative = negative && !limbs.empty();
+   r._limbs = std::move(limbs);
+   return r;
+}
+
+bigint_c bigint_c::add(const bigint_c &lhs, const bigint_c &rhs,
+                       bool negate_rhs) {
+   bool rhs_negative = rhs._negative != negate_rhs;
+   if (lhs._negative == rhs_negative) {
+      return make(lhs._negative, add_magnitude(lhs._limbs, rhs._limbs));
+   }
+   if (compare_magnitude(lhs._limbs, rhs._limbs) >= 0) {
+      return make(lhs._negative, subtract_magnitude(lhs._limbs, rhs._limbs));
+   }
+   return make(rhs_negative, subtract_magnitude(rhs._limbs, lhs._limbs));
+}
+
+bigint_c bigint_c::operator+(const bigint_c &other) const {
+   return add(*this, other, false);
+}
+
+bigint_c bigint_c::operator-(const bigint_c &other) const {
+   return add(*this, other, true);
+}
+
+bigint_c bigint_c::operator*(const bigint_c &other) const {
+   return make(_negative != other._negative,
+               multiply_magnitude(_limbs, other._limbs));
+}
+
+bigint_c bigint_c::operator/(const bigint_c &other) const {
+   if (other.is_zero()) {
+      throw std::domain_error("division by zero");
+   }
+   return make(_negative != other._negative,
+               divide_magnitude(_limbs, other._limbs));
+}
+
+cell_t arithmetic(arithmetic_e op, cell_span args) {
+   if (args.empty()) {
+      if (op == arithmetic_e::ADD || op == arithmetic_e::MULTIPLY) {
+         return integer_cell(op == arithmetic_e::ADD ? 0 : 1);
+      }
+      throw std::invalid_argument("expected at least one argument");
+   }
+
+   bool integers = std::none_of(args.begin(), args.end(), [](auto &c) {
+      return c.type == cell_type_e::DOUBLE;
+   });
+   if (integers) {
+      if (auto result = integer_arithmetic(op, args)) {
+         return std::move(*result);
+      }
+   }
+   return double_arithmetic(op, args);
+}
+
+bool compare(comparison_e op, cell_span args) {
+   if (args.empty()) {
+      throw std::invalid_argument("expected at least one argument");
+   }
+
+   // The first argument is compared with each of the others
+   //
+   for (auto i = args.begin() + 1; i != args.end(); ++i) {
+      int order = compare_numbers(args[0], *i);
+      bool holds = false;
+      switch (op) {
+      case comparison_e::LESS:
+         holds = order < 0;
+         break;
+      case comparison_e::LESS_EQUAL:
+         holds = order <= 0;
+         break;
+      case comparison_e::GREATER:
+         holds = order > 0;
+         break;
+      case comparison_e::GREATER_EQUAL:
+         holds = order >= 0;
+         break;
+      }
+      if (!holds) {
+         return false;
+      }
+   }
+   return true;
+}
+
+} // namespace polaris
@@ -0,0 +1,91 @@
+#ifndef POLARIS_NUMBER_HPP
+#define POLARIS_NUMBER_HPP
+
+#include "cell.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace polaris {
+
+//! \brief Arbitrary precision integer. Only used by the arithmetic builtins
+//!        once a result no longer fits in 64 bits, NUMBER cells keep their
+//!        decimal representation either way
+class bigint_c {
+ public:
+   //! \brief Construct zero
+   bigint_c() = default;
+
+   //! \brief Construct from a 64 bit integer
+   explicit bigint_c(int64_t value);
+
+   //! \brief Construct from a decimal string, with an optional sign
+   //! \throws std::invalid_argument if the string is not an integer
+   explicit bigint_c(std::string_view decimal);
+
+   //! \brief Retrieve the decimal representation
+   std::string to_string() const;
+
+   //! \brief Check if the value can be represented by an int64_t
+   bool fits_int64() const;
+
+   //! \brief Retrieve the value as an int64_t, only valid if fits_int64()
+   int64_t to_int64() const;
+
+   //! \brief Check if the value is zero
+   bool is_zero() const { return _limbs.empty(); }
+
+   //! \brief Compare with another integer
+   //! \returns Less than, equal to or greater than zero, as for strcmp
+   int compare(const bigint_c &other) const;
+
+   bigint_c operator+(const bigint_c &other) const;
+   bigint_c operator-(const bigint_c &other) const;
+   bigint_c operator*(const bigint_c &other) const;
+
+   //! \brief Divide, truncating towards zero
+   //! \throws std::domain_error if other is zero
+   bigint_c operator/(const bigint_c &other) const;
+
+ private:
+   using limbs_t = std::vector<uint32_t>;
+
+   //  Magnitude in base 10^9, least significant limb first, no leading
+   //  zero limbs. Zero has no limbs and is never negative
+   //
+   bool _negative{false};
+   limbs_t _limbs;
+
+   static bigint_c make(bool negative, limbs_t limbs);
+   static bigint_c add(const bigint_c &lhs, const bigint_c &rhs,
+                       bool negate_rhs);
+};
+
+//! \brief Operators shared by the arithmetic builtins
+enum class arithmetic_e { ADD, SUBTRACT, MULTIPLY, DIVIDE };
+
+//! \brief Operators shared by the comparison builtins
+enum class comparison_e { LESS, LESS_EQUAL, GREATER, GREATER_EQUAL };
+
+//! \brief Fold an arithmetic operator over the arguments, left to right.
+//!        Integers are computed exactly in 64 bits, promoted to a bigint_c
+//!        on overflow and brought back once the value fits again. If any
+//!        argument is a DOUBLE the computation is done in double precision
+//! \param op The operator to apply
+//! \param args The arguments to apply it to
+//! \throws std::invalid_argument if an argument is not a number
+//! \throws std::domain_error on integer division by zero
+extern cell_t arithmetic(arithmetic_e op, cell_span args);
+
+//! \brief Check that every argument is ordered with respect to the next.
+//!        Integers are compared exactly
+//! \param op The comparison to apply
+//! \param args The arguments to compare
+//! \throws std::invalid_argument if an argument is not a number
+extern bool compare(comparison_e op, cell_span args);
+
+} // namespace polaris
+
+#endif
@@ -1,98 +1,233 @@
 #include "polaris.hpp"
 
 #include <iostream>
-#include <list>
-#include <regex>
+#include <optional>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace polaris {
 
 namespace {
 
-// Convert a string into a list of string "tokens" to be processed
-std::list<std::string> tokenize(const std::string &str) {
-   std::list<std::string> tokens;
-   for (auto i = 0; i < str.size(); i++) {
-      if (std::isspace(str[i])) {
-         continue;
-      }
-      if (str[i] == '(' || str[i] == ')') {
-         tokens.push_back(str[i] == '(' ? "(" : ")");
-      } else {
-         bool in_str{false};
-         std::string token;
-         while (i < str.size()) {
-            if (str[i] == '"') {
-               if (i > 0 && str[i - 1] != '\\') {
-                  in_str = !in_str;
-               }
-            }
-            if (in_str) {
-               token += str[i];
-            } else if (!std::isspace(str[i]) && str[i] != '(' &&
-                       str[i] != ')') {
-               token += str[i];
-            } else {
-               --i;
-               break;
-            }
-            ++i;
-         }
-         if (!token.empty()) {
-            tokens.push_back(token);
-         }
+// Check if a token is a number, [+-]?([0-9]*[.])?[0-9]+
+bool is_number(std::string_view token) {
+   std::size_t i = 0;
+   if (i < token.size() && (token[i] == '+' || token[i] == '-')) {
+      ++i;
+   }
+   auto digits = [&]() {
+      std::size_t start = i;
+      while (i < token.size() && std::isdigit(static_cast<unsigned char>(
+                                     token[i])) != 0) {
+         ++i;
       }
+      return i - start;
+   };
+   std::size_t whole = digits();
+   if (i == token.size()) {
+      return whole > 0;
+   }
+   if (token[i] != '.') {
+      return false;
    }
-   return tokens;
+   ++i;
+   return digits() > 0 && i == token.size();
 }
 
-// Check if something is a digit
-bool is_digit(const char c) {
-   return std::isdigit(static_cast<unsigned char>(c)) != 0;
+// Take a token and convert it into a cell
+cell_t atom(std::string_view token) {
+
+   if (is_number(token)) {
+      if (token.find('.') != std::string_view::npos) {
+         return cell_t(cell_type_e::DOUBLE, std::string(token));
+      }
+      return cell_t(cell_type_e::NUMBER, std::string(token));
+   }
+
+   if (token.size() > 1 && token.starts_with('"') && token.ends_with('"')) {
+      return cell_t(cell_type_e::STRING,
+                    std::string(token.substr(1, token.size() - 2)));
+   }
+
+   return cell_t(cell_type_e::SYMBOL, std::string(token));
 }
 
-static std::regex is_number("[+-]?([0-9]*[.])?[0-9]+");
+// Reads forms straight out of a buffer, the text is walked once and no
+// list of tokens is built along the way. Given a file, every list records
+// where it starts
+class reader_c {
+ public:
+   explicit reader_c(std::string_view source,
+                     std::optional<uint32_t> file = std::nullopt)
+       : _source(source), _file(file) {}
+
+   // Skip whitespace and comments, false once the buffer is exhausted
+   bool more() {
+      while (_at < _source.size()) {
+         char c = _source[_at];
+         if (c == ';') {
+            _at = _source.find('\n', _at);
+            if (_at == std::string_view::npos) {
+               _at = _source.size();
+            }
+         } else if (std::isspace(static_cast<unsigned char>(c))) {
+            ++_at;
+         } else {
+            return true;
+         }
+      }
+      return false;
+   }
 
-// Take a token and convert it into a cell
-cell_t atom(const std::string &token) {
+   // Read the form at the cursor, false if a list is left open or a list
+   // is closed that was never opened
+   bool read(cell_t &form) {
+      if (!more()) {
+         return false;
+      }
+      if (_source[_at] == ')') {
+         return false;
+      }
+      if (_source[_at] != '(') {
+         form = atom(token());
+         return true;
+      }
 
-   if (std::regex_match(token, is_number)) {
-      if (token.find('.') != std::string::npos) {
-         return cell_t(cell_type_e::DOUBLE, token);
+      form = cell_t(cell_type_e::LIST);
+      if (_file) {
+         form.loc = locate();
       }
-      return cell_t(cell_type_e::NUMBER, token);
+      ++_at;
+      while (more()) {
+         if (_source[_at] == ')') {
+            ++_at;
+            return true;
+         }
+         form.list.emplace_back();
+         if (!read(form.list.back())) {
+            return false;
+         }
+      }
+      return false;
    }
 
-   if (token.starts_with('"') && token.ends_with('"')) {
-      auto trimmed = token.substr(1, token.size() - 2);
-      return cell_t(cell_type_e::STRING, trimmed);
+ private:
+   std::string_view _source;
+   std::size_t _at{0};
+   std::optional<uint32_t> _file;
+   std::size_t _counted{0};
+   std::size_t _line_start{0};
+   uint32_t _line{1};
+
+   // Lines are counted up to the cursor as it moves, the text before it is
+   // never walked twice
+   uint32_t locate() {
+      for (; _counted < _at; ++_counted) {
+         if (_source[_counted] == '\n') {
+            ++_line;
+            _line_start = _counted + 1;
+         }
+      }
+      return add_source_location(
+          *_file, _line, static_cast<uint32_t>(_at - _line_start + 1));
    }
 
-   return cell_t(cell_type_e::SYMBOL, token);
+   // Strings run to the next quote that is not escaped, anything else to
+   // the next space, parenthesis or comment
+   std::string_view token() {
+      std::size_t start = _at;
+      bool in_str{false};
+      for (; _at < _source.size(); ++_at) {
+         char c = _source[_at];
+         if (c == '"' && (_at == start || _source[_at - 1] != '\\')) {
+            in_str = !in_str;
+         } else if (!in_str && (std::isspace(static_cast<unsigned char>(c)) ||
+                                c == '(' || c == ')' || c == ';')) {
+            break;
+         }
+      }
+      return _source.substr(start, _at - start);
+   }
+};
+
+// Read every form left in the reader
+bool read_forms(reader_c &reader, cells &forms) {
+   while (reader.more()) {
+      forms.emplace_back();
+      if (!reader.read(forms.back())) {
+         forms.pop_back();
+         return false;
+      }
+   }
+   return true;
 }
 
-// Take a list of tokens and convert them into  proper cell
-cell_t read_from(std::list<std::string> &tokens) {
-   const std::string token(tokens.front());
-   tokens.pop_front();
-   if (token == "(") {
-      cell_t c(cell_type_e::LIST);
-      while (tokens.front() != ")") {
-         c.list.push_back(read_from(tokens));
-      }
-      tokens.pop_front();
-      return c;
-   } else {
-      return atom(token);
+// Run a numeric operation, conversion failures are fatal
+template <typename Fn>
+cell_t numeric(std::shared_ptr<environment_c> env, Fn fn) {
+   try {
+      return fn();
+   } catch (const std::invalid_argument &) {
+      env->get_error_cb()(error_level_e::FATAL,
+                          "invalid argument for numerical conversion");
+   } catch (const std::out_of_range &) {
+      env->get_error_cb()(error_level_e::FATAL, "out of range");
+   } catch (const std::domain_error &) {
+      env->get_error_cb()(error_level_e::FATAL, "division by zero");
    }
+   std::exit(1);
 }
+
 } // End anonymous namespace
 
 cell_t read(const std::string &s) {
-   std::list<std::string> tokens(tokenize(s));
-   return read_from(tokens);
+   cell_t form;
+   if (!reader_c(s).read(form)) {
+      return nil;
+   }
+   return form;
+}
+
+bool read_all(std::string_view source, cells &forms) {
+   reader_c reader(source);
+   return read_forms(reader, forms);
+}
+
+bool read_all(std::string_view source, cells &forms, const std::string &file) {
+   reader_c reader(source, add_source_file(file));
+   return read_forms(reader, forms);
+}
+
+cell_t evaluate_all(engine_c &engine, std::string_view source,
+                    std::shared_ptr<environment_c> env, cells *results,
+                    const std::string &file) {
+   cells forms;
+   if (!(file.empty() ? read_all(source, forms)
+                      : read_all(source, forms, file))) {
+      env->get_error_cb()(error_level_e::FAILURE,
+                          "Unbalanced parentheses, nothing was evaluated");
+      return nil;
+   }
+
+   cell_t result = nil;
+   if (results) {
+      results->reserve(results->size() + forms.size());
+   }
+   for (auto &form : forms) {
+      current_source_t current(form.loc);
+      result = engine.evaluate(expand_macros(std::move(form), env, engine),
+                               env);
+      if (auto &snapshot = env->get_snapshot()) {
+         snapshot->publish(*env);
+      }
+      if (results) {
+         results->push_back(result);
+      }
+   }
+   return result;
 }
 
 std::string to_string(const cell_t &exp) {
@@ -109,6 +244,21 @@ std::string to_string(const cell_t &exp) {
       return "<Lambda>";
    else if (exp.type == cell_type_e::PROC)
       return "<Proc>";
+   else if (exp.type == cell_type_e::FUTURE)
+      return "<Future>";
+   else if (exp.type == cell_type_e::SEQUENCE)
+      return "<Sequence>";
+   else if (exp.type == cell_type_e::PROMISE)
+      return "<Promise>";
+   else if (exp.type == cell_type_e::CHANNEL)
+      return "<Channel>";
+   else if (exp.type == cell_type_e::MACRO)
+      return "<Macro>";
+   else if (exp.type == cell_type_e::RECORD)
+      return static_cast<const record_c &>(*exp.obj).to_string();
+   else if (exp.type == cell_type_e::BUILDER)
+      return std::string(
+          static_cast<const string_builder_c &>(*exp.obj).view());
    return exp.val;
 }
 
@@ -121,7 +271,7 @@ void add_globals(std::shared_ptr<environment_c> env, imports_c &imports) {
    env->get("#f") = false_sym;
    env->get("#t") = true_sym;
 
-   env->get("exit") = cell_t([=](const cells &c) -> cell_t {
+   env->get("exit") = cell_t([=](cell_span c) -> cell_t {
       if (!c.empty()) {
          try{
             int n(std::stoi(c[0].val.c_str()));
@@ -134,7 +284,7 @@ void add_globals(std::shared_ptr<environment_c> env, imports_c &imports) {
       std::exit(0);
    });
 
-   env->get("print") = cell_t([](const cells &c) -> cell_t {
+   env->get("print") = cell_t([](cell_span c) -> cell_t {
       std::string result;
       for (auto i = c.begin(); i != c.end(); ++i) {
          result += to_string((*i));
@@ -143,9 +293,16 @@ void add_globals(std::shared_ptr<environment_c> env, imports_c &imports) {
       return true_sym;
    });
 
-   env->get("ref") = cell_t([](const cells &c) -> cell_t {
+   env->get("ref") = cell_t([](cell_span c) -> cell_t {
       cell_t result(cell_type_e::LIST);
       for (auto i = c.begin(); i != c.end(); ++i) {
+         // Records are reported by the name of their type
+         if ((*i).type == cell_type_e::RECORD) {
+            result.list.push_back(cell_t(
+                cell_type_e::STRING,
+                static_cast<const record_c &>(*(*i).obj).type().name()));
+            continue;
+         }
          result.list.push_back(
             cell_t(cell_type_e::STRING, cell_type_to_string((*i).type))
          );
@@ -153,9 +310,10 @@ void add_globals(std::shared_ptr<environment_c> env, imports_c &imports) {
       return result;
    });
 
-   env->get("import") = cell_t([&](const cells &c) -> cell_t {
+   env->get("import") = cell_t([=, &imports](cell_span c) -> cell_t {
       if (c.empty()) {
-         std::cerr << "Malformed import statement" << std::endl;
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Malformed import statement");
          std::exit(EXIT_FAILURE);
       }
 
@@ -166,7 +324,7 @@ void add_globals(std::shared_ptr<environment_c> env, imports_c &imports) {
       return true_sym;
    });
 
-   env->get("append") = cell_t([](const cells &c) -> cell_t {
+   env->get("append") = cell_t([](cell_span c) -> cell_t {
       cell_t result(cell_type_e::LIST);
       result.list = c[0].list;
       for (auto i = c[1].list.begin(); i != c[1].list.end(); ++i) {
@@ -176,9 +334,9 @@ void add_globals(std::shared_ptr<environment_c> env, imports_c &imports) {
    });
 
    env->get("car") =
-       cell_t([](const cells &c) -> cell_t { return c[0].list[0]; });
+       cell_t([](cell_span c) -> cell_t { return c[0].list[0]; });
 
-   env->get("cdr") = cell_t([](const cells &c) -> cell_t {
+   env->get("cdr") = cell_t([](cell_span c) -> cell_t {
       if (c[0].list.size() < 2) {
          return nil;
       }
@@ -187,7 +345,7 @@ void add_globals(std::shared_ptr<environment_c> env, imports_c &imports) {
       return result;
    });
 
-   env->get("cons") = cell_t([](const cells &c) -> cell_t {
+   env->get("cons") = cell_t([](cell_span c) -> cell_t {
       cell_t result(cell_type_e::LIST);
       result.list.push_back(c[0]);
       for (auto i = c[1].list.begin(); i != c[1].list.end(); ++i) {
@@ -196,21 +354,26 @@ void add_globals(std::shared_ptr<environment_c> env, imports_c &imports) {
       return result;
    });
 
-   env->get("length") = cell_t([](const cells &c) -> cell_t {
+   env->get("length") = cell_t([](cell_span c) -> cell_t {
       return cell_t(cell_type_e::NUMBER, std::to_string(c[0].list.size()));
    });
 
-   env->get("list") = cell_t([](const cells &c) -> cell_t {
+   env->get("list") = cell_t([](cell_span c) -> cell_t {
       cell_t result(cell_type_e::LIST);
-      result.list = c;
+      result.list.assign(c.begin(), c.end());
       return result;
    });
 
-   env->get("null?") = cell_t([](const cells &c) -> cell_t {
+   env->get("null?") = cell_t([](cell_span c) -> cell_t {
+      if (c[0].type == cell_type_e::SEQUENCE) {
+         return std::static_pointer_cast<sequence_c>(c[0].obj)->empty()
+                    ? true_sym
+                    : false_sym;
+      }
       return c[0].list.empty() ? true_sym : false_sym;
    });
 
-   env->get("eq") = cell_t([](const cells &c) -> cell_t {
+   env->get("eq") = cell_t([](cell_span c) -> cell_t {
       bool equal{false};
       for (auto i = c.begin() + 1; i != c.end(); ++i) {
          equal = (c[0].type == i->type && c[0].val == i->val);
@@ -218,7 +381,7 @@ void add_globals(std::shared_ptr<environment_c> env, imports_c &imports) {
       return equal ? true_sym : false_sym;
    });
 
-   env->get("neq") = cell_t([](const cells &c) -> cell_t {
+   env->get("neq") = cell_t([](cell_span c) -> cell_t {
       bool equal{false};
       for (auto i = c.begin() + 1; i != c.end(); ++i) {
          equal = (c[0].type == i->type && c[0].val == i->val);
@@ -226,177 +389,80 @@ void add_globals(std::shared_ptr<environment_c> env, imports_c &imports) {
       return equal ? false_sym : true_sym;
    });
 
-   env->get("+") = cell_t([=](const cells &c) -> cell_t {
-      try {
-         double n(std::stod(c[0].val.c_str()));
-         bool store_as_double = (c[0].type == cell_type_e::DOUBLE);
-         for (auto i = c.begin() + 1; i != c.end(); ++i) {
-            n += std::stod(i->val.c_str());
-            if (i->type == cell_type_e::DOUBLE) {
-               store_as_double = true;
-            }
-         }
-         if (store_as_double) {
-            return cell_t(cell_type_e::DOUBLE, std::to_string(n));
-         } else {
-            return cell_t(cell_type_e::NUMBER,
-                          std::to_string(static_cast<long>(n)));
-         }
-      } catch (const std::invalid_argument &) {
-         env->get_error_cb()(error_level_e::FATAL,
-                             "invalid argument for numerical conversion");
-      } catch (const std::out_of_range &) {
-         env->get_error_cb()(error_level_e::FATAL, "out of range");
-      }
-      std::exit(1);
+   //  Integers are exact, see number.hpp
+   //
+   env->get("+") = cell_t([=](cell_span c) -> cell_t {
+      return numeric(env,
+                     [c]() { return arithmetic(arithmetic_e::ADD, c); });
    });
 
-   env->get("-") = cell_t([=](const cells &c) -> cell_t {
-      try {
-         double n(std::stod(c[0].val.c_str()));
-         bool store_as_double = (c[0].type == cell_type_e::DOUBLE);
-         for (auto i = c.begin() + 1; i != c.end(); ++i) {
-            n -= std::stod(i->val.c_str());
-            if (i->type == cell_type_e::DOUBLE) {
-               store_as_double = true;
-            }
-         }
-         if (store_as_double) {
-            return cell_t(cell_type_e::DOUBLE, std::to_string(n));
-         } else {
-            return cell_t(cell_type_e::NUMBER,
-                          std::to_string(static_cast<long>(n)));
-         }
-      } catch (const std::invalid_argument &) {
-         env->get_error_cb()(error_level_e::FATAL,
-                             "invalid argument for numerical conversion");
-      } catch (const std::out_of_range &) {
-         env->get_error_cb()(error_level_e::FATAL, "out of range");
-      }
-      std::exit(1);
+   env->get("-") = cell_t([=](cell_span c) -> cell_t {
+      return numeric(env,
+                     [c]() { return arithmetic(arithmetic_e::SUBTRACT, c); });
    });
 
-   env->get("*") = cell_t([=](const cells &c) -> cell_t {
-      try {
-         double n(1);
-         bool store_as_double = false;
-         for (auto i = c.begin(); i != c.end(); ++i) {
-            n *= std::stod(i->val.c_str());
-            if (i->type == cell_type_e::DOUBLE) {
-               store_as_double = true;
-            }
-         }
-         if (store_as_double) {
-            return cell_t(cell_type_e::DOUBLE, std::to_string(n));
-         } else {
-            return cell_t(cell_type_e::NUMBER,
-                          std::to_string(static_cast<long>(n)));
-         }
-      } catch (const std::invalid_argument &) {
-         env->get_error_cb()(error_level_e::FATAL,
-                             "invalid argument for numerical conversion");
-      } catch (const std::out_of_range &) {
-         env->get_error_cb()(error_level_e::FATAL, "out of range");
-      }
-      std::exit(1);
+   env->get("*") = cell_t([=](cell_span c) -> cell_t {
+      return numeric(env,
+                     [c]() { return arithmetic(arithmetic_e::MULTIPLY, c); });
    });
 
-   env->get("/") = cell_t([=](const cells &c) -> cell_t {
-      try {
-         bool store_as_double = (c[0].type == cell_type_e::DOUBLE);
-         double n(std::stod(c[0].val.c_str()));
-         for (auto i = c.begin() + 1; i != c.end(); ++i) {
-            n /= std::stod(i->val.c_str());
-            if (i->type == cell_type_e::DOUBLE) {
-               store_as_double = true;
-            }
-         }
-         if (store_as_double) {
-            return cell_t(cell_type_e::DOUBLE, std::to_string(n));
-         } else {
-            return cell_t(cell_type_e::NUMBER,
-                          std::to_string(static_cast<long>(n)));
-         }
-      } catch (const std::invalid_argument &) {
-         env->get_error_cb()(error_level_e::FATAL,
-                             "invalid argument for numerical conversion");
-      } catch (const std::out_of_range &) {
-         env->get_error_cb()(error_level_e::FATAL, "out of range");
-      }
-      std::exit(1);
+   env->get("/") = cell_t([=](cell_span c) -> cell_t {
+      return numeric(env,
+                     [c]() { return arithmetic(arithmetic_e::DIVIDE, c); });
    });
 
-   env->get(">") = cell_t([=](const cells &c) -> cell_t {
-      try {
-         double n(std::stod(c[0].val.c_str()));
-         for (auto i = c.begin() + 1; i != c.end(); ++i) {
-            if (n <= std::stod(i->val.c_str())) {
-               return false_sym;
-            }
-         }
-         return true_sym;
-      } catch (const std::invalid_argument &) {
-         env->get_error_cb()(error_level_e::FATAL,
-                             "invalid argument for numerical conversion");
-      } catch (const std::out_of_range &) {
-         env->get_error_cb()(error_level_e::FATAL, "out of range");
-      }
-      std::exit(1);
+   env->get(">") = cell_t([=](cell_span c) -> cell_t {
+      return numeric(env, [c]() {
+         return compare(comparison_e::GREATER, c) ? true_sym : false_sym;
+      });
    });
 
-   env->get("<") = cell_t([=](const cells &c) -> cell_t {
-      try {
-         double n(std::stod(c[0].val.c_str()));
-         for (auto i = c.begin() + 1; i != c.end(); ++i) {
-            if (n >= std::stod(i->val.c_str())) {
-               return false_sym;
-            }
-         }
-         return true_sym;
-      } catch (const std::invalid_argument &) {
-         env->get_error_cb()(error_level_e::FATAL,
-                             "invalid argument for numerical conversion");
-      } catch (const std::out_of_range &) {
-         env->get_error_cb()(error_level_e::FATAL, "out of range");
-      }
-      std::exit(1);
+   env->get("<") = cell_t([=](cell_span c) -> cell_t {
+      return numeric(env, [c]() {
+         return compare(comparison_e::LESS, c) ? true_sym : false_sym;
+      });
    });
 
-   env->get("<=") = cell_t([=](const cells &c) -> cell_t {
-      try {
-         double n(std::stod(c[0].val.c_str()));
-         for (auto i = c.begin() + 1; i != c.end(); ++i) {
-            if (n > std::stod(i->val.c_str())) {
-               return false_sym;
-            }
-         }
-         return true_sym;
-      } catch (const std::invalid_argument &) {
+   env->get("<=") = cell_t([=](cell_span c) -> cell_t {
+      return numeric(env, [c]() {
+         return compare(comparison_e::LESS_EQUAL, c) ? true_sym : false_sym;
+      });
+   });
+
+   env->get(">=") = cell_t([=](cell_span c) -> cell_t {
+      return numeric(env, [c]() {
+         return compare(comparison_e::GREATER_EQUAL, c) ? true_sym : false_sym;
+      });
+   });
+
+   env->get("sys-stats") = cell_t([=](cell_span c) -> cell_t {
+      if (!c.empty()) {
          env->get_error_cb()(error_level_e::FATAL,
-                             "invalid argument for numerical conversion");
-      } catch (const std::out_of_range &) {
-         env->get_error_cb()(error_level_e::FATAL, "out of range");
+                             "Expected 0 arguments for [sys-stats]");
+         std::exit(1);
       }
-      std::exit(1);
+      return stats_to_cell();
    });
 
-   env->get(">=") = cell_t([=](const cells &c) -> cell_t {
-      try {
-         double n(std::stod(c[0].val.c_str()));
-         for (auto i = c.begin() + 1; i != c.end(); ++i) {
-            if (n < std::stod(i->val.c_str())) {
-               return false_sym;
-            }
-         }
+   //  Long running scripts publish at points where their variables agree
+   //  with each other, rather than waiting for the statement to finish
+   //
+   env->get("publish") = cell_t([=](cell_span c) -> cell_t {
+      if (auto &snapshot = env->get_snapshot()) {
+         snapshot->publish(*env);
          return true_sym;
-      } catch (const std::invalid_argument &) {
-         env->get_error_cb()(error_level_e::FATAL,
-                             "invalid argument for numerical conversion");
-      } catch (const std::out_of_range &) {
-         env->get_error_cb()(error_level_e::FATAL, "out of range");
       }
-      std::exit(1);
+      return false_sym;
    });
+
+   add_sequence_globals(env, imports.get_engine());
+   add_memo_globals(env, imports.get_engine());
+   add_sort_globals(env, imports.get_engine());
+   add_serialize_globals(env, imports.get_engine());
+   add_macro_globals(env, imports.get_engine());
+   add_record_globals(env);
+   add_string_globals(env);
+   env->name_procs();
 }
 
 } // namespace polaris
\ No newline at end of file
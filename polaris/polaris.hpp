@@ -3,12 +3,33 @@
 
 #include <memory>
 #include <string>
+#include <string_view>
 
+#include "actor.hpp"
+#include "async.hpp"
 #include "cell.hpp"
+#include "compiler.hpp"
+#include "emit.hpp"
 #include "environment.hpp"
 #include "error.hpp"
 #include "evaluator.hpp"
+#include "handle.hpp"
+#include "image.hpp"
 #include "imports.hpp"
+#include "macro.hpp"
+#include "memo.hpp"
+#include "native.hpp"
+#include "number.hpp"
+#include "profile.hpp"
+#include "record.hpp"
+#include "sequence.hpp"
+#include "serialize.hpp"
+#include "server.hpp"
+#include "snapshot.hpp"
+#include "sort.hpp"
+#include "source.hpp"
+#include "stats.hpp"
+#include "strings.hpp"
 
 namespace polaris {
 
@@ -17,6 +38,42 @@ namespace polaris {
 //! \param s The string to process in
 extern cell_t read(const std::string &str);
 
+//! \brief Read every top level form of a buffer in a single pass. Comments
+//!        run from a `;` outside of a string to the end of the line
+//! \param source The text to read
+//! \param forms The forms read are appended to this
+//! \returns false if a list is left open or closed without being opened,
+//!          the forms read before that point are kept
+extern bool read_all(std::string_view source, cells &forms);
+
+//! \brief Read every top level form of a file already loaded into a
+//!        buffer. Every list read records the line and column it starts
+//!        at, see source.hpp
+//! \param source The text to read
+//! \param forms The forms read are appended to this
+//! \param file The name of the file, reported with the locations
+//! \returns false if a list is left open or closed without being opened,
+//!          the forms read before that point are kept
+extern bool read_all(std::string_view source, cells &forms,
+                     const std::string &file);
+
+//! \brief Read a whole buffer and evaluate its top level forms in order.
+//!        Each form is a top level evaluation of its own. If the buffer
+//!        can not be read the error callback of the environment is given a
+//!        failure and nothing is evaluated
+//! \param engine The engine to evaluate with
+//! \param source The text to evaluate
+//! \param env The environment to evaluate in
+//! \param results If given, the result of every form is appended to this
+//! \param file If given, the file the text was loaded from. The forms
+//!        record where they were read and current_source_location gives the
+//!        form being evaluated while it is
+//! \returns The result of the last form, nil if there were none
+extern cell_t evaluate_all(engine_c &engine, std::string_view source,
+                           std::shared_ptr<environment_c> env,
+                           cells *results = nullptr,
+                           const std::string &file = {});
+
 //! \brief Convert a given cell to a string
 //! \param exp The cell to convert
 extern std::string to_string(const cell_t &exp);
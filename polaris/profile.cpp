@@ -0,0 +1,129 @@
+#include "profile.hpp"
+#include "source.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <utility>
+
+namespace polaris {
+
+namespace {
+
+double milliseconds(line_profile_c::clock::duration d) {
+   return std::chrono::duration<double, std::milli>(d).count();
+}
+
+} // namespace
+
+void line_profile_c::charge(clock::time_point now) {
+   if (!_entered.empty()) {
+      _counters[_entered.back()].self += now - _last;
+   }
+   _last = now;
+}
+
+void line_profile_c::enter(uint32_t loc) {
+   charge(clock::now());
+   if (loc >= _counters.size()) {
+      _counters.resize(static_cast<std::size_t>(loc) + 1);
+   }
+   ++_counters[loc].hits;
+   _entered.push_back(loc);
+}
+
+void line_profile_c::leave() {
+   charge(clock::now());
+   _entered.pop_back();
+}
+
+std::vector<line_profile_c::line_t> line_profile_c::lines() const {
+
+   //  Several forms can start on one line, they are added together
+   //
+   std::map<std::pair<std::string, uint32_t>, line_t> by_line;
+   for (std::size_t loc = 0; loc < _counters.size(); ++loc) {
+      const counter_t &c = _counters[loc];
+      if (c.hits == 0) {
+         continue;
+      }
+      source_location_t where =
+          find_source_location(static_cast<uint32_t>(loc));
+      line_t &l = by_line[{where.file, where.line}];
+      l.file = where.file;
+      l.line = where.line;
+      l.hits += c.hits;
+      l.self += c.self;
+   }
+
+   std::vector<line_t> result;
+   result.reserve(by_line.size());
+   for (auto &[key, l] : by_line) {
+      result.push_back(std::move(l));
+   }
+   return result;
+}
+
+void line_profile_c::report(std::ostream &out, std::size_t hottest) const {
+   std::vector<line_t> counted = lines();
+
+   std::vector<const line_t *> hot;
+   for (auto &l : counted) {
+      hot.push_back(&l);
+   }
+   std::stable_sort(hot.begin(), hot.end(),
+                    [](const line_t *a, const line_t *b) {
+                       return a->self > b->self;
+                    });
+   hot.resize(std::min(hot.size(), hottest));
+
+   out << "\nHottest lines :\n" << std::fixed << std::setprecision(3);
+   for (auto *l : hot) {
+      out << std::setw(12) << milliseconds(l->self) << " ms "
+          << std::setw(10) << l->hits << " hits   " << l->file << ":"
+          << l->line << "\n";
+   }
+
+   //  Every file with hits is listed in full, lines that were never
+   //  evaluated are left unannotated
+   //
+   for (std::size_t i = 0; i < counted.size();) {
+      const std::string &file = counted[i].file;
+      out << "\n" << file << " :\n"
+          << std::setw(10) << "hits" << std::setw(13) << "self ms"
+          << "\n";
+
+      std::ifstream fs(file);
+      std::string text;
+      uint32_t number = 0;
+      while (std::getline(fs, text)) {
+         ++number;
+         if (i < counted.size() && counted[i].file == file &&
+             counted[i].line == number) {
+            out << std::setw(10) << counted[i].hits << std::setw(13)
+                << milliseconds(counted[i].self);
+            ++i;
+         } else {
+            out << std::setw(23) << "";
+         }
+         out << std::setw(7) << number << " | " << text << "\n";
+      }
+
+      //  The file may have changed or gone since it was read
+      //
+      while (i < counted.size() && counted[i].file == file) {
+         ++i;
+      }
+   }
+   out << std::defaultfloat;
+}
+
+void line_profile_c::reset() {
+
+   //  Forms that are still being evaluated are left entered
+   //
+   _counters.assign(_counters.size(), counter_t{});
+}
+
+} // namespace polaris
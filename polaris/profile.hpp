@@ -0,0 +1,92 @@
+#ifndef POLARIS_PROFILE_HPP
+#define POLARIS_PROFILE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace polaris {
+
+//! \brief Execution counts and time of the source lines of the forms an
+//!        evaluator runs, for finding the hot lines of a program and the
+//!        libraries it imports. Only forms read from a file are counted,
+//!        see source.hpp. Attach it with evaluator_c::set_line_profile, an
+//!        evaluator without one pays a single check per list evaluated.
+//!        Time is attributed to the innermost counted form being evaluated,
+//!        so a line is charged for its own work and not for the lines of
+//!        the functions it calls
+class line_profile_c {
+ public:
+   using clock = std::chrono::steady_clock;
+
+   //! \brief What was counted for one line of a file
+   struct line_t {
+      //! The file
+      std::string file;
+
+      //! The line, from 1
+      uint32_t line{0};
+
+      //! Number of times a form starting on the line was evaluated
+      uint64_t hits{0};
+
+      //! Time spent evaluating those forms, less the time spent in other
+      //! counted forms they evaluated
+      clock::duration self{};
+   };
+
+   //! \brief Counts the evaluation of a form for as long as it is in scope
+   struct scope_t {
+      scope_t(line_profile_c &profile, uint32_t loc) : profile(profile) {
+         profile.enter(loc);
+      }
+      ~scope_t() { profile.leave(); }
+
+      scope_t(const scope_t &) = delete;
+      scope_t &operator=(const scope_t &) = delete;
+
+      line_profile_c &profile;
+   };
+
+   //! \brief Start evaluating a form
+   //! \param loc The location the form carries in cell_t::loc
+   void enter(uint32_t loc);
+
+   //! \brief Finish evaluating the form most recently entered
+   void leave();
+
+   //! \brief Retrieve what was counted, one entry per line with hits,
+   //!        ordered by file and line
+   std::vector<line_t> lines() const;
+
+   //! \brief Write the hottest lines followed by the source of every file
+   //!        with hits, each line annotated with its hits and time
+   //! \param out The stream to write to
+   //! \param hottest The number of lines to list first, by time
+   void report(std::ostream &out, std::size_t hottest = 10) const;
+
+   //! \brief Forget everything counted
+   void reset();
+
+ private:
+   struct counter_t {
+      uint64_t hits{0};
+      clock::duration self{};
+   };
+
+   //  Counters are kept by location and only gathered into lines for a
+   //  report, counting is an index into a vector
+   //
+   std::vector<counter_t> _counters;
+   std::vector<uint32_t> _entered;
+   clock::time_point _last;
+
+   void charge(clock::time_point now);
+};
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,134 @@
+#include "record.hpp"
+#include "builtins.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+#include "macro.hpp"
+#include "polaris.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace polaris {
+
+namespace {
+
+cell_t quoted(cell_t c) {
+   cell_t q(cell_type_e::LIST);
+   q.list.emplace_back(cell_type_e::SYMBOL, "quote");
+   q.list.push_back(std::move(c));
+   return q;
+}
+
+//  (define-record name field*) or (define-record name (field*)), rewritten
+//  to defines of procedures that hold the type and the slot they use. The
+//  definitions are made by the expansion rather than by the macro, so a
+//  record defined inside a lambda is local to it like any other define
+//
+class record_macro_c : public macro_c {
+ public:
+   record_macro_c() : macro_c("define-record") {}
+
+ protected:
+   cell_t transform(const cell_t &form, engine_c &,
+                    std::shared_ptr<environment_c> env) override {
+      const cells &args = form.list;
+      if (args.size() < 2 || args[1].type != cell_type_e::SYMBOL) {
+         fail(env, "Expected a name and fields for [define-record]");
+      }
+      cell_span given = args.size() == 3 && args[2].type == cell_type_e::LIST
+                            ? cell_span(args[2].list)
+                            : cell_span(args).subspan(2);
+
+      std::vector<std::string> fields;
+      for (auto &field : given) {
+         if (field.type != cell_type_e::SYMBOL ||
+             std::find(fields.begin(), fields.end(), field.val) !=
+                 fields.end()) {
+            fail(env, "Fields of record [" + args[1].val +
+                          "] must be distinct names");
+         }
+         fields.push_back(field.val);
+      }
+
+      const std::string &name = args[1].val;
+      auto type = std::make_shared<const record_type_c>(name, fields);
+
+      cell_t expansion(cell_type_e::LIST);
+      expansion.list.emplace_back(cell_type_e::SYMBOL, "begin");
+      auto define = [&](const std::string &var, cell_t proc) {
+         cell_t d(cell_type_e::LIST);
+         d.list.emplace_back(cell_type_e::SYMBOL, "define");
+         d.list.emplace_back(cell_type_e::SYMBOL, var);
+         d.list.push_back(quoted(std::move(proc)));
+         expansion.list.push_back(std::move(d));
+      };
+
+      std::string make = "make-" + name;
+      define(make, cell_t([=](cell_span c) -> cell_t {
+                if (c.size() != type->fields().size()) {
+                   fail(env, "Expected " +
+                                 std::to_string(type->fields().size()) +
+                                 " arguments for [" + make + "]");
+                }
+                return make_record(type, c);
+             }));
+
+      define(name + "?", cell_t([type](cell_span c) -> cell_t {
+                return c.size() == 1 && c[0].type == cell_type_e::RECORD &&
+                               static_cast<const record_c &>(*c[0].obj)
+                                   .is_a(type.get())
+                           ? true_sym
+                           : false_sym;
+             }));
+
+      //  Each accessor checks the type it was made for and reads its slot,
+      //  the field name is not looked at again
+      //
+      for (std::size_t slot = 0; slot < fields.size(); slot++) {
+         std::string get = name + "-" + fields[slot];
+         std::string set = "set-" + get + "!";
+         auto record = [=](cell_span c, std::size_t count,
+                           const std::string &fn) -> record_c & {
+            if (c.size() != count || c[0].type != cell_type_e::RECORD ||
+                !static_cast<const record_c &>(*c[0].obj).is_a(type.get())) {
+               fail(env, "Expected a " + name + " for [" + fn + "]");
+            }
+            return static_cast<record_c &>(*c[0].obj);
+         };
+         define(get, cell_t([=](cell_span c) -> cell_t {
+                   return record(c, 1, get).slot(slot);
+                }));
+         define(set, cell_t([=](cell_span c) -> cell_t {
+                   return record(c, 2, set).slot(slot) = c[1];
+                }));
+      }
+
+      expansion.list.push_back(quoted(cell_t(cell_type_e::SYMBOL, name)));
+      return expansion;
+   }
+};
+
+} // namespace
+
+std::string record_c::to_string() const {
+   std::string s = "<" + _type->name();
+   for (std::size_t i = 0; i < _slots.size(); i++) {
+      s += ' ' + _type->fields()[i] + '=' + polaris::to_string(_slots[i]);
+   }
+   return s + '>';
+}
+
+cell_t make_record(std::shared_ptr<const record_type_c> type,
+                   cell_span values) {
+   cell_t c(cell_type_e::RECORD);
+   c.obj = std::make_shared<record_c>(std::move(type), values);
+   return c;
+}
+
+void add_record_globals(std::shared_ptr<environment_c> env) {
+   cell_t macro(cell_type_e::MACRO);
+   macro.obj = std::make_shared<record_macro_c>();
+   env->get("define-record") = macro;
+}
+
+} // namespace polaris
@@ -0,0 +1,84 @@
+#ifndef POLARIS_RECORD_HPP
+#define POLARIS_RECORD_HPP
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace polaris {
+
+//! \brief The name and fields of a record type, shared by every record of
+//!        the type and by the procedures defined for it
+class record_type_c {
+ public:
+   //! \brief Create the type
+   //! \param name The name the type was defined with
+   //! \param fields The names of the fields, in slot order
+   record_type_c(std::string name, std::vector<std::string> fields)
+       : _name(std::move(name)), _fields(std::move(fields)) {}
+
+   //! \brief Retrieve the name of the type
+   const std::string &name() const { return _name; }
+
+   //! \brief Retrieve the names of the fields, in slot order
+   const std::vector<std::string> &fields() const { return _fields; }
+
+ private:
+   std::string _name;
+   std::vector<std::string> _fields;
+};
+
+//! \brief A record. The fields are slots of one array, in the order the
+//!        type declares them, so reading a field is an index into it
+class record_c : public object_c {
+ public:
+   //! \brief Create a record
+   //! \param type The type of the record
+   //! \param values One value per field of the type
+   record_c(std::shared_ptr<const record_type_c> type, cell_span values)
+       : _type(std::move(type)), _slots(values.begin(), values.end()) {}
+
+   //! \brief Retrieve the type of the record
+   const record_type_c &type() const { return *_type; }
+
+   //! \brief Check if the record is of a type
+   bool is_a(const record_type_c *type) const { return _type.get() == type; }
+
+   //! \brief Retrieve the value of a slot
+   cell_t &slot(std::size_t index) { return _slots[index]; }
+
+   //! \brief Retrieve the value of a slot
+   const cell_t &slot(std::size_t index) const { return _slots[index]; }
+
+   //! \brief Retrieve the number of slots
+   std::size_t size() const { return _slots.size(); }
+
+   //! \brief Print the record as <name field=value ...>
+   std::string to_string() const;
+
+ private:
+   std::shared_ptr<const record_type_c> _type;
+   std::vector<cell_t> _slots;
+};
+
+//! \brief Create a record cell
+//! \param type The type of the record
+//! \param values One value per field of the type
+extern cell_t make_record(std::shared_ptr<const record_type_c> type,
+                          cell_span values);
+
+//! \brief Add the record builtins to an environment. This is the macro
+//!        `(define-record name field*)`, which defines `make-name`,
+//!        `name?`, and `name-field` and `set-name-field!` for every field.
+//!        The slot each accessor reads is decided when the record is
+//!        defined
+//! \param env The environment to load the symbols into
+extern void add_record_globals(std::shared_ptr<environment_c> env);
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,355 @@
+#include "sequence.hpp"
+#include "builtins.hpp"
+#include "closure.hpp"
+#include "engine.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace polaris {
+
+namespace {
+
+long long to_integer(std::shared_ptr<environment_c> env, const cell_t &c) {
+   try {
+      return std::stoll(c.val);
+   } catch (const std::invalid_argument &) {
+      env->get_error_cb()(error_level_e::FATAL,
+                          "invalid argument for numerical conversion");
+   } catch (const std::out_of_range &) {
+      env->get_error_cb()(error_level_e::FATAL, "out of range");
+   }
+   std::exit(1);
+}
+
+std::shared_ptr<sequence_c> to_sequence(std::shared_ptr<environment_c> env,
+                                        const cell_t &c,
+                                        const std::string &name) {
+   if (c.type != cell_type_e::SEQUENCE) {
+      std::string err = "Expected a list or sequence for [" + name + "]";
+      env->get_error_cb()(error_level_e::FATAL, err.c_str());
+      std::exit(1);
+   }
+   return std::static_pointer_cast<sequence_c>(c.obj);
+}
+
+std::ifstream open_file(std::shared_ptr<environment_c> env,
+                        const std::string &path) {
+   std::ifstream fs(path, std::ios::in | std::ios::binary);
+   if (!fs.is_open()) {
+      std::string err = "Unable to open file : " + path;
+      env->get_error_cb()(error_level_e::FATAL, err.c_str());
+      std::exit(1);
+   }
+   return fs;
+}
+
+} // namespace
+
+std::optional<cell_t> sequence_c::next() {
+   if (_peeked) {
+      auto item = std::move(_peeked);
+      _peeked.reset();
+      return item;
+   }
+   if (!_next) {
+      return std::nullopt;
+   }
+   auto item = _next();
+   if (!item) {
+      // Let go of whatever the generator holds on to (files, sources)
+      _next = nullptr;
+   }
+   return item;
+}
+
+bool sequence_c::empty() {
+   if (!_peeked) {
+      _peeked = next();
+   }
+   return !_peeked;
+}
+
+const cell_t &promise_c::force() {
+   if (_thunk) {
+      _value = _thunk();
+      _thunk = nullptr;
+   }
+   return _value;
+}
+
+cell_t make_sequence(sequence_c::next_f next) {
+   cell_t c(cell_type_e::SEQUENCE);
+   c.obj = std::make_shared<sequence_c>(std::move(next));
+   return c;
+}
+
+cell_t make_promise(std::function<cell_t()> thunk) {
+   cell_t c(cell_type_e::PROMISE);
+   c.obj = std::make_shared<promise_c>(std::move(thunk));
+   return c;
+}
+
+void add_sequence_globals(std::shared_ptr<environment_c> env,
+                          engine_c &engine) {
+
+   env->get("force") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 1, "force");
+      if (c[0].type != cell_type_e::PROMISE) {
+         return c[0];
+      }
+      return std::static_pointer_cast<promise_c>(c[0].obj)->force();
+   });
+
+   // (range end) (range start end) (range start end step)
+   env->get("range") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 3, "range");
+      long long start = 0;
+      long long end = to_integer(env, c[0]);
+      long long step = 1;
+      if (c.size() > 1) {
+         start = end;
+         end = to_integer(env, c[1]);
+      }
+      if (c.size() > 2) {
+         step = to_integer(env, c[2]);
+      }
+      if (step == 0) {
+         env->get_error_cb()(error_level_e::FATAL, "range step can not be 0");
+         std::exit(1);
+      }
+      return make_sequence(
+          [at = start, end, step]() mutable -> std::optional<cell_t> {
+             if ((step > 0 && at >= end) || (step < 0 && at <= end)) {
+                return std::nullopt;
+             }
+             cell_t item(cell_type_e::NUMBER, std::to_string(at));
+             at += step;
+             return item;
+          });
+   });
+
+   env->get("file-lines") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 1, "file-lines");
+      auto fs = std::make_shared<std::ifstream>(open_file(env, c[0].val));
+      return make_sequence([fs]() -> std::optional<cell_t> {
+         std::string line;
+         if (!std::getline(*fs, line)) {
+            return std::nullopt;
+         }
+         return cell_t(cell_type_e::STRING, std::move(line));
+      });
+   });
+
+   env->get("file-chunks") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 2, 2, "file-chunks");
+      auto fs = std::make_shared<std::ifstream>(open_file(env, c[0].val));
+      long long size = to_integer(env, c[1]);
+      if (size <= 0) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "chunk size must be greater than 0");
+         std::exit(1);
+      }
+      return make_sequence([fs, size]() -> std::optional<cell_t> {
+         std::string chunk(static_cast<std::size_t>(size), '\0');
+         fs->read(chunk.data(), size);
+         if (fs->gcount() <= 0) {
+            return std::nullopt;
+         }
+         chunk.resize(static_cast<std::size_t>(fs->gcount()));
+         return cell_t(cell_type_e::STRING, std::move(chunk));
+      });
+   });
+
+   // Lists are mapped and filtered straight away, sequences only as they
+   // are consumed. The function is called through one reused frame
+   //
+   env->get("map") = cell_t([=, &engine](cell_span c) -> cell_t {
+      expect_arguments(env, c, 2, 2, "map");
+      call_frame_c fn(engine, c[0]);
+      if (c[1].type == cell_type_e::LIST) {
+         cell_t result(cell_type_e::LIST);
+         result.list.reserve(c[1].list.size());
+         for (auto &item : c[1].list) {
+            result.list.push_back(fn.call(cell_span(&item, 1)));
+         }
+         return result;
+      }
+      auto source = to_sequence(env, c[1], "map");
+      return make_sequence([fn, source]() mutable -> std::optional<cell_t> {
+         auto item = source->next();
+         if (!item) {
+            return std::nullopt;
+         }
+         return fn.call(cell_span(&*item, 1));
+      });
+   });
+
+   env->get("filter") = cell_t([=, &engine](cell_span c) -> cell_t {
+      expect_arguments(env, c, 2, 2, "filter");
+      call_frame_c fn(engine, c[0]);
+      if (c[1].type == cell_type_e::LIST) {
+         cell_t result(cell_type_e::LIST);
+         for (auto &item : c[1].list) {
+            if (truthy(fn.call(cell_span(&item, 1)))) {
+               result.list.push_back(item);
+            }
+         }
+         return result;
+      }
+      auto source = to_sequence(env, c[1], "filter");
+      return make_sequence([fn, source]() mutable -> std::optional<cell_t> {
+         while (auto item = source->next()) {
+            if (truthy(fn.call(cell_span(&*item, 1)))) {
+               return item;
+            }
+         }
+         return std::nullopt;
+      });
+   });
+
+   env->get("for-each") = cell_t([=, &engine](cell_span c) -> cell_t {
+      expect_arguments(env, c, 2, 2, "for-each");
+      call_frame_c fn(engine, c[0]);
+      if (c[1].type == cell_type_e::LIST) {
+         for (auto &item : c[1].list) {
+            fn.call(cell_span(&item, 1));
+         }
+         return nil;
+      }
+      auto source = to_sequence(env, c[1], "for-each");
+      while (auto item = source->next()) {
+         fn.call(cell_span(&*item, 1));
+      }
+      return nil;
+   });
+
+   env->get("take") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 2, 2, "take");
+      long long count = to_integer(env, c[0]);
+      if (c[1].type == cell_type_e::LIST) {
+         cell_t result(cell_type_e::LIST);
+         auto n = std::min<std::size_t>(c[1].list.size(),
+                                        count > 0 ? count : 0);
+         result.list.assign(c[1].list.begin(), c[1].list.begin() + n);
+         return result;
+      }
+      auto source = to_sequence(env, c[1], "take");
+      return make_sequence(
+          [source, left = count]() mutable -> std::optional<cell_t> {
+             if (left <= 0) {
+                return std::nullopt;
+             }
+             --left;
+             return source->next();
+          });
+   });
+
+   env->get("next") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 1, "next");
+      auto item = to_sequence(env, c[0], "next")->next();
+      return item ? *item : nil;
+   });
+
+   // (nth n list-or-sequence), nil past the end
+   env->get("nth") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 2, 2, "nth");
+      long long n = to_integer(env, c[0]);
+      if (n < 0) {
+         return nil;
+      }
+      if (c[1].type == cell_type_e::LIST) {
+         return static_cast<std::size_t>(n) < c[1].list.size()
+                    ? c[1].list[static_cast<std::size_t>(n)]
+                    : nil;
+      }
+      auto source = to_sequence(env, c[1], "nth");
+      for (; n > 0; --n) {
+         if (!source->next()) {
+            return nil;
+         }
+      }
+      auto item = source->next();
+      return item ? *item : nil;
+   });
+
+   // Reducing a sequence keeps only the accumulator, so a pipeline ending
+   // in a fold runs in constant memory
+   //
+   env->get("fold-left") = cell_t([=, &engine](cell_span c) -> cell_t {
+      expect_arguments(env, c, 3, 3, "fold-left");
+      call_frame_c fn(engine, c[0]);
+      cell_t args[2] = {c[1], nil};
+      if (c[2].type == cell_type_e::LIST) {
+         for (auto &item : c[2].list) {
+            args[1] = item;
+            args[0] = fn.call(args);
+         }
+         return args[0];
+      }
+      auto source = to_sequence(env, c[2], "fold-left");
+      while (auto item = source->next()) {
+         args[1] = std::move(*item);
+         args[0] = fn.call(args);
+      }
+      return args[0];
+   });
+
+   // (fold-right fn init list) calls (fn item acc) from the last item to the
+   // first, a sequence has to be collected first
+   //
+   env->get("fold-right") = cell_t([=, &engine](cell_span c) -> cell_t {
+      expect_arguments(env, c, 3, 3, "fold-right");
+      call_frame_c fn(engine, c[0]);
+      cells collected;
+      const cells *items = &c[2].list;
+      if (c[2].type != cell_type_e::LIST) {
+         auto source = to_sequence(env, c[2], "fold-right");
+         while (auto item = source->next()) {
+            collected.push_back(std::move(*item));
+         }
+         items = &collected;
+      }
+      cell_t args[2] = {nil, c[1]};
+      for (auto item = items->rbegin(); item != items->rend(); ++item) {
+         args[0] = *item;
+         args[1] = fn.call(args);
+      }
+      return args[1];
+   });
+
+   env->get("reverse") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 1, "reverse");
+      cell_t result(cell_type_e::LIST);
+      if (c[0].type == cell_type_e::LIST) {
+         result.list.assign(c[0].list.rbegin(), c[0].list.rend());
+         return result;
+      }
+      auto source = to_sequence(env, c[0], "reverse");
+      while (auto item = source->next()) {
+         result.list.push_back(std::move(*item));
+      }
+      std::reverse(result.list.begin(), result.list.end());
+      return result;
+   });
+
+   env->get("collect") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 1, "collect");
+      if (c[0].type == cell_type_e::LIST) {
+         return c[0];
+      }
+      auto source = to_sequence(env, c[0], "collect");
+      cell_t result(cell_type_e::LIST);
+      while (auto item = source->next()) {
+         result.list.push_back(std::move(*item));
+      }
+      return result;
+   });
+}
+
+} // namespace polaris
@@ -0,0 +1,72 @@
+#ifndef POLARIS_SEQUENCE_HPP
+#define POLARIS_SEQUENCE_HPP
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+#include <functional>
+#include <memory>
+#include <optional>
+
+namespace polaris {
+
+//! \brief Lazy sequence. A generator with an internal cursor, each element
+//!        is produced only when it is asked for and is not kept afterwards,
+//!        so a sequence can be walked once in constant memory
+class sequence_c : public object_c {
+ public:
+   //! \brief Produces the next element, or nothing once exhausted
+   using next_f = std::function<std::optional<cell_t>()>;
+
+   //! \brief Create a sequence from its generator
+   explicit sequence_c(next_f next) : _next(std::move(next)) {}
+
+   //! \brief Advance the cursor
+   //! \returns The next element, or nothing if the sequence is exhausted
+   std::optional<cell_t> next();
+
+   //! \brief Check if the sequence is exhausted without consuming anything
+   bool empty();
+
+ private:
+   next_f _next;
+   std::optional<cell_t> _peeked;
+};
+
+//! \brief Delayed expression, evaluated the first time it is forced and
+//!        remembered from then on
+class promise_c : public object_c {
+ public:
+   //! \brief Create a promise for the result of a thunk
+   explicit promise_c(std::function<cell_t()> thunk)
+       : _thunk(std::move(thunk)) {}
+
+   //! \brief Retrieve the value, evaluating it if this is the first time
+   const cell_t &force();
+
+ private:
+   std::function<cell_t()> _thunk;
+   cell_t _value;
+};
+
+//! \brief Create a SEQUENCE cell
+//! \param next The generator of the sequence
+extern cell_t make_sequence(sequence_c::next_f next);
+
+//! \brief Create a PROMISE cell
+//! \param thunk What to evaluate when the promise is first forced
+extern cell_t make_promise(std::function<cell_t()> thunk);
+
+//! \brief Add the sequence and list builtins to an environment. These are
+//!        `force`, `range`, `file-lines`, `file-chunks`, `map`, `filter`,
+//!        `for-each`, `take`, `next`, `nth`, `fold-left`, `fold-right`,
+//!        `reverse` and `collect`
+//! \param env The environment to load the symbols into
+//! \param engine The engine used to call the lambdas handed to map, filter,
+//!        for-each and the folds
+extern void add_sequence_globals(std::shared_ptr<environment_c> env,
+                                 engine_c &engine);
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,688 @@
+#include "serialize.hpp"
+#include "closure.hpp"
+#include "engine.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+#include "sequence.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+
+namespace polaris {
+
+namespace {
+
+//  Every stream starts with these bytes and the version as a varint
+//
+constexpr std::string_view serial_magic = "\x89PLS";
+
+enum class tag_e : uint8_t {
+   SYMBOL = 1,
+   INTEGER,
+   NUMBER,
+   REAL,
+   DOUBLE,
+   STRING,
+   LIST,
+   LAMBDA,
+   PROC,
+   CHANNEL
+};
+
+//  Lists are grown as they are read rather than trusting the count, a
+//  damaged stream runs out of data instead of asking for absurd amounts
+//  of memory
+//
+constexpr uint64_t largest_reserve = 4096;
+
+[[noreturn]] void malformed() { throw std::runtime_error("malformed data"); }
+
+//  Counts a list being read for as long as it is being read
+//
+struct nesting_t {
+   std::size_t &depth;
+   ~nesting_t() { --depth; }
+};
+
+uint64_t zigzag(int64_t n) {
+   return (static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63);
+}
+
+int64_t unzigzag(uint64_t n) {
+   return static_cast<int64_t>(n >> 1) ^ -static_cast<int64_t>(n & 1);
+}
+
+// Integers are only stored as varints when printing them gives back the
+// same text, anything else (a bignum, a leading + or 0) is kept as written
+bool as_integer(const std::string &s, int64_t &value) {
+   std::size_t digits = (!s.empty() && s[0] == '-') ? 1 : 0;
+   if (s.size() == digits || s.size() > 20 ||
+       (s[digits] == '0' && (s.size() > digits + 1 || digits))) {
+      return false;
+   }
+   auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+   return ec == std::errc() && ptr == s.data() + s.size();
+}
+
+// Doubles that arithmetic produced are printed with six decimals and come
+// back the same from their 8 bytes, literals keep the text they were
+// written with
+bool as_real(const std::string &s, double &value) {
+   std::size_t point = s.find('.');
+   if (point == std::string::npos || s.size() - point != 7 || point == 0 ||
+       s[0] == '+' || (s[0] == '-' && point == 1)) {
+      return false;
+   }
+   auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+   return ec == std::errc() && ptr == s.data() + s.size();
+}
+
+std::string format_integer(int64_t value) {
+   char buffer[24];
+   auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+   return std::string(buffer, ptr);
+}
+
+// The same text std::to_string gives, without going through printf
+std::string format_real(double value) {
+   char buffer[400];
+   auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value,
+                                  std::chars_format::fixed, 6);
+   return std::string(buffer, ptr);
+}
+
+//  Lets a string be read through an istream without copying it
+//
+class view_buffer_c : public std::streambuf {
+ public:
+   explicit view_buffer_c(std::string_view data) {
+      char *begin = const_cast<char *>(data.data());
+      setg(begin, begin, begin + data.size());
+   }
+};
+
+} // namespace
+
+serial_writer_c::serial_writer_c(std::ostream &out,
+                                 std::shared_ptr<environment_c> env,
+                                 std::string context, serial_carry_t *carry)
+    : _out(*out.rdbuf()), _env(env), _context(std::move(context)),
+      _carry(carry) {
+   write_bytes(serial_magic);
+   write_count(serial_version);
+}
+
+void serial_writer_c::write(const cell_t &value) {
+   collect(value);
+   write_closures();
+   write_cell(value);
+   clear_closures();
+}
+
+// Find every closure and box reachable from a cell so they can be written
+// before anything refers to them
+void serial_writer_c::collect(const cell_t &c) {
+   if (c.type == cell_type_e::LIST) {
+      for (auto &item : c.list) {
+         collect(item);
+      }
+      return;
+   }
+   if (c.type != cell_type_e::LAMBDA) {
+      return;
+   }
+
+   auto closure = std::static_pointer_cast<closure_c>(c.env);
+   if (_closure_ids.contains(closure.get())) {
+      return;
+   }
+   _closure_ids[closure.get()] = _closures.size();
+   _closures.emplace_back(closure, c);
+
+   for (auto &[name, value] : closure->get_bindings()) {
+      collect(value);
+   }
+   for (auto &[name, box] : closure->get_boxes()) {
+      if (_box_ids.contains(box.get())) {
+         continue;
+      }
+      _box_ids[box.get()] = _boxes.size();
+      _boxes.push_back(box);
+      collect(*box);
+   }
+
+   // Anything free that the closure did not capture is a global
+   //
+   if (_carry) {
+      for (auto &var : closure->info().free) {
+         if (!closure->contains(var)) {
+            collect_global(closure->get_outer(), var);
+         }
+      }
+   }
+}
+
+// Builtins bound to their own name are already in every interpreter
+void serial_writer_c::collect_global(
+    const std::shared_ptr<environment_c> &global, const std::string &name) {
+   if (!global || !_global_names.insert(name).second) {
+      return;
+   }
+   auto &bindings = global->get_bindings();
+   auto it = bindings.find(name);
+   if (it == bindings.end() ||
+       (it->second.type == cell_type_e::PROC && it->second.val == name)) {
+      return;
+   }
+   _globals.emplace_back(name, it->second);
+   collect(it->second);
+}
+
+void serial_writer_c::write_closures() {
+   write_count(_closures.size());
+   for (auto &[closure, lambda] : _closures) {
+      const cell_t &source = lambda_source(lambda);
+      write_count(source.list.size());
+      for (auto &item : source.list) {
+         write_cell(item);
+      }
+   }
+
+   write_count(_boxes.size());
+   for (auto &[closure, lambda] : _closures) {
+      write_count(closure->get_bindings().size());
+      for (auto &[name, value] : closure->get_bindings()) {
+         write_name(name);
+         write_cell(value);
+      }
+      write_count(closure->get_boxes().size());
+      for (auto &[name, box] : closure->get_boxes()) {
+         write_name(name);
+         write_count(_box_ids.at(box.get()));
+      }
+   }
+   for (auto &box : _boxes) {
+      write_cell(*box);
+   }
+
+   if (_carry) {
+      write_count(_globals.size());
+      for (auto &[name, value] : _globals) {
+         write_name(name);
+         write_cell(value);
+      }
+   }
+}
+
+void serial_writer_c::write_cell(const cell_t &c) {
+   switch (c.type) {
+   case cell_type_e::SYMBOL:
+      write_byte(static_cast<uint8_t>(tag_e::SYMBOL));
+      write_name(c.val);
+      return;
+   case cell_type_e::NUMBER: {
+      int64_t value;
+      if (as_integer(c.val, value)) {
+         write_byte(static_cast<uint8_t>(tag_e::INTEGER));
+         write_count(zigzag(value));
+      } else {
+         write_byte(static_cast<uint8_t>(tag_e::NUMBER));
+         write_string(c.val);
+      }
+      return;
+   }
+   case cell_type_e::DOUBLE: {
+      double value;
+      if (as_real(c.val, value)) {
+         write_byte(static_cast<uint8_t>(tag_e::REAL));
+         uint64_t bits = std::bit_cast<uint64_t>(value);
+         for (int i = 0; i < 8; i++) {
+            write_byte(static_cast<uint8_t>(bits >> (8 * i)));
+         }
+      } else {
+         write_byte(static_cast<uint8_t>(tag_e::DOUBLE));
+         write_string(c.val);
+      }
+      return;
+   }
+   case cell_type_e::STRING:
+      write_byte(static_cast<uint8_t>(tag_e::STRING));
+      write_string(c.val);
+      return;
+   case cell_type_e::LIST:
+      write_byte(static_cast<uint8_t>(tag_e::LIST));
+      write_count(c.list.size());
+      for (auto &item : c.list) {
+         write_cell(item);
+      }
+      return;
+   case cell_type_e::LAMBDA: {
+      auto it = _closure_ids.find(static_cast<closure_c *>(c.env.get()));
+      if (it != _closure_ids.end()) {
+         write_byte(static_cast<uint8_t>(tag_e::LAMBDA));
+         write_count(it->second);
+         return;
+      }
+      break;
+   }
+   case cell_type_e::PROC:
+      if (!c.val.empty()) {
+         write_byte(static_cast<uint8_t>(tag_e::PROC));
+         write_name(c.val);
+         return;
+      }
+      break;
+   case cell_type_e::CHANNEL:
+      if (_carry) {
+         write_byte(static_cast<uint8_t>(tag_e::CHANNEL));
+         write_count(_carry->channels.size());
+         _carry->channels.push_back(c.obj);
+         return;
+      }
+      break;
+   default:
+      break;
+   }
+
+   //  nil keeps the stream readable, but what was written is not what was
+   //  asked for
+   //
+   std::string err = std::string("Unable to save ") +
+                     cell_type_to_string(c.type) + " in " + _context;
+   _env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+   _failed = true;
+   write_cell(nil);
+}
+
+// Unsigned LEB128, seven bits to a byte with the high bit set on every
+// byte but the last
+void serial_writer_c::write_count(uint64_t n) {
+   while (n >= 0x80) {
+      write_byte(static_cast<uint8_t>(n | 0x80));
+      n >>= 7;
+   }
+   write_byte(static_cast<uint8_t>(n));
+}
+
+void serial_writer_c::write_string(std::string_view s) {
+   write_count(s.size());
+   write_bytes(s);
+}
+
+void serial_writer_c::write_byte(uint8_t byte) {
+   if (_out.sputc(static_cast<char>(byte)) == std::char_traits<char>::eof()) {
+      _failed = true;
+   }
+}
+
+void serial_writer_c::write_bytes(std::string_view s) {
+   auto size = static_cast<std::streamsize>(s.size());
+   if (_out.sputn(s.data(), size) != size) {
+      _failed = true;
+   }
+}
+
+// A name is written once, after that it is the index it was given plus
+// one, 0 says a new name follows
+void serial_writer_c::write_name(const std::string &name) {
+   auto [it, added] = _names.try_emplace(name, _names.size());
+   if (!added) {
+      write_count(it->second + 1);
+      return;
+   }
+   write_count(0);
+   write_string(name);
+}
+
+void serial_writer_c::clear_closures() {
+   _closure_ids.clear();
+   _closures.clear();
+   _box_ids.clear();
+   _boxes.clear();
+   _global_names.clear();
+   _globals.clear();
+}
+
+serial_reader_c::serial_reader_c(std::istream &in, engine_c &engine,
+                                 std::shared_ptr<environment_c> env,
+                                 const serial_carry_t *carry)
+    : _in(*in.rdbuf()), _engine(engine), _env(env), _carry(carry) {
+   std::string magic(serial_magic.size(), '\0');
+   auto size = static_cast<std::streamsize>(magic.size());
+   if (_in.sgetn(magic.data(), size) != size || magic != serial_magic) {
+      throw std::runtime_error("not serialized polaris data");
+   }
+   uint64_t version = read_count();
+   if (version != serial_version) {
+      throw std::runtime_error("unsupported version " +
+                               std::to_string(version));
+   }
+}
+
+bool serial_reader_c::read(cell_t &value) {
+   if (_in.sgetc() == std::char_traits<char>::eof()) {
+      return false;
+   }
+   read_closures();
+   value = read_cell();
+   _lambdas.clear();
+   return true;
+}
+
+// Closures are created empty first, their captures can refer to each
+// other (and to themselves through boxes)
+void serial_reader_c::read_closures() {
+   uint64_t count = read_count();
+   std::vector<std::shared_ptr<closure_c>> closures;
+   for (uint64_t i = 0; i < count; i++) {
+      cell_t lambda(cell_type_e::LIST);
+      uint64_t size = read_count();
+      for (uint64_t j = 0; j < size; j++) {
+         lambda.list.push_back(read_cell());
+      }
+      if (lambda.list.size() < 3) {
+         malformed();
+      }
+      lambda.type = cell_type_e::LAMBDA;
+      auto closure = std::make_shared<closure_c>(analyze_lambda(lambda), _env);
+      lambda.env = closure;
+      _engine.adopt(lambda);
+      closures.push_back(closure);
+      _lambdas.push_back(std::move(lambda));
+   }
+
+   uint64_t box_count = read_count();
+   std::vector<std::shared_ptr<cell_t>> boxes;
+   for (uint64_t i = 0; i < box_count; i++) {
+      boxes.push_back(std::make_shared<cell_t>(nil));
+   }
+
+   for (auto &closure : closures) {
+      uint64_t bindings = read_count();
+      for (uint64_t i = 0; i < bindings; i++) {
+         std::string name = read_name();
+         closure->get(name) = read_cell();
+      }
+      uint64_t boxed = read_count();
+      for (uint64_t i = 0; i < boxed; i++) {
+         std::string name = read_name();
+         uint64_t box = read_count();
+         if (box >= boxes.size()) {
+            malformed();
+         }
+         closure->bind_box(name, boxes[box]);
+      }
+   }
+   for (auto &box : boxes) {
+      *box = read_cell();
+   }
+
+   if (_carry) {
+      auto &bindings = _env->get_bindings();
+      uint64_t globals = read_count();
+      for (uint64_t i = 0; i < globals; i++) {
+         std::string name = read_name();
+         cell_t value = read_cell();
+         if (!bindings.contains(name)) {
+            bindings[name] = std::move(value);
+         }
+      }
+   }
+}
+
+cell_t serial_reader_c::read_cell() {
+   switch (static_cast<tag_e>(read_byte())) {
+   case tag_e::SYMBOL:
+      return cell_t(cell_type_e::SYMBOL, read_name());
+   case tag_e::INTEGER:
+      return cell_t(cell_type_e::NUMBER,
+                    format_integer(unzigzag(read_count())));
+   case tag_e::NUMBER:
+      return cell_t(cell_type_e::NUMBER, read_string());
+   case tag_e::REAL: {
+      uint64_t bits = 0;
+      for (int i = 0; i < 8; i++) {
+         bits |= static_cast<uint64_t>(read_byte()) << (8 * i);
+      }
+      return cell_t(cell_type_e::DOUBLE,
+                    format_real(std::bit_cast<double>(bits)));
+   }
+   case tag_e::DOUBLE:
+      return cell_t(cell_type_e::DOUBLE, read_string());
+   case tag_e::STRING:
+      return cell_t(cell_type_e::STRING, read_string());
+   case tag_e::LIST: {
+      if (_depth >= serial_max_depth) {
+         malformed();
+      }
+      nesting_t nesting{++_depth};
+      cell_t c(cell_type_e::LIST);
+      uint64_t size = read_count();
+      c.list.reserve(std::min(size, largest_reserve));
+      for (uint64_t i = 0; i < size; i++) {
+         c.list.push_back(read_cell());
+      }
+      return c;
+   }
+   case tag_e::LAMBDA: {
+      uint64_t id = read_count();
+      if (id >= _lambdas.size()) {
+         malformed();
+      }
+      return _lambdas[id];
+   }
+   case tag_e::PROC: {
+      const std::string &name = read_name();
+      auto &bindings = _env->get_bindings();
+      auto it = bindings.find(name);
+      if (it == bindings.end() || it->second.type != cell_type_e::PROC ||
+          it->second.val != name) {
+         throw std::runtime_error("refers to unknown builtin : " + name);
+      }
+      return it->second;
+   }
+   case tag_e::CHANNEL: {
+      uint64_t id = read_count();
+      if (!_carry || id >= _carry->channels.size()) {
+         malformed();
+      }
+      cell_t c(cell_type_e::CHANNEL);
+      c.obj = _carry->channels[id];
+      return c;
+   }
+   default:
+      malformed();
+   }
+}
+
+uint64_t serial_reader_c::read_count() {
+   uint64_t n = 0;
+   for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte = read_byte();
+      n |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+         return n;
+      }
+   }
+   malformed();
+}
+
+std::string serial_reader_c::read_string() {
+   uint64_t size = read_count();
+   std::string s;
+   constexpr uint64_t chunk = 1 << 16;
+   while (s.size() < size) {
+      std::size_t at = s.size();
+      auto n = static_cast<std::streamsize>(std::min(size - at, chunk));
+      s.resize(at + static_cast<std::size_t>(n));
+      if (_in.sgetn(s.data() + at, n) != n) {
+         malformed();
+      }
+   }
+   return s;
+}
+
+uint8_t serial_reader_c::read_byte() {
+   auto c = _in.sbumpc();
+   if (c == std::char_traits<char>::eof()) {
+      malformed();
+   }
+   return static_cast<uint8_t>(c);
+}
+
+const std::string &serial_reader_c::read_name() {
+   uint64_t id = read_count();
+   if (id == 0) {
+      _names.push_back(read_string());
+      return _names.back();
+   }
+   if (id > _names.size()) {
+      malformed();
+   }
+   return _names[id - 1];
+}
+
+std::string serialize(const cell_t &value,
+                      std::shared_ptr<environment_c> env) {
+   std::ostringstream out(std::ios::out | std::ios::binary);
+   serial_writer_c writer(out, env);
+   writer.write(value);
+   return out.str();
+}
+
+cell_t deserialize(std::string_view data, engine_c &engine,
+                   std::shared_ptr<environment_c> env,
+                   const serial_carry_t *carry) {
+   view_buffer_c buffer(data);
+   std::istream in(&buffer);
+   serial_reader_c reader(in, engine, env, carry);
+   cell_t value;
+   if (!reader.read(value)) {
+      malformed();
+   }
+   return value;
+}
+
+void add_serialize_globals(std::shared_ptr<environment_c> env,
+                           engine_c &engine) {
+
+   env->get("serialize") = cell_t([=](cell_span c) -> cell_t {
+      if (c.size() != 1) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected 1 argument for [serialize]");
+         std::exit(1);
+      }
+      std::ostringstream out(std::ios::out | std::ios::binary);
+      serial_writer_c writer(out, env);
+      writer.write(c[0]);
+      if (!writer.good()) {
+         return false_sym;
+      }
+      return cell_t(cell_type_e::STRING, out.str());
+   });
+
+   // Damaged data is a failure rather than fatal, it usually came from
+   // outside of the program
+   //
+   env->get("deserialize") = cell_t([=, &engine](cell_span c) -> cell_t {
+      if (c.size() != 1 || c[0].type != cell_type_e::STRING) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected a string for [deserialize]");
+         std::exit(1);
+      }
+      try {
+         return deserialize(c[0].val, engine, env);
+      } catch (const std::exception &e) {
+         std::string err = std::string("Unable to deserialize : ") + e.what();
+         env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+         return nil;
+      }
+   });
+
+   // (serialize-file path items), items is a list or a sequence and each
+   // item is written as it is produced. Returns the number of records
+   env->get("serialize-file") = cell_t([=](cell_span c) -> cell_t {
+      if (c.size() != 2 || (c[1].type != cell_type_e::LIST &&
+                            c[1].type != cell_type_e::SEQUENCE)) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected a path and a list or sequence for "
+                             "[serialize-file]");
+         std::exit(1);
+      }
+      std::ofstream fs(c[0].val,
+                       std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!fs.is_open()) {
+         std::string err = "Unable to write file : " + c[0].val;
+         env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+         return false_sym;
+      }
+      serial_writer_c writer(fs, env);
+      std::size_t records = 0;
+      if (c[1].type == cell_type_e::LIST) {
+         for (auto &item : c[1].list) {
+            writer.write(item);
+         }
+         records = c[1].list.size();
+      } else {
+         auto items = std::static_pointer_cast<sequence_c>(c[1].obj);
+         while (auto item = items->next()) {
+            writer.write(*item);
+            ++records;
+         }
+      }
+      if (!writer.good()) {
+         std::string err = "Unable to write file : " + c[0].val;
+         env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+         return false_sym;
+      }
+      return cell_t(cell_type_e::NUMBER, std::to_string(records));
+   });
+
+   // (deserialize-file path), a sequence reading one record at a time. A
+   // damaged record ends the sequence
+   env->get("deserialize-file") = cell_t([=, &engine](cell_span c) -> cell_t {
+      if (c.size() != 1) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected 1 argument for [deserialize-file]");
+         std::exit(1);
+      }
+      auto fs = std::make_shared<std::ifstream>(
+          c[0].val, std::ios::in | std::ios::binary);
+      if (!fs->is_open()) {
+         std::string err = "Unable to open file : " + c[0].val;
+         env->get_error_cb()(error_level_e::FATAL, err.c_str());
+         std::exit(1);
+      }
+      std::shared_ptr<serial_reader_c> reader;
+      try {
+         reader = std::make_shared<serial_reader_c>(*fs, engine, env);
+      } catch (const std::exception &e) {
+         std::string err = "Unable to deserialize " + c[0].val + " : " +
+                           e.what();
+         env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+         return nil;
+      }
+      return make_sequence(
+          [fs, reader, env, path = c[0].val]() -> std::optional<cell_t> {
+             try {
+                cell_t value;
+                if (reader->read(value)) {
+                   return value;
+                }
+             } catch (const std::exception &e) {
+                std::string err =
+                    "Unable to deserialize " + path + " : " + e.what();
+                env->get_error_cb()(error_level_e::FAILURE, err.c_str());
+             }
+             return std::nullopt;
+          });
+   });
+}
+
+} // namespace polaris
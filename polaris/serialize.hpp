@@ -0,0 +1,183 @@
+#ifndef POLARIS_SERIALIZE_HPP
+#define POLARIS_SERIALIZE_HPP
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace polaris {
+
+//! \brief Version of the binary encoding, streams written by another
+//!        version are refused
+constexpr uint64_t serial_version = 1;
+
+//! \brief Deepest nesting of lists a reader accepts, deeper data is taken
+//!        to be damaged rather than read until the stack runs out
+constexpr std::size_t serial_max_depth = 10000;
+
+//! \brief What a value takes with it when it is handed to another
+//!        interpreter in the same process rather than saved. Channels are
+//!        shared instead of written, and lambdas take the globals they
+//!        refer to along with their closures. The writer and the reader
+//!        must both be given one
+struct serial_carry_t {
+   //! The channels in the value, written as their index here
+   std::vector<std::shared_ptr<object_c>> channels;
+};
+
+//! \brief Writes cells in the binary encoding. The stream starts with a
+//!        header holding the version, then holds records. Counts and
+//!        integers are varints, symbols are interned so each name is only
+//!        written once per stream, strings and lists are length prefixed.
+//!        Lambdas are written with everything their closures captured,
+//!        builtins by name
+class serial_writer_c {
+ public:
+   //! \brief Create the writer, the header is written straight away
+   //! \param out The stream to write to
+   //! \param env Environment whose error callback is told about cells that
+   //!        can not be written, those are written as nil and the writer
+   //!        is no longer good
+   //! \param context What is being written, for the error messages
+   //! \param carry Set when the value stays in the process, the channels
+   //!        written are added to it
+   serial_writer_c(std::ostream &out, std::shared_ptr<environment_c> env,
+                   std::string context = "serialized data",
+                   serial_carry_t *carry = nullptr);
+
+   //! \brief Write a value as a record of its own, with the closures of
+   //!        any lambdas in it
+   void write(const cell_t &value);
+
+   //! \brief Find the closures reachable from a cell, they must all be
+   //!        collected before write_closures and before any cell that
+   //!        refers to them is written
+   void collect(const cell_t &c);
+
+   //! \brief Write the collected closures and the boxes they share, and
+   //!        when carrying the globals they refer to
+   void write_closures();
+
+   //! \brief Write a cell, lambdas in it must have been collected
+   void write_cell(const cell_t &c);
+
+   //! \brief Write a count or any other unsigned number
+   void write_count(uint64_t n);
+
+   //! \brief Write a length prefixed string
+   void write_string(std::string_view s);
+
+   //! \brief Check that everything so far could be written and reached
+   //!        the stream
+   bool good() const { return !_failed; }
+
+ private:
+   void write_byte(uint8_t byte);
+   void write_bytes(std::string_view s);
+   void write_name(const std::string &name);
+   void collect_global(const std::shared_ptr<environment_c> &global,
+                       const std::string &name);
+   void clear_closures();
+
+   std::streambuf &_out;
+   bool _failed{false};
+   std::shared_ptr<environment_c> _env;
+   std::string _context;
+   serial_carry_t *_carry;
+   std::unordered_map<std::string, std::size_t> _names;
+   std::unordered_map<const closure_c *, std::size_t> _closure_ids;
+   std::vector<std::pair<std::shared_ptr<closure_c>, cell_t>> _closures;
+   std::unordered_map<const cell_t *, std::size_t> _box_ids;
+   std::vector<std::shared_ptr<cell_t>> _boxes;
+   std::unordered_set<std::string> _global_names;
+   std::vector<std::pair<std::string, cell_t>> _globals;
+};
+
+//! \brief Reads cells written by serial_writer_c. Damaged or truncated
+//!        data, including lists nested deeper than serial_max_depth, makes
+//!        the reader throw std::runtime_error
+class serial_reader_c {
+ public:
+   //! \brief Create the reader and check the header
+   //! \param in The stream to read from
+   //! \param engine The engine that will call the lambdas read
+   //! \param env The global environment builtins are found in and that
+   //!        the closures read are created against. Globals carried with
+   //!        lambdas are defined in it unless it already has them
+   //! \param carry What the writer was given, if it was given anything
+   serial_reader_c(std::istream &in, engine_c &engine,
+                   std::shared_ptr<environment_c> env,
+                   const serial_carry_t *carry = nullptr);
+
+   //! \brief Read the next record
+   //! \param value Set to the value of the record
+   //! \returns false if the stream has no more records
+   bool read(cell_t &value);
+
+   //! \brief Read closures (and carried globals) written by write_closures
+   void read_closures();
+
+   //! \brief Read a cell written by write_cell
+   cell_t read_cell();
+
+   //! \brief Read a number written by write_count
+   uint64_t read_count();
+
+   //! \brief Read a string written by write_string
+   std::string read_string();
+
+ private:
+   uint8_t read_byte();
+   const std::string &read_name();
+
+   std::streambuf &_in;
+   engine_c &_engine;
+   std::shared_ptr<environment_c> _env;
+   const serial_carry_t *_carry;
+   std::vector<std::string> _names;
+   cells _lambdas;
+   std::size_t _depth{0};
+};
+
+//! \brief Encode a value as a stream holding one record
+//! \param value The value to encode
+//! \param env Environment whose error callback is told about cells that
+//!        can not be encoded
+extern std::string serialize(const cell_t &value,
+                             std::shared_ptr<environment_c> env);
+
+//! \brief Decode the first record of a stream made by serialize. Throws
+//!        std::runtime_error if the data is damaged
+//! \param data The encoded stream
+//! \param engine The engine that will call any lambdas decoded
+//! \param env The global environment to decode against
+//! \param carry What the writer was given, if it was given anything
+extern cell_t deserialize(std::string_view data, engine_c &engine,
+                          std::shared_ptr<environment_c> env,
+                          const serial_carry_t *carry = nullptr);
+
+//! \brief Add the serialization builtins to an environment. These are
+//!        `(serialize value)` and `(deserialize string)`, along with
+//!        `(serialize-file path items)` which writes each item of a list
+//!        or sequence as a record and `(deserialize-file path)` which
+//!        reads the records back as a sequence
+//! \param env The environment to load the symbols into
+//! \param engine The engine that will call any lambdas decoded
+extern void add_serialize_globals(std::shared_ptr<environment_c> env,
+                                  engine_c &engine);
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,646 @@
+#include "server.hpp"
+#include "builtins.hpp"
+#include "async.hpp"
+#include "compiler.hpp"
+#include "environment.hpp"
+#include "image.hpp"
+#include "imports.hpp"
+#include "polaris.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace polaris {
+
+namespace {
+
+#ifdef MSG_NOSIGNAL
+constexpr int send_flags = MSG_NOSIGNAL;
+#else
+constexpr int send_flags = 0;
+#endif
+
+constexpr std::size_t frame_header = 4;
+
+//  Thrown out of the error callback of a worker on a fatal error, which
+//  would otherwise end the process
+//
+class request_failed_c : public std::exception {
+ public:
+   const char *what() const noexcept override { return "request failed"; }
+};
+
+void set_nonblocking(int fd) {
+   ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+   ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+void put_frame(std::string &out, char first, std::string_view rest) {
+   uint32_t size = static_cast<uint32_t>(rest.size() + 1);
+   for (int shift = 24; shift >= 0; shift -= 8) {
+      out.push_back(static_cast<char>((size >> shift) & 0xff));
+   }
+   out.push_back(first);
+   out.append(rest);
+}
+
+uint32_t frame_size(const char *header) {
+   uint32_t size = 0;
+   for (std::size_t i = 0; i < frame_header; i++) {
+      size = (size << 8) | static_cast<unsigned char>(header[i]);
+   }
+   return size;
+}
+
+//  Sockets of the server are non blocking, a full socket is waited on
+//  rather than dropping the rest of the replies
+//
+//  Gives up once the peer has taken nothing for timeout_ms, a negative
+//  timeout waits for as long as it takes
+//
+bool write_all(int fd, std::string_view data, int timeout_ms = -1) {
+   while (!data.empty()) {
+      ssize_t n = ::send(fd, data.data(), data.size(), send_flags);
+      if (n > 0) {
+         data.remove_prefix(static_cast<std::size_t>(n));
+         continue;
+      }
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+         pollfd p{fd, POLLOUT, 0};
+         int ready = ::poll(&p, 1, timeout_ms);
+         if (ready == 0 || (ready < 0 && errno != EINTR)) {
+            return false;
+         }
+         continue;
+      }
+      return false;
+   }
+   return true;
+}
+
+bool read_exact(int fd, char *data, std::size_t size) {
+   while (size) {
+      ssize_t n = ::read(fd, data, size);
+      if (n > 0) {
+         data += n;
+         size -= static_cast<std::size_t>(n);
+         continue;
+      }
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      return false;
+   }
+   return true;
+}
+
+void wake(int fd) {
+   char c = 0;
+   [[maybe_unused]] ssize_t n = ::write(fd, &c, 1);
+}
+
+} // namespace
+
+void latency_c::record(uint64_t us) {
+   _buckets[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+   _count.fetch_add(1, std::memory_order_relaxed);
+   _total.fetch_add(us, std::memory_order_relaxed);
+   uint64_t max = _max.load(std::memory_order_relaxed);
+   while (us > max &&
+          !_max.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+   }
+}
+
+uint64_t latency_c::mean() const {
+   uint64_t n = count();
+   return n ? _total.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint64_t latency_c::percentile(double fraction) const {
+   uint64_t n = count();
+   if (!n) {
+      return 0;
+   }
+   uint64_t wanted = std::max<uint64_t>(
+       1, static_cast<uint64_t>(fraction * static_cast<double>(n) + 0.5));
+   uint64_t seen = 0;
+   for (std::size_t i = 0; i < buckets; i++) {
+      seen += _buckets[i].load(std::memory_order_relaxed);
+      if (seen >= wanted) {
+         return std::min(bucket_top(i), max());
+      }
+   }
+   return max();
+}
+
+//  Values below 8 have a bucket each, above that every power of two is
+//  split into 8 buckets by the 3 bits after the leading one
+//
+std::size_t latency_c::bucket(uint64_t us) {
+   if (us < 8) {
+      return static_cast<std::size_t>(us);
+   }
+   std::size_t exponent = static_cast<std::size_t>(std::bit_width(us) - 1);
+   std::size_t sub = static_cast<std::size_t>((us >> (exponent - 3)) & 7);
+   return 8 + (exponent - 3) * 8 + sub;
+}
+
+uint64_t latency_c::bucket_top(std::size_t index) {
+   if (index < 8) {
+      return index;
+   }
+   std::size_t exponent = (index - 8) / 8 + 3;
+   uint64_t sub = (index - 8) % 8;
+   return (((8 | sub) + 1) << (exponent - 3)) - 1;
+}
+
+struct server_c::worker_t {
+   std::string errors;
+   evaluator_c evaluator;
+   compiler_c compiler;
+   engine_c *engine{nullptr};
+   loop_c loop;
+   std::shared_ptr<environment_c> env;
+   std::unique_ptr<imports_c> imports;
+};
+
+server_c::server_c(server_config_t config, error_cb_f error_cb)
+    : _config(std::move(config)), _error_cb(std::move(error_cb)) {
+   _config.workers = std::max<std::size_t>(1, _config.workers);
+   _config.max_batch = std::max<std::size_t>(1, _config.max_batch);
+}
+
+server_c::~server_c() {
+   stop();
+   shutdown();
+}
+
+bool server_c::start() {
+   auto fail = [this](const std::string &what) {
+      std::string err = what + " : " + _config.socket_path + " : " +
+                        std::strerror(errno);
+      _error_cb(error_level_e::FAILURE, err.c_str());
+      return false;
+   };
+
+   sockaddr_un addr{};
+   addr.sun_family = AF_UNIX;
+   if (_config.socket_path.empty() ||
+       _config.socket_path.size() >= sizeof(addr.sun_path)) {
+      errno = ENAMETOOLONG;
+      return fail("Invalid socket path");
+   }
+   std::memcpy(addr.sun_path, _config.socket_path.c_str(),
+               _config.socket_path.size() + 1);
+
+   if (::pipe(_wake) != 0) {
+      return fail("Unable to create wake pipe");
+   }
+   set_nonblocking(_wake[0]);
+   set_nonblocking(_wake[1]);
+
+   _listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+   if (_listen_fd < 0) {
+      return fail("Unable to create socket");
+   }
+   ::unlink(_config.socket_path.c_str());
+   if (::bind(_listen_fd, reinterpret_cast<sockaddr *>(&addr),
+              sizeof(addr)) != 0 ||
+       ::listen(_listen_fd, SOMAXCONN) != 0) {
+      return fail("Unable to listen on socket");
+   }
+   set_nonblocking(_listen_fd);
+
+   // Each interpreter is built on its own thread, the start up cost is
+   // paid in parallel and the runtime statistics stay per worker
+   //
+   for (std::size_t i = 0; i < _config.workers; i++) {
+      _workers.emplace_back(&server_c::work, this, i);
+   }
+   std::unique_lock<std::mutex> lock(_mutex);
+   _ready_cv.wait(lock, [this]() { return _ready == _workers.size(); });
+   for (auto &err : _start_errors) {
+      _error_cb(error_level_e::FAILURE, err.c_str());
+   }
+   return true;
+}
+
+void server_c::stop() {
+   _stopping.store(true);
+   if (_wake[1] >= 0) {
+      wake(_wake[1]);
+   }
+}
+
+cell_t server_c::metrics() const {
+   cell_t c(cell_type_e::LIST);
+   c.list.push_back(pair("requests", _latency.count()));
+   c.list.push_back(pair("batches", _batches.load()));
+   c.list.push_back(pair("failures", _failures.load()));
+   c.list.push_back(pair("dropped", _drops.load()));
+   c.list.push_back(pair("workers", _config.workers));
+   c.list.push_back(pair("mean-us", _latency.mean()));
+   c.list.push_back(pair("p50-us", _latency.percentile(0.5)));
+   c.list.push_back(pair("p90-us", _latency.percentile(0.9)));
+   c.list.push_back(pair("p99-us", _latency.percentile(0.99)));
+   c.list.push_back(pair("max-us", _latency.max()));
+   return c;
+}
+
+void server_c::work(std::size_t index) {
+   worker_t w;
+   w.engine = _config.compile ? static_cast<engine_c *>(&w.compiler)
+                              : static_cast<engine_c *>(&w.evaluator);
+   w.evaluator.set_limits(_config.limits);
+   w.env = std::make_shared<environment_c>(
+       [&w](error_level_e level, const char *message) {
+          if (!w.errors.empty()) {
+             w.errors += '\n';
+          }
+          w.errors += message;
+          if (level == error_level_e::FATAL) {
+             throw request_failed_c();
+          }
+       });
+   w.imports =
+       std::make_unique<imports_c>(*w.engine, w.env, _config.include_dirs);
+   add_globals(w.env, *w.imports);
+   add_async_globals(w.env, *w.engine, w.loop);
+
+   //  Leaving is up to the server, a request can not take it down
+   //
+   w.env->get("exit") = cell_t([&w](cell_span) -> cell_t {
+      w.env->get_error_cb()(error_level_e::FATAL,
+                            "[exit] is not available to requests");
+      return nil;
+   });
+
+   try {
+      if (!_config.image.empty()) {
+         load_image(_config.image, *w.engine, w.env, *w.imports);
+      }
+      evaluate_all(*w.engine, _config.prelude, w.env);
+      w.loop.run();
+   } catch (const std::exception &) {
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!w.errors.empty()) {
+         _start_errors.push_back("Worker " + std::to_string(index) + " : " +
+                                 w.errors);
+      }
+      ++_ready;
+   }
+   _ready_cv.notify_all();
+
+   while (true) {
+      batch_t batch;
+      {
+         std::unique_lock<std::mutex> lock(_mutex);
+         _work_cv.wait(lock, [this]() { return _closed || !_queue.empty(); });
+         if (_queue.empty()) {
+            return;
+         }
+         batch = std::move(_queue.front());
+         _queue.pop_front();
+      }
+
+      std::string replies;
+      for (auto &request : batch.requests) {
+         std::string reply = serve(w, request);
+         _latency.record(static_cast<uint64_t>(
+             std::chrono::duration_cast<std::chrono::microseconds>(
+                 clock::now() - batch.received)
+                 .count()));
+         put_frame(replies, reply[0], std::string_view(reply).substr(1));
+      }
+      //  A client that stops reading its replies would otherwise hold on
+      //  to the worker forever
+      //
+      bool sent = write_all(batch.fd, replies, _config.write_timeout_ms);
+      if (!sent) {
+         _drops.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         (sent ? _done : _dropped).push_back(batch.fd);
+      }
+      wake(_wake[1]);
+   }
+}
+
+std::string server_c::serve(worker_t &w, std::string_view request) {
+   w.errors.clear();
+   cell_t result = nil;
+   try {
+      std::string_view payload = request.substr(1);
+      switch (static_cast<request_kind_e>(request[0])) {
+      case request_kind_e::EVALUATE:
+         result = evaluate_all(*w.engine, payload, w.env);
+         break;
+      case request_kind_e::CALL: {
+         auto end = payload.find_first_of(" \t\r\n");
+         std::string name(payload.substr(0, end));
+         cells args;
+         if (end != std::string_view::npos &&
+             !read_all(payload.substr(end), args)) {
+            w.errors = "Unbalanced parentheses in arguments";
+            break;
+         }
+         cell_t fn = w.env->lookup(name);
+         result = w.engine->apply(fn, cell_span(args));
+         break;
+      }
+      case request_kind_e::METRICS:
+         result = metrics();
+         break;
+      default:
+         w.errors = std::string("Unknown request kind : ") + request[0];
+         break;
+      }
+      w.loop.run();
+   } catch (const request_failed_c &) {
+   } catch (const std::exception &e) {
+      w.errors += e.what();
+   }
+
+   if (!w.errors.empty()) {
+      _failures.fetch_add(1, std::memory_order_relaxed);
+      return "F" + w.errors;
+   }
+   return "O" + to_string(result);
+}
+
+void server_c::accept() {
+   while (true) {
+      int fd = ::accept(_listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         return;
+      }
+      set_nonblocking(fd);
+      if (_config.send_buffer > 0) {
+         ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &_config.send_buffer,
+                      sizeof(_config.send_buffer));
+      }
+      _connections[fd].fd = fd;
+   }
+}
+
+bool server_c::receive(connection_t &connection) {
+   char buffer[65536];
+   while (true) {
+      ssize_t n = ::read(connection.fd, buffer, sizeof(buffer));
+      if (n > 0) {
+         connection.buffer.append(buffer, static_cast<std::size_t>(n));
+         continue;
+      }
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+   }
+}
+
+// Hand every complete request that has arrived on a connection to a worker
+// as one batch. A connection has at most one batch in flight so that its
+// replies are written in the order the requests were sent
+//
+void server_c::dispatch(connection_t &connection) {
+   if (connection.busy) {
+      return;
+   }
+
+   batch_t batch;
+   std::size_t at = 0;
+   const std::string &buffer = connection.buffer;
+   while (batch.requests.size() < _config.max_batch &&
+          buffer.size() - at >= frame_header) {
+      std::size_t size = frame_size(buffer.data() + at);
+      if (size == 0 || size > _config.max_request) {
+         connection.closing = true;
+         connection.buffer.clear();
+         batch.requests.clear();
+         at = 0;
+         break;
+      }
+      if (buffer.size() - at - frame_header < size) {
+         break;
+      }
+      batch.requests.emplace_back(buffer, at + frame_header, size);
+      at += frame_header + size;
+   }
+   connection.buffer.erase(0, at);
+
+   if (batch.requests.empty()) {
+      if (connection.closing) {
+         int fd = connection.fd;
+         ::close(fd);
+         _connections.erase(fd);
+      }
+      return;
+   }
+
+   connection.busy = true;
+   batch.fd = connection.fd;
+   batch.received = clock::now();
+   _batches.fetch_add(1, std::memory_order_relaxed);
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _queue.push_back(std::move(batch));
+   }
+   _work_cv.notify_one();
+}
+
+void server_c::finished() {
+   char buffer[256];
+   while (::read(_wake[0], buffer, sizeof(buffer)) > 0) {
+   }
+
+   std::vector<int> done;
+   std::vector<int> dropped;
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      done.swap(_done);
+      dropped.swap(_dropped);
+   }
+   for (int fd : dropped) {
+      ::close(fd);
+      _connections.erase(fd);
+   }
+   for (int fd : done) {
+      auto it = _connections.find(fd);
+      if (it != _connections.end()) {
+         it->second.busy = false;
+         dispatch(it->second);
+      }
+   }
+}
+
+void server_c::run() {
+   std::vector<pollfd> fds;
+   while (!_stopping.load()) {
+      fds.clear();
+      fds.push_back(pollfd{_wake[0], POLLIN, 0});
+      fds.push_back(pollfd{_listen_fd, POLLIN, 0});
+
+      // Busy connections are not read from until their batch is done,
+      // whatever they send meanwhile waits in the socket
+      //
+      for (auto &[fd, connection] : _connections) {
+         if (!connection.busy && !connection.closing) {
+            fds.push_back(pollfd{fd, POLLIN, 0});
+         }
+      }
+
+      if (::poll(fds.data(), fds.size(), -1) < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         break;
+      }
+      if (fds[0].revents) {
+         finished();
+      }
+      if (fds[1].revents) {
+         accept();
+      }
+      for (std::size_t i = 2; i < fds.size(); i++) {
+         if (!fds[i].revents) {
+            continue;
+         }
+         auto it = _connections.find(fds[i].fd);
+         if (it == _connections.end()) {
+            continue;
+         }
+         if (!receive(it->second)) {
+            it->second.closing = true;
+         }
+         dispatch(it->second);
+      }
+   }
+   shutdown();
+}
+
+void server_c::shutdown() {
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closed = true;
+   }
+   _work_cv.notify_all();
+   for (auto &worker : _workers) {
+      worker.join();
+   }
+   _workers.clear();
+
+   for (auto &[fd, connection] : _connections) {
+      ::close(fd);
+   }
+   _connections.clear();
+
+   if (_listen_fd >= 0) {
+      ::close(_listen_fd);
+      ::unlink(_config.socket_path.c_str());
+      _listen_fd = -1;
+   }
+   for (auto &fd : _wake) {
+      if (fd >= 0) {
+         ::close(fd);
+         fd = -1;
+      }
+   }
+}
+
+client_c::~client_c() {
+   if (_fd >= 0) {
+      ::close(_fd);
+   }
+}
+
+bool client_c::connect(const std::string &socket_path) {
+   sockaddr_un addr{};
+   addr.sun_family = AF_UNIX;
+   if (socket_path.size() >= sizeof(addr.sun_path)) {
+      return false;
+   }
+   std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+   if (_fd >= 0) {
+      ::close(_fd);
+   }
+   _fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+   if (_fd < 0) {
+      return false;
+   }
+   if (::connect(_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) !=
+       0) {
+      ::close(_fd);
+      _fd = -1;
+      return false;
+   }
+   return true;
+}
+
+bool client_c::send(request_kind_e kind, std::string_view payload) {
+   if (_fd < 0) {
+      return false;
+   }
+   std::string frame;
+   frame.reserve(frame_header + 1 + payload.size());
+   put_frame(frame, static_cast<char>(kind), payload);
+   return write_all(_fd, frame);
+}
+
+reply_t client_c::receive() {
+   char header[frame_header];
+   if (_fd < 0 || !read_exact(_fd, header, frame_header)) {
+      return {false, "Connection lost"};
+   }
+   std::string payload(frame_size(header), '\0');
+   if (payload.empty() || !read_exact(_fd, payload.data(), payload.size())) {
+      return {false, "Connection lost"};
+   }
+   return {payload[0] == 'O', payload.substr(1)};
+}
+
+reply_t client_c::evaluate(std::string_view source) {
+   if (!send(request_kind_e::EVALUATE, source)) {
+      return {false, "Connection lost"};
+   }
+   return receive();
+}
+
+reply_t client_c::call(std::string_view name, std::string_view args) {
+   std::string payload(name);
+   payload += ' ';
+   payload += args;
+   if (!send(request_kind_e::CALL, payload)) {
+      return {false, "Connection lost"};
+   }
+   return receive();
+}
+
+reply_t client_c::metrics() {
+   if (!send(request_kind_e::METRICS, {})) {
+      return {false, "Connection lost"};
+   }
+   return receive();
+}
+
+} // namespace polaris
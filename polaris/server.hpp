@@ -0,0 +1,249 @@
+#ifndef POLARIS_SERVER_HPP
+#define POLARIS_SERVER_HPP
+
+#include "cell.hpp"
+#include "error.hpp"
+#include "evaluator.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace polaris {
+
+//! \brief What a request asks the server to do. Requests and replies are
+//!        framed by a 4 byte big endian length, the first byte of a request
+//!        is its kind and the first byte of a reply is 'O' or 'F' for a
+//!        result or a failure
+enum class request_kind_e : char {
+   //! Evaluate every form of the payload, the reply is the last result
+   EVALUATE = 'E',
+
+   //! Call the global named by the first word of the payload with the
+   //! rest of the payload read as its (unevaluated) arguments
+   CALL = 'C',
+
+   //! Retrieve the latency metrics of the server
+   METRICS = 'M'
+};
+
+//! \brief The answer to a request
+struct reply_t {
+   //! false if the request failed
+   bool ok{false};
+
+   //! The result as text, or the reason the request failed
+   std::string text;
+};
+
+//! \brief Settings for a server
+struct server_config_t {
+   //! Path of the unix socket to listen on, replaced if it exists
+   std::string socket_path;
+
+   //! Number of worker threads, each with its own interpreter
+   std::size_t workers{1};
+
+   //! Most requests from one connection handed to a worker at once
+   std::size_t max_batch{64};
+
+   //! Largest request accepted, larger ones close the connection
+   std::size_t max_request{16 * 1024 * 1024};
+
+   //! Longest a worker waits, in milliseconds, for a client to take more
+   //! of its replies. The connection is dropped once it expires
+   int write_timeout_ms{10000};
+
+   //! Size of the socket buffer for the replies of each connection, in
+   //! bytes. 0 leaves the system default
+   int send_buffer{0};
+
+   //! Use the compiler rather than the evaluator
+   bool compile{false};
+
+   //! Limits applied to each request by the evaluator
+   limits_t limits;
+
+   //! Include directories for imports
+   std::vector<std::string> include_dirs;
+
+   //! Image every interpreter boots from, if any
+   std::string image;
+
+   //! Source every interpreter evaluates before serving
+   std::string prelude;
+};
+
+//! \brief Histogram of latencies in microseconds. Buckets are an eighth of
+//!        a power of two wide so percentiles are accurate to about 12%.
+//!        Recording is lock free and can happen from any thread
+class latency_c {
+ public:
+   //! \brief Record one latency
+   void record(uint64_t us);
+
+   //! \brief Retrieve the number of latencies recorded
+   uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+
+   //! \brief Retrieve the mean latency
+   uint64_t mean() const;
+
+   //! \brief Retrieve the largest latency recorded
+   uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+
+   //! \brief Retrieve the latency that a fraction of the recorded latencies
+   //!        are at or below, rounded up to the top of its bucket
+   //! \param fraction Between 0 and 1, 0.99 for the 99th percentile
+   uint64_t percentile(double fraction) const;
+
+ private:
+   static constexpr std::size_t buckets = 8 + 61 * 8;
+   static std::size_t bucket(uint64_t us);
+   static uint64_t bucket_top(std::size_t index);
+
+   std::array<std::atomic<uint64_t>, buckets> _buckets{};
+   std::atomic<uint64_t> _count{0};
+   std::atomic<uint64_t> _total{0};
+   std::atomic<uint64_t> _max{0};
+};
+
+//! \brief Serve requests from a unix socket with a pool of interpreters
+//!        that are initialised once, one per worker thread. Requests that
+//!        arrive on a connection together are handed to a worker as one
+//!        batch and their replies written together, in order. Interpreters
+//!        do not share state, anything defined by a request is only seen
+//!        by later requests that land on the same worker
+class server_c {
+ public:
+   //! \brief Create the server, nothing is started
+   //! \param config The settings to serve with
+   //! \param error_cb Given the reason if the server can not start
+   server_c(server_config_t config, error_cb_f error_cb);
+
+   //! \brief Stop serving and wait for the workers
+   ~server_c();
+
+   server_c(const server_c &) = delete;
+   server_c &operator=(const server_c &) = delete;
+
+   //! \brief Initialise the interpreters and listen on the socket
+   //! \returns false if the socket could not be listened on
+   bool start();
+
+   //! \brief Accept connections and serve requests until stop is called
+   void run();
+
+   //! \brief Ask run to return. Safe to call from other threads and from
+   //!        signal handlers
+   void stop();
+
+   //! \brief Retrieve the latency of requests, from being read off the
+   //!        socket to their result being ready
+   const latency_c &get_latency() const { return _latency; }
+
+   //! \brief Retrieve the metrics of the server as a list of pairs, the
+   //!        reply to a METRICS request
+   cell_t metrics() const;
+
+ private:
+   using clock = std::chrono::steady_clock;
+
+   struct worker_t;
+
+   struct connection_t {
+      int fd{-1};
+      std::string buffer;
+      bool busy{false};
+      bool closing{false};
+   };
+
+   struct batch_t {
+      int fd{-1};
+      std::vector<std::string> requests;
+      clock::time_point received;
+   };
+
+   void work(std::size_t index);
+   std::string serve(worker_t &worker, std::string_view request);
+   void accept();
+   bool receive(connection_t &connection);
+   void dispatch(connection_t &connection);
+   void finished();
+   void shutdown();
+
+   server_config_t _config;
+   error_cb_f _error_cb;
+   int _listen_fd{-1};
+   int _wake[2]{-1, -1};
+   std::atomic<bool> _stopping{false};
+   std::unordered_map<int, connection_t> _connections;
+
+   std::mutex _mutex;
+   std::condition_variable _work_cv;
+   std::condition_variable _ready_cv;
+   std::deque<batch_t> _queue;
+   std::vector<int> _done;
+   std::vector<int> _dropped;
+   std::size_t _ready{0};
+   std::vector<std::string> _start_errors;
+   bool _closed{false};
+   std::vector<std::thread> _workers;
+
+   latency_c _latency;
+   std::atomic<uint64_t> _batches{0};
+   std::atomic<uint64_t> _failures{0};
+   std::atomic<uint64_t> _drops{0};
+};
+
+//! \brief Connection to a server_c. Requests can be sent ahead of reading
+//!        their replies, the replies come back in the order sent
+class client_c {
+ public:
+   client_c() = default;
+   ~client_c();
+
+   client_c(const client_c &) = delete;
+   client_c &operator=(const client_c &) = delete;
+
+   //! \brief Connect to a server
+   //! \param socket_path The unix socket the server listens on
+   //! \returns false if the connection could not be made
+   bool connect(const std::string &socket_path);
+
+   //! \brief Send a request without waiting for its reply
+   //! \returns false if the connection has been lost
+   bool send(request_kind_e kind, std::string_view payload);
+
+   //! \brief Wait for the reply to the oldest request not yet received
+   //! \returns A failed reply if the connection has been lost
+   reply_t receive();
+
+   //! \brief Evaluate source and wait for the result
+   reply_t evaluate(std::string_view source);
+
+   //! \brief Call a global function and wait for the result
+   //! \param name The name the function is bound to
+   //! \param args The arguments, as source
+   reply_t call(std::string_view name, std::string_view args);
+
+   //! \brief Retrieve the metrics of the server
+   reply_t metrics();
+
+ private:
+   int _fd{-1};
+};
+
+} // namespace polaris
+
+#endif
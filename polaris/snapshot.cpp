@@ -0,0 +1,34 @@
+#include "snapshot.hpp"
+#include "environment.hpp"
+
+namespace polaris {
+
+snapshot_c::snapshot_c(std::vector<std::string> names)
+    : _names(std::move(names)), _view(std::make_shared<const view_t>()) {}
+
+void snapshot_c::publish(environment_c &env) {
+   auto view = std::make_shared<view_t>();
+   view->version = read()->version + 1;
+   view->values.reserve(_names.size());
+
+   //  Variables are looked up without failing, one that is not bound yet
+   //  is left out of the view
+   //
+   for (auto &name : _names) {
+      for (environment_c *e = &env; e; e = e->get_outer().get()) {
+         if (e->contains(name)) {
+            view->values.emplace(name, e->get(name));
+            break;
+         }
+      }
+   }
+   _view.store(std::move(view), std::memory_order_release);
+}
+
+cell_t snapshot_c::get(const std::string &name) const {
+   auto view = read();
+   auto it = view->values.find(name);
+   return it == view->values.end() ? nil : it->second;
+}
+
+} // namespace polaris
@@ -0,0 +1,66 @@
+#ifndef POLARIS_SNAPSHOT_HPP
+#define POLARIS_SNAPSHOT_HPP
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace polaris {
+
+//! \brief Values of chosen variables of an environment, published by the
+//!        thread running the interpreter for other threads to read. Each
+//!        publication copies the variables into a new map that is never
+//!        changed again and swaps it in, readers keep the map they loaded
+//!        for as long as they hold it and never wait on the interpreter.
+//!        Values that hold an object, such as records, share it with the
+//!        interpreter and their contents are not safe to read
+class snapshot_c {
+ public:
+   //! \brief The variables as of one publication
+   struct view_t {
+      //! Number of publications up to and including this one
+      uint64_t version{0};
+
+      //! The variables that were bound, by name
+      cell_t::map values;
+   };
+
+   //! \brief Create the snapshot, nothing is published until publish is
+   //!        called
+   //! \param names The variables to publish
+   explicit snapshot_c(std::vector<std::string> names);
+
+   snapshot_c(const snapshot_c &) = delete;
+   snapshot_c &operator=(const snapshot_c &) = delete;
+
+   //! \brief Publish the current values of the variables. Must be called
+   //!        on the thread evaluating in the environment, which
+   //!        evaluate_all does after every statement for an environment
+   //!        given a snapshot with set_snapshot
+   //! \param env The environment to look the variables up in
+   void publish(environment_c &env);
+
+   //! \brief Retrieve the latest publication, from any thread. All of the
+   //!        values in it were read at the same point of the program
+   std::shared_ptr<const view_t> read() const {
+      return _view.load(std::memory_order_acquire);
+   }
+
+   //! \brief Retrieve the latest published value of a variable, from any
+   //!        thread
+   //! \returns The value, or nil if it was not bound when published
+   cell_t get(const std::string &name) const;
+
+ private:
+   std::vector<std::string> _names;
+   std::atomic<std::shared_ptr<const view_t>> _view;
+};
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,323 @@
+#include "sort.hpp"
+#include "builtins.hpp"
+#include "closure.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+#include "number.hpp"
+#include "sequence.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+namespace polaris {
+
+namespace {
+
+//  Each thread sorts at least this many items
+//
+constexpr std::size_t smallest_run = parallel_sort_threshold / 4;
+
+enum class parsed_e { INT64, BIG, OTHER };
+
+parsed_e parse_integer(const std::string &s, int64_t &value) {
+   const char *begin = s.data();
+   const char *end = s.data() + s.size();
+   if (begin != end && *begin == '+') {
+      ++begin;
+   }
+   auto [ptr, ec] = std::from_chars(begin, end, value);
+   if (ptr != end || begin == end) {
+      return parsed_e::OTHER;
+   }
+   if (ec == std::errc()) {
+      return parsed_e::INT64;
+   }
+   return ec == std::errc::result_out_of_range ? parsed_e::BIG
+                                               : parsed_e::OTHER;
+}
+
+struct big_key_t {
+   bigint_c value;
+   bool operator<(const big_key_t &other) const {
+      return value.compare(other.value) < 0;
+   }
+};
+
+//  NaN goes after every other number so that the order stays strict
+//
+struct real_key_t {
+   double value;
+   bool operator<(const real_key_t &other) const {
+      if (std::isnan(value)) {
+         return false;
+      }
+      return std::isnan(other.value) || value < other.value;
+   }
+};
+
+template <typename Key>
+using keyed_t = std::vector<std::pair<Key, std::size_t>>;
+
+// Call fn with 0 to n - 1, each on a thread of its own
+template <typename Fn> void run_parallel(std::size_t n, Fn &&fn) {
+   std::vector<std::thread> threads;
+   for (std::size_t i = 1; i < n; i++) {
+      threads.emplace_back(fn, i);
+   }
+   fn(0);
+   for (auto &t : threads) {
+      t.join();
+   }
+}
+
+// Sort runs of the items on separate threads then merge neighbouring runs
+// until one is left, the merges of each round also run in parallel
+template <typename Item, typename Less>
+void parallel_sort(std::vector<Item> &items, Less less, std::size_t threads) {
+   if (!threads) {
+      threads = std::thread::hardware_concurrency();
+   }
+   threads = std::min(threads, items.size() / smallest_run);
+   if (items.size() < parallel_sort_threshold || threads < 2) {
+      std::sort(items.begin(), items.end(), less);
+      return;
+   }
+
+   auto at = [&items](std::size_t offset) { return items.begin() + offset; };
+   std::vector<std::size_t> bounds;
+   for (std::size_t i = 0; i <= threads; i++) {
+      bounds.push_back(items.size() * i / threads);
+   }
+   run_parallel(threads, [&](std::size_t i) {
+      std::sort(at(bounds[i]), at(bounds[i + 1]), less);
+   });
+
+   while (bounds.size() > 2) {
+      run_parallel((bounds.size() - 1) / 2, [&](std::size_t i) {
+         std::inplace_merge(at(bounds[2 * i]), at(bounds[2 * i + 1]),
+                            at(bounds[2 * i + 2]), less);
+      });
+      std::vector<std::size_t> merged;
+      for (std::size_t i = 0; i < bounds.size(); i += 2) {
+         merged.push_back(bounds[i]);
+      }
+      if (merged.back() != bounds.back()) {
+         merged.push_back(bounds.back());
+      }
+      bounds.swap(merged);
+   }
+}
+
+// Ties are broken by position, which keeps the sort stable and lets runs
+// be sorted with std::sort
+template <typename Key>
+void order_keyed(keyed_t<Key> &keyed, bool descending,
+                 std::vector<std::size_t> &order, std::size_t threads) {
+   using item_t = std::pair<Key, std::size_t>;
+   if (descending) {
+      auto greater = [](const item_t &a, const item_t &b) {
+         return b.first < a.first ||
+                (!(a.first < b.first) && a.second < b.second);
+      };
+      parallel_sort(keyed, greater, threads);
+   } else {
+      auto less = [](const item_t &a, const item_t &b) {
+         return a.first < b.first ||
+                (!(b.first < a.first) && a.second < b.second);
+      };
+      parallel_sort(keyed, less, threads);
+   }
+   order.resize(keyed.size());
+   for (std::size_t i = 0; i < keyed.size(); i++) {
+      order[i] = keyed[i].second;
+   }
+}
+
+// The comparator could touch anything, it is only ever called from the
+// thread running the engine
+std::vector<std::size_t> order_with(engine_c &engine, const cells &keys,
+                                    const cell_t &less) {
+   call_frame_c fn(engine, less);
+   std::vector<std::size_t> order(keys.size());
+   std::iota(order.begin(), order.end(), 0);
+   cell_t args[2];
+   std::stable_sort(order.begin(), order.end(),
+                    [&](std::size_t a, std::size_t b) {
+                       args[0] = keys[a];
+                       args[1] = keys[b];
+                       return truthy(fn.call(args));
+                    });
+   return order;
+}
+
+std::vector<std::size_t> order_of(std::shared_ptr<environment_c> env,
+                                  engine_c &engine, const cells &keys,
+                                  const cell_t *less,
+                                  const std::string &name) {
+   std::vector<std::size_t> order;
+   if (!less) {
+      if (!sort_natural(keys, false, order)) {
+         std::string err = "Expected every item to be a number or every item "
+                           "to be a string for [" +
+                           name + "] without a comparator";
+         env->get_error_cb()(error_level_e::FATAL, err.c_str());
+         std::exit(1);
+      }
+      return order;
+   }
+
+   // The builtin comparisons do not need to be called to know what they
+   // would say about numbers
+   //
+   if (less->type == cell_type_e::PROC &&
+       (less->val == "<" || less->val == ">")) {
+      if (sort_natural(keys, less->val == ">", order)) {
+         return order;
+      }
+   }
+   return order_with(engine, keys, *less);
+}
+
+const cells &items_of(std::shared_ptr<environment_c> env, const cell_t &c,
+                      cells &collected, const std::string &name) {
+   if (c.type == cell_type_e::LIST) {
+      return c.list;
+   }
+   if (c.type != cell_type_e::SEQUENCE) {
+      std::string err = "Expected a list or sequence for [" + name + "]";
+      env->get_error_cb()(error_level_e::FATAL, err.c_str());
+      std::exit(1);
+   }
+   auto source = std::static_pointer_cast<sequence_c>(c.obj);
+   while (auto item = source->next()) {
+      collected.push_back(std::move(*item));
+   }
+   return collected;
+}
+
+cell_t in_order(const cells &items, const std::vector<std::size_t> &order) {
+   cell_t result(cell_type_e::LIST);
+   result.list.reserve(order.size());
+   for (auto i : order) {
+      result.list.push_back(items[i]);
+   }
+   return result;
+}
+
+} // namespace
+
+bool sort_natural(const cells &keys, bool descending,
+                  std::vector<std::size_t> &order, std::size_t threads) {
+   if (!keys.empty() && keys[0].type == cell_type_e::STRING) {
+      keyed_t<std::string_view> keyed;
+      keyed.reserve(keys.size());
+      for (std::size_t i = 0; i < keys.size(); i++) {
+         if (keys[i].type != cell_type_e::STRING) {
+            return false;
+         }
+         keyed.emplace_back(keys[i].val, i);
+      }
+      order_keyed(keyed, descending, order, threads);
+      return true;
+   }
+
+   // Integers are compared in 64 bits unless one of them does not fit,
+   // any double makes it a comparison of doubles
+   //
+   bool integers = true;
+   bool big = false;
+   int64_t value;
+   for (auto &k : keys) {
+      if (k.type == cell_type_e::DOUBLE) {
+         integers = false;
+      } else if (k.type != cell_type_e::NUMBER) {
+         return false;
+      } else if (integers) {
+         switch (parse_integer(k.val, value)) {
+         case parsed_e::INT64:
+            break;
+         case parsed_e::BIG:
+            big = true;
+            break;
+         case parsed_e::OTHER:
+            integers = false;
+            break;
+         }
+      }
+   }
+
+   if (integers && !big) {
+      keyed_t<int64_t> keyed;
+      keyed.reserve(keys.size());
+      for (std::size_t i = 0; i < keys.size(); i++) {
+         parse_integer(keys[i].val, value);
+         keyed.emplace_back(value, i);
+      }
+      order_keyed(keyed, descending, order, threads);
+   } else if (integers) {
+      keyed_t<big_key_t> keyed;
+      keyed.reserve(keys.size());
+      for (std::size_t i = 0; i < keys.size(); i++) {
+         keyed.emplace_back(big_key_t{bigint_c(keys[i].val)}, i);
+      }
+      order_keyed(keyed, descending, order, threads);
+   } else {
+      keyed_t<real_key_t> keyed;
+      keyed.reserve(keys.size());
+      for (std::size_t i = 0; i < keys.size(); i++) {
+         double d = std::strtod(keys[i].val.c_str(), nullptr);
+         keyed.emplace_back(real_key_t{d}, i);
+      }
+      order_keyed(keyed, descending, order, threads);
+   }
+   return true;
+}
+
+void add_sort_globals(std::shared_ptr<environment_c> env, engine_c &engine) {
+
+   // (sort list) (sort list less)
+   env->get("sort") = cell_t([=, &engine](cell_span c) -> cell_t {
+      if (c.empty() || c.size() > 2) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected a list and optional comparator for "
+                             "[sort]");
+         std::exit(1);
+      }
+      cells collected;
+      const cells &items = items_of(env, c[0], collected, "sort");
+      return in_order(items,
+                      order_of(env, engine, items,
+                               c.size() > 1 ? &c[1] : nullptr, "sort"));
+   });
+
+   // (sort-by key list) (sort-by key list less), key is called once per item
+   env->get("sort-by") = cell_t([=, &engine](cell_span c) -> cell_t {
+      if (c.size() < 2 || c.size() > 3) {
+         env->get_error_cb()(error_level_e::FATAL,
+                             "Expected a key function, a list and optional "
+                             "comparator for [sort-by]");
+         std::exit(1);
+      }
+      cells collected;
+      const cells &items = items_of(env, c[1], collected, "sort-by");
+      call_frame_c key(engine, c[0]);
+      cells keys;
+      keys.reserve(items.size());
+      for (auto &item : items) {
+         keys.push_back(key.call(cell_span(&item, 1)));
+      }
+      return in_order(items,
+                      order_of(env, engine, keys,
+                               c.size() > 2 ? &c[2] : nullptr, "sort-by"));
+   });
+}
+
+} // namespace polaris
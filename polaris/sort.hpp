@@ -0,0 +1,40 @@
+#ifndef POLARIS_SORT_HPP
+#define POLARIS_SORT_HPP
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace polaris {
+
+//! \brief Lists of numbers or strings at least this long are sorted across
+//!        threads when no comparator, or the builtin `<` or `>`, is given
+constexpr std::size_t parallel_sort_threshold = 1 << 16;
+
+//! \brief Find the order of cells that are all numbers or all strings,
+//!        without calling into an engine. The sort is stable, integers are
+//!        compared exactly and strings by their bytes
+//! \param keys The cells to order
+//! \param descending Order from the largest to the smallest
+//! \param order Set to the indices of keys in sorted order
+//! \param threads The most threads to sort with, 0 for one per core
+//! \returns false if the cells are not all numbers or all strings
+extern bool sort_natural(const cells &keys, bool descending,
+                         std::vector<std::size_t> &order,
+                         std::size_t threads = 0);
+
+//! \brief Add the sorting builtins to an environment. These are
+//!        `(sort list [less])` and `(sort-by key list [less])`, which
+//!        return a new list ordered by the items, or by `(key item)`, using
+//!        their natural order unless a comparator is given
+//! \param env The environment to load the symbols into
+//! \param engine The engine used to call key and comparator lambdas
+extern void add_sort_globals(std::shared_ptr<environment_c> env,
+                             engine_c &engine);
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,87 @@
+#include "source.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace polaris {
+
+namespace {
+
+struct entry_t {
+   uint32_t file;
+   uint32_t line;
+   uint32_t column;
+};
+
+//  Files are few and kept by name, locations are one small entry per list
+//  read. Index 0 of the locations is reserved for "no location"
+//
+struct registry_t {
+   std::mutex mutex;
+   std::vector<std::string> files;
+   std::vector<entry_t> locations{entry_t{0, 0, 0}};
+};
+
+//  Never destroyed, exit handlers such as a line profile report can still
+//  look locations up
+//
+registry_t &registry() {
+   static registry_t *r = new registry_t;
+   return *r;
+}
+
+thread_local uint32_t current = 0;
+
+} // namespace
+
+uint32_t add_source_file(const std::string &file) {
+   registry_t &r = registry();
+   std::lock_guard<std::mutex> lock(r.mutex);
+   auto it = std::find(r.files.begin(), r.files.end(), file);
+   if (it != r.files.end()) {
+      return static_cast<uint32_t>(it - r.files.begin());
+   }
+   r.files.push_back(file);
+   return static_cast<uint32_t>(r.files.size() - 1);
+}
+
+uint32_t add_source_location(uint32_t file, uint32_t line, uint32_t column) {
+   registry_t &r = registry();
+   std::lock_guard<std::mutex> lock(r.mutex);
+   if (r.locations.size() >= std::numeric_limits<uint32_t>::max()) {
+      return 0;
+   }
+   r.locations.push_back(entry_t{file, line, column});
+   return static_cast<uint32_t>(r.locations.size() - 1);
+}
+
+source_location_t find_source_location(uint32_t loc) {
+   registry_t &r = registry();
+   std::lock_guard<std::mutex> lock(r.mutex);
+   if (loc == 0 || loc >= r.locations.size()) {
+      return {};
+   }
+   const entry_t &e = r.locations[loc];
+   return source_location_t{r.files[e.file], e.line, e.column};
+}
+
+std::string describe_source_location(uint32_t loc) {
+   source_location_t l = find_source_location(loc);
+   if (l.file.empty()) {
+      return {};
+   }
+   return l.file + ":" + std::to_string(l.line) + ":" +
+          std::to_string(l.column);
+}
+
+uint32_t current_source_location() { return current; }
+
+current_source_t::current_source_t(uint32_t loc) : previous(current) {
+   current = loc;
+}
+
+current_source_t::~current_source_t() { current = previous; }
+
+} // namespace polaris
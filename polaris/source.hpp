@@ -0,0 +1,66 @@
+#ifndef POLARIS_SOURCE_HPP
+#define POLARIS_SOURCE_HPP
+
+#include <cstdint>
+#include <string>
+
+namespace polaris {
+
+//! \brief Where a form was read from
+struct source_location_t {
+   //! The file the form was read from
+   std::string file;
+
+   //! Line of the opening parenthesis, from 1
+   uint32_t line{0};
+
+   //! Column of the opening parenthesis, from 1
+   uint32_t column{0};
+};
+
+//! \brief Register a file that forms are about to be read from. Lists read
+//!        from a file record where they start and carry the index of that
+//!        record in cell_t::loc, copies of the list carry it with them
+//! \param file The name of the file
+//! \returns The index of the file, given to add_source_location
+extern uint32_t add_source_file(const std::string &file);
+
+//! \brief Record where a list starts
+//! \param file The index of the file, from add_source_file
+//! \param line The line, from 1
+//! \param column The column, from 1
+//! \returns The location to store in cell_t::loc, 0 once there is no room
+//!          left for more
+extern uint32_t add_source_location(uint32_t file, uint32_t line,
+                                    uint32_t column);
+
+//! \brief Retrieve a recorded location, from any thread
+//! \param loc The location stored in cell_t::loc
+//! \returns The location, with no file if loc is 0
+extern source_location_t find_source_location(uint32_t loc);
+
+//! \brief Describe a location as file:line:column
+//! \param loc The location stored in cell_t::loc
+//! \returns The description, empty if loc is 0
+extern std::string describe_source_location(uint32_t loc);
+
+//! \brief Retrieve the location of the top level form the calling thread
+//!        is evaluating with evaluate_all, so that errors can point at it
+//! \returns The location, 0 if the form was not read from a file
+extern uint32_t current_source_location();
+
+//! \brief Marks the top level form being evaluated for as long as it is in
+//!        scope, the form it replaced is restored after
+struct current_source_t {
+   explicit current_source_t(uint32_t loc);
+   ~current_source_t();
+
+   current_source_t(const current_source_t &) = delete;
+   current_source_t &operator=(const current_source_t &) = delete;
+
+   uint32_t previous;
+};
+
+} // namespace polaris
+
+#endif
@@ -0,0 +1,177 @@
+#include "stats.hpp"
+#include "builtins.hpp"
+#include "cell.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace polaris {
+
+namespace {
+
+using counter_t = std::atomic<uint64_t>;
+
+//  Builtins are given an index when they are first counted, each thread
+//  counts into its own slots for them in chunks that never move
+//
+constexpr std::size_t chunk_size = 64;
+using chunk_t = std::array<counter_t, chunk_size>;
+
+struct thread_calls_t;
+
+struct registry_t {
+   std::mutex mutex;
+   std::map<std::string, std::size_t> index;
+   std::set<thread_calls_t *> threads;
+   std::vector<uint64_t> finished; // calls made by threads that have ended
+};
+
+registry_t &registry() {
+   static registry_t r;
+   return r;
+}
+
+std::atomic<bool> counting{false};
+
+//  Only the owning thread adds to its slots and adds chunks, so a count
+//  is a load and a store. Readers take the registry lock, which is also
+//  held while chunks are added
+//
+struct thread_calls_t {
+   std::vector<std::unique_ptr<chunk_t>> chunks;
+
+   thread_calls_t() {
+      auto &r = registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+      r.threads.insert(this);
+   }
+
+   ~thread_calls_t() {
+      auto &r = registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+      for (std::size_t i = 0; i < chunks.size() * chunk_size; i++) {
+         if (auto n = at(i).load(std::memory_order_relaxed)) {
+            r.finished.resize(std::max(r.finished.size(), i + 1));
+            r.finished[i] += n;
+         }
+      }
+      r.threads.erase(this);
+   }
+
+   counter_t &at(std::size_t index) {
+      return (*chunks[index / chunk_size])[index % chunk_size];
+   }
+
+   void count(std::size_t index) {
+      if (index / chunk_size >= chunks.size()) {
+         std::lock_guard<std::mutex> lock(registry().mutex);
+         while (index / chunk_size >= chunks.size()) {
+            chunks.push_back(std::make_unique<chunk_t>());
+         }
+      }
+      counter_t &n = at(index);
+      n.store(n.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+   }
+};
+
+thread_calls_t &thread_calls() {
+   thread_local thread_calls_t calls;
+   return calls;
+}
+
+cell_t by_type(const std::array<uint64_t, stats_cell_types> &counts) {
+   cell_t c(cell_type_e::LIST);
+   for (std::size_t i = 0; i < cell_type_count; i++) {
+      c.list.push_back(
+          pair(cell_type_to_string(static_cast<cell_type_e>(i)), counts[i]));
+   }
+   return c;
+}
+
+} // namespace
+
+void count_builtin_calls(bool on) {
+   counting.store(on, std::memory_order_relaxed);
+}
+
+bool counting_builtin_calls() {
+   return counting.load(std::memory_order_relaxed);
+}
+
+void count_calls(cell_t &proc, const std::string &name) {
+   std::size_t index;
+   {
+      auto &r = registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+      index = r.index.try_emplace(name, r.index.size()).first->second;
+   }
+   proc.proc = [index, fn = std::move(proc.proc)](cell_span c) -> cell_t {
+      thread_calls().count(index);
+      return fn(c);
+   };
+}
+
+std::map<std::string, uint64_t> builtin_calls() {
+   std::map<std::string, uint64_t> calls;
+   auto &r = registry();
+   std::lock_guard<std::mutex> lock(r.mutex);
+   for (auto &[name, index] : r.index) {
+      uint64_t n = index < r.finished.size() ? r.finished[index] : 0;
+      for (auto *thread : r.threads) {
+         if (index < thread->chunks.size() * chunk_size) {
+            n += thread->at(index).load(std::memory_order_relaxed);
+         }
+      }
+      if (n) {
+         calls[name] = n;
+      }
+   }
+   return calls;
+}
+
+cell_t stats_to_cell() {
+   const stats_t s = stats();
+   cell_t c(cell_type_e::LIST);
+   c.list.push_back(pair("cells-created", by_type(s.cells_created)));
+   c.list.push_back(pair("cells-copied", by_type(s.cells_copied)));
+   c.list.push_back(pair("environments-created", s.environments_created));
+   c.list.push_back(pair("environments-live", s.environments_live()));
+   c.list.push_back(pair("peak-depth", s.peak_depth));
+   c.list.push_back(pair("bytes-allocated", s.bytes_allocated));
+   if (counting_builtin_calls()) {
+      cell_t calls(cell_type_e::LIST);
+      for (auto &[name, n] : builtin_calls()) {
+         calls.list.push_back(pair(name, n));
+      }
+      c.list.push_back(pair("builtin-calls", calls));
+   }
+   return c;
+}
+
+void reset_stats() {
+   stats_t &s = stats();
+   uint64_t live = s.environments_live();
+   uint64_t depth = s.depth;
+   s = stats_t{};
+   s.environments_created = live;
+   s.depth = depth;
+   s.peak_depth = depth;
+
+   auto &r = registry();
+   std::lock_guard<std::mutex> lock(r.mutex);
+   r.finished.clear();
+   for (auto *thread : r.threads) {
+      for (auto &chunk : thread->chunks) {
+         for (auto &n : *chunk) {
+            n.store(0, std::memory_order_relaxed);
+         }
+      }
+   }
+}
+
+} // namespace polaris
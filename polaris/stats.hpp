@@ -0,0 +1,96 @@
+#ifndef POLARIS_STATS_HPP
+#define POLARIS_STATS_HPP
+
+#include "fwd.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace polaris {
+
+//! \brief Number of cell types the per type counters have room for
+constexpr std::size_t stats_cell_types = 16;
+
+//! \brief Counters kept while the interpreter runs. Every counter is a
+//!        plain increment on a thread local so they are always on
+struct stats_t {
+   //! Cells constructed, by type
+   std::array<uint64_t, stats_cell_types> cells_created{};
+
+   //! Cells copied (constructed or assigned from another cell), by type
+   std::array<uint64_t, stats_cell_types> cells_copied{};
+
+   //! Environments (global, call frames, closures, scopes) constructed
+   uint64_t environments_created{0};
+
+   //! Environments destroyed
+   uint64_t environments_destroyed{0};
+
+   //! Current depth of nested lambda calls
+   uint64_t depth{0};
+
+   //! Deepest nesting of lambda calls reached
+   uint64_t peak_depth{0};
+
+   //! Approximate bytes allocated for environments and copied cell values
+   uint64_t bytes_allocated{0};
+
+   //! \brief Environments that currently exist
+   uint64_t environments_live() const {
+      return environments_created - environments_destroyed;
+   }
+};
+
+//! \brief Retrieve the counters of the calling thread
+inline stats_t &stats() {
+   thread_local stats_t s;
+   return s;
+}
+
+//! \brief Counts a lambda call for as long as it is in scope
+struct call_depth_t {
+   call_depth_t() {
+      stats_t &s = stats();
+      if (++s.depth > s.peak_depth) {
+         s.peak_depth = s.depth;
+      }
+   }
+   ~call_depth_t() { --stats().depth; }
+};
+
+//! \brief Turn counting of builtin calls on or off. Only builtins named
+//!        while it is on are counted, it is off unless asked for since
+//!        every counted call goes through an extra wrapper
+//! \param on Whether builtins named from now on are counted
+extern void count_builtin_calls(bool on);
+
+//! \brief Check whether builtins named from now on are counted
+extern bool counting_builtin_calls();
+
+//! \brief Wrap a builtin so that its calls are counted under its name. The
+//!        count goes to the calling thread and is merged when read
+//! \param proc The builtin to wrap
+//! \param name The name to count the calls under
+extern void count_calls(cell_t &proc, const std::string &name);
+
+//! \brief Retrieve the number of calls made to each builtin that has been
+//!        called, across every thread. Empty when no builtin was named
+//!        while counting was on, which does not mean none were called
+extern std::map<std::string, uint64_t> builtin_calls();
+
+//! \brief Retrieve the counters of the calling thread and the builtin call
+//!        counts as a list of (name value) pairs. The builtin-calls pair
+//!        is left out while counting is off, rather than reading as no calls
+extern cell_t stats_to_cell();
+
+//! \brief Zero the counters of the calling thread and the builtin call
+//!        counts. The current call depth is kept, calls other threads make
+//!        while the counts are zeroed may survive it
+extern void reset_stats();
+
+} // namespace polaris
+
+#endif
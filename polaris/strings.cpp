@@ -0,0 +1,238 @@
+#include "strings.hpp"
+#include "builtins.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+#include "polaris.hpp"
+
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <string>
+
+namespace polaris {
+
+namespace {
+
+cell_t make_string(std::string_view s) {
+   cell_t c(cell_type_e::STRING);
+   c.val.assign(s);
+   return c;
+}
+
+//  Strings and builders are read in place, nothing is copied until the
+//  result is made
+//
+std::string_view string_arg(const std::shared_ptr<environment_c> &env,
+                            const cell_t &c, const char *fn) {
+   if (c.type == cell_type_e::STRING) {
+      return c.val;
+   }
+   if (c.type == cell_type_e::BUILDER) {
+      return static_cast<const string_builder_c &>(*c.obj).view();
+   }
+   fail(env, std::string("Expected a string for [") + fn + "]");
+}
+
+//  Anything that is joined into a string, which also takes numbers as they
+//  print
+//
+std::string_view text_arg(const std::shared_ptr<environment_c> &env,
+                          const cell_t &c, const char *fn) {
+   if (c.type == cell_type_e::NUMBER || c.type == cell_type_e::DOUBLE) {
+      return c.val;
+   }
+   return string_arg(env, c, fn);
+}
+
+std::size_t index_arg(const std::shared_ptr<environment_c> &env,
+                      const cell_t &c, const char *fn) {
+   std::size_t index = 0;
+   const char *end = c.val.data() + c.val.size();
+   if (c.type != cell_type_e::NUMBER ||
+       std::from_chars(c.val.data(), end, index).ptr != end) {
+      fail(env, std::string("Expected an index for [") + fn + "]");
+   }
+   return index;
+}
+
+string_builder_c &builder_arg(const std::shared_ptr<environment_c> &env,
+                              const cell_t &c, const char *fn) {
+   if (c.type != cell_type_e::BUILDER) {
+      fail(env, std::string("Expected a string builder for [") + fn + "]");
+   }
+   return static_cast<string_builder_c &>(*c.obj);
+}
+
+//  Pieces between separators, or between runs of whitespace when there is
+//  no separator. Each piece is cut from the argument as a view and copied
+//  once into its cell
+//
+cell_t split(std::string_view s, const std::string_view *separator) {
+   cell_t result(cell_type_e::LIST);
+   if (!separator) {
+      std::size_t at = 0;
+      while (at < s.size()) {
+         while (at < s.size() &&
+                std::isspace(static_cast<unsigned char>(s[at]))) {
+            ++at;
+         }
+         std::size_t start = at;
+         while (at < s.size() &&
+                !std::isspace(static_cast<unsigned char>(s[at]))) {
+            ++at;
+         }
+         if (at > start) {
+            result.list.push_back(make_string(s.substr(start, at - start)));
+         }
+      }
+      return result;
+   }
+   if (separator->empty()) {
+      result.list.reserve(s.size());
+      for (std::size_t i = 0; i < s.size(); i++) {
+         result.list.push_back(make_string(s.substr(i, 1)));
+      }
+      return result;
+   }
+   std::size_t start = 0;
+   while (true) {
+      std::size_t found = s.find(*separator, start);
+      if (found == std::string_view::npos) {
+         result.list.push_back(make_string(s.substr(start)));
+         return result;
+      }
+      result.list.push_back(make_string(s.substr(start, found - start)));
+      start = found + separator->size();
+   }
+}
+
+} // namespace
+
+cell_t make_string_builder() {
+   cell_t c(cell_type_e::BUILDER);
+   c.obj = std::make_shared<string_builder_c>();
+   return c;
+}
+
+void add_string_globals(std::shared_ptr<environment_c> env) {
+
+   //  The length of the result is known before anything is copied, so it
+   //  is allocated once
+   //
+   env->get("string-append") = cell_t([=](cell_span c) -> cell_t {
+      std::size_t size = 0;
+      for (auto &item : c) {
+         size += text_arg(env, item, "string-append").size();
+      }
+      cell_t result(cell_type_e::STRING);
+      result.val.reserve(size);
+      for (auto &item : c) {
+         result.val.append(text_arg(env, item, "string-append"));
+      }
+      return result;
+   });
+
+   env->get("substring") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 2, 3, "substring");
+      std::string_view s = string_arg(env, c[0], "substring");
+      std::size_t start = index_arg(env, c[1], "substring");
+      std::size_t end =
+          c.size() > 2 ? index_arg(env, c[2], "substring") : s.size();
+      if (start > end || end > s.size()) {
+         fail(env, "Index out of range for [substring]");
+      }
+      return make_string(s.substr(start, end - start));
+   });
+
+   env->get("string-split") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 2, "string-split");
+      std::string_view s = string_arg(env, c[0], "string-split");
+      if (c.size() < 2) {
+         return split(s, nullptr);
+      }
+      std::string_view separator = string_arg(env, c[1], "string-split");
+      return split(s, &separator);
+   });
+
+   env->get("string-join") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 2, "string-join");
+      if (c[0].type != cell_type_e::LIST) {
+         fail(env, "Expected a list for [string-join]");
+      }
+      const cells &items = c[0].list;
+      std::string_view separator =
+          c.size() > 1 ? string_arg(env, c[1], "string-join") : "";
+      std::size_t size =
+          items.empty() ? 0 : separator.size() * (items.size() - 1);
+      for (auto &item : items) {
+         size += text_arg(env, item, "string-join").size();
+      }
+      cell_t result(cell_type_e::STRING);
+      result.val.reserve(size);
+      for (std::size_t i = 0; i < items.size(); i++) {
+         if (i) {
+            result.val.append(separator);
+         }
+         result.val.append(text_arg(env, items[i], "string-join"));
+      }
+      return result;
+   });
+
+   env->get("string-length") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 1, "string-length");
+      return cell_t(cell_type_e::NUMBER,
+                    std::to_string(string_arg(env, c[0], "string-length")
+                                       .size()));
+   });
+
+   env->get("number->string") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 1, "number->string");
+      if (c[0].type != cell_type_e::NUMBER &&
+          c[0].type != cell_type_e::DOUBLE) {
+         fail(env, "Expected a number for [number->string]");
+      }
+      return make_string(c[0].val);
+   });
+
+   //  Whatever the reader takes for a number is one, anything else is #f
+   //
+   env->get("string->number") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 1, "string->number");
+      std::string_view s = string_arg(env, c[0], "string->number");
+      cell_t number = read(std::string(s));
+      if ((number.type == cell_type_e::NUMBER ||
+           number.type == cell_type_e::DOUBLE) &&
+          number.val == s) {
+         return number;
+      }
+      return false_sym;
+   });
+
+   env->get("string-builder") = cell_t([=](cell_span c) -> cell_t {
+      cell_t builder = make_string_builder();
+      auto &b = static_cast<string_builder_c &>(*builder.obj);
+      for (auto &item : c) {
+         b.append(text_arg(env, item, "string-builder"));
+      }
+      return builder;
+   });
+
+   //  The builder is changed in place and returned, every cell holding it
+   //  sees the appended text
+   //
+   env->get("builder-append!") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, c.size() + 1, "builder-append!");
+      auto &b = builder_arg(env, c[0], "builder-append!");
+      for (std::size_t i = 1; i < c.size(); i++) {
+         b.append(text_arg(env, c[i], "builder-append!"));
+      }
+      return c[0];
+   });
+
+   env->get("builder->string") = cell_t([=](cell_span c) -> cell_t {
+      expect_arguments(env, c, 1, 1, "builder->string");
+      return make_string(builder_arg(env, c[0], "builder->string").view());
+   });
+}
+
+} // namespace polaris
@@ -0,0 +1,44 @@
+#ifndef POLARIS_STRINGS_HPP
+#define POLARIS_STRINGS_HPP
+
+#include "cell.hpp"
+#include "fwd.hpp"
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace polaris {
+
+//! \brief A string that is built up in place. Appends go to the end of one
+//!        buffer that grows geometrically, so appending is amortised O(1)
+//!        and building a string of n bytes copies each byte a constant
+//!        number of times
+class string_builder_c : public object_c {
+ public:
+   //! \brief Append text to the end
+   void append(std::string_view text) { _text.append(text); }
+
+   //! \brief Retrieve the text built so far
+   std::string_view view() const { return _text; }
+
+ private:
+   std::string _text;
+};
+
+//! \brief Create a BUILDER cell holding an empty string_builder_c
+extern cell_t make_string_builder();
+
+//! \brief Add the string builtins to an environment. These are
+//!        `(string-append s...)`, `(substring s start [end])`,
+//!        `(string-split s [separator])`, `(string-join list [separator])`,
+//!        `(string-length s)`, `(number->string n)`, `(string->number s)`,
+//!        and `(string-builder s...)`, `(builder-append! b s...)` and
+//!        `(builder->string b)` for building strings in place. Strings are
+//!        measured and cut in bytes, as written in the source
+//! \param env The environment to load the symbols into
+extern void add_string_globals(std::shared_ptr<environment_c> env);
+
+} // namespace polaris
+
+#endif
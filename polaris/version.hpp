@@ -0,0 +1,9 @@
+#ifndef LIBPOLARIS_VERSION_
+#define LIBPOLARIS_VERSION_
+
+#define LIBPOLARIS_MAJOR_VERSION (0)
+#define LIBPOLARIS_MINOR_VERSION (1)
+#define LIBPOLARIS_PATCH_VERSION (0)
+#define LIBPOLARIS_VERSION "0.1.0"
+
+#endif  // LIBPOLARIS_VERSION_
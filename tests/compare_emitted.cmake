@@ -0,0 +1,19 @@
+# Run a program with the interpreter and as translated by --emit-cpp, the
+# output has to be the same
+#
+# cmake -DPOLARIS=<polaris> -DPROGRAM=<translated> -DSOURCE=<source.pol>
+#       -P compare_emitted.cmake
+execute_process(COMMAND ${POLARIS} ${SOURCE}
+  OUTPUT_VARIABLE interpreted RESULT_VARIABLE interpreted_result)
+execute_process(COMMAND ${PROGRAM}
+  OUTPUT_VARIABLE translated RESULT_VARIABLE translated_result)
+
+if(NOT interpreted_result EQUAL translated_result)
+  message(FATAL_ERROR "${SOURCE} exited with ${interpreted_result} when "
+    "interpreted and ${translated_result} when translated")
+endif()
+if(NOT interpreted STREQUAL translated)
+  message(FATAL_ERROR "${SOURCE} printed\n${interpreted}\nwhen interpreted "
+    "and\n${translated}\nwhen translated")
+endif()
+message(STATUS "${SOURCE} prints the same when translated")
@@ -1,81 +1,1629 @@
-
+#include "polaris/closure.hpp"
 #include "polaris/polaris.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include <CppUTest/TestHarness.h>
 
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+//  Heap allocations are counted by replacing malloc, which the global
+//  operator new ends up in whether or not CppUTest has installed its own
+//  overloads. Only glibc lets the original be called, and sanitizers
+//  replace malloc themselves. Only the allocations of the thread that asked
+//  for them are counted, anything another test left running is not
+//
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define POLARIS_TESTS_SANITIZED
+#endif
+#endif
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) &&                   \
+    !defined(POLARIS_TESTS_SANITIZED)
+#define POLARIS_TESTS_COUNT_ALLOCATIONS
+
+namespace {
+thread_local bool counting_allocations{false};
+thread_local std::size_t allocations{0};
+} // namespace
+
+extern "C" void *__libc_malloc(std::size_t size);
+
+extern "C" void *malloc(std::size_t size) {
+   if (counting_allocations) {
+      ++allocations;
+   }
+   return __libc_malloc(size);
+}
+#endif
+
+namespace {
+
+polaris::task_t write_later(polaris::loop_c &loop, int fd, uint64_t ms) {
+   co_await loop.sleep(ms);
+   CHECK_EQUAL(4, ::write(fd, "ping", 4));
+   co_return polaris::true_sym;
+}
+
+struct test_case_t {
+   std::string input;
+   std::string expected_output;
+};
+
+std::vector<test_case_t> tests = {
+    {"(quote (testing 1 (2.0) -3.14e159))", "(testing 1 (2.0) -3.14e159)"},
+    {"(+ 2 2)", "4"},
+    {"(+ 3 1.2)", "4.200000"},
+    {"(- 3 1.2)", "1.800000"},
+    {"(* 3 1.2)", "3.600000"},
+    {"(/ 3 1.5)", "2.000000"},
+    {"(+ (* 2 100) (* 1 10))", "210"},
+    {"(if (> 6 5) (+ 1 1) (+ 2 2))", "2"},
+    {"(if (< 6 5) (+ 1 1) (+ 2 2))", "4"},
+    {"(define x 3)", "3"},
+    {"x", "3"},
+    {"(+ x x)", "6"},
+    {"(begin (define x 1) (set! x (+ x 1)) (+ x 1))", "3"},
+    {"((lambda (x) (+ x x)) 5)", "10"},
+    {"(define twice (lambda (x) (* 2 x)))", "<Lambda>"},
+    {"(twice 5)", "10"},
+    {"(define compose (lambda (f g) (lambda (x) (f (g x)))))", "<Lambda>"},
+    {"((compose list twice) 5)", "(10)"},
+    {"(define repeat (lambda (f) (compose f f)))", "<Lambda>"},
+    {"((repeat twice) 5)", "20"},
+    {"((repeat (repeat twice)) 5)", "80"},
+    {"(define fact (lambda (n) (if (<= n 1) 1 (* n (fact (- n 1))))))",
+     "<Lambda>"},
+    {"(fact 3)", "6"},
+    {"(fact 12)", "479001600"},
+    {"(fact 25)", "15511210043330985984000000"},
+    {"(/ (fact 25) (fact 23))", "600"},
+    {"(< (fact 21) (fact 22) (fact 23))", "#t"},
+    {"(+ 9007199254740993 0)", "9007199254740993"},
+    {"(+ 9223372036854775807 1)", "9223372036854775808"},
+    {"(- (+ 9223372036854775807 1) 1)", "9223372036854775807"},
+    {"(* -4611686018427387904 2)", "-9223372036854775808"},
+    {"(/ -7 2)", "-3"},
+    {"(define abs (lambda (n) ((if (> n 0) + -) 0 n)))", "<Lambda>"},
+    {"(list (abs -3) (abs 0) (abs 3))", "(3 0 3)"},
+    {"(define combine (lambda (f)"
+     "(lambda (x y)"
+     "(if (null? x) (quote ())"
+     "(f (list (car x) (car y))"
+     "((combine f) (cdr x) (cdr y)))))))",
+     "<Lambda>"},
+    {"(define zip (combine cons))", "<Lambda>"},
+    {"(zip (list 1 2 3 4) (list 5 6 7 8))", "((1 5) (2 6) (3 7) (4 8))"},
+    {"(define riff-shuffle (lambda (deck) (begin"
+     "(define take (lambda (n seq) (if (<= n 0) (quote ()) (cons (car seq) "
+     "(take (- n 1) (cdr seq))))))"
+     "(define drop (lambda (n seq) (if (<= n 0) seq (drop (- n 1) (cdr "
+     "seq)))))"
+     "(define mid (lambda (seq) (/ (length seq) 2)))"
+     "((combine append) (take (mid deck) deck) (drop (mid deck) deck)))))",
+     "<Lambda>"},
+    {"(riff-shuffle (list 1 2 3 4 5 6 7 8))", "(1 5 2 6 3 7 4 8)"},
+    {"((repeat riff-shuffle) (list 1 2 3 4 5 6 7 8))", "(1 3 5 7 2 4 6 8)"},
+    {"(riff-shuffle (riff-shuffle (riff-shuffle (list 1 2 3 4 5 6 7 8))))",
+     "(1 2 3 4 5 6 7 8)"},
+    {"(define make-counter (lambda () (begin (define n 0)"
+     "(lambda () (begin (set! n (+ n 1)) n)))))",
+     "<Lambda>"},
+    {"(define counter (make-counter))", "<Lambda>"},
+    {"(counter)", "1"},
+    {"(counter)", "2"},
+    {"(define make-acc (lambda (total)"
+     "(lambda (x) (begin (set! total (+ total x)) total))))",
+     "<Lambda>"},
+    {"(define acc (make-acc 10))", "<Lambda>"},
+    {"(acc 5)", "15"},
+    {"(acc 5)", "20"},
+    {"(let ((a 1) (b 2)) (+ a b))", "3"},
+    {"(let ((x 10)) (let ((x 1) (y x)) (+ x y)))", "11"},
+    {"(let* ((x 1) (y (+ x 1))) (* x y))", "2"},
+    {"(let ((n 0)) (define inc (lambda () (set! n (+ n 1)))) (inc) (inc) n)",
+     "2"},
+    {"(let loop ((i 0) (acc 0)) (if (> i 100) acc (loop (+ i 1) (+ acc i))))",
+     "5050"},
+    {"(let loop ((i 0)) (if (< i 200000) (loop (+ i 1)) i))", "200000"},
+    {"(let f ((n 5)) (if (<= n 1) 1 (* n (f (- n 1)))))", "120"},
+    {"(define thunks (let loop ((i 0) (acc (list))) (if (< i 3) (loop (+ i "
+     "1) (cons (lambda () i) acc)) acc)))",
+     "(<Lambda> <Lambda> <Lambda>)"},
+    {"(list ((car thunks)) ((car (cdr thunks))))", "(2 1)"},
+    {"(begin (define w 0) (while (< w 10) (set! w (+ w 1))) w)", "10"},
+    {"(do ((i 0 (+ i 1)) (acc 1 (* acc 2))) ((>= i 10) acc))", "1024"},
+    {"(map (lambda (x) (* x x)) (list 1 2 3))", "(1 4 9)"},
+    {"(fold-right cons (quote ()) (list 1 2 3))", "(1 2 3)"},
+    {"(fold-right (lambda (x acc) (- x acc)) 0 (list 1 2 3))", "2"},
+    {"(reverse (list 1 2 3))", "(3 2 1)"},
+    {"(list (nth 1 (list 4 5 6)) (nth 5 (list 1)) (nth 2 (range 10)))",
+     "(5 nil 2)"},
+    {"(begin (define total 0) (for-each (lambda (x) (set! total (+ total "
+     "x))) (list 1 2 3)) total)",
+     "6"},
+    {"(map (lambda (f) (f)) (map (lambda (x) (lambda () x)) (list 1 2 3)))",
+     "(1 2 3)"},
+    {"(map force (map (lambda (x) (delay x)) (list 1 2 3)))", "(1 2 3)"},
+    {"(map (lambda (x) (begin (define y (* x 2)) y)) (list 1 2 3))",
+     "(2 4 6)"},
+    {"(map (lambda (x) (begin (define f (lambda () x)) (set! x (+ x 1)) "
+     "(f))) (list 1 2))",
+     "(2 3)"},
+    {"(sort (list 3 -1 2 10))", "(-1 2 3 10)"},
+    {"(sort (list 3 1 2) >)", "(3 2 1)"},
+    {"(sort (list \"pear\" \"fig\" \"apple\"))", "(apple fig pear)"},
+    {"(sort (list 1.5 -2 100000000000000000000 0.25))",
+     "(-2 0.25 1.5 100000000000000000000)"},
+    {"(sort (list 99999999999999999999 -5 -99999999999999999999))",
+     "(-99999999999999999999 -5 99999999999999999999)"},
+    {"(sort (list 1 3 2) (lambda (a b) (> a b)))", "(3 2 1)"},
+    {"(sort-by car (list (list 2 1) (list 1 2) (list 2 3) (list 0 4)))",
+     "((0 4) (1 2) (2 1) (2 3))"},
+    {"(sort-by (lambda (x) (* x x)) (list -3 2 -1) >)", "(-3 2 -1)"},
+    {"(sort (range 3 0 -1))", "(1 2 3)"},
+    {"(print \"This is a string\")", "#t"},
+};
+
+//  Upper bounds on the heap allocations made by one execution of an already
+//  prepared expression. These catch extra copies of cell vectors and strings
+//
+struct allocation_case_t {
+   std::string input;
+   std::size_t evaluator_budget;
+   std::size_t compiler_budget;
+};
+
+std::vector<allocation_case_t> allocation_cases = {
+    {"x", 1, 0},
+    {"(quote (1 2 3))", 6, 1},
+    {"(+ 2 2)", 4, 2},
+    {"(car lst)", 4, 2},
+    {"(cdr lst)", 5, 3},
+    {"(cons 0 lst)", 8, 6},
+    {"(length lst)", 4, 2},
+    {"(if (< x 5) x 0)", 8, 2},
+    {"((lambda (a) a) 1)", 19, 7},
+    {"(let ((a 1) (b 2)) (+ a b))", 34, 6},
+    {"(fact 5)", 157, 81},
+};
+
+#if defined(POLARIS_TESTS_COUNT_ALLOCATIONS)
+std::size_t count_allocations(const std::function<void()> &fn) {
+   allocations = 0;
+   counting_allocations = true;
+   fn();
+   counting_allocations = false;
+   return allocations;
+}
+#endif
+
+//  An interpreter with the builtins, set up the way most tests need one.
+//  Calling it evaluates source and gives the result as text, the errors it
+//  reports are kept for the test to check
+//
+struct interpreter_t {
+   explicit interpreter_t(polaris::engine_c &engine)
+       : engine(engine),
+         env(std::make_shared<polaris::environment_c>(
+             [this](polaris::error_level_e e, const char *message) {
+                std::lock_guard<std::mutex> lock(mutex);
+                errors.push_back(message);
+             })),
+         imports(engine, env, {}) {
+      polaris::add_globals(env, imports);
+   }
+
+   interpreter_t(const interpreter_t &) = delete;
+   interpreter_t &operator=(const interpreter_t &) = delete;
+
+   std::string operator()(const std::string &input) {
+      return polaris::to_string(polaris::evaluate_all(engine, input, env));
+   }
+
+   polaris::engine_c &engine;
+   std::mutex mutex;
+   std::vector<std::string> errors;
+   std::shared_ptr<polaris::environment_c> env;
+   polaris::imports_c imports;
+};
+
+//  A server running on a thread of its own, stopped and waited for however
+//  the test ends so a failed check does not leave the thread joinable
+//
+struct serving_t {
+   explicit serving_t(polaris::server_c &server)
+       : server(server), thread([&server]() { server.run(); }) {}
+   ~serving_t() { stop(); }
+   serving_t(const serving_t &) = delete;
+   serving_t &operator=(const serving_t &) = delete;
+   void stop() {
+      if (thread.joinable()) {
+         server.stop();
+         thread.join();
+      }
+   }
+   polaris::server_c &server;
+   std::thread thread;
+};
+
+//  Run a test with the evaluator and then with the compiler
+//
+void with_each_engine(const std::function<void(polaris::engine_c &)> &test) {
+   polaris::evaluator_c eval;
+   polaris::compiler_c compiler;
+   test(eval);
+   test(compiler);
+}
+
+void run_tests(polaris::engine_c &engine) {
+   interpreter_t run(engine);
+   for (auto &tc : tests) {
+      CHECK_EQUAL_TEXT(tc.expected_output, run(tc.input),
+                       "Output did not meet expectations");
+   }
+   CHECK_TRUE(run.errors.empty());
+}
+
+} // namespace
+
 TEST_GROUP(polaris_tests){};
 
 TEST(polaris_tests, all) {
-   struct test_case_t {
-      std::string input;
-      std::string expected_output;
+   polaris::evaluator_c eval;
+   run_tests(eval);
+
+   //  A lambda keeps its analysis once it has been through the expander,
+   //  copies of the form evaluated later reuse it
+   //
+   auto env = std::make_shared<polaris::environment_c>(
+       [](polaris::error_level_e e, const char *message) {});
+   auto form = polaris::expand_macros(
+       polaris::read("(lambda (x) (+ x y))"), env, eval);
+   auto info = polaris::analyze_lambda(form);
+   CHECK_TRUE(info == polaris::analyze_lambda(polaris::cell_t(form)));
+   CHECK_EQUAL(1u, info->params.size());
+   CHECK_FALSE(info ==
+               polaris::analyze_lambda(polaris::read("(lambda (x) x)")));
+
+   //  So does the shape of a named let, loop or not
+   //
+   auto loop = polaris::expand_macros(
+       polaris::read("(let f ((i 0)) (if (< i 3) (f (+ i 1)) i))"), env,
+       eval);
+   auto shape = polaris::analyze_named_let(loop);
+   CHECK_TRUE(shape->loop);
+   CHECK_TRUE(shape == polaris::analyze_named_let(polaris::cell_t(loop)));
+   auto call = polaris::expand_macros(
+       polaris::read("(let f ((i 0)) (if (< i 3) (+ 1 (f (+ i 1))) i))"), env,
+       eval);
+   shape = polaris::analyze_named_let(call);
+   CHECK_FALSE(shape->loop);
+   CHECK_TRUE(shape == polaris::analyze_named_let(polaris::cell_t(call)));
+   CHECK_TRUE(polaris::analyze_lambda(shape->lambda) ==
+              polaris::analyze_lambda(shape->lambda));
+}
+
+TEST(polaris_tests, compiled) {
+   polaris::compiler_c compiler;
+   run_tests(compiler);
+
+   //  Making a lambda does not copy its source, which every lambda made
+   //  from the form shares
+   //
+   interpreter_t run(compiler);
+   auto make = compiler.prepare(
+       polaris::read("(lambda (x) (begin (define y (list x x)) (car y)))"));
+   make(run.env);
+   polaris::reset_stats();
+   polaris::cell_t fn = make(run.env);
+   CHECK_EQUAL(0UL, polaris::stats().cells_copied[static_cast<std::size_t>(
+                        polaris::cell_type_e::LIST)]);
+   CHECK_TRUE(fn.list.empty());
+   CHECK_EQUAL(3UL, polaris::lambda_source(fn).list.size());
+   CHECK_TRUE(run.errors.empty());
+}
+
+TEST(polaris_tests, natives) {
+   polaris::evaluator_c eval;
+   interpreter_t run(eval);
+   auto &env = run.env;
+
+   polaris::register_native(env, "hypot", [](double a, double b) {
+      return std::sqrt(a * a + b * b);
+   });
+   polaris::register_native(env, "shout", [](std::string_view s) {
+      return std::string(s) + "!";
+   });
+   polaris::register_native(env, "square", [](long n) { return n * n; });
+   polaris::register_native(env, "positive?", [](long n) { return n > 0; });
+   polaris::register_native(env, "first", [](const polaris::cell_t &c) {
+      return c.list[0];
+   });
+
+   std::vector<test_case_t> native_tests = {
+       {"(hypot 3 4)", "5.000000"},
+       {"(shout \"hey\")", "hey!"},
+       {"(square (+ 2 3))", "25"},
+       {"(positive? -2)", "#f"},
+       {"(first (list 4 5 6))", "4"},
+       {"(list 1 2 3 4 5 6 7 8)", "(1 2 3 4 5 6 7 8)"},
    };
 
-   std::vector<test_case_t> tests = {
-       {"(quote (testing 1 (2.0) -3.14e159))", "(testing 1 (2.0) -3.14e159)"},
-       {"(+ 2 2)", "4"},
-       {"(+ 3 1.2)", "4.200000"},
-       {"(- 3 1.2)", "1.800000"},
-       {"(* 3 1.2)", "3.600000"},
-       {"(/ 3 1.5)", "2.000000"},
-       {"(+ (* 2 100) (* 1 10))", "210"},
-       {"(if (> 6 5) (+ 1 1) (+ 2 2))", "2"},
-       {"(if (< 6 5) (+ 1 1) (+ 2 2))", "4"},
-       {"(define x 3)", "3"},
-       {"x", "3"},
-       {"(+ x x)", "6"},
-       {"(begin (define x 1) (set! x (+ x 1)) (+ x 1))", "3"},
-       {"((lambda (x) (+ x x)) 5)", "10"},
-       {"(define twice (lambda (x) (* 2 x)))", "<Lambda>"},
-       {"(twice 5)", "10"},
-       {"(define compose (lambda (f g) (lambda (x) (f (g x)))))", "<Lambda>"},
-       {"((compose list twice) 5)", "(10)"},
-       {"(define repeat (lambda (f) (compose f f)))", "<Lambda>"},
-       {"((repeat twice) 5)", "20"},
-       {"((repeat (repeat twice)) 5)", "80"},
-       {"(define fact (lambda (n) (if (<= n 1) 1 (* n (fact (- n 1))))))",
-        "<Lambda>"},
-       {"(fact 3)", "6"},
-       {"(fact 12)", "479001600"},
-       {"(define abs (lambda (n) ((if (> n 0) + -) 0 n)))", "<Lambda>"},
-       {"(list (abs -3) (abs 0) (abs 3))", "(3 0 3)"},
-       {"(define combine (lambda (f)"
-        "(lambda (x y)"
-        "(if (null? x) (quote ())"
-        "(f (list (car x) (car y))"
-        "((combine f) (cdr x) (cdr y)))))))",
-        "<Lambda>"},
-       {"(define zip (combine cons))", "<Lambda>"},
-       {"(zip (list 1 2 3 4) (list 5 6 7 8))", "((1 5) (2 6) (3 7) (4 8))"},
-       {"(define riff-shuffle (lambda (deck) (begin"
-        "(define take (lambda (n seq) (if (<= n 0) (quote ()) (cons (car seq) "
-        "(take (- n 1) (cdr seq))))))"
-        "(define drop (lambda (n seq) (if (<= n 0) seq (drop (- n 1) (cdr "
-        "seq)))))"
-        "(define mid (lambda (seq) (/ (length seq) 2)))"
-        "((combine append) (take (mid deck) deck) (drop (mid deck) deck)))))",
-        "<Lambda>"},
-       {"(riff-shuffle (list 1 2 3 4 5 6 7 8))", "(1 5 2 6 3 7 4 8)"},
-       {"((repeat riff-shuffle) (list 1 2 3 4 5 6 7 8))", "(1 3 5 7 2 4 6 8)"},
-       {"(riff-shuffle (riff-shuffle (riff-shuffle (list 1 2 3 4 5 6 7 8))))",
-        "(1 2 3 4 5 6 7 8)"},
-       {"(print \"This is a string\")", "#t"},
+   for (auto &tc : native_tests) {
+      CHECK_EQUAL_TEXT(tc.expected_output, run(tc.input),
+                       "Output did not meet expectations");
+   }
+   CHECK_TRUE(run.errors.empty());
+}
+
+TEST(polaris_tests, handles) {
+   with_each_engine([&](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+
+      polaris::program_c setup(engine, run.env,
+                               "(define calls 0) ; counts the calls\n"
+                               "(define score (lambda (a b)\n"
+                               "  (begin (set! calls (+ calls 1))\n"
+                               "         (+ (* a 10) b))))\n");
+      setup.run();
+
+      polaris::program_c tick(engine, run.env, "(set! calls (+ calls 1))");
+      polaris::function_c score(engine, run.env, "score");
+      polaris::function_c make_list(engine, run.env, "list");
+
+      for (long i = 0; i < 10; i++) {
+         CHECK_EQUAL(i * 10 + 2, score.call<long>(i, 2));
+      }
+      CHECK_EQUAL(std::string("11"), polaris::to_string(tick.run()));
+      CHECK_EQUAL(std::string("12"), polaris::to_string(tick.run()));
+      CHECK_EQUAL(std::string("4.500000"), score.call<std::string>(0.45, 0));
+      CHECK_EQUAL(std::string("(hello 1)"),
+                  polaris::to_string(make_list.call("hello", 1)));
+
+      //  Macros are expanded when the program is prepared, including one
+      //  it defines itself
+      //
+      polaris::program_c bump(engine, run.env,
+                              "(define-syntax inc! (syntax-rules ()\n"
+                              "  ((_ v) (set! v (+ v 1)))))\n"
+                              "(inc! calls)\n");
+      CHECK_EQUAL(std::string("14"), polaris::to_string(bump.run()));
+      CHECK_EQUAL(std::string("15"), polaris::to_string(bump.run()));
+      CHECK_TRUE(run.errors.empty());
+   });
+}
+
+TEST(polaris_tests, limits) {
+   polaris::evaluator_c eval;
+   interpreter_t run(eval);
+   auto &errors = run.errors;
+
+   run("(define spin (lambda (n) (spin (+ n 1))))");
+   run("(define fact (lambda (n) (if (<= n 1) 1 (* n (fact (- n 1))))))");
+   run("(define grow (lambda (l n) (if (<= n 0) l (grow (append l l) (- n "
+       "1)))))");
+
+   eval.set_limits({.steps = 5000});
+   CHECK_EQUAL(std::string("nil"), run("(spin 0)"));
+   CHECK_TRUE(eval.get_usage().aborted);
+   CHECK_EQUAL(5001UL, eval.get_usage().steps);
+   CHECK_EQUAL(1UL, errors.size());
+   CHECK_EQUAL(std::string("step limit exceeded (5000)"), errors.back());
+
+   //  The evaluator is still usable after an abort
+   //
+   CHECK_EQUAL(std::string("120"), run("(fact 5)"));
+   CHECK_FALSE(eval.get_usage().aborted);
+   CHECK_EQUAL(5UL, eval.get_usage().peak_depth);
+
+   eval.set_limits({.depth = 10});
+   CHECK_EQUAL(std::string("nil"), run("(fact 20)"));
+   CHECK_EQUAL(std::string("depth limit exceeded (10)"), errors.back());
+   CHECK_EQUAL(std::string("3628800"), run("(fact 10)"));
+
+   eval.set_limits({.bytes = 1 << 20});
+   CHECK_EQUAL(std::string("nil"), run("(grow (list 1) 30)"));
+   CHECK_EQUAL(std::string("memory limit exceeded (1048576)"),
+               errors.back());
+   CHECK_EQUAL(std::string("(1 1 1 1)"), run("(grow (list 1) 2)"));
+   CHECK_EQUAL(3UL, errors.size());
+
+   polaris::function_c fact(eval, run.env, "fact");
+   eval.set_limits({.depth = 3});
+   CHECK_EQUAL(std::string("nil"), polaris::to_string(fact.call(8)));
+   CHECK_EQUAL(4UL, errors.size());
+}
+
+TEST(polaris_tests, async) {
+   with_each_engine([](polaris::engine_c &engine) {
+      polaris::loop_c loop;
+      interpreter_t run(engine);
+      auto &errors = run.errors;
+      polaris::add_async_globals(run.env, engine, loop);
+
+      //  Two tasks sleeping at the same time finish in the time of one,
+      //  the bound is loose so a busy machine does not fail it
+      //
+      run("(define log (quote ()))");
+      run("(define note (lambda (x) (set! log (append log (list x)))))");
+      auto start = std::chrono::steady_clock::now();
+      run("(define a (spawn (lambda () (begin (await (sleep 80)) (note 2) "
+          "2))))");
+      run("(define b (spawn (lambda () (begin (await (sleep 70)) (note 1) "
+          "1))))");
+      CHECK_EQUAL(std::string("<Future>"), run("a"));
+      CHECK_EQUAL(std::string("3"), run("(+ (await a) (await b))"));
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start);
+      CHECK_TRUE(elapsed.count() >= 80);
+      CHECK_TRUE(elapsed.count() < 1000);
+      CHECK_EQUAL(std::string("(1 2)"), run("log"));
+      CHECK_EQUAL(std::string("7"), run("(await 7)"));
+
+      //  Reading from a pipe suspends until the other end writes to it
+      //
+      int fds[2];
+      CHECK_EQUAL(0, ::pipe(fds));
+      auto writer = write_later(loop, fds[1], 10);
+      CHECK_FALSE(writer.future()->done());
+      CHECK_EQUAL(std::string("ping"),
+                  run("(await (fd-read " + std::to_string(fds[0]) + "))"));
+      CHECK_TRUE(writer.future()->done());
+
+      //  A second reader of the same descriptor is turned away rather than
+      //  replacing the first
+      //
+      std::string fd = std::to_string(fds[0]);
+      run("(define first (fd-read " + fd + "))");
+      CHECK_EQUAL(std::string("#f"), run("(await (fd-read " + fd + "))"));
+      CHECK_EQUAL(1UL, errors.size());
+      CHECK_EQUAL(4, ::write(fds[1], "pong", 4));
+      CHECK_EQUAL(std::string("pong"), run("(await first)"));
+      ::close(fds[0]);
+      ::close(fds[1]);
+
+      //  Regular files can not be waited on
+      //
+      int file = ::open("/proc/self/exe", O_RDONLY);
+      CHECK_TRUE(file >= 0);
+      CHECK_EQUAL(std::string("#f"),
+                  run("(await (fd-read " + std::to_string(file) + "))"));
+      CHECK_EQUAL(2UL, errors.size());
+      ::close(file);
+      CHECK_TRUE(loop.idle());
+   });
+}
+
+TEST(polaris_tests, sequences) {
+   std::string path = "polaris_sequence_test.txt";
+   {
+      std::ofstream out(path);
+      for (int i = 0; i < 10000; i++) {
+         out << (i % 3 ? "keep " : "drop ") << i << "\n";
+      }
+   }
+   auto size = std::filesystem::file_size(path);
+
+   with_each_engine([&](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+
+      //  Only the elements that are consumed are ever produced
+      //
+      CHECK_EQUAL(std::string("(0 1 4 9 16)"),
+                  run("(collect (take 5 (map (lambda (x) (* x x)) "
+                      "(range 1000000000000))))"));
+      CHECK_EQUAL(std::string("(10 7 4)"), run("(collect (range 10 1 -3))"));
+      CHECK_EQUAL(std::string("(2 4)"),
+                  run("(filter (lambda (x) (eq 0 (- x (* 2 (/ x 2))))) "
+                      "(list 1 2 3 4 5))"));
+
+      run("(define s (range 3))");
+      CHECK_EQUAL(std::string("<Sequence>"), run("s"));
+      CHECK_EQUAL(std::string("0"), run("(next s)"));
+      CHECK_EQUAL(std::string("#f"), run("(null? s)"));
+      CHECK_EQUAL(std::string("(1 2)"), run("(collect s)"));
+      CHECK_EQUAL(std::string("#t"), run("(null? s)"));
+      CHECK_EQUAL(std::string("nil"), run("(next s)"));
+
+      run("(define n 0)");
+      run("(define p (delay (begin (set! n (+ n 1)) (* n 10))))");
+      CHECK_EQUAL(std::string("0"), run("n"));
+      CHECK_EQUAL(std::string("10"), run("(force p)"));
+      CHECK_EQUAL(std::string("10"), run("(force p)"));
+      CHECK_EQUAL(std::string("1"), run("n"));
+      CHECK_EQUAL(std::string("5"),
+                  run("((lambda (x) (force (delay (+ x 1)))) 4)"));
+
+      //  Files are streamed through, never read in as a whole
+      //
+      CHECK_EQUAL(std::string("10000"),
+                  run("(fold-left (lambda (count line) (+ count 1)) 0 "
+                      "(file-lines \"" + path + "\"))"));
+      CHECK_EQUAL(std::string("(drop 9999)"),
+                  run("(collect (filter (lambda (line) (eq line \"drop "
+                      "9999\")) (file-lines \"" + path + "\")))"));
+      CHECK_EQUAL(std::to_string((size + 4095) / 4096),
+                  run("(fold-left (lambda (count chunk) (+ count 1)) 0 "
+                      "(file-chunks \"" + path + "\" 4096))"));
+      CHECK_TRUE(run.errors.empty());
+   });
+   std::remove(path.c_str());
+}
+
+TEST(polaris_tests, images) {
+   std::string library = std::filesystem::absolute("polaris_image_lib.pol");
+   std::string image = "polaris_image_test.img";
+   {
+      std::ofstream out(library);
+      out << "(define lib-value 42)\n";
+   }
+
+   with_each_engine([&](polaris::engine_c &engine) {
+      {
+         interpreter_t run(engine);
+         auto &errors = run.errors;
+         for (auto &input : std::vector<std::string>{
+                  "(import \"" + library + "\")",
+                  "(define plus +)",
+                  "(define data (list 1 2.5 \"three\" (quote (four))))",
+                  "(define fact (lambda (n) (if (<= n 1) 1 (* n (fact (- n "
+                  "1))))))",
+                  "(define make-counter (lambda () (begin (define n 0) "
+                  "(lambda () (begin (set! n (+ n 1)) n)))))",
+                  "(define counter (make-counter))",
+                  "(define same-counter counter)",
+                  "(counter)",
+                  "(define pending (range 3))"}) {
+            run(input);
+         }
+
+         //  A global that can not be saved fails the whole image
+         //
+         CHECK_FALSE(polaris::save_image(image, run.env, run.imports));
+         CHECK_EQUAL(2UL, errors.size());
+         CHECK_EQUAL(std::string("Unable to save sequence in image"),
+                     errors.front());
+         CHECK_FALSE(std::filesystem::exists(image));
+         run("(define pending nil)");
+         CHECK_TRUE(polaris::save_image(image, run.env, run.imports));
+         CHECK_EQUAL(2UL, errors.size());
+
+         //  Nor can the procedures of a record type
+         //
+         engine.evaluate(
+             polaris::expand_macros(polaris::read("(define-record pt x)"),
+                                    run.env, engine),
+             run.env);
+         CHECK_FALSE(
+             polaris::save_image(image + ".records", run.env, run.imports));
+         CHECK_TRUE(std::find(errors.begin(), errors.end(),
+                              "Unable to save proc in image") !=
+                    errors.end());
+         CHECK_FALSE(std::filesystem::exists(image + ".records"));
+      }
+
+      interpreter_t run(engine);
+      CHECK_TRUE(polaris::load_image(image, engine, run.env, run.imports));
+
+      CHECK_EQUAL(std::string("42"), run("lib-value"));
+      CHECK_EQUAL(std::string("3"), run("(plus 1 2)"));
+      CHECK_EQUAL(std::string("(1 2.5 three (four))"), run("data"));
+      CHECK_EQUAL(std::string("3628800"), run("(fact 10)"));
+      CHECK_EQUAL(std::string("2"), run("(counter)"));
+      CHECK_EQUAL(std::string("3"), run("(same-counter)"));
+      CHECK_EQUAL(std::string("1"), run("((make-counter))"));
+      CHECK_EQUAL(std::string("nil"), run("pending"));
+
+      //  Files imported before the image was made are not run again
+      //
+      run("(set! lib-value 0)");
+      run("(import \"" + library + "\")");
+      CHECK_EQUAL(std::string("0"), run("lib-value"));
+
+      CHECK_FALSE(
+          polaris::load_image(library, engine, run.env, run.imports));
+      CHECK_EQUAL(std::string("Unable to load image " + library +
+                              " : not an image for this version of polaris"),
+                  run.errors.back());
+   });
+   std::remove(library.c_str());
+   std::remove(image.c_str());
+}
+
+TEST(polaris_tests, memoize) {
+   auto number = [](const std::string &v) {
+      return polaris::cell_t(polaris::cell_type_e::NUMBER, v);
    };
+   polaris::cell_t a(polaris::cell_type_e::LIST);
+   a.list = {number("1"), polaris::cell_t(polaris::cell_type_e::STRING, "x")};
+   polaris::cell_t b(a);
+   CHECK_TRUE(polaris::cell_equal(a, b));
+   CHECK_EQUAL(polaris::cell_hash(a), polaris::cell_hash(b));
+   b.list[1].type = polaris::cell_type_e::SYMBOL;
+   CHECK_FALSE(polaris::cell_equal(a, b));
+   CHECK_FALSE(polaris::cell_equal(number("1"),
+                                   polaris::cell_t(polaris::cell_type_e::STRING,
+                                                   "1")));
+
+   with_each_engine([&](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+
+      run("(define calls 0)");
+      run("(define fib (memoize (lambda (n) (begin (set! calls (+ calls 1)) "
+          "(if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))))");
+      CHECK_EQUAL(std::string("832040"), run("(fib 30)"));
+      CHECK_EQUAL(std::string("31"), run("calls"));
+      CHECK_EQUAL(std::string("832040"), run("(fib 30)"));
+      CHECK_EQUAL(std::string("31"), run("calls"));
+      run("(clear-memo fib)");
+      CHECK_EQUAL(std::string("55"), run("(fib 10)"));
+      CHECK_EQUAL(std::string("42"), run("calls"));
+
+      //  Only the two most recently used results are kept
+      //
+      run("(set! calls 0)");
+      run("(define sq (memoize (lambda (x) (begin (set! calls (+ calls 1)) "
+          "(* x x))) 2))");
+      run("(begin (sq 1) (sq 2) (sq 1) (sq 3) (sq 1))");
+      CHECK_EQUAL(std::string("3"), run("calls"));
+      CHECK_EQUAL(std::string("4"), run("(sq 2)"));
+      CHECK_EQUAL(std::string("4"), run("calls"));
+
+      //  Arguments are compared by structure rather than by identity
+      //
+      run("(set! calls 0)");
+      run("(define len (memoize (lambda (l) (begin (set! calls (+ calls 1)) "
+          "(length l)))))");
+      run("(begin (len (list 1 (list 2 3))) (len (list 1 (list 2 3))))");
+      CHECK_EQUAL(std::string("1"), run("calls"));
+      run("(len (list 1 (list 2 4)))");
+      CHECK_EQUAL(std::string("2"), run("calls"));
+
+      CHECK_EQUAL(std::string("#t"),
+                  run("(equal? (list 1 (list 2 \"x\")) (list 1 (list 2 "
+                      "\"x\")))"));
+      CHECK_EQUAL(std::string("#f"),
+                  run("(equal? (list 1 (list 2 \"x\")) (list 1 (list 2 "
+                      "\"y\")))"));
+      CHECK_TRUE(run.errors.empty());
+   });
+}
+
+TEST(polaris_tests, stats) {
+   polaris::count_builtin_calls(true);
+
+   with_each_engine([](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+      run("(define fact (lambda (n) (if (<= n 1) 1 (* n (fact (- n 1))))))");
+
+      polaris::reset_stats();
+      uint64_t live = polaris::stats().environments_live();
+      CHECK_EQUAL(std::string("3628800"), run("(fact 10)"));
+
+      const polaris::stats_t &stats = polaris::stats();
+      CHECK_EQUAL(10UL, stats.peak_depth);
+      CHECK_EQUAL(0UL, stats.depth);
+      CHECK_EQUAL(live, stats.environments_live());
+      CHECK_TRUE(stats.environments_created >= 10);
+      CHECK_TRUE(stats.bytes_allocated >= 10 * sizeof(polaris::environment_c));
+
+      auto calls = polaris::builtin_calls();
+      CHECK_EQUAL(9UL, calls["*"]);
+      CHECK_EQUAL(10UL, calls["<="]);
+      CHECK_FALSE(calls.contains("car"));
+
+      CHECK_EQUAL(std::string("cells-created"), run("(car (car (sys-stats)))"));
+      CHECK_EQUAL(std::string("(* 9)"),
+                  run("(car (filter (lambda (p) (equal? (car p) (quote *))) "
+                      "(car (cdr (car (cdr (cdr (cdr (cdr (cdr (cdr "
+                      "(sys-stats))))))))))))"));
+      CHECK_TRUE(run.errors.empty());
+   });
+   polaris::count_builtin_calls(false);
+
+   //  Builtins named while counting is off are left as they are
+   //
    polaris::evaluator_c eval;
-   auto env = std::make_shared<polaris::environment_c>(
-       [](polaris::error_level_e e, const char *message) {
-          std::cerr << message << std::endl;
-       });
-   polaris::imports_c imports(eval, env, {});
-   polaris::add_globals(env, imports);
+   {
+      interpreter_t run(eval);
+      polaris::reset_stats();
+      run("(* 2 3)");
+      CHECK_FALSE(polaris::builtin_calls().contains("*"));
+      CHECK_EQUAL(std::string("6"), run("(length (sys-stats))"));
+   }
 
-   for (auto &tc : tests) {
-      auto result =
-          polaris::to_string(eval.evaluate(polaris::read(tc.input), env));
-      CHECK_EQUAL_TEXT(tc.expected_output, result,
-                       "Output did not meet expectations");
+   //  Calls made on other threads are merged in, including those of threads
+   //  that have ended
+   //
+   polaris::count_builtin_calls(true);
+   {
+      interpreter_t run(eval);
+      polaris::reset_stats();
+      std::thread([&]() {
+         polaris::evaluator_c other;
+         other.evaluate(polaris::read("(* 2 3)"), run.env);
+      }).join();
+      run("(* 2 3)");
+      CHECK_EQUAL(2UL, polaris::builtin_calls()["*"]);
+   }
+   polaris::count_builtin_calls(false);
+
+   polaris::cell_t a(polaris::cell_type_e::STRING, "a");
+   polaris::reset_stats();
+   polaris::cell_t b(a);
+   polaris::cell_t c(polaris::cell_type_e::NUMBER, "1");
+   b = c;
+   auto index = [](polaris::cell_type_e type) {
+      return static_cast<std::size_t>(type);
+   };
+   CHECK_EQUAL(1UL, polaris::stats().cells_copied[index(
+                        polaris::cell_type_e::STRING)]);
+   CHECK_EQUAL(1UL, polaris::stats().cells_copied[index(
+                        polaris::cell_type_e::NUMBER)]);
+   CHECK_EQUAL(1UL, polaris::stats().cells_created[index(
+                        polaris::cell_type_e::NUMBER)]);
+}
+
+TEST(polaris_tests, allocations) {
+#if defined(POLARIS_TESTS_COUNT_ALLOCATIONS)
+   with_each_engine([](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+      for (auto setup : {"(define x 3)", "(define lst (list 1 2 3 4))",
+                         "(define fact (lambda (n) (if (<= n 1) 1 (* n "
+                         "(fact (- n 1))))))"}) {
+         run(setup);
+      }
+
+      bool evaluating = dynamic_cast<polaris::evaluator_c *>(&engine);
+      for (auto &tc : allocation_cases) {
+         auto code = engine.prepare(polaris::read(tc.input));
+         code(run.env);
+
+         polaris::cell_t result;
+         std::size_t n = count_allocations([&]() { result = code(run.env); });
+         std::size_t budget =
+             evaluating ? tc.evaluator_budget : tc.compiler_budget;
+         std::string message = tc.input + " made " + std::to_string(n) +
+                               " allocations, budget is " +
+                               std::to_string(budget);
+         CHECK_TEXT(n <= budget, message.c_str());
+      }
+      CHECK_TRUE(run.errors.empty());
+   });
+#endif
+}
+
+TEST(polaris_tests, batch) {
+   polaris::cells forms;
+   CHECK_TRUE(polaris::read_all("(define a 1) ; comment (\n"
+                                "a \"semi ; colon\" (+ 1.5 -2)",
+                                forms));
+   CHECK_EQUAL(4UL, forms.size());
+   CHECK_EQUAL(std::string("semi ; colon"), forms[2].val);
+   CHECK_TRUE(polaris::cell_type_e::DOUBLE == forms[3].list[1].type);
+   CHECK_TRUE(polaris::cell_type_e::NUMBER == forms[3].list[2].type);
+   CHECK_FALSE(polaris::read_all("(a) (b", forms));
+   CHECK_EQUAL(5UL, forms.size());
+   CHECK_FALSE(polaris::read_all(")", forms));
+
+   with_each_engine([&](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+
+      polaris::cells results;
+      auto last = polaris::evaluate_all(engine,
+                                        "(define sq (lambda (x) (* x x)))\n"
+                                        "; squares\n"
+                                        "(sq 3) (sq 4)\n",
+                                        run.env, &results);
+      CHECK_EQUAL(std::string("16"), polaris::to_string(last));
+      CHECK_EQUAL(3UL, results.size());
+      CHECK_EQUAL(std::string("9"), polaris::to_string(results[1]));
+
+      CHECK_EQUAL(std::string("nil"), run("(define sq 0) (sq 2"));
+      CHECK_EQUAL(1UL, run.errors.size());
+      CHECK_EQUAL(std::string("4"), run("(sq 2)"));
+      CHECK_EQUAL(std::string("nil"), run(""));
+   });
+}
+
+TEST(polaris_tests, server) {
+   polaris::latency_c latency;
+   for (uint64_t us = 1; us <= 1000; us++) {
+      latency.record(us);
+   }
+   CHECK_EQUAL(1000UL, latency.count());
+   CHECK_EQUAL(500UL, latency.mean());
+   CHECK_TRUE(latency.percentile(0.5) >= 500);
+   CHECK_TRUE(latency.percentile(0.5) <= 560);
+   CHECK_EQUAL(1000UL, latency.percentile(0.99));
+
+   for (bool compile : {false, true}) {
+      std::vector<std::string> errors;
+      polaris::server_config_t config;
+      config.socket_path =
+          "/tmp/polaris_tests_" + std::to_string(::getpid()) + ".sock";
+      config.workers = 2;
+      config.compile = compile;
+      config.prelude = "(define square (lambda (x) (* x x))) "
+                       "(define big (collect (range 300000)))";
+      config.write_timeout_ms = 200;
+      config.send_buffer = 4096;
+      polaris::server_c server(
+          config, [&errors](polaris::error_level_e e, const char *message) {
+             errors.push_back(message);
+          });
+      CHECK_TRUE(server.start());
+      serving_t serving(server);
+
+      polaris::client_c client;
+      CHECK_TRUE(client.connect(config.socket_path));
+      auto result = [](const polaris::reply_t &reply) {
+         return std::string(reply.ok ? "" : "failed : ") + reply.text;
+      };
+
+      CHECK_EQUAL(std::string("3"), result(client.evaluate("(+ 1 2)")));
+      CHECK_EQUAL(std::string("144"), result(client.call("square", "12")));
+      CHECK_EQUAL(std::string("(1 2)"),
+                  result(client.call("list", "1 2")));
+      CHECK_EQUAL(std::string("5"),
+                  result(client.evaluate("(define y 4) (+ y 1)")));
+
+      //  A failed request does not take the worker down with it
+      //
+      CHECK_EQUAL(std::string("failed : Unbound symbol : [missing]"),
+                  result(client.evaluate("(square missing)")));
+      CHECK_FALSE(client.evaluate("(+ 1").ok);
+      CHECK_FALSE(client.call("square", "(1").ok);
+      CHECK_EQUAL(std::string("failed : Not a function : [1]"),
+                  result(client.evaluate("(1 2)")));
+      CHECK_FALSE(client.call("big", "1").ok);
+      CHECK_FALSE(client.evaluate("(exit)").ok);
+
+      //  Requests sent ahead are answered in order
+      //
+      for (int i = 0; i < 100; i++) {
+         CHECK_TRUE(client.send(polaris::request_kind_e::EVALUATE,
+                                "(square " + std::to_string(i) + ")"));
+      }
+      for (int i = 0; i < 100; i++) {
+         CHECK_EQUAL(std::to_string(i * i), result(client.receive()));
+      }
+
+      polaris::client_c other;
+      CHECK_TRUE(other.connect(config.socket_path));
+      CHECK_EQUAL(std::string("9"), result(other.call("square", "3")));
+
+      auto metrics = client.metrics();
+      CHECK_TRUE(metrics.ok);
+      CHECK_TRUE(metrics.text.starts_with("((requests 111) (batches "));
+      CHECK_TRUE(metrics.text.find("(failures 6) (dropped 0)") !=
+                 std::string::npos);
+
+      //  A client that does not read its replies is dropped rather than
+      //  holding on to a worker. The replies are far larger than the send
+      //  buffer, so the write stalls whatever the system defaults are
+      //
+      polaris::client_c stalled;
+      CHECK_TRUE(stalled.connect(config.socket_path));
+      for (int i = 0; i < 4; i++) {
+         CHECK_TRUE(stalled.send(polaris::request_kind_e::EVALUATE, "big"));
+      }
+      auto deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(30);
+      while (other.metrics().text.find("(dropped 1)") == std::string::npos &&
+             std::chrono::steady_clock::now() < deadline) {
+         std::this_thread::sleep_for(
+             std::chrono::milliseconds(config.write_timeout_ms));
+      }
+      CHECK_TRUE(other.metrics().text.find("(dropped 1)") !=
+                 std::string::npos);
+      CHECK_FALSE(stalled.receive().ok);
+      CHECK_EQUAL(std::string("16"), result(other.call("square", "4")));
+
+      serving.stop();
+      CHECK_FALSE(client.evaluate("1").ok);
+      CHECK_FALSE(std::filesystem::exists(config.socket_path));
+      CHECK_TRUE(errors.empty());
+   }
+}
+
+TEST(polaris_tests, sort) {
+
+   //  Enough items to be split into uneven runs and merged over two rounds
+   //
+   std::size_t count = polaris::parallel_sort_threshold * 3 + 7;
+   polaris::cells numbers;
+   polaris::cells strings;
+   uint64_t seed = 42;
+   for (std::size_t i = 0; i < count; i++) {
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      int64_t n = static_cast<int64_t>(seed >> 40) - (1 << 23);
+      numbers.emplace_back(polaris::cell_type_e::NUMBER, std::to_string(n));
+      strings.emplace_back(polaris::cell_type_e::STRING,
+                           std::to_string(n % 1000));
+   }
+
+   for (auto *keys : {&numbers, &strings}) {
+      std::vector<std::size_t> expected(count);
+      for (std::size_t i = 0; i < count; i++) {
+         expected[i] = i;
+      }
+      std::stable_sort(expected.begin(), expected.end(),
+                       [&](std::size_t a, std::size_t b) {
+                          if (keys == &strings) {
+                             return (*keys)[a].val < (*keys)[b].val;
+                          }
+                          return std::stoll((*keys)[a].val) <
+                                 std::stoll((*keys)[b].val);
+                       });
+      for (std::size_t threads : {1, 3, 4}) {
+         std::vector<std::size_t> order;
+         CHECK_TRUE(polaris::sort_natural(*keys, false, order, threads));
+         CHECK_TRUE(order == expected);
+      }
+   }
+
+   polaris::cells mixed = {numbers[0], strings[0]};
+   std::vector<std::size_t> order;
+   CHECK_FALSE(polaris::sort_natural(mixed, false, order));
+}
+
+TEST(polaris_tests, actors) {
+   auto number = [](int n) {
+      return polaris::message_t{
+          polaris::cell_t(polaris::cell_type_e::NUMBER, std::to_string(n)),
+          nullptr};
+   };
+
+   polaris::channel_c small(3);
+   CHECK_EQUAL(4UL, small.capacity());
+   for (int i = 0; i < 4; i++) {
+      auto message = number(i);
+      CHECK_TRUE(small.try_send(message));
+   }
+   auto extra = number(4);
+   CHECK_FALSE(small.try_send(extra));
+   CHECK_EQUAL(std::string("4"), extra.value.val);
+   small.close();
+   CHECK_FALSE(small.send(number(5)));
+   polaris::message_t message;
+   for (int i = 0; i < 4; i++) {
+      CHECK_TRUE(small.receive(message));
+      CHECK_EQUAL(std::to_string(i), message.value.val);
+   }
+   CHECK_FALSE(small.receive(message));
+
+   //  Every message sent by every producer arrives exactly once, a small
+   //  capacity keeps both sides blocking
+   //
+   polaris::channel_c channel(8);
+   constexpr int producers = 4;
+   constexpr int per_producer = 5000;
+   std::vector<std::thread> threads;
+   for (int p = 0; p < producers; p++) {
+      threads.emplace_back([&channel, &number, p]() {
+         for (int i = 0; i < per_producer; i++) {
+            channel.send(number(p * per_producer + i));
+         }
+      });
+   }
+   std::vector<int64_t> sums(2, 0);
+   std::vector<std::thread> consumers;
+   for (std::size_t c = 0; c < sums.size(); c++) {
+      consumers.emplace_back([&channel, &sums, c]() {
+         polaris::message_t m;
+         while (channel.receive(m)) {
+            sums[c] += std::stoll(m.value.val);
+         }
+      });
+   }
+   for (auto &t : threads) {
+      t.join();
+   }
+   channel.close();
+   for (auto &t : consumers) {
+      t.join();
+   }
+   int64_t total = producers * per_producer;
+   CHECK_EQUAL(total * (total - 1) / 2, sums[0] + sums[1]);
+
+   //  Every send that succeeds is received, however it races the close
+   //
+   for (int round = 0; round < 200; round++) {
+      polaris::channel_c racing(4);
+      std::atomic<int> accepted{0};
+      std::vector<std::thread> senders;
+      for (int s = 0; s < 3; s++) {
+         senders.emplace_back([&racing, &accepted, &number]() {
+            while (racing.send(number(1))) {
+               accepted.fetch_add(1);
+            }
+         });
+      }
+      int received = 0;
+      std::thread receiver([&racing, &received]() {
+         polaris::message_t m;
+         while (racing.receive(m)) {
+            received++;
+         }
+      });
+      for (int spin = 0; spin < round * 10; spin++) {
+         std::this_thread::yield();
+      }
+      racing.close();
+      for (auto &t : senders) {
+         t.join();
+      }
+      receiver.join();
+      CHECK_EQUAL(accepted.load(), received);
+   }
+
+   with_each_engine([](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+      auto &errors = run.errors;
+      polaris::actors_c actors;
+      polaris::add_actor_globals(run.env, engine, actors);
+
+      //  Globals the lambda refers to go with it, the actor has nothing
+      //  else of the caller
+      //
+      run("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) "
+          "(fib (- n 2))))))");
+      run("(define r (spawn-actor fib 15))");
+      CHECK_EQUAL(std::string("<Channel>"), run("r"));
+      CHECK_EQUAL(std::string("610"), run("(receive r)"));
+      CHECK_EQUAL(std::string("nil"), run("(receive r)"));
+
+      //  Captures are copied with their boxes shared between the closures
+      //  that had them
+      //
+      run("(define counter (let ((n 0)) (list (lambda () (set! n (+ n 1))) "
+          "(lambda () n))))");
+      run("((car counter))");
+      CHECK_EQUAL(std::string("3"),
+                  run("(receive (spawn-actor (lambda (c) (begin ((car c)) "
+                      "((car c)) ((car (cdr c))))) counter))"));
+      CHECK_EQUAL(std::string("1"), run("((car (cdr counter)))"));
+
+      //  Actors talk through channels handed to them
+      //
+      run("(define in (make-channel 2))");
+      run("(define out (make-channel))");
+      run("(define total (lambda (sum) (let ((v (receive in))) (if (eq v nil) "
+          "(send out sum) (total (+ sum v))))))");
+      run("(spawn-actor total 0)");
+      for (int i = 1; i <= 20; i++) {
+         CHECK_EQUAL(std::string("#t"),
+                     run("(send in " + std::to_string(i) + ")"));
+      }
+      run("(close in)");
+      CHECK_EQUAL(std::string("#f"), run("(send in 1)"));
+      CHECK_EQUAL(std::string("210"), run("(receive out)"));
+
+      CHECK_EQUAL(std::string("(<Channel> (a 2.5 (1)))"),
+                  run("(select (make-channel) (spawn-actor (lambda () "
+                      "(list \"a\" 2.5 (map car (list (list 1)))))))"));
+      run("(close out)");
+      CHECK_EQUAL(std::string("nil"), run("(select out)"));
+
+      //  Channels inside a value are shared, not copied
+      //
+      run("(define back (make-channel))");
+      run("(spawn-actor (lambda (c) (send (car c) 5)) (list back))");
+      CHECK_EQUAL(std::string("5"), run("(receive back)"));
+      actors.join();
+      CHECK_TRUE(errors.empty());
+
+      //  Sequences can not be copied, nil is sent in their place
+      //
+      CHECK_EQUAL(std::string("#t"), run("(send (make-channel) (range 3))"));
+      CHECK_EQUAL(1UL, errors.size());
+
+      //  An actor that fails ends alone, the error goes to its spawner and
+      //  its channel is closed without a result
+      //
+      CHECK_EQUAL(std::string("nil"),
+                  run("(receive (spawn-actor (lambda () (missing 1))))"));
+      CHECK_EQUAL(std::string("nil"),
+                  run("(receive (spawn-actor (lambda () (exit))))"));
+      CHECK_EQUAL(std::string("nil"),
+                  run("(receive (spawn-actor (lambda () (1 2))))"));
+      CHECK_EQUAL(4UL, errors.size());
+
+      for (auto capacity : {"0", "-1", "99999999999999999999", "16777217"}) {
+         CHECK_EQUAL(std::string("nil"),
+                     run(std::string("(make-channel ") + capacity + ")"));
+      }
+      CHECK_EQUAL(8UL, errors.size());
+   });
+
+   //  Actors that are still busy when their actors_c goes are waited for,
+   //  those waiting on its channels are woken by the close
+   //
+   polaris::evaluator_c eval;
+   interpreter_t run(eval);
+   auto actors = std::make_unique<polaris::actors_c>();
+   polaris::add_actor_globals(run.env, eval, *actors);
+   auto finished = std::make_shared<polaris::channel_c>(1);
+   run.env->get("finished") = polaris::cell_t(polaris::cell_type_e::CHANNEL);
+   run.env->get("finished").obj = finished;
+   run("(spawn-actor (lambda () (send finished (do ((i 0 (+ i 1))) "
+       "((eq i 100000) i)))))");
+   run("(spawn-actor (lambda () (receive (make-channel))))");
+   actors.reset();
+   CHECK_TRUE(finished->try_receive(message));
+   CHECK_EQUAL(std::string("100000"), message.value.val);
+   CHECK_TRUE(run.errors.empty());
+}
+
+TEST(polaris_tests, serialize) {
+   with_each_engine([&](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+      auto &errors = run.errors;
+
+      //  Every type comes back as the type it was, which printing and
+      //  reading would lose for strings that look like numbers
+      //
+      run("(define data (list 0 -1 9223372036854775807 "
+          "123456789012345678901234567890 2.5 (/ 1.0 4) \"12\" \"\" "
+          "(quote sym) (list) (list car (list \"a b\"))))");
+      polaris::cell_t data = engine.evaluate(polaris::read("data"), run.env);
+      polaris::cell_t back = polaris::deserialize(
+          polaris::serialize(data, run.env), engine, run.env);
+      CHECK_TRUE(polaris::cell_equal(data, back));
+      CHECK_TRUE(back.list[6].type == polaris::cell_type_e::STRING);
+      CHECK_EQUAL(std::string("0.250000"), back.list[5].val);
+
+      //  A symbol is written once however often it appears
+      //
+      std::string one = polaris::serialize(polaris::read("(symbol)"), run.env);
+      std::string many = polaris::serialize(
+          polaris::read("(symbol symbol symbol symbol)"), run.env);
+      CHECK_EQUAL(one.size() + 3 * 2, many.size());
+
+      //  Lambdas keep the boxes they share
+      //
+      run("(define counter (let ((n 0)) (list (lambda () (set! n (+ n 1))) "
+          "(lambda () n))))");
+      run("((car counter))");
+      run("(define copy (deserialize (serialize counter)))");
+      run("((car copy))");
+      CHECK_EQUAL(std::string("2"), run("((car (cdr copy)))"));
+      CHECK_EQUAL(std::string("1"), run("((car (cdr counter)))"));
+
+      //  Files hold one record per item and are read back lazily
+      //
+      std::string path = "polaris_serialize_test.bin";
+      CHECK_EQUAL(std::string("4"),
+                  run("(serialize-file \"" + path +
+                      "\" (map (lambda (x) (list x \"x\")) (range 4)))"));
+      CHECK_EQUAL(std::string("((0 x) (1 x) (2 x) (3 x))"),
+                  run("(collect (deserialize-file \"" + path + "\"))"));
+
+      {
+         std::ofstream out(path, std::ios::binary);
+         polaris::serial_writer_c writer(out, run.env);
+         for (int i = 0; i < 1000; i++) {
+            writer.write(polaris::read("(record " + std::to_string(i) +
+                                       " (field value))"));
+         }
+      }
+      {
+         std::ifstream in(path, std::ios::binary);
+         polaris::serial_reader_c reader(in, engine, run.env);
+         polaris::cell_t value;
+         int count = 0;
+         while (reader.read(value)) {
+            CHECK_EQUAL(std::to_string(count), value.list[1].val);
+            ++count;
+         }
+         CHECK_EQUAL(1000, count);
+      }
+      std::remove(path.c_str());
+
+      //  Damaged data is refused
+      //
+      auto refused = [&](const std::string &bytes) {
+         try {
+            polaris::deserialize(bytes, engine, run.env);
+         } catch (const std::runtime_error &) {
+            return true;
+         }
+         return false;
+      };
+      std::string good = polaris::serialize(data, run.env);
+      CHECK_TRUE(refused(good.substr(0, good.size() / 2)));
+      std::string newer = good;
+      newer[4] = 2;
+      CHECK_TRUE(refused(newer));
+      std::string deep = good.substr(0, 5) + std::string(2, '\0');
+      for (int i = 0; i < 1000000; i++) {
+         deep += "\x07\x01";
+      }
+      CHECK_TRUE(refused(deep));
+      CHECK_TRUE(errors.empty());
+      CHECK_EQUAL(std::string("nil"), run("(deserialize \"(1 2)\")"));
+      CHECK_EQUAL(std::string("Unable to deserialize : not serialized "
+                              "polaris data"),
+                  errors.back());
+      CHECK_EQUAL(std::string("#f"), run("(serialize (range 3))"));
+      CHECK_EQUAL(std::string("Unable to save sequence in serialized data"),
+                  errors.back());
+   });
+}
+
+TEST(polaris_tests, macros) {
+   with_each_engine([&](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+
+      //  Definitions evaluate to the name, the macro is bound globally
+      //
+      CHECK_EQUAL(std::string("swap!"),
+                  run("(define-syntax swap! (syntax-rules () ((_ a b) "
+                      "(let ((tmp a)) (set! a b) (set! b tmp)))))"));
+      CHECK_EQUAL(std::string("(macro)"), run("(ref swap!)"));
+
+      //  The tmp of the template does not capture the tmp of the use
+      //
+      run("(define tmp 1) (define other 2) (swap! tmp other)");
+      CHECK_EQUAL(std::string("(2 1)"), run("(list tmp other)"));
+
+      //  Rules are tried in order, ellipses repeat and can recurse
+      //
+      run("(define-syntax my-or (syntax-rules () ((_) #f) ((_ e) e) "
+          "((_ e r ...) (let ((t e)) (if t t (my-or r ...))))))");
+      CHECK_EQUAL(std::string("3"), run("(my-or #f #f 3)"));
+      CHECK_EQUAL(std::string("#f"), run("(my-or)"));
+      CHECK_EQUAL(std::string("1"), run("(define t 1) (my-or #f t)"));
+
+      run("(define-syntax unless (syntax-rules () ((_ c body ...) "
+          "(if c #f (begin body ...)))))");
+      CHECK_EQUAL(std::string("2"), run("(unless #f 1 2)"));
+      CHECK_EQUAL(std::string("#f"), run("(unless #t 1 2)"));
+
+      //  Literals must appear as written
+      //
+      run("(define-syntax for (syntax-rules (in) ((_ x in items body ...) "
+          "(map (lambda (x) body ...) items))))");
+      CHECK_EQUAL(std::string("(2 4 6)"),
+                  run("(for x in (list 1 2 3) (* x 2))"));
+
+      //  A name bound by lambda or let is a variable, not the macro
+      //
+      CHECK_EQUAL(std::string("5"),
+                  run("((lambda (unless) (+ unless 1)) 4)"));
+      CHECK_EQUAL(std::string("7"), run("(let ((unless 7)) unless)"));
+
+      //  Procedural macros are called with the forms of the use
+      //
+      run("(define-macro (twice x) (list (quote begin) x x))");
+      run("(define n 0) (twice (set! n (+ n 1)))");
+      CHECK_EQUAL(std::string("2"), run("n"));
+      run("(define-macro (quoted . xs) (list (quote quote) xs))");
+      CHECK_EQUAL(std::string("(a b c)"), run("(quoted a b c)"));
+
+      //  Code inside lambdas is expanded when it is defined, not on
+      //  each call, and the same use is only rewritten once
+      //
+      run("(define count-down (lambda (k) (do ((i k (- i 1))) "
+          "((unless (> i 0) #t) i))))");
+      CHECK_EQUAL(std::string("0"), run("(count-down 10)"));
+      CHECK_EQUAL(std::string("(let ((tmp%"),
+                  run("(macroexpand (quote (swap! p q)))").substr(0, 11));
+      CHECK_EQUAL(run("(macroexpand (quote (swap! p q)))"),
+                  run("(macroexpand (quote (swap! p q)))"));
+      CHECK_EQUAL(std::string("(quote (swap! p q))"),
+                  run("(macroexpand (quote (quote (swap! p q))))"));
+
+      //  A rewrite that is reused is placed at the use it replaces
+      //
+      polaris::cells uses;
+      CHECK_TRUE(polaris::read_all("(swap! p q)\n(swap! p q)", uses,
+                                   "uses.pol"));
+      for (auto &use : uses) {
+         CHECK_EQUAL(polaris::describe_source_location(use.loc),
+                     polaris::describe_source_location(
+                         polaris::expand_macros(use, run.env, engine).loc));
+      }
+      CHECK_TRUE(run.errors.empty());
+   });
+}
+
+TEST(polaris_tests, records) {
+   with_each_engine([&](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+
+      CHECK_EQUAL(std::string("point"), run("(define-record point x y)"));
+      run("(define p (make-point 1 (list 2 3)))");
+      CHECK_EQUAL(std::string("<point x=1 y=(2 3)>"), run("p"));
+      CHECK_EQUAL(std::string("(point)"), run("(ref p)"));
+      CHECK_EQUAL(std::string("1"), run("(point-x p)"));
+      CHECK_EQUAL(std::string("(2 3)"), run("(point-y p)"));
+
+      //  Setting a field changes the record in place, every reference to
+      //  it sees the change
+      //
+      run("(define same p) (set-point-x! p 10)");
+      CHECK_EQUAL(std::string("10"), run("(point-x same)"));
+
+      //  The predicate knows the type, not just the shape
+      //
+      run("(define-record pair (left right))");
+      CHECK_EQUAL(std::string("(#t #f #f)"),
+                  run("(list (point? p) (point? (make-pair 1 2)) "
+                      "(point? (list 1 2)))"));
+
+      //  Records can change, they are only equal to themselves
+      //
+      CHECK_EQUAL(std::string("#f"),
+                  run("(equal? (make-pair 1 \"a\") (make-pair 1 \"a\"))"));
+      CHECK_EQUAL(std::string("#t"), run("(equal? p same)"));
+      CHECK_EQUAL(
+          polaris::cell_hash(polaris::evaluate_all(engine, "p", run.env)),
+          polaris::cell_hash(polaris::evaluate_all(engine, "same", run.env)));
+
+      //  Accessors work anywhere a procedure does
+      //
+      CHECK_EQUAL(std::string("(1 3 5)"),
+                  run("(map pair-left (map (lambda (i) (make-pair i 0)) "
+                      "(list 1 3 5)))"));
+      CHECK_TRUE(run.errors.empty());
+   });
+}
+
+TEST(polaris_tests, emit_cpp) {
+   polaris::evaluator_c eval;
+   interpreter_t run(eval);
+   auto &env = run.env;
+
+   auto emit = [&](const std::string &source) {
+      std::ostringstream out;
+      CHECK_TRUE(polaris::emit_cpp(source, "test.pol", out, env, eval));
+      return out.str();
+   };
+   auto contains = [](const std::string &code, const std::string &text) {
+      return code.find(text) != std::string::npos;
+   };
+
+   CHECK_FALSE(polaris::emit_cpp("(print 1", "test.pol", std::cout, env,
+                                 eval));
+
+   //  A counter of a do loop is an integer stepped in place, the
+   //  comparison with it is computed without making #t or #f
+   //
+   std::string code =
+       emit("(define sum (lambda (n) (do ((i 0 (+ i 1)) (acc 0 (+ acc i))) "
+            "((eq i n) acc))))");
+   CHECK_TRUE(contains(code, "int64_t v"));
+   CHECK_TRUE(contains(code, "polaris::emitted::step("));
+   CHECK_TRUE(contains(code, "polaris::emitted::test_eq("));
+   CHECK_TRUE(contains(code, "polaris::emitted::arithmetic("));
+   CHECK_TRUE(contains(code, "int main(int argc, char **argv)"));
+   CHECK_FALSE(contains(code, "program->evaluate"));
+
+   //  A counter a closure can see stays a cell
+   //
+   code = emit("(do ((i 0 (+ i 1))) ((eq i 3)) (print (lambda () i)))");
+   CHECK_FALSE(contains(code, "int64_t v"));
+
+   //  Redefining a builtin turns its fast path off
+   //
+   code = emit("(define + (lambda (a b) a)) (print (+ 1 2))");
+   CHECK_FALSE(contains(code, "polaris::emitted::arithmetic("));
+
+   //  A named let that only calls itself in tail position is a loop
+   //
+   code = emit("(let loop ((i 0)) (if (< i 10) (loop (+ i 1)) i))");
+   CHECK_TRUE(contains(code, "while (true)"));
+   CHECK_TRUE(contains(code, "continue;"));
+
+   //  Forms that can not be translated are evaluated as written, macro
+   //  definitions are kept so the interpreter has them too
+   //
+   code = emit("(define-record point x y) (define-syntax twice (syntax-rules "
+               "() ((_ e) (begin e e)))) (twice (print \"a\\\"b\"))");
+   CHECK_TRUE(
+       contains(code, "program->evaluate(\"(define-record point x y)\")"));
+   CHECK_TRUE(contains(code, "program->evaluate(\"(define-syntax twice"));
+   CHECK_TRUE(contains(code, "\"a\\\\\\\"b\""));
+   CHECK_TRUE(run.errors.empty());
+}
+
+TEST(polaris_tests, snapshots) {
+   polaris::evaluator_c eval;
+   interpreter_t run(eval);
+   auto &env = run.env;
+
+   //  Without a snapshot there is nothing to publish to
+   //
+   CHECK_EQUAL(std::string("#f"), run("(publish)"));
+
+   auto snapshot = std::make_shared<polaris::snapshot_c>(
+       std::vector<std::string>{"a", "b", "missing"});
+   CHECK_TRUE(snapshot->read()->version == 0);
+   env->set_snapshot(snapshot);
+
+   //  Every statement publishes, unbound variables are left out
+   //
+   run("(define a 1) (define b (list 1 2))");
+   CHECK_TRUE(snapshot->read()->version == 2);
+   CHECK_EQUAL(std::string("1"), snapshot->get("a").val);
+   CHECK_EQUAL(std::string("(1 2)"), polaris::to_string(snapshot->get("b")));
+   CHECK_FALSE(snapshot->read()->values.contains("missing"));
+
+   //  A reader on another thread sees a and b agree in every view, while
+   //  the script changes them one after the other. Half way through, the
+   //  script waits for the reader to load a view it published so the reads
+   //  are known to overlap the writes
+   //
+   run("(set! b 1) (define caught-up #f)");
+   std::atomic<bool> done{false};
+   std::atomic<uint64_t> seen{0};
+   bool agreed{true};
+   std::thread reader([&]() {
+      while (!done.load()) {
+         auto view = snapshot->read();
+         agreed = agreed && view->values.at("a").val ==
+                                view->values.at("b").val;
+         seen = view->version;
+      }
+   });
+   env->get("wait-for-reader") = polaris::cell_t([&](polaris::cell_span) {
+      uint64_t wanted = snapshot->read()->version;
+      auto give_up =
+          std::chrono::steady_clock::now() + std::chrono::seconds(10);
+      while (seen.load() < wanted) {
+         if (std::chrono::steady_clock::now() > give_up) {
+            return polaris::false_sym;
+         }
+         std::this_thread::yield();
+      }
+      return polaris::true_sym;
+   });
+   run("(do ((i 0 (+ i 1))) ((eq i 2000)) (set! a i) (set! b i) (publish) "
+       "(if (eq i 1000) (set! caught-up (wait-for-reader))))");
+   done = true;
+   reader.join();
+
+   CHECK_TRUE(agreed);
+   CHECK_EQUAL(std::string("1999"), snapshot->get("b").val);
+   CHECK_TRUE(snapshot->read()->version == 2005);
+   CHECK_EQUAL(std::string("#t"), run("caught-up"));
+
+   //  A view that is held stays as it was
+   //
+   auto held = snapshot->read();
+   run("(set! a 5)");
+   CHECK_EQUAL(std::string("1999"), held->values.at("a").val);
+   CHECK_EQUAL(std::string("5"), snapshot->get("a").val);
+
+   env->set_snapshot(nullptr);
+   run("(set! a 6)");
+   CHECK_EQUAL(std::string("5"), snapshot->get("a").val);
+}
+
+TEST(polaris_tests, strings) {
+   with_each_engine([&](polaris::engine_c &engine) {
+      interpreter_t run(engine);
+
+      CHECK_EQUAL(std::string("ab12.5"),
+                  run("(string-append \"a\" \"b\" 1 2.5)"));
+      CHECK_EQUAL(std::string("(string)"), run("(ref (string-append))"));
+      CHECK_EQUAL(std::string("ell"), run("(substring \"hello\" 1 4)"));
+      CHECK_EQUAL(std::string("llo"), run("(substring \"hello\" 2)"));
+      CHECK_EQUAL(std::string("5"), run("(string-length \"hello\")"));
+
+      //  Without a separator runs of whitespace split, with one every
+      //  occurrence does and empty pieces are kept
+      //
+      CHECK_EQUAL(std::string("(a b c)"),
+                  run("(string-split \"  a b   c \")"));
+      CHECK_EQUAL(std::string("(3 (a  b))"),
+                  run("(let ((p (string-split \"a,,b\" \",\"))) "
+                      "(list (length p) p))"));
+      CHECK_EQUAL(std::string("(x y)"), run("(string-split \"xy\" \"\")"));
+      CHECK_EQUAL(std::string("a, b, 3"),
+                  run("(string-join (list \"a\" \"b\" 3) \", \")"));
+      CHECK_EQUAL(std::string("ab"), run("(string-join (list \"a\" \"b\"))"));
+
+      CHECK_EQUAL(std::string("(string number double)"),
+                  run("(ref (number->string 12) (string->number \"12\") "
+                      "(string->number \"-1.5\"))"));
+      CHECK_EQUAL(std::string("(#f #f)"),
+                  run("(list (string->number \"12a\") "
+                      "(string->number \"1 2\"))"));
+
+      //  A builder is appended to in place, every reference sees it
+      //
+      run("(define b (string-builder \"n=\"))"
+          "(define same b)"
+          "(do ((i 0 (+ i 1))) ((eq i 3)) (builder-append! b i \";\"))");
+      CHECK_EQUAL(std::string("n=0;1;2;"), run("same"));
+      CHECK_EQUAL(std::string("(builder string)"),
+                  run("(ref b (builder->string b))"));
+      CHECK_EQUAL(std::string("8"), run("(string-length b)"));
+      CHECK_EQUAL(std::string("n=0"), run("(substring b 0 3)"));
+      CHECK_EQUAL(std::string("#t"),
+                  run("(eq (string-append b) \"n=0;1;2;\")"));
+      CHECK_TRUE(run.errors.empty());
+   });
+}
+
+TEST(polaris_tests, line_profile) {
+   std::string library = std::filesystem::absolute("polaris_profile_lib.pol");
+   {
+      std::ofstream out(library);
+      out << "(define square (lambda (x)\n"
+             "   (* x x)))\n"
+             "; the sum of squares below n\n"
+             "(define total (lambda (n)\n"
+             "   (do ((i 0 (+ i 1)) (sum 0 (+ sum (square i))))\n"
+             "       ((eq i n) sum))))\n";
+   }
+
+   //  Lists read from a file know where they start, copies keep it
+   //
+   polaris::cells forms;
+   CHECK_TRUE(polaris::read_all("(a\n  (b c)) (d)", forms, "forms.pol"));
+   CHECK_EQUAL(std::string("forms.pol:2:3"),
+               polaris::describe_source_location(forms[0].list[1].loc));
+   polaris::cell_t copy = forms[1];
+   CHECK_EQUAL(std::string("forms.pol:2:10"),
+               polaris::describe_source_location(copy.loc));
+   forms.clear();
+   polaris::read_all("(a (b))", forms);
+   CHECK_EQUAL(0u, forms[0].list[1].loc);
+
+   polaris::evaluator_c eval;
+   polaris::line_profile_c profile;
+   eval.set_line_profile(&profile);
+
+   interpreter_t run(eval);
+   run("(import \"" + library + "\")");
+   profile.reset();
+   CHECK_EQUAL(std::string("285"), run("(total 10)"));
+
+   //  Only the lines of the library were read from a file, the call typed
+   //  in is not counted
+   //
+   std::map<uint32_t, uint64_t> hits;
+   for (auto &line : profile.lines()) {
+      CHECK_EQUAL(library, line.file);
+      hits[line.line] = line.hits;
    }
-}
\ No newline at end of file
+   CHECK_EQUAL(10u, hits[2]);
+   CHECK_EQUAL(0u, hits.count(1));
+   CHECK_EQUAL(1u + 10u * 3u, hits[5]);
+   CHECK_EQUAL(11u, hits[6]);
+
+   std::ostringstream report;
+   profile.report(report);
+   CHECK_TRUE(report.str().find("Hottest lines") != std::string::npos);
+   CHECK_TRUE(report.str().find(library + " :") != std::string::npos);
+   CHECK_TRUE(report.str().find("      2 |    (* x x)))") !=
+              std::string::npos);
+
+   //  Without a profile nothing more is counted
+   //
+   eval.set_line_profile(nullptr);
+   run("(total 10)");
+   CHECK_EQUAL(10u, profile.lines()[0].hits);
+   CHECK_TRUE(run.errors.empty());
+   std::remove(library.c_str());
+}